@@ -0,0 +1,281 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./test_p.h"
+
+// ============================================================================
+// [Bench]
+//
+// Each benchmark unfilters the same image repeatedly in place. Filter IDs are
+// never changed, so each run does the same amount of work. After a warmup run
+// each trial repeats the filter until it takes at least `minTrialNs`, trials
+// are then sorted and the median and 99th percentile (the slow tail) of their
+// throughput is reported. Image sizes go from L1 resident to beyond LLC.
+// ============================================================================
+
+enum OptDePngBenchFormat {
+  kOptDePngBenchText = 0,
+  kOptDePngBenchCsv = 1,
+  kOptDePngBenchJson = 2
+};
+
+struct OptDePngBenchOptions {
+  uint32_t format;
+  uint32_t trials;
+  uint64_t minTrialNs;
+  uint32_t sizeCount;
+  uint32_t recordCount;
+};
+
+static const uint32_t OptDePngBenchSizes[] = {
+  16 * 1024,        // L1.
+  256 * 1024,       // L2.
+  4 * 1024 * 1024,  // L3.
+  64 * 1024 * 1024  // Beyond LLC.
+};
+
+struct OptDePngBenchResult {
+  double medianMBps;
+  double p99MBps;
+  double cpb;
+};
+
+static void OptDePngBenchMeasure(const OptDePngBenchOptions& options, OptDePngFilterFunc func,
+  uint8_t* pImage, uint32_t h, uint32_t bpp, uint32_t bpl, OptDePngBenchResult& result) {
+
+  uint64_t bytes = static_cast<uint64_t>(bpl) * h;
+  uint64_t ns[OPT_DEPNG_MAX_TRIALS];
+  uint64_t tsc[OPT_DEPNG_MAX_TRIALS];
+
+  OptDePngMeasureFilter run = { func, pImage, h, bpp, bpl };
+  OptDePngMeasure(run, options.trials, options.minTrialNs, ns, tsc);
+
+  uint32_t medianIndex = options.trials / 2;
+  uint32_t p99Index = (options.trials * 99 + 99) / 100 - 1;
+
+  result.medianMBps = static_cast<double>(bytes) * 1e3 / static_cast<double>(ns[medianIndex] ? ns[medianIndex] : 1);
+  result.p99MBps = static_cast<double>(bytes) * 1e3 / static_cast<double>(ns[p99Index] ? ns[p99Index] : 1);
+  result.cpb = static_cast<double>(tsc[medianIndex]) / static_cast<double>(bytes);
+}
+
+static void OptDePngBenchOne(OptDePngBenchOptions& options, const char* name, OptDePngFilterFunc func, uint32_t filter, uint32_t bpp, uint32_t size) {
+  // Rows of 4kB at most, smaller images have at least 16 rows.
+  uint32_t w = (size / 16 < 4096 ? size / 16 : 4096) / bpp;
+  if (w == 0) w = 1;
+
+  uint32_t bpl = w * bpp + 1;
+  uint32_t h = size / bpl;
+  if (h == 0) h = 1;
+
+  uint64_t bytes = static_cast<uint64_t>(bpl) * h;
+  uint8_t* pImage = OptDePngRandomImage(w, h, bpp, filter, 0);
+
+  if (pImage == NULL)
+    return;
+
+  OptDePngBenchResult r;
+  OptDePngBenchMeasure(options, func, pImage, h, bpp, bpl, r);
+  ::free(pImage);
+
+  switch (options.format) {
+    case kOptDePngBenchText:
+      printf("[BENCH] IMPL=%-5s  %-5s BPP=%u  %6ux%-6u %9u kB  median %9.1f MB/s  p99 %9.1f MB/s  %6.3f c/B\n",
+        name, OptDePngFilterNames[filter], bpp, w, h, static_cast<uint32_t>(bytes / 1024), r.medianMBps, r.p99MBps, r.cpb);
+      break;
+
+    case kOptDePngBenchCsv:
+      printf("%s,%s,%u,%u,%u,%llu,%u,%.1f,%.1f,%.4f\n",
+        name, OptDePngFilterNames[filter], bpp, w, h, static_cast<unsigned long long>(bytes),
+        options.trials, r.medianMBps, r.p99MBps, r.cpb);
+      break;
+
+    case kOptDePngBenchJson:
+      printf("%s  {\"impl\": \"%s\", \"filter\": \"%s\", \"bpp\": %u, \"width\": %u, \"height\": %u, \"bytes\": %llu, "
+             "\"trials\": %u, \"median_mbps\": %.1f, \"p99_mbps\": %.1f, \"median_cpb\": %.4f}",
+        options.recordCount ? ",\n" : "", name, OptDePngFilterNames[filter], bpp, w, h,
+        static_cast<unsigned long long>(bytes), options.trials, r.medianMBps, r.p99MBps, r.cpb);
+      break;
+  }
+
+  options.recordCount++;
+  fflush(stdout);
+}
+
+static void OptDePngBench(OptDePngBenchOptions& options, const char* name, OptDePngFilterFunc func) {
+  for (uint32_t sizeIndex = 0; sizeIndex < options.sizeCount; sizeIndex++) {
+    for (uint32_t filter = 1; filter <= kPngFilterCount; filter++) {
+      for (uint32_t bppIndex = 0; bppIndex < 6; bppIndex++) {
+        OptDePngBenchOne(options, name, func, filter, OptDePngBppData[bppIndex], OptDePngBenchSizes[sizeIndex]);
+      }
+    }
+  }
+
+  if (options.format == kOptDePngBenchText)
+    printf("\n");
+}
+
+// ============================================================================
+// [Corpus]
+// ============================================================================
+
+static bool OptDePngBenchCorpus(OptDePngBenchOptions& options, const char* dir,
+  const OptDePngImplInfo* impls, uint32_t implCount) {
+
+  static const uint32_t kMaxFiles = 4096;
+  char** names = static_cast<char**>(::malloc(sizeof(char*) * kMaxFiles));
+  if (names == NULL)
+    return false;
+
+  uint32_t fileCount = OptDePngListCorpus(dir, names, kMaxFiles);
+  bool ok = true;
+
+  if (fileCount == 0)
+    printf("[CORPUS] No *.png or *.idat files found in '%s'\n", dir);
+
+  if (options.format == kOptDePngBenchCsv)
+    printf("impl,image,bpp,bpl,height,bytes,trials,median_mbps,p99_mbps,median_cpb,none,sub,up,avg,paeth\n");
+
+  if (options.format == kOptDePngBenchJson)
+    printf("[\n");
+
+  for (uint32_t fileIndex = 0; fileIndex < fileCount; fileIndex++) {
+    const char* name = names[fileIndex];
+    OptDePngCorpusImage image;
+
+    const char* msg = OptDePngLoadCorpus(dir, name, image);
+    if (msg != NULL) {
+      if (options.format == kOptDePngBenchText)
+        printf("[CORPUS] %s: Skipped (%s)\n", name, msg);
+      continue;
+    }
+
+    size_t dataSize = static_cast<size_t>(image.bpl) * image.h;
+    uint32_t histogram[kPngFilterCount + 1];
+
+    OptDePngCorpusHistogram(image, histogram);
+    if (options.format == kOptDePngBenchText)
+      OptDePngCorpusPrint(name, image, histogram);
+
+    uint8_t* pOpt = static_cast<uint8_t*>(::malloc(dataSize));
+    if (pOpt == NULL) {
+      ::free(image.data);
+      ok = false;
+      break;
+    }
+
+    for (uint32_t implIndex = 0; implIndex < implCount; implIndex++) {
+      const OptDePngImplInfo& impl = impls[implIndex];
+      OptDePngBenchResult r;
+
+      ::memcpy(pOpt, image.data, dataSize);
+      OptDePngBenchMeasure(options, impl.func, pOpt, image.h, image.bpp, image.bpl, r);
+
+      switch (options.format) {
+        case kOptDePngBenchText:
+          printf("[BENCH] IMPL=%-5s  %-32s median %9.1f MB/s  p99 %9.1f MB/s  %6.3f c/B\n",
+            impl.name, name, r.medianMBps, r.p99MBps, r.cpb);
+          break;
+
+        case kOptDePngBenchCsv:
+          printf("%s,%s,%u,%u,%u,%llu,%u,%.1f,%.1f,%.4f,%u,%u,%u,%u,%u\n",
+            impl.name, name, image.bpp, image.bpl, image.h, static_cast<unsigned long long>(dataSize),
+            options.trials, r.medianMBps, r.p99MBps, r.cpb,
+            histogram[0], histogram[1], histogram[2], histogram[3], histogram[4]);
+          break;
+
+        case kOptDePngBenchJson:
+          printf("%s  {\"impl\": \"%s\", \"image\": \"%s\", \"bpp\": %u, \"bpl\": %u, \"height\": %u, \"bytes\": %llu, "
+                 "\"trials\": %u, \"median_mbps\": %.1f, \"p99_mbps\": %.1f, \"median_cpb\": %.4f, "
+                 "\"histogram\": [%u, %u, %u, %u, %u]}",
+            options.recordCount ? ",\n" : "", impl.name, name, image.bpp, image.bpl, image.h,
+            static_cast<unsigned long long>(dataSize), options.trials, r.medianMBps, r.p99MBps, r.cpb,
+            histogram[0], histogram[1], histogram[2], histogram[3], histogram[4]);
+          break;
+      }
+
+      options.recordCount++;
+      fflush(stdout);
+    }
+
+    ::free(pOpt);
+    ::free(image.data);
+  }
+
+  if (options.format == kOptDePngBenchJson)
+    printf("\n]\n");
+
+  for (uint32_t i = 0; i < fileCount; i++)
+    ::free(names[i]);
+  ::free(names);
+
+  return ok;
+}
+
+// ============================================================================
+// [Main]
+// ============================================================================
+
+int main(int argc, char* argv[]) {
+  OptDePngImplInfo impls[OPT_DEPNG_MAX_IMPLS];
+  uint32_t implCount = OptDePngGetImpls(impls);
+  const char* corpusDir = NULL;
+
+  OptDePngBenchOptions options;
+  options.format = kOptDePngBenchText;
+  options.trials = 11;
+  options.minTrialNs = 2000000;
+  options.sizeCount = sizeof(OptDePngBenchSizes) / sizeof(OptDePngBenchSizes[0]);
+  options.recordCount = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (::strcmp(arg, "--quick") == 0) {
+      options.trials = 5;
+      options.minTrialNs = 500000;
+      options.sizeCount = 2;
+    }
+    else if (::strcmp(arg, "--csv") == 0) {
+      options.format = kOptDePngBenchCsv;
+    }
+    else if (::strcmp(arg, "--json") == 0) {
+      options.format = kOptDePngBenchJson;
+    }
+    else if (::strncmp(arg, "--corpus=", 9) == 0) {
+      corpusDir = arg + 9;
+    }
+    else if (::strncmp(arg, "--trials=", 9) == 0) {
+      int trials = ::atoi(arg + 9);
+      options.trials = trials < 1 ? 1 : trials > OPT_DEPNG_MAX_TRIALS ? OPT_DEPNG_MAX_TRIALS : static_cast<uint32_t>(trials);
+    }
+    else {
+      printf("Usage: %s [--quick] [--csv | --json] [--trials=N] [--corpus=DIR]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Corpus mode replaces synthetic images by real ones.
+  if (corpusDir != NULL)
+    return OptDePngBenchCorpus(options, corpusDir, impls, implCount) ? 0 : 1;
+
+  if (options.format == kOptDePngBenchCsv)
+    printf("impl,filter,bpp,width,height,bytes,trials,median_mbps,p99_mbps,median_cpb\n");
+
+  if (options.format == kOptDePngBenchJson)
+    printf("[\n");
+
+  for (uint32_t implIndex = 0; implIndex < implCount; implIndex++)
+    OptDePngBench(options, impls[implIndex].name, impls[implIndex].func);
+
+  if (options.format == kOptDePngBenchJson)
+    printf("\n]\n");
+
+  return 0;
+}
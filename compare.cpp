@@ -0,0 +1,506 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./test_p.h"
+
+#if defined(OPT_HAVE_LIBPNG)
+#include <png.h>
+#endif // OPT_HAVE_LIBPNG
+
+#if defined(OPT_HAVE_SPNG)
+#include <spng.h>
+#endif // OPT_HAVE_SPNG
+
+#if defined(OPT_HAVE_STB)
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include <stb_image.h>
+#endif // OPT_HAVE_STB
+
+// ============================================================================
+// [Compare]
+//
+// Compares `OptDePngFilter()` with the unfilter code of other PNG decoders on
+// the same images, and checks it against a stored baseline so a regression of
+// a kernel fails the build:
+//
+//   optdepng_compare [--quick] [--trials=N] [--size=KB]
+//                    [--baseline=PATH [--tolerance=PCT]] [--save-baseline=PATH]
+//
+// Other decoders don't expose their unfilter code, so each image is encoded as
+// a PNG that has uncompressed (stored) deflate blocks and is decoded twice, as
+// is and with all filter IDs set to `None`. The difference of the two is the
+// time of the unfilter (inflate, checksums, and row copies are the same), it's
+// an estimate that also includes the overhead of the decoder per filter type.
+// Each decoder must produce the same pixels as `OptDePngFilterRef()`.
+//
+// A baseline is a text file of `<Filter> <BPP> <MB/s>` lines of our kernel.
+// The run fails if any of them is slower than the baseline by more than `PCT`
+// percent (10 by default), entries missing in either are not compared.
+// ============================================================================
+
+struct OptDePngCompareOptions {
+  uint32_t trials;
+  uint64_t minTrialNs;
+  uint32_t size;
+};
+
+// PNG color type and bit depth of `bpp`, see `OptDePngBppData`.
+static void OptDePngCompareFormat(uint32_t bpp, uint32_t& colorType, uint32_t& bitDepth) {
+  static const uint8_t colorTypes[] = { 0, 0, 4, 2, 6, 0, 2, 0, 6 };
+
+  colorType = colorTypes[bpp];
+  bitDepth = bpp >= 6 ? 16 : 8;
+}
+
+// ============================================================================
+// [Encode]
+// ============================================================================
+
+static uint8_t* OptDePngComparePutChunk(uint8_t* p, const char* type, const uint8_t* data, uint32_t size) {
+  p[0] = static_cast<uint8_t>(size >> 24);
+  p[1] = static_cast<uint8_t>(size >> 16);
+  p[2] = static_cast<uint8_t>(size >>  8);
+  p[3] = static_cast<uint8_t>(size      );
+  ::memcpy(p + 4, type, 4);
+  if (size)
+    ::memcpy(p + 8, data, size);
+
+  uLong crc = crc32(0, p + 4, size + 4);
+  p += 8 + size;
+
+  p[0] = static_cast<uint8_t>(crc >> 24);
+  p[1] = static_cast<uint8_t>(crc >> 16);
+  p[2] = static_cast<uint8_t>(crc >>  8);
+  p[3] = static_cast<uint8_t>(crc      );
+  return p + 4;
+}
+
+// Encode filtered rows `p` as a PNG file, the IDAT is not compressed.
+static uint8_t* OptDePngCompareEncode(const uint8_t* p, uint32_t w, uint32_t h, uint32_t bpp, size_t* size) {
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+  uLong dataSize = static_cast<uLong>(w * bpp + 1) * h;
+  uLongf zSize = compressBound(dataSize);
+
+  uint8_t* zData = static_cast<uint8_t*>(::malloc(zSize));
+  uint8_t* file = static_cast<uint8_t*>(::malloc(zSize + 64));
+
+  if (zData == NULL || file == NULL || compress2(zData, &zSize, p, dataSize, Z_NO_COMPRESSION) != Z_OK) {
+    ::free(zData);
+    ::free(file);
+    return NULL;
+  }
+
+  uint32_t colorType, bitDepth;
+  OptDePngCompareFormat(bpp, colorType, bitDepth);
+
+  uint8_t ihdr[13] = {
+    static_cast<uint8_t>(w >> 24), static_cast<uint8_t>(w >> 16), static_cast<uint8_t>(w >> 8), static_cast<uint8_t>(w),
+    static_cast<uint8_t>(h >> 24), static_cast<uint8_t>(h >> 16), static_cast<uint8_t>(h >> 8), static_cast<uint8_t>(h),
+    static_cast<uint8_t>(bitDepth), static_cast<uint8_t>(colorType), 0, 0, 0
+  };
+
+  ::memcpy(file, signature, 8);
+  uint8_t* end = file + 8;
+
+  end = OptDePngComparePutChunk(end, "IHDR", ihdr, 13);
+  end = OptDePngComparePutChunk(end, "IDAT", zData, static_cast<uint32_t>(zSize));
+  end = OptDePngComparePutChunk(end, "IEND", NULL, 0);
+
+  ::free(zData);
+  *size = static_cast<size_t>(end - file);
+  return file;
+}
+
+// ============================================================================
+// [Decoders]
+//
+// Each decoder writes compact rows (no filter IDs) of a PNG encoded above to
+// `dst`, 16-bit samples are stored in the big-endian order of PNG.
+// ============================================================================
+
+typedef bool (*OptDePngDecodeFunc)(const uint8_t* png, size_t size, uint8_t* dst, uint32_t rowSize);
+
+struct OptDePngDecoderInfo {
+  const char* name;
+  OptDePngDecodeFunc func;
+};
+
+#if defined(OPT_HAVE_LIBPNG)
+struct OptDePngLibpngReader {
+  const uint8_t* p;
+  size_t remaining;
+};
+
+static void OptDePngLibpngRead(png_structp png, png_bytep data, png_size_t size) {
+  OptDePngLibpngReader* reader = static_cast<OptDePngLibpngReader*>(png_get_io_ptr(png));
+  if (size > reader->remaining)
+    png_error(png, "Truncated");
+
+  ::memcpy(data, reader->p, size);
+  reader->p += size;
+  reader->remaining -= size;
+}
+
+static bool OptDePngDecodeLibpng(const uint8_t* png, size_t size, uint8_t* dst, uint32_t rowSize) {
+  png_structp ctx = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info = ctx ? png_create_info_struct(ctx) : NULL;
+
+  if (info == NULL) {
+    png_destroy_read_struct(&ctx, NULL, NULL);
+    return false;
+  }
+
+  if (setjmp(png_jmpbuf(ctx))) {
+    png_destroy_read_struct(&ctx, &info, NULL);
+    return false;
+  }
+
+  OptDePngLibpngReader reader = { png, size };
+  png_set_read_fn(ctx, &reader, OptDePngLibpngRead);
+  png_read_info(ctx, info);
+
+  uint32_t h = png_get_image_height(ctx, info);
+  // `dst` must not be modified after `setjmp()`.
+  for (uint32_t y = 0; y < h; y++)
+    png_read_row(ctx, dst + static_cast<size_t>(y) * rowSize, NULL);
+
+  png_destroy_read_struct(&ctx, &info, NULL);
+  return true;
+}
+#endif // OPT_HAVE_LIBPNG
+
+#if defined(OPT_HAVE_SPNG)
+static bool OptDePngDecodeSpng(const uint8_t* png, size_t size, uint8_t* dst, uint32_t rowSize) {
+  spng_ctx* ctx = spng_ctx_new(0);
+  if (ctx == NULL)
+    return false;
+
+  struct spng_ihdr ihdr;
+  size_t dstSize = 0;
+
+  bool ok = spng_set_png_buffer(ctx, png, size) == 0 &&
+            spng_get_ihdr(ctx, &ihdr) == 0 &&
+            spng_decoded_image_size(ctx, SPNG_FMT_RAW, &dstSize) == 0 &&
+            dstSize == static_cast<size_t>(rowSize) * ihdr.height &&
+            spng_decode_image(ctx, dst, dstSize, SPNG_FMT_RAW, 0) == 0;
+
+  spng_ctx_free(ctx);
+  return ok;
+}
+#endif // OPT_HAVE_SPNG
+
+#if defined(OPT_HAVE_STB)
+static bool OptDePngDecodeStb(const uint8_t* png, size_t size, uint8_t* dst, uint32_t rowSize) {
+  int w, h, comp;
+  const stbi_uc* data = reinterpret_cast<const stbi_uc*>(png);
+
+  if (stbi_is_16_bit_from_memory(data, static_cast<int>(size))) {
+    stbi_us* pixels = stbi_load_16_from_memory(data, static_cast<int>(size), &w, &h, &comp, 0);
+    if (pixels == NULL)
+      return false;
+
+    // Samples are returned in the native order.
+    size_t count = static_cast<size_t>(rowSize / 2) * static_cast<uint32_t>(h);
+    for (size_t i = 0; i < count; i++) {
+      dst[i * 2    ] = static_cast<uint8_t>(pixels[i] >> 8);
+      dst[i * 2 + 1] = static_cast<uint8_t>(pixels[i]);
+    }
+
+    stbi_image_free(pixels);
+  }
+  else {
+    stbi_uc* pixels = stbi_load_from_memory(data, static_cast<int>(size), &w, &h, &comp, 0);
+    if (pixels == NULL)
+      return false;
+
+    ::memcpy(dst, pixels, static_cast<size_t>(rowSize) * static_cast<uint32_t>(h));
+    stbi_image_free(pixels);
+  }
+
+  return true;
+}
+#endif // OPT_HAVE_STB
+
+static const OptDePngDecoderInfo OptDePngDecoders[] = {
+#if defined(OPT_HAVE_LIBPNG)
+  { "libpng", OptDePngDecodeLibpng },
+#endif // OPT_HAVE_LIBPNG
+#if defined(OPT_HAVE_SPNG)
+  { "spng", OptDePngDecodeSpng },
+#endif // OPT_HAVE_SPNG
+#if defined(OPT_HAVE_STB)
+  { "stb_image", OptDePngDecodeStb },
+#endif // OPT_HAVE_STB
+  { NULL, NULL }
+};
+
+#define OPT_DEPNG_DECODER_COUNT (sizeof(OptDePngDecoders) / sizeof(OptDePngDecoders[0]) - 1)
+
+// ============================================================================
+// [Measure]
+// ============================================================================
+
+// Get the median time of `OptDePngFilter()` in nanoseconds, the image is
+// unfiltered repeatedly in place, see `bench.cpp`.
+static uint64_t OptDePngCompareFilter(const OptDePngCompareOptions& options, uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint64_t ns[OPT_DEPNG_MAX_TRIALS];
+  OptDePngMeasureFilter run = { OptDePngFilter, p, h, bpp, bpl };
+
+  OptDePngMeasure(run, options.trials, options.minTrialNs, ns, NULL);
+  return ns[options.trials / 2];
+}
+
+// Runs a decoder, see `OptDePngMeasure()`.
+struct OptDePngMeasureDecode {
+  OptDePngDecodeFunc func;
+  const uint8_t* png;
+  size_t size;
+  uint8_t* dst;
+  uint32_t rowSize;
+
+  OPT_INLINE void operator()() { func(png, size, dst, rowSize); }
+};
+
+// Get the median time of a decode in nanoseconds, zero if it failed.
+static uint64_t OptDePngCompareDecode(const OptDePngCompareOptions& options, OptDePngDecodeFunc func,
+  const uint8_t* png, size_t size, uint8_t* dst, uint32_t rowSize) {
+
+  if (!func(png, size, dst, rowSize))
+    return 0;
+
+  uint64_t ns[OPT_DEPNG_MAX_TRIALS];
+  OptDePngMeasureDecode run = { func, png, size, dst, rowSize };
+
+  OptDePngMeasure(run, options.trials, options.minTrialNs, ns, NULL);
+  return ns[options.trials / 2] ? ns[options.trials / 2] : 1;
+}
+
+// ============================================================================
+// [Baseline]
+// ============================================================================
+
+// Indexed by filter (Sub to Mixed) and BPP, zero if there is no entry.
+struct OptDePngBaseline {
+  double mbps[kPngFilterCount + 1][9];
+};
+
+static bool OptDePngBaselineLoad(const char* path, OptDePngBaseline& baseline) {
+  ::memset(&baseline, 0, sizeof(baseline));
+
+  FILE* f = ::fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char line[256];
+  while (::fgets(line, sizeof(line), f) != NULL) {
+    char name[16];
+    unsigned bpp;
+    double mbps;
+
+    if (line[0] == '#' || ::sscanf(line, "%15s %u %lf", name, &bpp, &mbps) != 3 || bpp > 8)
+      continue;
+
+    for (uint32_t filter = 1; filter <= kPngFilterCount; filter++) {
+      if (::strcmp(name, OptDePngFilterNames[filter]) == 0)
+        baseline.mbps[filter][bpp] = mbps;
+    }
+  }
+
+  ::fclose(f);
+  return true;
+}
+
+static bool OptDePngBaselineSave(const char* path, const OptDePngBaseline& baseline) {
+  FILE* f = ::fopen(path, "w");
+  if (f == NULL)
+    return false;
+
+  ::fprintf(f, "# Baseline of optdepng_compare: <Filter> <BPP> <MB/s> of OptDePngFilter().\n");
+  for (uint32_t filter = 1; filter <= kPngFilterCount; filter++) {
+    for (uint32_t bppIndex = 0; bppIndex < 6; bppIndex++) {
+      uint32_t bpp = OptDePngBppData[bppIndex];
+      if (baseline.mbps[filter][bpp] > 0.0)
+        ::fprintf(f, "%s %u %.1f\n", OptDePngFilterNames[filter], bpp, baseline.mbps[filter][bpp]);
+    }
+  }
+
+  return ::fclose(f) == 0;
+}
+
+// ============================================================================
+// [Main]
+// ============================================================================
+
+static double OptDePngCompareMBps(uint64_t bytes, uint64_t ns) {
+  return static_cast<double>(bytes) * 1e3 / static_cast<double>(ns ? ns : 1);
+}
+
+int main(int argc, char* argv[]) {
+  const char* baselinePath = NULL;
+  const char* savePath = NULL;
+  double tolerance = 10.0;
+
+  OptDePngCompareOptions options;
+  options.trials = 11;
+  options.minTrialNs = 20000000;
+  options.size = 1024 * 1024;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (::strcmp(arg, "--quick") == 0) {
+      options.trials = 5;
+      options.minTrialNs = 5000000;
+    }
+    else if (::strncmp(arg, "--trials=", 9) == 0) {
+      int trials = ::atoi(arg + 9);
+      options.trials = trials < 1 ? 1 : trials > OPT_DEPNG_MAX_TRIALS ? OPT_DEPNG_MAX_TRIALS : static_cast<uint32_t>(trials);
+    }
+    else if (::strncmp(arg, "--size=", 7) == 0) {
+      int size = ::atoi(arg + 7);
+      options.size = static_cast<uint32_t>(size < 16 ? 16 : size > 65536 ? 65536 : size) * 1024;
+    }
+    else if (::strncmp(arg, "--baseline=", 11) == 0) {
+      baselinePath = arg + 11;
+    }
+    else if (::strncmp(arg, "--tolerance=", 12) == 0) {
+      tolerance = ::atof(arg + 12);
+    }
+    else if (::strncmp(arg, "--save-baseline=", 16) == 0) {
+      savePath = arg + 16;
+    }
+    else {
+      printf("Usage: %s [--quick] [--trials=N] [--size=KB] [--baseline=PATH [--tolerance=PCT]] [--save-baseline=PATH]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  OptDePngBaseline stored;
+  if (baselinePath != NULL && !OptDePngBaselineLoad(baselinePath, stored)) {
+    printf("[ERROR] Cannot read baseline '%s'\n", baselinePath);
+    return 1;
+  }
+
+  OptDePngBaseline current;
+  ::memset(&current, 0, sizeof(current));
+
+  printf("[COMPARE] %-5s BPP  %10s", "", "OptDePng");
+  for (uint32_t d = 0; d < OPT_DEPNG_DECODER_COUNT; d++)
+    printf("  %10s", OptDePngDecoders[d].name);
+  printf("  (MB/s, %u kB images)\n", options.size / 1024);
+
+  bool ok = true;
+  uint32_t regressions = 0;
+
+  for (uint32_t filter = 1; filter <= kPngFilterCount && ok; filter++) {
+    for (uint32_t bppIndex = 0; bppIndex < 6 && ok; bppIndex++) {
+      uint32_t bpp = OptDePngBppData[bppIndex];
+
+      // Rows of 4kB at most, the same shape as `bench.cpp`.
+      uint32_t w = (options.size / 16 < 4096 ? options.size / 16 : 4096) / bpp;
+      uint32_t bpl = w * bpp + 1;
+      uint32_t h = options.size / bpl;
+      uint32_t rowSize = bpl - 1;
+      uint64_t bytes = static_cast<uint64_t>(bpl) * h;
+
+      uint8_t* pImage = OptDePngRandomImage(w, h, bpp, filter, 0);
+      uint8_t* pNone = OptDePngRandomImage(w, h, bpp, filter, 0);
+      uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, 0);
+      uint8_t* pDst = static_cast<uint8_t*>(::malloc(static_cast<size_t>(rowSize) * h));
+
+      size_t pngSize = 0, noneSize = 0;
+      uint8_t* png = NULL;
+      uint8_t* pngNone = NULL;
+
+      if (pImage != NULL && pNone != NULL && pRef != NULL && pDst != NULL) {
+        for (uint32_t y = 0; y < h; y++)
+          pNone[y * bpl] = kPngFilterNone;
+
+        png = OptDePngCompareEncode(pImage, w, h, bpp, &pngSize);
+        pngNone = OptDePngCompareEncode(pNone, w, h, bpp, &noneSize);
+        OptDePngFilterRef(pRef, h, bpp, bpl);
+      }
+
+      if (png == NULL || pngNone == NULL) {
+        printf("[ERROR] Out of memory\n");
+        ok = false;
+      }
+      else {
+        uint64_t ns = OptDePngCompareFilter(options, pImage, h, bpp, bpl);
+        double mbps = OptDePngCompareMBps(bytes, ns);
+        current.mbps[filter][bpp] = mbps;
+
+        printf("[COMPARE] %-5s %3u  %10.1f", OptDePngFilterNames[filter], bpp, mbps);
+
+        for (uint32_t d = 0; d < OPT_DEPNG_DECODER_COUNT && ok; d++) {
+          const OptDePngDecoderInfo& decoder = OptDePngDecoders[d];
+
+          if (!decoder.func(png, pngSize, pDst, rowSize)) {
+            printf("\n[ERROR] %s failed to decode %s BPP=%u\n", decoder.name, OptDePngFilterNames[filter], bpp);
+            ok = false;
+            break;
+          }
+
+          for (uint32_t y = 0; y < h && ok; y++) {
+            if (::memcmp(pDst + y * rowSize, pRef + y * bpl + 1, rowSize) != 0) {
+              printf("\n[ERROR] %s differs from Ref at %s BPP=%u Y=%u\n", decoder.name, OptDePngFilterNames[filter], bpp, y);
+              ok = false;
+            }
+          }
+
+          if (!ok)
+            break;
+
+          uint64_t tImage = OptDePngCompareDecode(options, decoder.func, png, pngSize, pDst, rowSize);
+          uint64_t tNone = OptDePngCompareDecode(options, decoder.func, pngNone, noneSize, pDst, rowSize);
+
+          // The difference is lost in noise if the unfilter is too fast.
+          if (tImage > tNone)
+            printf("  %10.1f", OptDePngCompareMBps(bytes, tImage - tNone));
+          else
+            printf("  %10s", "n/a");
+        }
+        printf("\n");
+
+        double base = baselinePath != NULL ? stored.mbps[filter][bpp] : 0.0;
+        if (ok && base > 0.0 && mbps < base * (1.0 - tolerance / 100.0)) {
+          printf("[REGRESSION] %s BPP=%u %.1f MB/s is %.1f%% slower than baseline %.1f MB/s\n",
+            OptDePngFilterNames[filter], bpp, mbps, (1.0 - mbps / base) * 100.0, base);
+          regressions++;
+        }
+      }
+
+      ::free(png);
+      ::free(pngNone);
+      ::free(pImage);
+      ::free(pNone);
+      ::free(pRef);
+      ::free(pDst);
+      fflush(stdout);
+    }
+  }
+
+  if (!ok)
+    return 1;
+
+  if (savePath != NULL && !OptDePngBaselineSave(savePath, current)) {
+    printf("[ERROR] Cannot write baseline '%s'\n", savePath);
+    return 1;
+  }
+
+  if (regressions != 0) {
+    printf("[COMPARE] %u regressions (tolerance %.1f%%)\n", regressions, tolerance);
+    return 1;
+  }
+
+  return 0;
+}
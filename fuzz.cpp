@@ -0,0 +1,557 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./test_p.h"
+
+// ============================================================================
+// [Fuzz]
+//
+// Differential fuzzer that runs every implementation the host CPU supports
+// (in place and out of place) on the same input and compares the result with
+// `OptDePngFilterRef()` BYTE for BYTE. An input is a 6 BYTE header followed by
+// filtered rows, filter IDs are taken as they are, so invalid ones are tested
+// too (rows that have them must be left as is):
+//
+//   [0]    - BPP - 1 (modulo 17).
+//   [1..2] - Width - 1, little-endian (modulo 1024).
+//   [3]    - Height - 1 (modulo 64).
+//   [4]    - Misalignment of the source (low 6 bits).
+//   [5]    - Misalignment of the destination (low 6 bits) and a padding of
+//            its stride (high 2 bits).
+//
+// Rows are filled by repeating the rest of the input (zeros if empty). The
+// same binary is either a driver of libFuzzer (`OPT_DEPNG_LIBFUZZER`), or a
+// randomized runner that also replays input files, which is what AFL needs:
+//
+//   optdepng_fuzz [--seed=N] [--iterations=N] [--repro=PATH] [FILE...]
+//
+// The runner minimizes the first failing input and writes it to `PATH`
+// (`optdepng_fuzz.bin` by default), which is then replayed by passing it as
+// `FILE`.
+// ============================================================================
+
+static const uint32_t kOptDePngFuzzHeaderSize = 6;
+static const uint32_t kOptDePngFuzzMaxBpp = 17;
+static const uint32_t kOptDePngFuzzMaxWidth = 1024;
+static const uint32_t kOptDePngFuzzMaxHeight = 64;
+
+// Inputs smaller than that are minimized BYTE by BYTE.
+static const uint32_t kOptDePngFuzzMinimizeBytes = 4096;
+
+struct OptDePngFuzzCase {
+  uint32_t bpp;
+  uint32_t w;
+  uint32_t h;
+  uint32_t srcOffset;
+  uint32_t dstOffset;
+  uint32_t dstPad;
+  uint8_t* data;
+};
+
+struct OptDePngFuzzFailure {
+  const char* name;
+  const char* what;
+  bool to;
+  uint32_t y;
+  uint32_t i;
+};
+
+static uint32_t OptDePngFuzzBpl(const OptDePngFuzzCase& c) {
+  return c.w * c.bpp + 1;
+}
+
+static bool OptDePngFuzzDecode(const uint8_t* input, size_t size, OptDePngFuzzCase& c) {
+  if (size < kOptDePngFuzzHeaderSize)
+    return false;
+
+  c.bpp = input[0] % kOptDePngFuzzMaxBpp + 1;
+  c.w = (static_cast<uint32_t>(input[1]) | (static_cast<uint32_t>(input[2]) << 8)) % kOptDePngFuzzMaxWidth + 1;
+  c.h = input[3] % kOptDePngFuzzMaxHeight + 1;
+  c.srcOffset = input[4] & 63;
+  c.dstOffset = input[5] & 63;
+  c.dstPad = input[5] >> 6;
+
+  size_t dataSize = static_cast<size_t>(OptDePngFuzzBpl(c)) * c.h;
+  c.data = static_cast<uint8_t*>(::malloc(dataSize));
+  if (c.data == NULL)
+    return false;
+
+  const uint8_t* rows = input + kOptDePngFuzzHeaderSize;
+  size_t rowsSize = size - kOptDePngFuzzHeaderSize;
+
+  for (size_t i = 0; i < dataSize; i++)
+    c.data[i] = rowsSize != 0 ? rows[i % rowsSize] : 0;
+
+  return true;
+}
+
+// ============================================================================
+// [Run]
+// ============================================================================
+
+// Implementations compared with `Ref`, the first one.
+static uint32_t OptDePngFuzzGetImpls(OptDePngImplInfo* impls) {
+  uint32_t count = OptDePngGetImpls(impls);
+  OptDePngAddImpl(impls, count, "Best", OptDePngFilter, OptDePngFilterTo);
+  return count;
+}
+
+// Find the first BYTE of `h` rows that differs, rows are `size` BYTEs apart
+// in `a` and `aStride` / `bStride` BYTEs apart in `a` and `b`.
+static bool OptDePngFuzzFind(const uint8_t* a, intptr_t aStride, const uint8_t* b, intptr_t bStride,
+  uint32_t size, uint32_t h, OptDePngFuzzFailure& f) {
+
+  for (uint32_t y = 0; y < h; y++, a += aStride, b += bStride) {
+    if (::memcmp(a, b, size) == 0)
+      continue;
+
+    uint32_t i = 0;
+    while (a[i] == b[i])
+      i++;
+
+    f.y = y;
+    f.i = i;
+    return true;
+  }
+
+  return false;
+}
+
+// Allocate `offset + size` BYTEs at a 64 BYTE boundary. A buffer at `offset`
+// ends where the allocation ends, so ASan reports any access past its end.
+static uint8_t* OptDePngFuzzAlloc(size_t offset, size_t size) {
+#if defined(_WIN32)
+  return static_cast<uint8_t*>(::_aligned_malloc(offset + size, 64));
+#else
+  void* p;
+  return ::posix_memalign(&p, 64, offset + size) == 0 ? static_cast<uint8_t*>(p) : NULL;
+#endif
+}
+
+static void OptDePngFuzzFree(uint8_t* p) {
+#if defined(_WIN32)
+  ::_aligned_free(p);
+#else
+  ::free(p);
+#endif
+}
+
+// Run all implementations on `c`, returns false and fills `f` on a mismatch.
+static bool OptDePngFuzzRun(const OptDePngFuzzCase& c, const OptDePngImplInfo* impls, uint32_t implCount, OptDePngFuzzFailure& f) {
+  uint32_t bpl = OptDePngFuzzBpl(c);
+  uint32_t rowSize = bpl - 1;
+  size_t size = static_cast<size_t>(bpl) * c.h;
+  intptr_t dstStride = static_cast<intptr_t>(rowSize + c.dstPad);
+
+  // All buffers start at a 64 BYTE boundary plus the requested offset and end
+  // with the image, the padding of the last destination row is not included.
+  uint8_t* pRef = static_cast<uint8_t*>(::malloc(size));
+  uint8_t* bufSrc = OptDePngFuzzAlloc(c.srcOffset, size);
+  uint8_t* bufDst = OptDePngFuzzAlloc(c.dstOffset, static_cast<size_t>(dstStride) * (c.h - 1) + rowSize);
+
+  bool ok = pRef != NULL && bufSrc != NULL && bufDst != NULL;
+  if (!ok) {
+    f.name = "Ref";
+    f.what = "Out of memory";
+    f.to = false;
+    f.y = 0;
+    f.i = 0;
+  }
+  else {
+    uint8_t* pSrc = bufSrc + c.srcOffset;
+    uint8_t* pDst = bufDst + c.dstOffset;
+
+    ::memcpy(pRef, c.data, size);
+    OptDePngFilterRef(pRef, c.h, c.bpp, bpl);
+
+    for (uint32_t implIndex = 1; ok && implIndex < implCount; implIndex++) {
+      const OptDePngImplInfo& impl = impls[implIndex];
+
+      f.name = impl.name;
+      f.y = 0;
+      f.i = 0;
+
+      // In place, the result must be the same including filter IDs.
+      f.to = false;
+      ::memcpy(pSrc, c.data, size);
+
+      if (impl.func(pSrc, c.h, c.bpp, bpl) != kOptDePngErrorOk) {
+        f.what = "Error returned";
+        ok = false;
+      }
+      else if (OptDePngFuzzFind(pRef, bpl, pSrc, bpl, bpl, c.h, f)) {
+        f.what = "Mismatch";
+        ok = false;
+      }
+
+      if (!ok || impl.funcTo == NULL)
+        continue;
+
+      // Out of place, rows without filter IDs and the source not modified.
+      f.to = true;
+      ::memcpy(pSrc, c.data, size);
+
+      if (impl.funcTo(pDst, dstStride, pSrc, c.h, c.bpp, bpl) != kOptDePngErrorOk) {
+        f.what = "Error returned";
+        ok = false;
+      }
+      else if (OptDePngFuzzFind(c.data, bpl, pSrc, bpl, bpl, c.h, f)) {
+        f.what = "Source modified";
+        ok = false;
+      }
+      else if (OptDePngFuzzFind(pRef + 1, bpl, pDst, dstStride, rowSize, c.h, f)) {
+        f.what = "Mismatch";
+        ok = false;
+      }
+    }
+  }
+
+  ::free(pRef);
+  OptDePngFuzzFree(bufSrc);
+  OptDePngFuzzFree(bufDst);
+  return ok;
+}
+
+static void OptDePngFuzzReport(const OptDePngFuzzCase& c, const OptDePngFuzzFailure& f) {
+  printf("[ERROR] IMPL=%s%s  [%ux%u|bpp:%u|src+%u|dst+%u|pad:%u at Y=%u Byte=%u] %s\n",
+    f.name, f.to ? "To" : "", c.w, c.h, c.bpp, c.srcOffset, c.dstOffset, c.dstPad, f.y, f.i, f.what);
+}
+
+// ============================================================================
+// [LibFuzzer]
+// ============================================================================
+
+#if defined(OPT_DEPNG_LIBFUZZER)
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static OptDePngImplInfo impls[OPT_DEPNG_MAX_IMPLS + 1];
+  static uint32_t implCount = OptDePngFuzzGetImpls(impls);
+
+  OptDePngFuzzCase c;
+  if (!OptDePngFuzzDecode(data, size, c))
+    return 0;
+
+  OptDePngFuzzFailure f;
+  if (!OptDePngFuzzRun(c, impls, implCount, f)) {
+    OptDePngFuzzReport(c, f);
+    ::abort();
+  }
+
+  ::free(c.data);
+  return 0;
+}
+#else
+
+// ============================================================================
+// [Minimize]
+//
+// Shrink a failing case while it still fails: crop it to the first mismatch
+// (rows below and pixels to the right don't affect it in the reference), then
+// try to remove rows, replace filters by `None`, clear BYTEs, and remove the
+// misalignment, until nothing changes.
+// ============================================================================
+
+// Replace the data of `c` by the first `w` pixels of rows [0, h], except row
+// `skip` (if it's less than `h`, otherwise row `h` is not used).
+static void OptDePngFuzzCrop(OptDePngFuzzCase& c, uint32_t h, uint32_t skip, uint32_t w) {
+  uint32_t srcBpl = OptDePngFuzzBpl(c);
+  uint32_t dstBpl = w * c.bpp + 1;
+
+  uint8_t* data = static_cast<uint8_t*>(::malloc(static_cast<size_t>(dstBpl) * h));
+  uint8_t* d = data;
+
+  for (uint32_t y = 0; d != data + static_cast<size_t>(dstBpl) * h; y++) {
+    if (y == skip)
+      continue;
+    ::memcpy(d, c.data + static_cast<size_t>(y) * srcBpl, dstBpl);
+    d += dstBpl;
+  }
+
+  ::free(c.data);
+  c.data = data;
+  c.w = w;
+  c.h = h;
+}
+
+static bool OptDePngFuzzTry(OptDePngFuzzCase& c, OptDePngFuzzCase& t,
+  const OptDePngImplInfo* impls, uint32_t implCount, OptDePngFuzzFailure& f) {
+
+  OptDePngFuzzFailure tf;
+  if (OptDePngFuzzRun(t, impls, implCount, tf)) {
+    ::free(t.data);
+    return false;
+  }
+
+  ::free(c.data);
+  c = t;
+  f = tf;
+  return true;
+}
+
+static OptDePngFuzzCase OptDePngFuzzCopy(const OptDePngFuzzCase& c) {
+  size_t size = static_cast<size_t>(OptDePngFuzzBpl(c)) * c.h;
+
+  OptDePngFuzzCase t = c;
+  t.data = static_cast<uint8_t*>(::malloc(size));
+  ::memcpy(t.data, c.data, size);
+  return t;
+}
+
+static void OptDePngFuzzMinimize(OptDePngFuzzCase& c, const OptDePngImplInfo* impls, uint32_t implCount, OptDePngFuzzFailure& f) {
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    // Crop to the first mismatch, `f.i` is a BYTE offset in the row, which
+    // includes the filter ID when filtered in place.
+    uint32_t x = (f.to ? f.i : (f.i != 0 ? f.i - 1 : 0)) / c.bpp;
+    if (f.y + 1 < c.h || x + 1 < c.w) {
+      OptDePngFuzzCase t = OptDePngFuzzCopy(c);
+      OptDePngFuzzCrop(t, f.y + 1, f.y + 1, x + 1);
+      changed |= OptDePngFuzzTry(c, t, impls, implCount, f);
+    }
+
+    for (uint32_t y = 0; y < c.h && c.h > 1; y++) {
+      OptDePngFuzzCase t = OptDePngFuzzCopy(c);
+      OptDePngFuzzCrop(t, c.h - 1, y, c.w);
+      if (OptDePngFuzzTry(c, t, impls, implCount, f)) {
+        changed = true;
+        y--;
+      }
+    }
+
+    uint32_t bpl = OptDePngFuzzBpl(c);
+    size_t size = static_cast<size_t>(bpl) * c.h;
+
+    for (size_t i = 0; i < size; i++) {
+      bool isFilter = i % bpl == 0;
+      if (c.data[i] == 0 || (!isFilter && size > kOptDePngFuzzMinimizeBytes))
+        continue;
+
+      OptDePngFuzzCase t = OptDePngFuzzCopy(c);
+      t.data[i] = 0;
+      changed |= OptDePngFuzzTry(c, t, impls, implCount, f);
+    }
+
+    if (c.srcOffset != 0 || c.dstOffset != 0 || c.dstPad != 0) {
+      OptDePngFuzzCase t = OptDePngFuzzCopy(c);
+      t.srcOffset = 0;
+      t.dstOffset = 0;
+      t.dstPad = 0;
+      changed |= OptDePngFuzzTry(c, t, impls, implCount, f);
+    }
+  }
+}
+
+// ============================================================================
+// [Runner]
+// ============================================================================
+
+// Encode `c` as an input that decodes to the same case, returns its size.
+static size_t OptDePngFuzzEncode(const OptDePngFuzzCase& c, uint8_t** input) {
+  size_t dataSize = static_cast<size_t>(OptDePngFuzzBpl(c)) * c.h;
+  uint8_t* p = static_cast<uint8_t*>(::malloc(kOptDePngFuzzHeaderSize + dataSize));
+
+  *input = p;
+  if (p == NULL)
+    return 0;
+
+  p[0] = static_cast<uint8_t>(c.bpp - 1);
+  p[1] = static_cast<uint8_t>((c.w - 1) & 0xFF);
+  p[2] = static_cast<uint8_t>((c.w - 1) >> 8);
+  p[3] = static_cast<uint8_t>(c.h - 1);
+  p[4] = static_cast<uint8_t>(c.srcOffset);
+  p[5] = static_cast<uint8_t>(c.dstOffset | (c.dstPad << 6));
+
+  ::memcpy(p + kOptDePngFuzzHeaderSize, c.data, dataSize);
+  return kOptDePngFuzzHeaderSize + dataSize;
+}
+
+static uint32_t OptDePngFuzzRandom(uint32_t& state) {
+  // Xorshift32, `state` must not be zero.
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Generate a case biased to what breaks SIMD kernels - widths around vector
+// sizes, BPPs that have their own kernels, uniform filters, invalid filter
+// IDs, and BYTEs that saturate.
+static bool OptDePngFuzzGenerate(OptDePngFuzzCase& c, uint32_t& state) {
+  static const uint32_t kBppList[] = { 1, 2, 3, 4, 6, 8 };
+  static const uint8_t kEdgeBytes[] = { 0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF };
+
+  uint32_t r = OptDePngFuzzRandom(state);
+  c.bpp = (r & 1) ? kBppList[(r >> 1) % 6] : (r >> 1) % kOptDePngFuzzMaxBpp + 1;
+
+  r = OptDePngFuzzRandom(state);
+  switch (r % 4) {
+    case 0: c.w = 1 + (r >> 2) % 32; break;
+    case 1: c.w = 1 + (r >> 2) % 256; break;
+    case 2: c.w = 1 + (r >> 2) % kOptDePngFuzzMaxWidth; break;
+    default: {
+      // One vector size (16, 32, or 64 BYTEs) multiplied, plus -1, 0, or 1.
+      uint32_t bytes = (16u << ((r >> 2) % 3)) * (1 + (r >> 4) % 8);
+      c.w = bytes / c.bpp + (r >> 7) % 3;
+      c.w = c.w > 1 ? c.w - 1 : 1;
+      c.w = c.w < kOptDePngFuzzMaxWidth ? c.w : kOptDePngFuzzMaxWidth;
+      break;
+    }
+  }
+
+  r = OptDePngFuzzRandom(state);
+  c.h = (r & 1) ? 1 + (r >> 1) % 4 : 1 + (r >> 1) % kOptDePngFuzzMaxHeight;
+
+  r = OptDePngFuzzRandom(state);
+  c.srcOffset = r & 63;
+  c.dstOffset = (r >> 6) & 63;
+  c.dstPad = (r >> 12) & 3;
+
+  uint32_t bpl = OptDePngFuzzBpl(c);
+  c.data = static_cast<uint8_t*>(::malloc(static_cast<size_t>(bpl) * c.h));
+  if (c.data == NULL)
+    return false;
+
+  uint32_t mode = OptDePngFuzzRandom(state);
+  uint32_t uniform = (mode >> 4) % kPngFilterCount;
+
+  for (uint32_t y = 0; y < c.h; y++) {
+    uint8_t* row = c.data + static_cast<size_t>(y) * bpl;
+
+    r = OptDePngFuzzRandom(state);
+    if ((mode & 3) == 0)
+      row[0] = static_cast<uint8_t>(uniform);
+    else if ((mode & 3) == 1 && (r & 7) == 0)
+      row[0] = static_cast<uint8_t>(kPngFilterCount + (r >> 3) % (256 - kPngFilterCount));
+    else
+      row[0] = static_cast<uint8_t>((r >> 3) % kPngFilterCount);
+
+    for (uint32_t i = 1; i < bpl; i++) {
+      r = OptDePngFuzzRandom(state);
+      row[i] = (mode & 4) ? kEdgeBytes[r % 6] : static_cast<uint8_t>(r >> 8);
+    }
+  }
+
+  return true;
+}
+
+static bool OptDePngFuzzWriteFile(const char* path, const uint8_t* data, size_t size) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL)
+    return false;
+
+  bool ok = fwrite(data, 1, size, f) == size;
+  return fclose(f) == 0 && ok;
+}
+
+// Minimize a failing case, print it and write it to `reproPath`.
+static void OptDePngFuzzFail(OptDePngFuzzCase& c, const OptDePngImplInfo* impls, uint32_t implCount,
+  OptDePngFuzzFailure& f, const char* reproPath) {
+
+  OptDePngFuzzReport(c, f);
+  OptDePngFuzzMinimize(c, impls, implCount, f);
+
+  printf("[ERROR] Minimized:\n");
+  OptDePngFuzzReport(c, f);
+
+  uint8_t* input;
+  size_t size = OptDePngFuzzEncode(c, &input);
+
+  for (size_t i = 0; i < size; i++)
+    printf("%02X%s", input[i], (i % 16 == 15 || i + 1 == size) ? "\n" : " ");
+
+  if (OptDePngFuzzWriteFile(reproPath, input, size))
+    printf("[ERROR] Reproducer written to '%s'\n", reproPath);
+
+  ::free(input);
+}
+
+int main(int argc, char* argv[]) {
+  OptDePngImplInfo impls[OPT_DEPNG_MAX_IMPLS + 1];
+  uint32_t implCount = OptDePngFuzzGetImpls(impls);
+
+  uint32_t seed = 1;
+  uint32_t iterations = 10000;
+  const char* reproPath = "optdepng_fuzz.bin";
+  bool replay = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (::strncmp(arg, "--seed=", 7) == 0) {
+      seed = static_cast<uint32_t>(::strtoul(arg + 7, NULL, 10));
+    }
+    else if (::strncmp(arg, "--iterations=", 13) == 0) {
+      iterations = static_cast<uint32_t>(::strtoul(arg + 13, NULL, 10));
+    }
+    else if (::strncmp(arg, "--repro=", 8) == 0) {
+      reproPath = arg + 8;
+    }
+    else if (arg[0] == '-') {
+      printf("Usage: %s [--seed=N] [--iterations=N] [--repro=PATH] [FILE...]\n", argv[0]);
+      return 1;
+    }
+    else {
+      // Replay a file, a failure is reported, but not minimized.
+      size_t size = 0;
+      uint8_t* input = OptDePngReadFile(arg, &size);
+
+      OptDePngFuzzCase c;
+      OptDePngFuzzFailure f;
+
+      if (!OptDePngFuzzDecode(input, input != NULL ? size : 0, c)) {
+        printf("[ERROR] Failed to read '%s'\n", arg);
+        ::free(input);
+        return 1;
+      }
+
+      bool ok = OptDePngFuzzRun(c, impls, implCount, f);
+      printf("[FUZZ ] FILE=%s %s\n", arg, ok ? "OK" : "FAILED");
+
+      if (!ok)
+        OptDePngFuzzReport(c, f);
+
+      ::free(c.data);
+      ::free(input);
+
+      if (!ok)
+        return 1;
+      replay = true;
+    }
+  }
+
+  if (replay)
+    return 0;
+
+  printf("[FUZZ ] IMPLS=%u SEED=%u ITERATIONS=%u\n", implCount - 1, seed, iterations);
+
+  uint32_t state = seed != 0 ? seed : 1;
+  for (uint32_t i = 0; i < iterations; i++) {
+    OptDePngFuzzCase c;
+    if (!OptDePngFuzzGenerate(c, state))
+      return 1;
+
+    OptDePngFuzzFailure f;
+    bool ok = OptDePngFuzzRun(c, impls, implCount, f);
+
+    if (!ok) {
+      printf("[ERROR] Iteration %u failed\n", i);
+      OptDePngFuzzFail(c, impls, implCount, f, reproPath);
+    }
+
+    ::free(c.data);
+    if (!ok)
+      return 1;
+  }
+
+  return 0;
+}
+#endif // OPT_DEPNG_LIBFUZZER
@@ -3,122 +3,19 @@
 //
 // [License]
 // Zlib - See LICENSE.md file in the package.
-#define USE_SSE2
 
-#include "./optglobals.h"
-#include "./optdepng.h"
-
-// ============================================================================
-// [Helpers]
-//
-// These are some inlines that are used across the reference and the optimized
-// code. The goal is to move some logic here so the implementation is not
-// polluted by code that can be easily moved out.
-// ============================================================================
-
-template<typename T> static T OPT_INLINE Min(T a, T b) { return a < b ? a : b; }
-template<typename T> static T OPT_INLINE Max(T a, T b) { return a > b ? a : b; }
-
-// Sum and pack to BYTE. The compiler should omit the `0xFF` as when the result
-// is stored in memory it's done automatically.
-static OPT_INLINE uint8_t Sum(uint32_t a, uint32_t b) {
-  return static_cast<uint8_t>((a + b) & 0xFF);
-}
-
-// Unsigned division by 3 translated into a multiplication and shift. The range
-// of `x` is [0, 255], inclusive. This means that we need at most 16 bits to
-// have the result. In SIMD this is exploited by using PMULHUW instruction that
-// will multiply and shift by 16 bits right (the constant is adjusted for that).
-static OPT_INLINE int32_t UDiv3(int32_t x) {
-  return (x * 0xAB) >> 9;
-}
-
-// Return an absolute value of `x`. This is used exclusively by `PaethRef()`
-// implementation. You can experiment by trying to make `Abs()` condition-
-// less, but since the `PaethOpt()` is using much better approach than the
-// reference implementation it probably doesn't matter at all.
-static OPT_INLINE int32_t Abs(int32_t x) {
-  return x >= 0 ? x : -x;
-}
-
-// Reference implementation of PNG's AVG reverse filter. Please note that the
-// SIMD functions (PAVGB, PAVGW) are not equal to the AVG method required by
-// PNG; SSE2 instructions add `1` before the result is shifted, thus becomes
-// rounded instead of truncated.
-static OPT_INLINE uint32_t Avg(uint32_t a, uint32_t b) {
-  return (a + b) >> 1;
-}
-
-// Reference implementation of PNG's Paeth reverse filter. This implementation
-// follows the specification pretty closely with only minor optimizations done.
-// This implementation is found in many PNG decoders; good to test against.
-static OPT_INLINE uint32_t PaethRef(uint32_t b, uint32_t a, uint32_t c) {
-  int32_t pa = static_cast<int32_t>(b) - static_cast<int32_t>(c);
-  int32_t pb = static_cast<int32_t>(a) - static_cast<int32_t>(c);
-  int32_t pc = pa + pb;
-
-  pa = Abs(pa);
-  pb = Abs(pb);
-  pc = Abs(pc);
-
-  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
-}
-
-// This is an optimized implementation of PNG's Paeth reference filter. This
-// optimization originally comes from my previous implementation where I tried
-// to simplify it to be more SIMD friendly. One interesting property of Paeth
-// filter is:
-//
-//   Paeth(a, b, c) == Paeth(b, a, c);
-//
-// Actually what the filter needs is a minimum and maximum of `a` and `b`, so
-// I based the implementation on getting those first. If you know `min(a, b)`
-// and `max(a, b)` you can divide the interval to be checked against `c`. This
-// requires division by 3, which is available above as `UDiv3()`.
-//
-// The previous implementation looked like:
-//
-//   static inline uint32_t Paeth(uint32_t a, uint32_t b, uint32_t c) {
-//     uint32_t minAB = Min(a, b);
-//     uint32_t maxAB = Max(a, b);
-//     uint32_t divAB = UDiv3(maxAB - minAB);
-//
-//     if (c <= minAB + divAB) return maxAB;
-//     if (c >= maxAB - divAB) return minAB;
-//
-//     return c;
-//   }
-//
-// Although it's not bad I tried to exploit more the idea of SIMD and masking.
-// The following code basically removes the need of any comparison, it relies
-// on bit shifting and performs an arithmetic (not logical) shift of signs
-// produced by `divAB + minAB` and `divAB - maxAB`, which are then used to mask
-// out `minAB` and `maxAB`. The `minAB` and `maxAB` can be negative after `c`
-// is subtracted, which will basically remove the original `c` if one of the
-// two additions is unmasked. The code can unmask either zero or one addition,
-// but it never unmasks both.
-//
-// Don't hesitate to contact the author <kobalicek.petr@gmail.com> if you need
-// a further explanation of the code below, it's probably hard to understand
-// without looking into the original Paeth implementation and without having a
-// visualization of the Paeth function.
-static OPT_INLINE uint32_t PaethOpt(uint32_t a, uint32_t b, uint32_t c) {
-  int32_t minAB = static_cast<int32_t>(Min(a, b));
-  int32_t maxAB = static_cast<int32_t>(Max(a, b));
-  int32_t divAB = UDiv3(maxAB - minAB);
-
-  minAB -= static_cast<int32_t>(c);
-  maxAB -= static_cast<int32_t>(c);
-
-  return static_cast<uint32_t>(c + (maxAB & ~((divAB + minAB) >> 31)) +
-                                   (minAB & ~((divAB - maxAB) >> 31)) );
-}
+#include "./optdepng_p.h"
+#include "./optthreadpool.h"
 
 // ============================================================================
 // [Implementation - Reference]
 // ============================================================================
 
-void OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+uint32_t OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
   uint32_t y = h;
   uint8_t* u = NULL;
 
@@ -129,8 +26,36 @@ void OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
     uint32_t i;
     uint32_t filter = *p++;
 
+    // The first row has no previous row so use a row of zeros instead of it,
+    // written explicitly here so other implementations can be tested against.
+    if (u == NULL) {
+      switch (filter) {
+        case kPngFilterSub:
+        case kPngFilterAvg:
+        case kPngFilterPaeth: {
+          for (i = bpl - bpp; i != 0; i--, p++) {
+            uint32_t a = p[0];
+            uint32_t x = filter == kPngFilterSub ? a :
+                         filter == kPngFilterAvg ? Avg(a, 0) : PaethRef(a, 0, 0);
+            p[bpp] = Sum(p[bpp], x);
+          }
+
+          p += bpp;
+          break;
+        }
+
+        default:
+          p += bpl;
+          break;
+      }
+
+      u = p - bpl;
+      continue;
+    }
+
     switch (filter) {
-      case kPngFilterNone:
+      // Rows that have an invalid filter ID are left as is.
+      default:
         p += bpl;
         break;
 
@@ -174,6 +99,41 @@ void OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
 
     u = p - bpl;
   } while (--y != 0);
+
+  return kOptDePngErrorOk;
+}
+
+static void OptDePngForwardRowRef(uint8_t* dst, const uint8_t* x, const uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t a = i >= bpp ? x[i - bpp] : 0;
+    uint32_t b = u[i];
+    uint32_t c = i >= bpp ? u[i - bpp] : 0;
+
+    uint32_t pred = filter == kPngFilterSub   ? a :
+                    filter == kPngFilterUp    ? b :
+                    filter == kPngFilterAvg   ? Avg(a, b) :
+                    filter == kPngFilterPaeth ? PaethRef(a, b, c) : 0;
+    dst[i] = static_cast<uint8_t>(x[i] - pred);
+  }
+}
+
+static void OptDePngForwardAllRef(uint8_t* const* dst, uint64_t* sums, const uint8_t* x, const uint8_t* u, uint32_t bpp, uint32_t n) {
+  for (uint32_t filter = 0; filter < kPngFilterCount; filter++) {
+    const uint8_t* row = x;
+    if (filter != kPngFilterNone) {
+      OptDePngForwardRowRef(dst[filter - 1], x, u, filter, bpp, n);
+      row = dst[filter - 1];
+    }
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+      sum += OptDePngForwardCost(row[i]);
+    sums[filter] = sum;
+  }
+}
+
+uint32_t OptDePngForwardRef(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter) {
+  return OptDePngForward_Driver(dst, src, srcStride, h, bpp, bpl, filter, OptDePngForwardRowRef, OptDePngForwardAllRef);
 }
 
 // ============================================================================
@@ -195,8 +155,18 @@ static OPT_INLINE void OptDePngFilterOpt_T(uint8_t* p, uint32_t h, uint32_t bpl)
     uint32_t i;
     uint32_t filter = *p++;
 
+    // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+    if (u == NULL) {
+      filter = OptDePngFirstRowFilter(filter);
+      if (filter == kPngFilterAvg) {
+        OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        filter = kPngFilterNone;
+      }
+    }
+
     switch (filter) {
-      case kPngFilterNone:
+      // Rows that have an invalid filter ID are left as is.
+      default:
         p += bpl;
         break;
 
@@ -242,7 +212,78 @@ static OPT_INLINE void OptDePngFilterOpt_T(uint8_t* p, uint32_t h, uint32_t bpl)
   } while (--y != 0);
 }
 
-void OptDePngFilterOpt(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+// Scalar span that works with any `bpp`, it's also used by the template below
+// that makes `bpp` constant.
+static OPT_INLINE void OptDePngSpanOpt_Generic(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  uint32_t i = x0;
+
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst(p, bpp, x0, x1);
+      return;
+    }
+  }
+
+  switch (filter) {
+    case kPngFilterSub: {
+      for (i = Max<uint32_t>(i, bpp); i < x1; i++)
+        p[i] = Sum(p[i], p[i - bpp]);
+      break;
+    }
+
+    case kPngFilterUp: {
+      for (; i < x1; i++)
+        p[i] = Sum(p[i], u[i]);
+      break;
+    }
+
+    case kPngFilterAvg: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i] >> 1);
+
+      for (; i < x1; i++)
+        p[i] = Sum(p[i], Avg(p[i - bpp], u[i]));
+      break;
+    }
+
+    case kPngFilterPaeth: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i]);
+
+      for (; i < x1; i++)
+        p[i] = Sum(p[i], PaethOpt(p[i - bpp], u[i], u[i - bpp]));
+      break;
+    }
+  }
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSpanOpt_T(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t x0, uint32_t x1) {
+  OptDePngSpanOpt_Generic(p, u, filter, bpp, x0, x1);
+}
+
+static OPT_INLINE void OptDePngFilterOpt_Generic(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = *p++;
+    OptDePngSpanOpt_Generic(p, u, filter, bpp, 0, bpl);
+
+    u = p;
+    p += bpl;
+  }
+}
+
+uint32_t OptDePngFilterOpt(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
   switch (bpp) {
     case 1: OptDePngFilterOpt_T<1>(p, h, bpl); break;
     case 2: OptDePngFilterOpt_T<2>(p, h, bpl); break;
@@ -250,1109 +291,905 @@ void OptDePngFilterOpt(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
     case 4: OptDePngFilterOpt_T<4>(p, h, bpl); break;
     case 6: OptDePngFilterOpt_T<6>(p, h, bpl); break;
     case 8: OptDePngFilterOpt_T<8>(p, h, bpl); break;
+    default: OptDePngFilterOpt_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanOpt(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanOpt_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanOpt_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanOpt_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanOpt_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanOpt_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanOpt_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanOpt_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+static void OptDePngUpToOpt(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++)
+    dst[i] = Sum(src[i], u[i]);
+}
+
+static void OptDePngCopyRowOpt(uint8_t* dst, const uint8_t* src, uint32_t n) {
+  ::memcpy(dst, src, n);
+}
+
+uint32_t OptDePngFilterOptTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanOpt, OptDePngUpToOpt);
+}
+
+uint32_t OptDePngFilterPaddedOpt(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidatePadded(p, stride, h, bpp, bpl);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  OptDePngFilterPadded_Driver(p, stride, h, bpp, bpl, OptDePngSpanOpt);
+  return kOptDePngErrorOk;
+}
+
+template<uint32_t bpp, bool premultiply>
+static void OptDePngConvertOpt_Func(uint8_t* dst, const uint8_t* src, uint32_t w) {
+  OptDePngConvertOpt_T<bpp, premultiply>(dst, src, 0, w);
+}
+
+OptDePngConvertFunc OptDePngConvertGetOpt(uint32_t bpp, uint32_t format) {
+  bool premultiply = format == kOptDePngFormatPRGB32;
+
+  if (format >= kOptDePngFormatCount)
+    return NULL;
+
+  switch (bpp) {
+    case 1: return OptDePngConvertOpt_Func<1, false>;
+    case 2: return premultiply ? OptDePngConvertOpt_Func<2, true> : OptDePngConvertOpt_Func<2, false>;
+    case 3: return OptDePngConvertOpt_Func<3, false>;
+    case 4: return premultiply ? OptDePngConvertOpt_Func<4, true> : OptDePngConvertOpt_Func<4, false>;
   }
+
+  return NULL;
 }
 
 // ============================================================================
-// [Implementation - SSE2 Optimized]
+// [Implementation - CRC32C]
 // ============================================================================
 
-#define PNG_SSE_SLL_ADDB_1X(P0, T0, Shift) \
-  do { \
-    T0 = _mm_slli_si128(P0, Shift); \
-    P0 = _mm_add_epi8(P0, T0); \
-  } while (0)
-
-#define PNG_SSE_SLL_ADDB_2X(P0, T0, P1, T1, Shift) \
-  do { \
-    T0 = _mm_slli_si128(P0, Shift); \
-    T1 = _mm_slli_si128(P1, Shift); \
-    P0 = _mm_add_epi8(P0, T0); \
-    P1 = _mm_add_epi8(P1, T1); \
-  } while (0)
-
-#define PNG_SSE_PAETH(Dst, A, B, C) \
-  do { \
-    __m128i MinAB = _mm_min_epi16(A, B); \
-    __m128i MaxAB = _mm_max_epi16(A, B); \
-    __m128i DivAB = _mm_mulhi_epu16(_mm_sub_epi16(MaxAB, MinAB), rcp3); \
-    \
-    MinAB = _mm_sub_epi16(MinAB, C); \
-    MaxAB = _mm_sub_epi16(MaxAB, C); \
-    \
-    Dst = _mm_add_epi16(C  , _mm_andnot_si128(_mm_srai_epi16(_mm_add_epi16(DivAB, MinAB), 15), MaxAB)); \
-    Dst = _mm_add_epi16(Dst, _mm_andnot_si128(_mm_srai_epi16(_mm_sub_epi16(DivAB, MaxAB), 15), MinAB)); \
-  } while (0)
+// Append `n` zero BYTEs to the CRC register `x`, a bit at a time.
+static uint32_t OptDePngCrc32cZeros(uint32_t x, uint32_t n) {
+  for (uint32_t i = 0; i < n * 8; i++)
+    x = (x >> 1) ^ (kOptDePngCrc32cPoly & (0u - (x & 1)));
+  return x;
+}
 
-template<uint32_t bpp>
-static OPT_INLINE void OptDePngFilterSSE2_T(uint8_t* p, uint32_t h, uint32_t bpl) {
-  uint32_t y = h;
-  uint8_t* u = NULL;
+static OptDePngCrc32cTables OptDePngCrc32cInit() {
+  OptDePngCrc32cTables t;
 
-  // Subtract one BYTE that is used to store the `filter` ID.
-  bpl--;
+  for (uint32_t i = 0; i < 256; i++)
+    t.slice[0][i] = OptDePngCrc32cZeros(i, 1);
 
-  do {
-    uint32_t i;
-    uint32_t filter = *p++;
+  for (uint32_t k = 1; k < 8; k++) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t x = t.slice[k - 1][i];
+      t.slice[k][i] = (x >> 8) ^ t.slice[0][x & 0xFF];
+    }
+  }
 
-    switch (filter) {
-      // ----------------------------------------------------------------------
-      // [None]
-      // ----------------------------------------------------------------------
+  // The shift is linear, so it's calculated for each bit and combined.
+  uint32_t bits[32];
+  for (uint32_t i = 0; i < 32; i++)
+    bits[i] = OptDePngCrc32cZeros(1u << i, kOptDePngCrc32cBlock);
+
+  for (uint32_t k = 0; k < 4; k++) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t x = 0;
+      for (uint32_t b = 0; b < 8; b++) {
+        if (i & (1u << b))
+          x ^= bits[k * 8 + b];
+      }
+      t.shift[k][i] = x;
+    }
+  }
 
-      case kPngFilterNone:
-        p += bpl;
-        break;
+  return t;
+}
 
-      // ----------------------------------------------------------------------
-      // [Sub]
-      // ----------------------------------------------------------------------
-
-      // This is one of the easiest filters to parallelize. Although it looks
-      // like the data dependency is too high, it's simply additions, which are
-      // really easy to parallelize. The following formula:
-      //
-      //     Y1' = BYTE(Y1 + Y0')
-      //     Y2' = BYTE(Y2 + Y1')
-      //     Y3' = BYTE(Y3 + Y2')
-      //     Y4' = BYTE(Y4 + Y3')
-      //
-      // Expanded to (with byte casts removed, as they are implicit in our case):
-      //
-      //     Y1' = Y1 + Y0'
-      //     Y2' = Y2 + Y1 + Y0'
-      //     Y3' = Y3 + Y2 + Y1 + Y0'
-      //     Y4' = Y4 + Y3 + Y2 + Y1 + Y0'
-      //
-      // Can be implemented like this by taking advantage of SIMD:
-      //
-      //     +-----------+-----------+-----------+-----------+----->
-      //     |    Y1     |    Y2     |    Y3     |    Y4     | ...
-      //     +-----------+-----------+-----------+-----------+----->
-      //                   Shift by 1 and PADDB
-      //     +-----------+-----------+-----------+-----------+
-      //     |           |    Y1     |    Y2     |    Y3     | ----+
-      //     +-----------+-----------+-----------+-----------+     |
-      //                                                           |
-      //     +-----------+-----------+-----------+-----------+     |
-      //     |    Y1     |   Y1+Y2   |   Y2+Y3   |   Y3+Y4   | <---+
-      //     +-----------+-----------+-----------+-----------+
-      //                   Shift by 2 and PADDB
-      //     +-----------+-----------+-----------+-----------+
-      //     |           |           |    Y1     |   Y1+Y2   | ----+
-      //     +-----------+-----------+-----------+-----------+     |
-      //                                                           |
-      //     +-----------+-----------+-----------+-----------+     |
-      //     |    Y1     |   Y1+Y2   | Y1+Y2+Y3  |Y1+Y2+Y3+Y4| <---+
-      //     +-----------+-----------+-----------+-----------+
-      //
-      // The size of the register doesn't matter here. The Y0' dependency has
-      // been omitted to make the flow cleaner, however, it can be added to Y1
-      // before processing or it can be shifter to the first cell so the first
-      // addition would be performed against [Y0', Y1, Y2, Y3].
+extern const OptDePngCrc32cTables OptDePngCrc32cData = OptDePngCrc32cInit();
 
-      case kPngFilterSub: {
-        i = bpl - bpp;
-
-        if (i >= 32) {
-          // Align to 16-BYTE boundary.
-          uint32_t j = OptAlignDiff(p + bpp, 16);
-          for (i -= j; j != 0; j--, p++)
-            p[bpp] = Sum(p[bpp], p[0]);
-
-          if (bpp == 1) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t2;
-
-            // Process 64 BYTEs at a time.
-            p0 = _mm_cvtsi32_si128(p[0]);
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 1));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 17));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 33));
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 49));
-
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 1);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 2);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 4);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 1), p0);
-
-              p0 = _mm_srli_si128(p0, 15);
-              t2 = _mm_srli_si128(p2, 15);
-              p1 = _mm_add_epi8(p1, p0);
-              p3 = _mm_add_epi8(p3, t2);
-
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 1);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 2);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 4);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 17), p1);
-
-              p1 = _mm_unpackhi_epi8(p1, p1);
-              p1 = _mm_unpackhi_epi16(p1, p1);
-              p1 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
-
-              p2 = _mm_add_epi8(p2, p1);
-              p3 = _mm_add_epi8(p3, p1);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 33), p2);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 49), p3);
-              p0 = _mm_srli_si128(p3, 15);
-
-              p += 64;
-              i -= 64;
-            }
-
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 1));
-
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 1);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 2);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 1), p0);
-              p0 = _mm_srli_si128(p0, 15);
-
-              p += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 2) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t2;
-
-            // Process 64 BYTEs at a time.
-            p0 = _mm_cvtsi32_si128(reinterpret_cast<uint16_t*>(p)[0]);
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 2));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 18));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 34));
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 50));
-
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 2);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 4);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 2), p0);
-
-              p0 = _mm_srli_si128(p0, 14);
-              t2 = _mm_srli_si128(p2, 14);
-              p1 = _mm_add_epi8(p1, p0);
-              p3 = _mm_add_epi8(p3, t2);
-
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 2);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 4);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 18), p1);
-
-              p1 = _mm_unpackhi_epi16(p1, p1);
-              p1 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
-
-              p2 = _mm_add_epi8(p2, p1);
-              p3 = _mm_add_epi8(p3, p1);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 34), p2);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 50), p3);
-              p0 = _mm_srli_si128(p3, 14);
-
-              p += 64;
-              i -= 64;
-            }
-
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 2));
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 2);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 2), p0);
-              p0 = _mm_srli_si128(p0, 14);
-
-              p += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 3) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t2;
-            __m128i ext3b = _mm_set1_epi32(0x01000001);
+// Slicing-by-8, which processes 8 BYTEs by 8 independent table lookups.
+uint32_t OptDePngCrc32cOpt(uint32_t crc, const uint8_t* data, size_t size) {
+  const OptDePngCrc32cTables& t = OptDePngCrc32cData;
+  uint32_t c = ~crc;
 
-            // Process 64 BYTEs at a time.
-            p0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0] & 0x00FFFFFFU);
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 3));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 19));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 35));
+  for (; size >= 8; size -= 8, data += 8) {
+    uint32_t x = c ^ (static_cast<uint32_t>(data[0])       | (static_cast<uint32_t>(data[1]) <<  8) |
+                      (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24));
+    c = t.slice[7][(x      ) & 0xFF] ^ t.slice[6][(x >>  8) & 0xFF] ^
+        t.slice[5][(x >> 16) & 0xFF] ^ t.slice[4][(x >> 24)       ] ^
+        t.slice[3][data[4]] ^ t.slice[2][data[5]] ^
+        t.slice[1][data[6]] ^ t.slice[0][data[7]];
+  }
 
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 3);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 6);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 12);
+  for (; size != 0; size--, data++)
+    c = (c >> 8) ^ t.slice[0][(c ^ data[0]) & 0xFF];
 
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 51));
-              t0 = _mm_srli_si128(p0, 13);
-              t2 = _mm_srli_si128(p2, 13);
+  return ~c;
+}
 
-              p1 = _mm_add_epi8(p1, t0);
-              p3 = _mm_add_epi8(p3, t2);
+// ============================================================================
+// [Implementation - Dispatch]
+// ============================================================================
 
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 3);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 6);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 12);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p +  3), p0);
+struct OptDePngImpl {
+  OptDePngFilterFunc filter;
+  OptDePngFilterToFunc filterTo;
+  OptDePngSpanFunc span;
+  OptDePngConvertFunc (*getConvert)(uint32_t bpp, uint32_t format);
+  OptDePngBatchFunc batch;
+  OptDePngCopyFunc loadRow;
+  OptDePngCopyFunc storeRow;
+  OptDePngForwardFunc forward;
+  OptDePngFilterPaddedFunc padded;
+  OptDePngCrc32cFunc crc32c;
+};
+
+static OptDePngImpl OptDePngSelect() {
+  uint32_t features = OptCpu::detect();
+  OptDePngImpl impl;
+
+  impl.filter = OptDePngFilterOpt;
+  impl.filterTo = OptDePngFilterOptTo;
+  impl.span = OptDePngSpanOpt;
+  impl.getConvert = OptDePngConvertGetOpt;
+  impl.batch = NULL;
+  impl.loadRow = OptDePngCopyRowOpt;
+  impl.storeRow = OptDePngCopyRowOpt;
+  impl.forward = OptDePngForwardRef;
+  impl.padded = OptDePngFilterPaddedOpt;
+  impl.crc32c = OptDePngCrc32cOpt;
+
+#if defined(OPT_BUILD_SSE2)
+  if (features & kOptCpuSSE2) {
+    impl.filter = OptDePngFilterSSE2;
+    impl.filterTo = OptDePngFilterSSE2To;
+    impl.span = OptDePngSpanSSE2;
+    impl.getConvert = OptDePngConvertGetSSE2;
+    // SSSE3 and AVX2 tiers use SSE2 batch kernels as well, a short row fits
+    // in a few XMM registers and their `Avg` and `Paeth` kernels are SSE2.
+    impl.batch = OptDePngBatchSSE2;
+    impl.loadRow = OptDePngLoadRowSSE2;
+    impl.storeRow = OptDePngStoreRowSSE2;
+    impl.forward = OptDePngForwardSSE2;
+    // Padded kernels use only 128-bit registers, which is enough to make rows
+    // aligned, so higher tiers use them as well.
+    impl.padded = OptDePngFilterPaddedSSE2;
+  }
+#endif // OPT_BUILD_SSE2
+
+#if defined(OPT_BUILD_SSE42)
+  // Only the CRC32 instruction, filters of SSSE3 and higher tiers are used.
+  if (features & kOptCpuSSE42)
+    impl.crc32c = OptDePngCrc32cSSE42;
+#endif // OPT_BUILD_SSE42
+
+#if defined(OPT_BUILD_SSSE3)
+  if (features & kOptCpuSSSE3) {
+    impl.filter = OptDePngFilterSSSE3;
+    impl.filterTo = OptDePngFilterSSSE3To;
+    impl.span = OptDePngSpanSSSE3;
+    impl.getConvert = OptDePngConvertGetSSSE3;
+  }
+#endif // OPT_BUILD_SSSE3
+
+#if defined(OPT_BUILD_AVX2)
+  if (features & kOptCpuAVX2) {
+    impl.filter = OptDePngFilterAVX2;
+    impl.filterTo = OptDePngFilterAVX2To;
+    impl.span = OptDePngSpanAVX2;
+    impl.getConvert = OptDePngConvertGetAVX2;
+  }
+#endif // OPT_BUILD_AVX2
+
+#if defined(OPT_BUILD_AVX512)
+  if (features & kOptCpuAVX512) {
+    impl.filter = OptDePngFilterAVX512;
+    impl.filterTo = OptDePngFilterAVX512To;
+    impl.span = OptDePngSpanAVX512;
+    impl.getConvert = OptDePngConvertGetAVX512;
+    impl.batch = OptDePngBatchAVX512;
+  }
+#endif // OPT_BUILD_AVX512
+
+#if defined(OPT_BUILD_NEON)
+  if (features & kOptCpuNEON) {
+    impl.filter = OptDePngFilterNEON;
+    impl.filterTo = OptDePngFilterNEONTo;
+    impl.span = OptDePngSpanNEON;
+    impl.getConvert = OptDePngConvertGetNEON;
+  }
+#endif // OPT_BUILD_NEON
 
-              p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
-              p0 = _mm_srli_epi32(p0, 8);
-              p0 = _mm_mul_epu32(p0, ext3b);
+  return impl;
+}
 
-              p0 = _mm_shufflelo_epi16(p0, _MM_SHUFFLE(0, 2, 1, 0));
-              p0 = _mm_shufflehi_epi16(p0, _MM_SHUFFLE(1, 0, 2, 1));
+// Initialized during static initialization, before `main()` is entered.
+static const OptDePngImpl OptDePngBest = OptDePngSelect();
+
+// Size of the output in BYTEs from which `OptDePngFilterTo()` uses the large
+// image mode. Below a half of the last level cache the source and the output
+// both stay in cache and regular stores are faster.
+static uint64_t OptDePngLargeSelectMinSize() {
+  // The row buffer only pays off if the output is written by non-temporal
+  // stores, which the portable implementation doesn't have.
+  if (OptDePngBest.storeRow == OptDePngCopyRowOpt)
+    return ~static_cast<uint64_t>(0);
+
+  uint64_t size = OptCpu::getCacheSize(3) / 2;
+  if (size == 0)
+    size = 8 * 1024 * 1024;
+  return size < 4 * 1024 * 1024 ? 4 * 1024 * 1024 : size;
+}
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 19), p1);
-              p2 = _mm_add_epi8(p2, p0);
-              p0 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 3, 2, 1));
+static const uint64_t OptDePngLargeMinSize = OptDePngLargeSelectMinSize();
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 35), p2);
-              p0 = _mm_add_epi8(p0, p3);
+uint32_t OptDePngFilter(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  return OptDePngBest.filter(p, h, bpp, bpl);
+}
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 51), p0);
-              p0 = _mm_srli_si128(p0, 13);
+uint32_t OptDePngFilterTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  if (srcBpl > 1 && static_cast<uint64_t>(h) * (srcBpl - 1) >= OptDePngLargeMinSize)
+    return OptDePngFilterToLarge(dst, dstStride, src, h, bpp, srcBpl);
+  return OptDePngBest.filterTo(dst, dstStride, src, h, bpp, srcBpl);
+}
 
-              p += 64;
-              i -= 64;
-            }
+uint32_t OptDePngForward(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter) {
+  return OptDePngBest.forward(dst, src, srcStride, h, bpp, bpl, filter);
+}
 
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 3));
+uint32_t OptDePngFilterPadded(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  return OptDePngBest.padded(p, stride, h, bpp, bpl);
+}
 
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 3);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 6);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 12);
+uint32_t OptDePngCrc32c(uint32_t crc, const uint8_t* data, size_t size) {
+  return OptDePngBest.crc32c(crc, data, size);
+}
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 3), p0);
-              p0 = _mm_srli_si128(p0, 13);
+OptDePngFilterFunc OptDePngFilterGetBest() {
+  return OptDePngBest.filter;
+}
 
-              p += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 4) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t1, t2;
+OptDePngSpanFunc OptDePngSpanGetBest() {
+  return OptDePngBest.span;
+}
 
-            // Process 64 BYTEs at a time.
-            p0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]);
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 4));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 20));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 36));
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 52));
+// ============================================================================
+// [Implementation - Checked]
+//
+// Filter IDs are validated by a scan of the filter column before any row is
+// unfiltered, so the kernels don't need to check them. The scan reads only one
+// BYTE per row and has one branch per four rows until an invalid ID is found.
+// ============================================================================
 
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 4);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+uint32_t OptDePngValidateFilters(const uint8_t* p, uint32_t h, uint32_t bpl, uint32_t* badRow) {
+  size_t stride = bpl;
+  uint32_t y = 0;
+
+  if (h >= 4) {
+    for (; y <= h - 4; y += 4) {
+      const uint8_t* r = p + y * stride;
+      uint32_t invalid = static_cast<uint32_t>(r[0         ] >= kPngFilterCount) |
+                         static_cast<uint32_t>(r[stride    ] >= kPngFilterCount) |
+                         static_cast<uint32_t>(r[stride * 2] >= kPngFilterCount) |
+                         static_cast<uint32_t>(r[stride * 3] >= kPngFilterCount);
+      if (invalid)
+        break;
+    }
+  }
 
-              p0 = _mm_srli_si128(p0, 12);
-              t2 = _mm_srli_si128(p2, 12);
+  for (; y < h; y++)
+    if (p[y * stride] >= kPngFilterCount)
+      break;
 
-              p1 = _mm_add_epi8(p1, p0);
-              p3 = _mm_add_epi8(p3, t2);
+  if (badRow != NULL)
+    *badRow = y;
+  return y < h ? kOptDePngErrorInvalidFilter : kOptDePngErrorOk;
+}
 
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 4);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 8);
+uint32_t OptDePngFilterChecked(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t* badRow) {
+  uint32_t y = 0;
+  uint32_t err = OptDePngValidate(bpp, bpl);
 
-              p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 20), p1);
+  if (err == kOptDePngErrorOk) {
+    err = OptDePngValidateFilters(p, h, bpl, &y);
+    // Rows above the invalid one are still unfiltered.
+    if (y != 0)
+      OptDePngBest.filter(p, y, bpp, bpl);
+  }
 
-              p2 = _mm_add_epi8(p2, p0);
-              p0 = _mm_add_epi8(p0, p3);
+  if (badRow != NULL)
+    *badRow = y;
+  return err;
+}
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 36), p2);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 52), p0);
-              p0 = _mm_srli_si128(p0, 12);
+// ============================================================================
+// [Implementation - Checksum]
+//
+// Rows are unfiltered one by one by the span function and checksummed right
+// away, a row (and the previous one) stays in L1 cache between the two.
+// ============================================================================
 
-              p += 64;
-              i -= 64;
-            }
+uint32_t OptDePngFilterChecksum(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t* crc) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  uint32_t c = 0;
 
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 4));
+  if (err == kOptDePngErrorOk) {
+    OptDePngSpanFunc span = OptDePngBest.span;
+    OptDePngCrc32cFunc crc32c = OptDePngBest.crc32c;
 
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
-              p0 = _mm_srli_si128(p0, 12);
+    uint32_t rowSize = bpl - 1;
+    uint8_t* row = p + 1;
+    uint8_t* u = NULL;
 
-              p += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 6) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t1;
+    for (uint32_t y = 0; y < h; y++) {
+      uint32_t filter = row[-1];
+      if (filter != kPngFilterNone)
+        span(row, u, filter, bpp, 0, rowSize);
+      c = crc32c(c, row, rowSize);
 
-            p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
-            p0 = _mm_slli_epi64(p0, 16);
-            p0 = _mm_srli_epi64(p0, 16);
+      u = row;
+      row += bpl;
+    }
+  }
 
-            // Process 64 BYTEs at a time.
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 6));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 22));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 38));
+  if (crc != NULL)
+    *crc = c;
+  return err;
+}
 
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 6);
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 12);
+// ============================================================================
+// [Implementation - Batch]
+//
+// Images are grouped by `bpp` and each group is passed to the batch function
+// of the implementation, so the `bpp` switch runs once per group and not once
+// per image. Groups are collected in a small array on the stack and flushed
+// when it's full, images with long rows or unusual `bpp` are not grouped.
+// ============================================================================
 
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 54));
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
+static OPT_INLINE bool OptDePngBatchIsGrouped(const OptDePngBatchItem& item, uint32_t bpp) {
+  return item.error == kOptDePngErrorOk && item.h != 0 && item.bpp == bpp && item.bpl - 1 <= OPT_DEPNG_BATCH_MAX_ROW;
+}
 
-              p0 = _mm_srli_si128(p0, 10);
-              t1 = _mm_srli_si128(p2, 10);
+uint32_t OptDePngFilterBatch(OptDePngBatchItem* items, size_t count) {
+  static const uint32_t kGroupBpp[] = { 1, 2, 3, 4, 6, 8 };
+  static const uint32_t kGroupCount = sizeof(kGroupBpp) / sizeof(kGroupBpp[0]);
 
-              p1 = _mm_add_epi8(p1, p0);
-              p3 = _mm_add_epi8(p3, t1);
+  OptDePngBatchFunc batch = OptDePngBest.batch;
+  uint32_t result = kOptDePngErrorOk;
+  size_t i;
 
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 6);
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 12);
-              p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 2, 3, 2));
+  for (i = 0; i < count; i++) {
+    OptDePngBatchItem& item = items[i];
+    item.error = OptDePngValidate(item.bpp, item.bpl);
 
-              p0 = _mm_shufflelo_epi16(p0, _MM_SHUFFLE(1, 3, 2, 1));
-              p0 = _mm_shufflehi_epi16(p0, _MM_SHUFFLE(2, 1, 3, 2));
+    if (item.error != kOptDePngErrorOk) {
+      if (result == kOptDePngErrorOk)
+        result = item.error;
+      continue;
+    }
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 22), p1);
-              p2 = _mm_add_epi8(p2, p0);
-              p0 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 3, 2, 1));
+    if (item.h == 0)
+      continue;
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 38), p2);
-              p0 = _mm_add_epi8(p0, p3);
+    bool grouped = false;
+    if (batch != NULL) {
+      for (uint32_t g = 0; g < kGroupCount; g++)
+        grouped |= OptDePngBatchIsGrouped(item, kGroupBpp[g]);
+    }
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 54), p0);
-              p0 = _mm_srli_si128(p0, 10);
+    if (!grouped)
+      OptDePngBest.filter(item.p, item.h, item.bpp, item.bpl);
+  }
 
-              p += 64;
-              i -= 64;
-            }
+  if (batch == NULL)
+    return result;
 
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 6));
+  OptDePngBatchItem* group[64];
+  for (uint32_t g = 0; g < kGroupCount; g++) {
+    uint32_t bpp = kGroupBpp[g];
+    size_t n = 0;
 
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 6);
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 12);
+    for (i = 0; i < count; i++) {
+      if (!OptDePngBatchIsGrouped(items[i], bpp))
+        continue;
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
-              p0 = _mm_srli_si128(p0, 10);
+      group[n++] = &items[i];
+      if (n == sizeof(group) / sizeof(group[0])) {
+        batch(group, n, bpp);
+        n = 0;
+      }
+    }
 
-              p += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 8) {
-            __m128i p0, p1, p2, p3;
-            __m128i t0, t1, t2;
-
-            // Process 64 BYTEs at a time.
-            p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
-            while (i >= 64) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 8));
-              p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 24));
-              p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 40));
-              p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 56));
-
-              PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 8);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
-
-              p0 = _mm_srli_si128(p0, 8);
-              t2 = _mm_shuffle_epi32(p2, _MM_SHUFFLE(3, 2, 3, 2));
-              p1 = _mm_add_epi8(p1, p0);
-
-              PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 8);
-              p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 2, 3, 2));
-              p3 = _mm_add_epi8(p3, t2);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 24), p1);
-
-              p2 = _mm_add_epi8(p2, p0);
-              p0 = _mm_add_epi8(p0, p3);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 40), p2);
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 56), p0);
-              p0 = _mm_srli_si128(p0, 8);
-
-              p += 64;
-              i -= 64;
-            }
-
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 8));
-              PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
-
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
-              p0 = _mm_srli_si128(p0, 8);
-
-              p += 16;
-              i -= 16;
-            }
-          }
-        }
+    if (n != 0)
+      batch(group, n, bpp);
+  }
 
-        for (; i != 0; i--, p++)
-          p[bpp] = Sum(p[bpp], p[0]);
+  return result;
+}
 
-        p += bpp;
-        break;
-      }
+// ============================================================================
+// [Implementation - Stream]
+// ============================================================================
 
-      // ----------------------------------------------------------------------
-      // [Up]
-      // ----------------------------------------------------------------------
-
-      // This is actually the easiest filter that doesn't require any kind of
-      // specialization for a particular BPP. Even C++ compiler like GCC is
-      // able to parallelize a naive implementation. However, MSC compiler does
-      // not parallelize the naive implementation so the SSE2 implementation
-      // provided greatly boosted the performance on Windows.
-      //
-      //     +-----------+-----------+-----------+-----------+
-      //     |    Y1     |    Y2     |    Y3     |    Y4     |
-      //     +-----------+-----------+-----------+-----------+
-      //                           PADDB
-      //     +-----------+-----------+-----------+-----------+
-      //     |    U1     |    U2     |    U3     |    U4     | ----+
-      //     +-----------+-----------+-----------+-----------+     |
-      //                                                           |
-      //     +-----------+-----------+-----------+-----------+     |
-      //     |   Y1+U1   |   Y2+U2   |   Y3+U3   |   Y4+U4   | <---+
-      //     +-----------+-----------+-----------+-----------+
+OptDePngStream::OptDePngStream()
+  : _span(OptDePngBest.span),
+    _prev(NULL),
+    _bpp(0),
+    _bpl(0),
+    _rowCount(0) {}
 
-      case kPngFilterUp: {
-        i = bpl;
+uint32_t OptDePngStream::init(uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
 
-        if (i >= 24) {
-          // Align to 16-BYTE boundary.
-          uint32_t j = OptAlignDiff(p, 16);
-          for (i -= j; j != 0; j--, p++, u++)
-            p[0] = Sum(p[0], u[0]);
+  // Invalid geometry makes `feedRow()` a no-op.
+  if (err != kOptDePngErrorOk) {
+    bpp = 0;
+    bpl = 0;
+  }
 
-          // Process 64 BYTEs at a time.
-          while (i >= 64) {
-            __m128i u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
-            __m128i u1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 16));
+  _span = OptDePngBest.span;
+  _bpp = bpp;
+  _bpl = bpl;
 
-            __m128i p0 = _mm_load_si128 (reinterpret_cast<__m128i*>(p));
-            __m128i p1 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 16));
+  reset();
+  return err;
+}
 
-            __m128i u2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 32));
-            __m128i u3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 48));
+void OptDePngStream::reset() {
+  _prev = NULL;
+  _rowCount = 0;
+}
 
-            p0 = _mm_add_epi8(p0, u0);
-            p1 = _mm_add_epi8(p1, u1);
+void OptDePngStream::feedRow(uint8_t* row) {
+  uint32_t filter = row[0];
 
-            __m128i p2 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 32));
-            __m128i p3 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 48));
+  if (filter != kPngFilterNone && _bpl > 1)
+    _span(row + 1, _prev ? _prev + 1 : NULL, filter, _bpp, 0, _bpl - 1);
 
-            p2 = _mm_add_epi8(p2, u2);
-            p3 = _mm_add_epi8(p3, u3);
+  _prev = row;
+  _rowCount++;
+}
 
-            _mm_store_si128(reinterpret_cast<__m128i*>(p     ), p0);
-            _mm_store_si128(reinterpret_cast<__m128i*>(p + 16), p1);
-            _mm_store_si128(reinterpret_cast<__m128i*>(p + 32), p2);
-            _mm_store_si128(reinterpret_cast<__m128i*>(p + 48), p3);
+// ============================================================================
+// [Implementation - Convert]
+// ============================================================================
 
-            p += 64;
-            u += 64;
-            i -= 64;
-          }
+uint32_t OptDePngFilterConvert(uint8_t* dst, intptr_t dstStride, uint32_t dstFormat, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  uint32_t err = OptDePngValidate(bpp, srcBpl);
+  if (err != kOptDePngErrorOk)
+    return err;
 
-          // Process 8 BYTEs at a time.
-          while (i >= 8) {
-            __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
-            __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+  OptDePngConvertFunc convert = OptDePngBest.getConvert(bpp, dstFormat);
+  if (convert == NULL)
+    return kOptDePngErrorInvalidFormat;
 
-            p0 = _mm_add_epi8(p0, u0);
-            _mm_storel_epi64(reinterpret_cast<__m128i*>(p), p0);
+  if (h == 0)
+    return kOptDePngErrorOk;
 
-            p += 8;
-            u += 8;
-            i -= 8;
-          }
-        }
+  // Two 16-BYTE aligned rows, the current one and the previous one.
+  uint32_t rowSize = srcBpl - 1;
+  uint32_t rowStride = (rowSize + 15) & ~15u;
 
-        for (; i != 0; i--, p++, u++)
-          p[0] = Sum(p[0], u[0]);
-        break;
-      }
+  uint8_t* buffer = static_cast<uint8_t*>(::malloc(static_cast<size_t>(rowStride) * 2 + 16));
+  if (buffer == NULL)
+    return kOptDePngErrorOutOfMemory;
 
-      // ----------------------------------------------------------------------
-      // [Avg]
-      // ----------------------------------------------------------------------
-
-      // This filter is extremely difficult for low BPP values as there is
-      // a huge sequential data dependency, I didn't succeeded to solve it.
-      // 1-3 BPP implementations are pretty bad and I would like to hear about
-      // a way to improve those. The implementation for 4 BPP and more is
-      // pretty good, as these is less data dependency between individual bytes.
-      //
-      // Sequental Approach:
-      //
-      //     Y1' = byte((2*Y1 + U1 + Y0') >> 1)
-      //     Y2' = byte((2*Y2 + U2 + Y1') >> 1)
-      //     Y3' = byte((2*Y3 + U3 + Y2') >> 1)
-      //     Y4' = byte((2*Y4 + U4 + Y3') >> 1)
-      //     Y5' = ...
-      //
-      // Expanded, `U1 + Y0'` replaced with `U1`:
-      //
-      //     Y1' = byte((2*Y1 + U1) >> 1)
-      //     Y2' = byte((2*Y2 + U2 +
-      //           byte((2*Y1 + U1) >> 1)) >> 1)
-      //     Y3' = byte((2*Y3 + U3 +
-      //           byte((2*Y2 + U2 +
-      //           byte((2*Y1 + U1) >> 1)) >> 1)) >> 1)
-      //     Y4' = byte((2*Y4 + U4 +
-      //           byte((2*Y3 + U3 +
-      //           byte((2*Y2 + U2 +
-      //           byte((2*Y1 + U1) >> 1)) >> 1)) >> 1)) >> 1)
-      //     Y5' = ...
+  uint8_t* rows[2];
+  rows[0] = buffer + OptAlignDiff(buffer, 16);
+  rows[1] = rows[0] + rowStride;
 
-      case kPngFilterAvg: {
-        for (i = 0; i < bpp; i++)
-          p[i] = Sum(p[i], u[i] >> 1);
+  OptDePngSpanFunc span = OptDePngBest.span;
+  uint32_t w = rowSize / bpp;
+  uint8_t* u = NULL;
 
-        i = bpl - bpp;
-        u += bpp;
+  for (uint32_t y = 0; y < h; y++) {
+    uint8_t* p = rows[y & 1];
+    uint32_t filter = src[0];
 
-        if (i >= 32) {
-          // Align to 16-BYTE boundary.
-          uint32_t j = OptAlignDiff(p + bpp, 16);
-          __m128i zero = _mm_setzero_si128();
-
-          for (i -= j; j != 0; j--, p++, u++)
-            p[bpp] = Sum(p[bpp], Avg(p[0], u[0]));
-
-          if (bpp == 1) {
-            // This is one of the most difficult AVG filters. 1-BPP has a huge
-            // sequential dependency, which is nearly impossible to parallelize.
-            // The code below is the best I could have written, it's a mixture
-            // of C++ and SIMD. Maybe using a pure C would be even better than
-            // this code, but, I tried to take advantage of 8 BYTE fetches at
-            // least. Unrolling the loop any further doesn't lead to an
-            // improvement.
-            //
-            // I know that the code looks terrible, but it's a bit faster than
-            // a pure specialized C++ implementation I used to have before.
-            uint32_t t0 = p[0];
-            uint32_t t1;
-
-            // Process 8 BYTEs at a time.
-            while (i >= 8) {
-              __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + 1));
-              __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
-
-              p0 = _mm_unpacklo_epi8(p0, zero);
-              u0 = _mm_unpacklo_epi8(u0, zero);
-
-              p0 = _mm_slli_epi16(p0, 1);
-              p0 = _mm_add_epi16(p0, u0);
-
-              t1 = _mm_cvtsi128_si32(p0);
-              p0 = _mm_srli_si128(p0, 4);
-              t0 = ((t0 + t1) >> 1) & 0xFF; t1 >>= 16;
-              p[1] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF;
-              t1 = _mm_cvtsi128_si32(p0);
-              p0 = _mm_srli_si128(p0, 4);
-              p[2] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF; t1 >>= 16;
-              p[3] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF;
-              t1 = _mm_cvtsi128_si32(p0);
-              p0 = _mm_srli_si128(p0, 4);
-              p[4] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF; t1 >>= 16;
-              p[5] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF;
-              t1 = _mm_cvtsi128_si32(p0);
-              p[6] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF; t1 >>= 16;
-              p[7] = static_cast<uint8_t>(t0);
-
-              t0 = ((t0 + t1) >> 1) & 0xFF;
-              p[8] = static_cast<uint8_t>(t0);
-
-              p += 8;
-              u += 8;
-              i -= 8;
-            }
-          }
-          // TODO: Not complete / Not working.
-          /*
-          else if (bpp == 2) {
-            // Process 16 BYTEs at a time.
-            // __m128i shf = _mm_setr_epi32(0x80000000, 0, 0, 0);
-            __m128i msk = _mm_set1_epi16(0x01FE);
-            __m128i t0 = _mm_unpacklo_epi8(
-              _mm_cvtsi32_si128(reinterpret_cast<uint16_t*>(p)[0]), zero);
-
-            __m128i scale = _mm_setr_epi32(0x00000000, 0x00000000, 0x00000000, 0x00000000);
-
-            // Sequental Approach:
-            //   y1' = byte{(256y1 + 128x1 + 128y0') / 256}
-            //   y2' = byte{(256y2 + 128x2 + 128y1') / 256}
-            //   y3' = byte{(256y3 + 128x3 + 128y2') / 256}
-            //   y4' = byte{(256y4 + 128x4 + 128y3') / 256}
-            //   y5' = ...
-            while (i >= 8) {
-              __m128i p0, p2, p3;
-
-              p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + 2));
-              p2 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
-
-              p0 = _mm_unpacklo_epi8(p0, zero);
-              p2 = _mm_unpacklo_epi8(p2, zero);
-
-              p0 = _mm_slli_epi16(p0, 1);
-              p0 = _mm_add_epi16(p0, p2);
-              p0 = _mm_add_epi16(p0, t0);
-              p0 = _mm_and_si128(p0, msk);
-
-              // P0/P2
-              p2 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 2, 3, 0));
-              p0 = _mm_slli_si128(p0, 12);
-              p2 = _mm_slli_epi16(p2, 1);
-
-              //p0 = _mm_srli_si128(p0, 8); // [Z Z 2 0]
-
-              //p2 = _mm_srli_epi64(p2, 32); // [Z 3 Z 1]
-              //p0 = _mm_srli_epi64(p0, 32); // [Z 2 Z 0]
-
-              p3 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 1, 1, 0));
-              p3 = _mm_srli_epi32(p3, 1);
-              p3 = _mm_and_si128(p3, msk);
-
-              p += 8;
-              u += 8;
-              i -= 8;
-            }
-          }
-          else if (bpp == 3) {
-          }
-          */
-          else if (bpp == 4) {
-            __m128i m00FF = _mm_set1_epi16(0x00FF);
-            __m128i m01FF = _mm_set1_epi16(0x01FF);
+    ::memcpy(p, src + 1, rowSize);
+    if (filter != kPngFilterNone)
+      span(p, u, filter, bpp, 0, rowSize);
+    convert(dst, p, w);
 
-            __m128i t1 = _mm_unpacklo_epi8(
-              _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]), zero);
+    u = p;
+    src += srcBpl;
+    dst += dstStride;
+  }
 
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              __m128i p0, p1;
-              __m128i u0, u1;
+  ::free(buffer);
+  return kOptDePngErrorOk;
+}
 
-              p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 4));
-              u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+// ============================================================================
+// [Implementation - Large]
+// ============================================================================
 
-              p1 = p0;                          // HI | Move Ln
-              p0 = _mm_unpacklo_epi8(p0, zero); // LO | Unpack Ln
+uint32_t OptDePngFilterToLarge(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  uint32_t err = OptDePngValidate(bpp, srcBpl);
+  uint32_t rowSize = srcBpl - 1;
 
-              u1 = u0;                          // HI | Move Up
-              p0 = _mm_slli_epi16(p0, 1);       // LO | << 1
+  if (err == kOptDePngErrorOk && h > 1 && static_cast<uintptr_t>(dstStride < 0 ? -dstStride : dstStride) < rowSize)
+    err = kOptDePngErrorInvalidGeometry;
 
-              u0 = _mm_unpacklo_epi8(u0, zero); // LO | Unpack Up
-              p0 = _mm_add_epi16(p0, t1);       // LO | Add Last
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
 
-              p1 = _mm_unpackhi_epi8(p1, zero); // HI | Unpack Ln
-              p0 = _mm_add_epi16(p0, u0);       // LO | Add Up
-              p0 = _mm_and_si128(p0, m01FF);    // LO | & 0x01FE
+  // Rows are unfiltered in two row buffers, the previous row is read from the
+  // buffer and not from the output written around the cache. Rows are aligned
+  // to 64 BYTEs (a cache line and the widest register).
+  uint32_t rowStride = (rowSize + 63) & ~63u;
 
-              u1 = _mm_unpackhi_epi8(u1, zero); // HI | Unpack Up
-              t1 = _mm_slli_si128(p0, 8);       // LO | Get Last
-              p0 = _mm_slli_epi16(p0, 1);       // LO | << 1
+  uint8_t* buffer = static_cast<uint8_t*>(::malloc(static_cast<size_t>(rowStride) * 2 + 64));
+  if (buffer == NULL)
+    return kOptDePngErrorOutOfMemory;
 
-              p1 = _mm_slli_epi16(p1, 1);       // HI | << 1
-              p0 = _mm_add_epi16(p0, t1);       // LO | Add Last
-              p0 = _mm_srli_epi16(p0, 2);       // LO | >> 2
+  uint8_t* rows[2];
+  rows[0] = buffer + OptAlignDiff(buffer, 64);
+  rows[1] = rows[0] + rowStride;
 
-              p1 = _mm_add_epi16(p1, u1);       // HI | Add Up
-              p0 = _mm_and_si128(p0, m00FF);    // LO | & 0x00FF
-              t1 = _mm_srli_si128(p0, 8);       // LO | Get Last
+  OptDePngSpanFunc span = OptDePngBest.span;
+  OptDePngCopyFunc loadRow = OptDePngBest.loadRow;
+  OptDePngCopyFunc storeRow = OptDePngBest.storeRow;
+  uint8_t* u = NULL;
 
-              p1 = _mm_add_epi16(p1, t1);       // HI | Add Last
-              p1 = _mm_and_si128(p1, m01FF);    // HI | & 0x01FE
+  for (uint32_t y = 0; y < h; y++) {
+    uint8_t* p = rows[y & 1];
+    uint32_t filter = src[0];
 
-              t1 = _mm_slli_si128(p1, 8);       // HI | Get Last
-              p1 = _mm_slli_epi16(p1, 1);       // HI | << 1
+    loadRow(p, src + 1, rowSize);
+    if (filter != kPngFilterNone)
+      span(p, u, filter, bpp, 0, rowSize);
+    storeRow(dst, p, rowSize);
 
-              t1 = _mm_add_epi16(t1, p1);       // HI | Add Last
-              t1 = _mm_srli_epi16(t1, 2);       // HI | >> 2
-              t1 = _mm_and_si128(t1, m00FF);    // HI | & 0x00FF
+    u = p;
+    src += srcBpl;
+    dst += dstStride;
+  }
 
-              p0 = _mm_packus_epi16(p0, t1);
-              t1 = _mm_srli_si128(t1, 8);       // HI | Get Last
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+  ::free(buffer);
+  return kOptDePngErrorOk;
+}
 
-              p += 16;
-              u += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 6) {
-            __m128i t1 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+// ============================================================================
+// [Implementation - Adam7]
+// ============================================================================
+
+struct OptDePngAdam7Pass {
+  uint8_t x0, y0, dx, dy;
+};
+
+static const OptDePngAdam7Pass OptDePngAdam7Data[7] = {
+  { 0, 0, 8, 8 },
+  { 4, 0, 8, 8 },
+  { 0, 4, 4, 8 },
+  { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 },
+  { 1, 0, 2, 2 },
+  { 0, 1, 1, 2 }
+};
+
+static OPT_INLINE uint32_t OptDePngAdam7Count(uint32_t size, uint32_t start, uint32_t step) {
+  return size > start ? (size - start + step - 1) / step : 0;
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngScatter_T(uint8_t* dst, const uint8_t* src, uint32_t n, uint32_t dx) {
+  size_t step = static_cast<size_t>(dx) * bpp;
 
-            // Process 16 BYTEs at a time.
-            while (i >= 16) {
-              __m128i p0, p1, p2;
-              __m128i u0, u1, u2;
+  for (uint32_t i = 0; i < n; i++, dst += step, src += bpp)
+    ::memcpy(dst, src, bpp);
+}
 
-              u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
-              t1 = _mm_unpacklo_epi8(t1, zero);
-              p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 6));
+static OPT_INLINE void OptDePngScatter(uint8_t* dst, const uint8_t* src, uint32_t n, uint32_t dx, uint32_t bpp) {
+  // The last pass has all pixels of its rows.
+  if (dx == 1) {
+    ::memcpy(dst, src, static_cast<size_t>(n) * bpp);
+    return;
+  }
 
-              p1 = _mm_srli_si128(p0, 6);       // P1 | Extract
-              u1 = _mm_srli_si128(u0, 6);       // P1 | Extract
+  switch (bpp) {
+    case 1: OptDePngScatter_T<1>(dst, src, n, dx); break;
+    case 2: OptDePngScatter_T<2>(dst, src, n, dx); break;
+    case 3: OptDePngScatter_T<3>(dst, src, n, dx); break;
+    case 4: OptDePngScatter_T<4>(dst, src, n, dx); break;
+    case 6: OptDePngScatter_T<6>(dst, src, n, dx); break;
+    case 8: OptDePngScatter_T<8>(dst, src, n, dx); break;
+
+    default: {
+      size_t step = static_cast<size_t>(dx) * bpp;
+      for (uint32_t i = 0; i < n; i++, dst += step, src += bpp)
+        ::memcpy(dst, src, bpp);
+      break;
+    }
+  }
+}
 
-              p2 = _mm_srli_si128(p0, 12);      // P2 | Extract
-              u2 = _mm_srli_si128(u0, 12);      // P2 | Extract
+size_t OptDePngAdam7GetSize(uint32_t w, uint32_t h, uint32_t bpp) {
+  size_t size = 0;
 
-              p0 = _mm_unpacklo_epi8(p0, zero); // P0 | Unpack
-              u0 = _mm_unpacklo_epi8(u0, zero); // P0 | Unpack
+  for (uint32_t i = 0; i < 7; i++) {
+    const OptDePngAdam7Pass& pass = OptDePngAdam7Data[i];
 
-              p1 = _mm_unpacklo_epi8(p1, zero); // P1 | Unpack
-              u1 = _mm_unpacklo_epi8(u1, zero); // P1 | Unpack
+    uint32_t pw = OptDePngAdam7Count(w, pass.x0, pass.dx);
+    uint32_t ph = OptDePngAdam7Count(h, pass.y0, pass.dy);
+
+    if (pw != 0)
+      size += (static_cast<size_t>(pw) * bpp + 1) * ph;
+  }
 
-              p2 = _mm_unpacklo_epi8(p2, zero); // P2 | Unpack
-              u2 = _mm_unpacklo_epi8(u2, zero); // P2 | Unpack
+  return size;
+}
 
-              u0 = _mm_add_epi16(u0, t1);       // P0 | Add Last
-              u0 = _mm_srli_epi16(u0, 1);       // P0 | >> 1
-              p0 = _mm_add_epi8(p0, u0);        // P0 | Add (Up+Last)/2
+uint32_t OptDePngFilterAdam7(uint8_t* dst, intptr_t dstStride, uint8_t* src, uint32_t w, uint32_t h, uint32_t bpp) {
+  if (bpp == 0)
+    return kOptDePngErrorInvalidGeometry;
 
-              u1 = _mm_add_epi16(u1, p0);       // P1 | Add P0
-              u1 = _mm_srli_epi16(u1, 1);       // P1 | >> 1
-              p1 = _mm_add_epi8(p1, u1);        // P1 | Add (Up+Last)/2
+  OptDePngSpanFunc span = OptDePngBest.span;
 
-              u2 = _mm_add_epi16(u2, p1);       // P2 | Add P1
-              u2 = _mm_srli_epi16(u2, 1);       // P2 | >> 1
-              p2 = _mm_add_epi8(p2, u2);        // P2 | Add (Up+Last)/2
+  for (uint32_t i = 0; i < 7; i++) {
+    const OptDePngAdam7Pass& pass = OptDePngAdam7Data[i];
 
-              p0 = _mm_slli_si128(p0, 4);
-              p0 = _mm_packus_epi16(p0, p1);
-              p0 = _mm_slli_si128(p0, 2);
-              p0 = _mm_srli_si128(p0, 4);
+    uint32_t pw = OptDePngAdam7Count(w, pass.x0, pass.dx);
+    uint32_t ph = OptDePngAdam7Count(h, pass.y0, pass.dy);
 
-              p2 = _mm_packus_epi16(p2, p2);
-              p2 = _mm_slli_si128(p2, 12);
-              p0 = _mm_or_si128(p0, p2);
+    if (pw == 0 || ph == 0)
+      continue;
 
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
-              t1 = _mm_srli_si128(p0, 10);
+    // Each pass is a separate image, its first row has no previous row.
+    uint32_t rowSize = pw * bpp;
+    uint8_t* u = NULL;
+    uint8_t* d = dst + static_cast<intptr_t>(pass.y0) * dstStride + static_cast<size_t>(pass.x0) * bpp;
 
-              p += 16;
-              u += 16;
-              i -= 16;
-            }
-          }
-          else if (bpp == 8) {
-            // Process 16 BYTEs at a time.
-            __m128i t1 = _mm_unpacklo_epi8(
-              _mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
-
-            while (i >= 16) {
-              __m128i p0, p1;
-              __m128i u0, u1;
-
-              u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
-              p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 8));
-
-              u1 = u0;                          // HI | Move Up
-              p1 = p0;                          // HI | Move Ln
-              u0 = _mm_unpacklo_epi8(u0, zero); // LO | Unpack Up
-              p0 = _mm_unpacklo_epi8(p0, zero); // LO | Unpack Ln
-
-              u0 = _mm_add_epi16(u0, t1);       // LO | Add Last
-              p1 = _mm_unpackhi_epi8(p1, zero); // HI | Unpack Ln
-              u0 = _mm_srli_epi16(u0, 1);       // LO | >> 1
-              u1 = _mm_unpackhi_epi8(u1, zero); // HI | Unpack Up
-
-              p0 = _mm_add_epi8(p0, u0);        // LO | Add (Up+Last)/2
-              u1 = _mm_add_epi16(u1, p0);       // HI | Add LO
-              u1 = _mm_srli_epi16(u1, 1);       // HI | >> 1
-              p1 = _mm_add_epi8(p1, u1);        // HI | Add (Up+LO)/2
-
-              p0 = _mm_packus_epi16(p0, p1);
-              t1 = p1;                          // HI | Get Last
-              _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
-
-              p += 16;
-              u += 16;
-              i -= 16;
-            }
-          }
-        }
+    for (uint32_t y = 0; y < ph; y++) {
+      uint32_t filter = *src++;
 
-        for (; i != 0; i--, p++, u++)
-          p[bpp] = Sum(p[bpp], Avg(p[0], u[0]));
+      if (filter != kPngFilterNone)
+        span(src, u, filter, bpp, 0, rowSize);
+      OptDePngScatter(d, src, pw, pass.dx, bpp);
 
-        p += bpp;
-        break;
-      }
+      u = src;
+      src += rowSize;
+      d += static_cast<intptr_t>(pass.dy) * dstStride;
+    }
+  }
 
-      // ----------------------------------------------------------------------
-      // [Paeth]
-      // ----------------------------------------------------------------------
+  return kOptDePngErrorOk;
+}
 
-      case kPngFilterPaeth: {
-        if (bpp == 1) {
-          // There is not much to optimize for 1BPP. The only thing this code
-          // does is to keep `p0` and `u0` values from the current iteration
-          // to the next one (they become `pz` and `uz`).
-          uint32_t pz = 0;
-          uint32_t uz = 0;
-          uint32_t u0;
-
-          for (i = 0; i < bpl; i++) {
-            u0 = u[i];
-            pz = (static_cast<uint32_t>(p[i]) + PaethOpt(pz, u0, uz)) & 0xFF;
-
-            p[i] = static_cast<uint8_t>(pz);
-            uz = u0;
-          }
+// ============================================================================
+// [Implementation - Blocked]
+//
+// Two rows of very wide images don't fit in L1 (or even L2), so the previous
+// row has already been evicted by the time the current row needs it. Blocked
+// filter splits the image into column bands and unfilters each band from the
+// top to the bottom by using the span function before it moves to the next
+// band, so the previous row is always read from the part of the band that has
+// just been unfiltered. The left neighbor of the first pixel of a band is the
+// last pixel of the previous band, which is unfiltered at that point.
+// ============================================================================
 
-          p += bpl;
-        }
-        else {
-          for (i = 0; i < bpp; i++)
-            p[i] = Sum(p[i], u[i]);
-
-          i = bpl - bpp;
-
-          if (i >= 32) {
-            // Align to 16-BYTE boundary.
-            uint32_t j = OptAlignDiff(p + bpp, 16);
-
-            __m128i zero = _mm_setzero_si128();
-            __m128i rcp3 = _mm_set1_epi16(0xAB << 7);
-
-            for (i -= j; j != 0; j--, p++, u++)
-              p[bpp] = Sum(p[bpp], PaethOpt(p[0], u[bpp], u[0]));
-
-            // TODO: Not complete.
-            /*
-            if (bpp == 2) {
-            }
-            */
-            if (bpp == 3) {
-              __m128i pz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0] & 0x00FFFFFFU), zero);
-              __m128i uz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(u)[0] & 0x00FFFFFFU), zero);
-              __m128i mask = _mm_setr_epi32(0xFFFFFFFF, 0x0000FFFF, 0x00000000, 0x00000000);
-
-              // Process 8 BYTEs at a time.
-              while (i >= 8) {
-                __m128i p0, p1;
-                __m128i u0, u1;
-
-                u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u + 3));
-                p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + 3));
-
-                u0 = _mm_unpacklo_epi8(u0, zero);
-                p0 = _mm_unpacklo_epi8(p0, zero);
-                u1 = _mm_srli_si128(u0, 6);
-
-                PNG_SSE_PAETH(uz, pz, u0, uz);
-                uz = _mm_and_si128(uz, mask);
-                p0 = _mm_add_epi8(p0, uz);
-
-                PNG_SSE_PAETH(uz, p0, u1, u0);
-                uz = _mm_and_si128(uz, mask);
-                uz = _mm_slli_si128(uz, 6);
-                p0 = _mm_add_epi8(p0, uz);
-
-                p1 = _mm_srli_si128(p0, 6);
-                u0 = _mm_srli_si128(u1, 6);
-
-                PNG_SSE_PAETH(u0, p1, u0, u1);
-                u0 = _mm_slli_si128(u0, 12);
-
-                p0 = _mm_add_epi8(p0, u0);
-                pz = _mm_srli_si128(p0, 10);
-                uz = _mm_srli_si128(u1, 4);
-
-                p0 = _mm_packus_epi16(p0, p0);
-                _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 3), p0);
-
-                p += 8;
-                u += 8;
-                i -= 8;
-              }
-            }
-            else if (bpp == 4) {
-              __m128i pz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]), zero);
-              __m128i uz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(u)[0]), zero);
-              __m128i mask = _mm_setr_epi32(0xFFFFFFFF, 0xFFFFFFFF, 0, 0);
-
-              // Process 16 BYTEs at a time.
-              while (i >= 16) {
-                __m128i p0, p1;
-                __m128i u0, u1;
-
-                p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 4));
-                u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 4));
-
-                p1 = _mm_unpackhi_epi8(p0, zero);
-                p0 = _mm_unpacklo_epi8(p0, zero);
-                u1 = _mm_unpackhi_epi8(u0, zero);
-                u0 = _mm_unpacklo_epi8(u0, zero);
-
-                PNG_SSE_PAETH(uz, pz, u0, uz);
-                uz = _mm_and_si128(uz, mask);
-                p0 = _mm_add_epi8(p0, uz);
-                uz = _mm_shuffle_epi32(u0, _MM_SHUFFLE(1, 0, 3, 2));
-
-                PNG_SSE_PAETH(u0, p0, uz, u0);
-                u0 = _mm_slli_si128(u0, 8);
-                p0 = _mm_add_epi8(p0, u0);
-                pz = _mm_srli_si128(p0, 8);
-
-                PNG_SSE_PAETH(uz, pz, u1, uz);
-                uz = _mm_and_si128(uz, mask);
-                p1 = _mm_add_epi8(p1, uz);
-                uz = _mm_shuffle_epi32(u1, _MM_SHUFFLE(1, 0, 3, 2));
-
-                PNG_SSE_PAETH(u1, p1, uz, u1);
-                u1 = _mm_slli_si128(u1, 8);
-                p1 = _mm_add_epi8(p1, u1);
-                pz = _mm_srli_si128(p1, 8);
-
-                p0 = _mm_packus_epi16(p0, p1);
-                _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
-
-                p += 16;
-                u += 16;
-                i -= 16;
-              }
-            }
-            else if (bpp == 6) {
-              __m128i pz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
-              __m128i uz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u)), zero);
-              __m128i mask = _mm_setr_epi32(0, 0xFFFFFFFF, 0, 0);
-
-              // Process 16 BYTEs at a time.
-              while (i >= 16) {
-                __m128i p0, p1, p2;
-                __m128i u0, u1, u2;
-
-                p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 6));
-                u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 6));
-
-                p1 = _mm_srli_si128(p0, 6);
-                p0 = _mm_unpacklo_epi8(p0, zero);
-                u1 = _mm_srli_si128(u0, 6);
-                u0 = _mm_unpacklo_epi8(u0, zero);
-
-                PNG_SSE_PAETH(uz, pz, u0, uz);
-                p0 = _mm_add_epi8(p0, uz);
-                p2 = _mm_srli_si128(p1, 6);
-                u2 = _mm_srli_si128(u1, 6);
-                p1 = _mm_unpacklo_epi8(p1, zero);
-                u1 = _mm_unpacklo_epi8(u1, zero);
-
-                PNG_SSE_PAETH(u0, p0, u1, u0);
-                p1 = _mm_add_epi8(p1, u0);
-                p2 = _mm_unpacklo_epi8(p2, zero);
-                u2 = _mm_unpacklo_epi8(u2, zero);
-
-                PNG_SSE_PAETH(u0, p1, u2, u1);
-                p2 = _mm_add_epi8(p2, u0);
-
-                p0 = _mm_slli_si128(p0, 4);
-                p0 = _mm_packus_epi16(p0, p1);
-                p0 = _mm_slli_si128(p0, 2);
-                p0 = _mm_srli_si128(p0, 4);
-
-                p2 = _mm_shuffle_epi32(p2, _MM_SHUFFLE(1, 0, 1, 0));
-                u2 = _mm_shuffle_epi32(u2, _MM_SHUFFLE(1, 0, 1, 0));
-
-                pz = _mm_shuffle_epi32(_mm_unpackhi_epi32(p1, p2), _MM_SHUFFLE(3, 3, 1, 0));
-                uz = _mm_shuffle_epi32(_mm_unpackhi_epi32(u1, u2), _MM_SHUFFLE(3, 3, 1, 0));
-
-                p2 = _mm_packus_epi16(p2, p2);
-                p2 = _mm_slli_si128(p2, 12);
-
-                p0 = _mm_or_si128(p0, p2);
-                _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
-
-                p += 16;
-                u += 16;
-                i -= 16;
-              }
-            }
-            else if (bpp == 8) {
-              __m128i pz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
-              __m128i uz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u)), zero);
-
-              // Process 16 BYTEs at a time.
-              while (i >= 16) {
-                __m128i p0, p1;
-                __m128i u0, u1;
-
-                p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 8));
-                u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 8));
-
-                p1 = _mm_unpackhi_epi8(p0, zero);
-                p0 = _mm_unpacklo_epi8(p0, zero);
-                u1 = _mm_unpackhi_epi8(u0, zero);
-                u0 = _mm_unpacklo_epi8(u0, zero);
-
-                PNG_SSE_PAETH(uz, pz, u0, uz);
-                p0 = _mm_add_epi8(p0, uz);
-
-                PNG_SSE_PAETH(pz, p0, u1, u0);
-                pz = _mm_add_epi8(pz, p1);
-                uz = u1;
-
-                p0 = _mm_packus_epi16(p0, pz);
-                _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
-
-                p += 16;
-                u += 16;
-                i -= 16;
-              }
-            }
-          }
+// Minimum and maximum width of a band, in BYTEs.
+static const uint32_t kOptDePngBlockedMinBand = 4 * 1024;
+static const uint32_t kOptDePngBlockedMaxBand = 64 * 1024;
+
+// Two rows of a band take a half of L1, the rest is left for the hardware
+// prefetcher, which fetches the following rows of the band in the meantime.
+static uint32_t OptDePngBlockedSelectBand() {
+  uint32_t l1 = OptCpu::getCacheSize(1);
+  if (l1 == 0)
+    l1 = 32 * 1024;
+  return Min(Max(l1 / 4, kOptDePngBlockedMinBand), kOptDePngBlockedMaxBand);
+}
 
-          for (; i != 0; i--, p++, u++)
-            p[bpp] = Sum(p[bpp], PaethOpt(p[0], u[bpp], u[0]));
+static const uint32_t OptDePngBlockedBand = OptDePngBlockedSelectBand();
 
-          p += bpp;
+uint32_t OptDePngFilterBlocked(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t bandSize) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  uint32_t rowSize = bpl - 1;
+  if (bandSize == 0)
+    bandSize = OptDePngBlockedBand;
+
+  // Band boundaries must be a multiple of `bpp`.
+  bandSize = Max<uint32_t>(bandSize - bandSize % bpp, bpp);
+  if (bandSize >= rowSize || h == 1)
+    return OptDePngBest.filter(p, h, bpp, bpl);
+
+  OptDePngSpanFunc span = OptDePngBest.span;
+  for (uint32_t x0 = 0; x0 < rowSize; x0 += bandSize) {
+    uint32_t x1 = Min(x0 + bandSize, rowSize);
+
+    uint8_t* row = p + 1;
+    uint8_t* u = NULL;
+
+    for (uint32_t y = 0; y < h; y++) {
+      uint32_t filter = row[-1];
+      if (filter != kPngFilterNone)
+        span(row, u, filter, bpp, x0, x1);
+
+      u = row;
+      row += bpl;
+    }
+  }
+
+  return kOptDePngErrorOk;
+}
+
+// ============================================================================
+// [Implementation - Parallel]
+//
+// Rows that use None or Sub filter don't depend on the previous row, so the
+// image can be split into bands that start at such rows. If there are not
+// enough of them, each row is split into column tiles, one per thread. Tile
+// `t` of row `y` depends only on tile `t - 1` of row `y` (Sub, Avg, Paeth)
+// and tile `t` of row `y - 1` (processed by the same thread), so all threads
+// run down the image at the same time, as a diagonal wavefront:
+//
+//     +-------+-------+-------+-------+
+//     | T0:Y2 | T1:Y1 | T2:Y0 |       |
+//     +-------+-------+-------+-------+
+//     | T0:Y3 | T1:Y2 | T2:Y1 | T3:Y0 |
+//     +-------+-------+-------+-------+
+// ============================================================================
+
+// Images smaller than that are unfiltered by the calling thread.
+static const uint32_t kOptDePngParallelMinSize = 128 * 1024;
+// Minimum width of a column tile, in BYTEs.
+static const uint32_t kOptDePngParallelMinTile = 1024;
+// Maximum number of bands or tiles.
+static const uint32_t kOptDePngParallelMaxTasks = 64;
+// Number of bands per thread to balance the work (bands differ in height).
+static const uint32_t kOptDePngParallelBandsPerThread = 4;
+
+struct OptDePngBandData {
+  uint8_t* p;
+  uint32_t bpp;
+  uint32_t bpl;
+  OptDePngFilterFunc filter;
+  uint32_t y[kOptDePngParallelMaxTasks + 1];
+};
+
+// Each counter has its own cache line as it's written by a different thread.
+struct OPT_ALIGN(64) OptDePngTileProgress {
+  volatile uint32_t rows;
+  uint8_t reserved[64 - sizeof(uint32_t)];
+};
+
+struct OptDePngTileData {
+  uint8_t* p;
+  uint32_t h;
+  uint32_t bpp;
+  uint32_t bpl;
+  OptDePngSpanFunc span;
+  uint32_t x[kOptDePngParallelMaxTasks + 1];
+  OptDePngTileProgress progress[kOptDePngParallelMaxTasks];
+};
+
+static void OptDePngBandTask(void* data, uint32_t index) {
+  OptDePngBandData* d = static_cast<OptDePngBandData*>(data);
+
+  uint32_t y0 = d->y[index];
+  uint32_t y1 = d->y[index + 1];
+
+  d->filter(d->p + static_cast<size_t>(y0) * d->bpl, y1 - y0, d->bpp, d->bpl);
+}
+
+static void OptDePngTileTask(void* data, uint32_t index) {
+  OptDePngTileData* d = static_cast<OptDePngTileData*>(data);
+
+  uint32_t x0 = d->x[index];
+  uint32_t x1 = d->x[index + 1];
+
+  volatile uint32_t* done = &d->progress[index].rows;
+  volatile uint32_t* left = index > 0 ? &d->progress[index - 1].rows : NULL;
+
+  uint8_t* p = d->p + 1;
+  uint8_t* u = NULL;
+
+  for (uint32_t y = 0; y < d->h; y++) {
+    uint32_t filter = p[-1];
+
+    if (filter != kPngFilterNone) {
+      // Wait for the left tile, `Up` is the only filter that doesn't need it.
+      if (left != NULL && filter != kPngFilterUp) {
+        uint32_t spins = 0;
+        while (OptAtomicLoad(left) <= y) {
+          if (++spins < 64)
+            OptPause();
+          else
+            OptYield();
         }
-        break;
       }
+
+      d->span(p, u, filter, d->bpp, x0, x1);
     }
 
-    u = p - bpl;
-  } while (--y != 0);
+    OptAtomicStore(done, y + 1);
+
+    u = p;
+    p += d->bpl;
+  }
 }
 
-void OptDePngFilterSSE2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
-  switch (bpp) {
-    case 1: OptDePngFilterSSE2_T<1>(p, h, bpl); break;
-    case 2: OptDePngFilterSSE2_T<2>(p, h, bpl); break;
-    case 3: OptDePngFilterSSE2_T<3>(p, h, bpl); break;
-    case 4: OptDePngFilterSSE2_T<4>(p, h, bpl); break;
-    case 6: OptDePngFilterSSE2_T<6>(p, h, bpl); break;
-    case 8: OptDePngFilterSSE2_T<8>(p, h, bpl); break;
+uint32_t OptDePngFilterParallel(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, OptThreadPool* threadPool) {
+  uint32_t threadCount = threadPool ? threadPool->getThreadCount() : 1;
+
+  if (threadCount <= 1 || static_cast<uint64_t>(h) * bpl < kOptDePngParallelMinSize)
+    return OptDePngFilter(p, h, bpp, bpl);
+
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  // Try to split the image into bands first.
+  {
+    OptDePngBandData d;
+    d.p = p;
+    d.bpp = bpp;
+    d.bpl = bpl;
+    d.filter = OptDePngBest.filter;
+
+    uint32_t bandCount = Min(threadCount * kOptDePngParallelBandsPerThread, kOptDePngParallelMaxTasks);
+    uint32_t n = 0;
+    uint32_t next = h / bandCount;
+    uint32_t maxBand = 0;
+
+    d.y[0] = 0;
+    for (uint32_t y = 1; y < h && n + 1 < bandCount; y++) {
+      uint32_t filter = p[static_cast<size_t>(y) * bpl];
+      if (y < next || (filter != kPngFilterNone && filter != kPngFilterSub))
+        continue;
+
+      maxBand = Max(maxBand, y - d.y[n]);
+      d.y[++n] = y;
+      next = static_cast<uint32_t>((static_cast<uint64_t>(n + 1) * h) / bandCount);
+    }
+
+    maxBand = Max(maxBand, h - d.y[n]);
+    d.y[++n] = h;
+
+    // Only use bands if none of them is much bigger than the work per thread.
+    if (n >= threadCount && maxBand <= (h * 2) / threadCount) {
+      threadPool->run(OptDePngBandTask, &d, n);
+      return kOptDePngErrorOk;
+    }
+  }
+
+  // Split the rows into tiles and run them as a wavefront.
+  uint32_t rowSize = bpl - 1;
+  uint32_t tileCount = Min(Min(threadCount, rowSize / kOptDePngParallelMinTile), kOptDePngParallelMaxTasks);
+
+  if (tileCount <= 1)
+    return OptDePngFilter(p, h, bpp, bpl);
+
+  OptDePngTileData tiles;
+
+  tiles.p = p;
+  tiles.h = h;
+  tiles.bpp = bpp;
+  tiles.bpl = bpl;
+  tiles.span = OptDePngBest.span;
+
+  // Tile boundaries must be a multiple of `bpp`.
+  uint32_t pixelCount = rowSize / bpp;
+  for (uint32_t t = 0; t < tileCount; t++) {
+    tiles.x[t] = static_cast<uint32_t>((static_cast<uint64_t>(t) * pixelCount) / tileCount) * bpp;
+    tiles.progress[t].rows = 0;
   }
+  tiles.x[tileCount] = rowSize;
+
+  threadPool->run(OptDePngTileTask, &tiles, tileCount);
+  return kOptDePngErrorOk;
 }
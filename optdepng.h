@@ -8,8 +8,11 @@
 #ifndef _OPTDEPNG_H
 #define _OPTDEPNG_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+class OptThreadPool;
+
 enum PngFilterType {
   kPngFilterNone  = 0,
   kPngFilterSub   = 1,
@@ -19,11 +22,302 @@ enum PngFilterType {
   kPngFilterCount = 5
 };
 
-typedef void (*OptDePngFilterFunc)(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+enum OptDePngError {
+  kOptDePngErrorOk = 0,
+  // Invalid `bpp` or `bpl`, a row must contain at least one pixel and its size
+  // (without the filter ID) must be a multiple of `bpp`.
+  kOptDePngErrorInvalidGeometry = 1,
+  // Unsupported combination of source `bpp` and destination pixel format.
+  kOptDePngErrorInvalidFormat = 2,
+  // Memory allocation of a temporary buffer failed.
+  kOptDePngErrorOutOfMemory = 3,
+  // A row uses a filter ID that is not one of `PngFilterType` (see
+  // `OptDePngFilterChecked()`).
+  kOptDePngErrorInvalidFilter = 4,
+  // A file can't be opened, created, or mapped (see `OptDePngFilterFile()`).
+  kOptDePngErrorFile = 5
+};
+
+// Destination pixel formats of `OptDePngFilterConvert()`.
+enum OptDePngFormat {
+  // 32-bit BGRA (B at the lowest address), alpha is not premultiplied.
+  kOptDePngFormatBGRA32 = 0,
+  // 32-bit premultiplied ARGB (0xAARRGGBB), stored as BGRA in memory.
+  kOptDePngFormatPRGB32 = 1,
+  kOptDePngFormatCount = 2
+};
+
+// Get `bpp` used by filters from PNG's bit depth and the number of channels.
+// Pixels smaller than a BYTE (1/2/4-bit grayscale or palette) use `bpp` of 1.
+static inline uint32_t OptDePngBppFromFormat(uint32_t bitDepth, uint32_t channels) {
+  uint32_t bits = bitDepth * channels;
+  return bits < 8 ? 1 : (bits + 7) / 8;
+}
+
+// All filter functions return `OptDePngError`. Any `bpp` is supported, the
+// SIMD implementations use generic (non-specialized) kernels if `bpp` is not
+// one of 1, 2, 3, 4, 6 and 8 (the values PNG specification uses).
+typedef uint32_t (*OptDePngFilterFunc)(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+typedef void (*OptDePngSpanFunc)(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+
+// ISA specific implementations are only defined if the library was built with
+// them (`OPT_BUILD_SSE2`, `OPT_BUILD_AVX2`, ...) and must only be called when
+// the CPU supports them. Embedders should call `OptDePngFilter()` instead.
+
+uint32_t OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterOpt(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterSSE2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterSSSE3(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterAVX2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterAVX512(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterNEON(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+
+// Out-of-place reverse filter that unfilters `src` into compact rows in `dst`
+// (without filter IDs), `src` is not modified. `dstStride` must be at least
+// the size of a row, `dst` and `dstStride` should be aligned to 32 BYTEs (see
+// `OptDePngGetAlignedStride()`) so SIMD code runs on aligned rows.
+typedef uint32_t (*OptDePngFilterToFunc)(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+
+// Get a stride of a `w` x `bpp` row aligned to 32 BYTEs.
+static inline intptr_t OptDePngGetAlignedStride(uint32_t w, uint32_t bpp) {
+  return static_cast<intptr_t>((static_cast<size_t>(w) * bpp + 31) & ~static_cast<size_t>(31));
+}
+
+uint32_t OptDePngFilterOptTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+uint32_t OptDePngFilterSSE2To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+uint32_t OptDePngFilterSSSE3To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+uint32_t OptDePngFilterAVX2To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+uint32_t OptDePngFilterAVX512To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+uint32_t OptDePngFilterNEONTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+
+// Reverse filter that uses the best implementation the host CPU supports. The
+// implementation is selected only once (at startup) by using CPUID.
+uint32_t OptDePngFilter(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+
+// Out-of-place version of `OptDePngFilter()`, see `OptDePngFilterToFunc`.
+uint32_t OptDePngFilterTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+
+// Get the implementation used by `OptDePngFilter()`.
+OptDePngFilterFunc OptDePngFilterGetBest();
+
+// Forward filter (the encoder side) that filters compact rows in `src` into
+// `dst` in the layout reverse filters use, rows of `bpl` BYTEs prefixed by the
+// filter ID. `filter` is either a `PngFilterType` used by all rows, or
+// `kOptDePngForwardAdaptive` that tries all five filters on each row and keeps
+// the one with the minimum sum of absolute differences (BYTEs taken as signed),
+// the heuristic libpng uses.
+enum OptDePngForwardMode {
+  kOptDePngForwardAdaptive = 5
+};
+
+typedef uint32_t (*OptDePngForwardFunc)(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter);
+
+uint32_t OptDePngForwardRef(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter);
+uint32_t OptDePngForwardSSE2(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter);
+
+// Forward filter that uses the best implementation the host CPU supports.
+uint32_t OptDePngForward(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter);
+
+// Scan filter IDs of `h` rows and return `kOptDePngErrorInvalidFilter` if any
+// of them is invalid. `badRow` (if not NULL) receives the index of the first
+// invalid row, or `h` if all rows are valid.
+uint32_t OptDePngValidateFilters(const uint8_t* p, uint32_t h, uint32_t bpl, uint32_t* badRow);
+
+// Same as `OptDePngFilter()`, but validates filter IDs first, which is meant
+// for untrusted images. Filters don't check filter IDs, a row that has an
+// invalid one is left as is. If a row is invalid only rows above it are
+// unfiltered, `badRow` (if not NULL) receives the index of the first row that
+// was not unfiltered - `h` on success and `0` if the geometry is invalid.
+uint32_t OptDePngFilterChecked(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t* badRow);
+
+// CRC32C (Castagnoli polynomial, as used by iSCSI and SSE4.2) of `size` BYTEs.
+// `crc` is the CRC32C of the preceding data (zero at the start), so the same
+// as zlib's `crc32()` the checksum can be calculated in parts. All versions
+// return the same value.
+typedef uint32_t (*OptDePngCrc32cFunc)(uint32_t crc, const uint8_t* data, size_t size);
+
+uint32_t OptDePngCrc32cOpt(uint32_t crc, const uint8_t* data, size_t size);
+uint32_t OptDePngCrc32cSSE42(uint32_t crc, const uint8_t* data, size_t size);
+
+// CRC32C that uses the best implementation the host CPU supports.
+uint32_t OptDePngCrc32c(uint32_t crc, const uint8_t* data, size_t size);
+
+// Same as `OptDePngFilter()`, but also calculates CRC32C of the unfiltered
+// image without filter IDs (the compact rows `OptDePngFilterTo()` produces),
+// which `crc` receives. Each row is checksummed right after it's unfiltered,
+// while it's still in L1 cache, so there is no second pass over the image.
+uint32_t OptDePngFilterChecksum(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t* crc);
+
+// Image unfiltered by `OptDePngFilterBatch()`, `error` is set by the call.
+struct OptDePngBatchItem {
+  uint8_t* p;
+  uint32_t h;
+  uint32_t bpp;
+  uint32_t bpl;
+  uint32_t error;
+};
+
+// Unfilter `count` images in one call, meant for many small images (icons,
+// thumbnails, sprites), which spend more time in the per-call dispatch and in
+// the scalar prologues and tails of SIMD kernels than in filtering. Images are
+// grouped by `bpp` and images with short rows are unfiltered by kernels tuned
+// for them. Images must not overlap. Returns the first error, an image that
+// has an invalid geometry is skipped and doesn't affect other images.
+uint32_t OptDePngFilterBatch(OptDePngBatchItem* items, size_t count);
 
-void OptDePngFilterRef(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
-void OptDePngFilterOpt(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
-void OptDePngFilterSSE2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl);
+// Unfilter a file of raw filtered rows (inflated IDAT data of `bpl` BYTEs per
+// row) without reading it into memory, the file is mapped instead. The height
+// is given by the file size, which must be a multiple of `bpl`. If `dstPath` is
+// NULL the file is unfiltered in place, otherwise `dstPath` is created with the
+// compact rows (without filter IDs) and `srcPath` is not modified. A non-zero
+// `chunkSize` unfilters the file in chunks of that many BYTEs (rounded to whole
+// rows), each read ahead and released when done, so only a few chunks of a file
+// larger than the memory are resident at a time.
+uint32_t OptDePngFilterFile(const char* dstPath, const char* srcPath, uint32_t bpp, uint32_t bpl, size_t chunkSize);
+
+// Multi-threaded reverse filter, the output is the same as `OptDePngFilter()`.
+// Rows that don't depend on the previous row are used to split the image into
+// independent bands, otherwise rows are split into column tiles processed as a
+// wavefront. Small images and a NULL `threadPool` use the calling thread only.
+uint32_t OptDePngFilterParallel(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, OptThreadPool* threadPool);
+
+// Out-of-place reverse filter for images much larger than the last level cache,
+// the output is the same as `OptDePngFilterTo()`. Each row is unfiltered in a
+// row buffer that stays in L1 while the source is prefetched, and then written
+// to `dst` by non-temporal stores that bypass the cache. `OptDePngFilterTo()`
+// uses it automatically when the output is larger than a half of the last
+// level cache. In-place filtering has no such mode, as the output is read back
+// when the next row is unfiltered.
+uint32_t OptDePngFilterToLarge(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+
+// Cache blocked reverse filter for very wide images, the output is the same as
+// `OptDePngFilter()`. The image is unfiltered in column bands of `bandSize`
+// BYTEs (rounded down to a multiple of `bpp`), each from the top to the bottom,
+// so the part of the previous row that is needed stays in L1. Zero `bandSize`
+// selects the width from the size of L1 cache.
+uint32_t OptDePngFilterBlocked(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t bandSize);
+
+// Reverse filter of a padded layout, which an inflater can produce for free and
+// in which SIMD kernels run on aligned registers without scalar prologues and
+// tails. Rows of `bpl` BYTEs (including the filter ID) start at `p + y * stride`
+// and the following requirements must be met, otherwise the function returns
+// `kOptDePngErrorInvalidGeometry`:
+//
+//   - The first BYTE after the filter ID (`p + 1`) is aligned to 16 BYTEs.
+//   - `stride` is a multiple of 16 and at least `OptDePngGetPaddedStride(bpl)`
+//     (a multiple of 32 works as well).
+//
+// BYTEs between the end of a row and the filter ID of the next row are slack,
+// which is read and overwritten by garbage. The output is otherwise the same
+// as `OptDePngFilter()` of the same rows.
+typedef uint32_t (*OptDePngFilterPaddedFunc)(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl);
+
+// Get the minimum stride of the padded layout, the row size rounded up to 16
+// BYTEs plus 16 BYTEs that hold the filter ID of the next row.
+static inline intptr_t OptDePngGetPaddedStride(uint32_t bpl) {
+  return static_cast<intptr_t>(((static_cast<size_t>(bpl) + 14) & ~static_cast<size_t>(15)) + 16);
+}
+
+uint32_t OptDePngFilterPaddedOpt(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl);
+uint32_t OptDePngFilterPaddedSSE2(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl);
+
+// Padded reverse filter that uses the best implementation the host CPU has.
+uint32_t OptDePngFilterPadded(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl);
+
+// Get the size of Adam7 interlaced image data in BYTEs, which includes filter
+// IDs of all rows of all seven passes (empty passes have no rows).
+size_t OptDePngAdam7GetSize(uint32_t w, uint32_t h, uint32_t bpp);
+
+// Unfilter Adam7 interlaced image data `src` in place and write each pixel to
+// its final position in `dst`, which is a `w` x `h` image that has `dstStride`
+// BYTEs per row (no filter IDs). Each row is de-interlaced right after it has
+// been unfiltered, while it's still in cache, so no extra pass over the image
+// is needed. Only BYTE aligned pixels (bit depth 8 and 16) are supported.
+uint32_t OptDePngFilterAdam7(uint8_t* dst, intptr_t dstStride, uint8_t* src, uint32_t w, uint32_t h, uint32_t bpp);
+
+// Unfilter `src` and convert it to `dstFormat` in one pass, `src` is not
+// modified. Each row is unfiltered in a temporary buffer of two rows that stays
+// in L1 cache and converted right away. Source pixels are 8-bit samples and
+// their format is given by `bpp` - 1 (Gray), 2 (Gray+Alpha), 3 (RGB), and 4
+// (RGBA). Pixels that have no alpha are stored as opaque in both formats.
+uint32_t OptDePngFilterConvert(uint8_t* dst, intptr_t dstStride, uint32_t dstFormat, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl);
+
+// ============================================================================
+// [Profiling]
+//
+// Instrumented build of the SSE2 filter, only available if the library has
+// been compiled with `OPT_DEPNG_PROFILE` (CMake option `OPTDEPNG_PROFILE`).
+// It's compiled out by default, as the counters slow down all kernels.
+// ============================================================================
+
+#if defined(OPT_DEPNG_PROFILE)
+// Counters indexed by the filter that was used to unfilter a row (the first
+// row is counted as `None`, `Sub` or `Avg`, see `OptDePngFirstRowFilter()`).
+// `bytes` is the number of BYTEs a filter had to unfilter, which were handled
+// either by SIMD loops or by scalar code (prologues, tails and filters that
+// have no SIMD kernel for the given `bpp`), `cycles` are measured by RDTSC.
+struct OptDePngStats {
+  uint64_t rows[kPngFilterCount];
+  uint64_t bytes[kPngFilterCount];
+  uint64_t simdBytes[kPngFilterCount];
+  uint64_t scalarBytes[kPngFilterCount];
+  uint64_t cycles[kPngFilterCount];
+};
+
+static inline void OptDePngStatsReset(OptDePngStats* stats) {
+  for (uint32_t i = 0; i < kPngFilterCount; i++) {
+    stats->rows[i] = 0;
+    stats->bytes[i] = 0;
+    stats->simdBytes[i] = 0;
+    stats->scalarBytes[i] = 0;
+    stats->cycles[i] = 0;
+  }
+}
+
+// Same as `OptDePngFilterSSE2()`, but adds its counters to `stats`. It's not
+// reentrant, only one image can be profiled at a time.
+uint32_t OptDePngFilterSSE2Profile(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, OptDePngStats* stats);
+#endif // OPT_DEPNG_PROFILE
+
+// ============================================================================
+// [OptDePngStream]
+//
+// Streaming reverse filter that unfilters one row at a time, so it can be used
+// directly by an inflate loop while the row that was just inflated is still in
+// L1 cache. Rows are unfiltered in place and never copied, the stream only
+// remembers the last row fed, which must stay valid and unchanged until the
+// next row is fed. Two row buffers used alternately are enough to decode the
+// whole image.
+// ============================================================================
+
+class OptDePngStream {
+public:
+  OptDePngStream();
+
+  //! Initialize the stream for rows of `bpl` BYTEs (including the filter ID),
+  //! returns `kOptDePngErrorInvalidGeometry` if `bpp` and `bpl` are invalid.
+  uint32_t init(uint32_t bpp, uint32_t bpl);
+  //! Forget the previous row, the next row fed is handled as the first one.
+  void reset();
+
+  //! Unfilter the next `row` in place, `row` points to its filter ID.
+  void feedRow(uint8_t* row);
+
+  //! Get the last row fed (points to its filter ID), NULL if there is none.
+  uint8_t* prevRow() const { return _prev; }
+  //! Get the number of rows fed since `init()` or `reset()`.
+  uint32_t getRowCount() const { return _rowCount; }
+
+  // --------------------------------------------------------------------------
+  // [Members]
+  // --------------------------------------------------------------------------
+
+  OptDePngSpanFunc _span;
+  uint8_t* _prev;
+  uint32_t _bpp;
+  uint32_t _bpl;
+  uint32_t _rowCount;
+};
 
 // [Guard]
 #endif // _OPTDEPNG_H
@@ -0,0 +1,342 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_SSE2
+#define USE_SSSE3
+#define USE_AVX2
+
+#include "./optdepng_p.h"
+#include "./optdepng_sse2_p.h"
+
+// ============================================================================
+// [Implementation - AVX2 Optimized]
+//
+// AVX2 implementation provides 256-bit Sub and Up kernels. Avg and Paeth have
+// a sequential dependency on the previous pixel, which is already the only
+// bottleneck of the 128-bit kernels. The 256-bit registers don't help there as
+// there is no cheap way of moving a pixel across 128-bit lanes, so these are
+// the SSE2/SSSE3 kernels compiled as VEX encoded (non-destructive) code.
+// ============================================================================
+
+#define PNG_AVX2_SLL_ADDB_1X(P0, T0, Shift) \
+  do { \
+    T0 = _mm256_slli_si256(P0, Shift); \
+    P0 = _mm256_add_epi8(P0, T0); \
+  } while (0)
+
+// Index of the BYTE that carries into BYTE `k` of the next 16 BYTEs, relative
+// to the beginning of the previous 16 BYTEs. Used to build PSHUFB predicates.
+#define PNG_AVX2_SUB_INDEX(k) static_cast<char>(16 - bpp + ((k) % bpp))
+
+// ----------------------------------------------------------------------------
+// [Sub]
+// ----------------------------------------------------------------------------
+
+// AVX2 version of the Sub filter. The SSE2 implementation propagates the last
+// pixel by adding it to the first cell before the prefix-sum is calculated,
+// which means that the whole prefix-sum is on the critical path. This version
+// calculates the prefix-sum of each 32 BYTEs independently and only adds the
+// last pixel of the previous 32 BYTEs broadcasted into all cells, so the only
+// sequential work per 32 BYTEs is VPERM2I128, VPSHUFB, and VPADDB:
+//
+//   1. VPSLLDQ and VPADDB calculate a prefix-sum of each 128-bit lane.
+//   2. The last pixel of the low lane is broadcasted (in the right phase, as
+//      16 is not divisible by 3 and 6) into the high lane and added to it.
+//   3. The last pixel of the previous 32 BYTEs is broadcasted (also in the
+//      right phase) into both lanes and added to the result.
+template<uint32_t bpp>
+static OPT_INLINE __m256i OptDePngSubSumAVX2_T(__m256i p0, __m256i fix) {
+  __m256i t0;
+
+  PNG_AVX2_SLL_ADDB_1X(p0, t0, bpp);
+  if (bpp * 2 < 16) PNG_AVX2_SLL_ADDB_1X(p0, t0, bpp * 2);
+  if (bpp * 4 < 16) PNG_AVX2_SLL_ADDB_1X(p0, t0, bpp * 4);
+  if (bpp * 8 < 16) PNG_AVX2_SLL_ADDB_1X(p0, t0, bpp * 8);
+
+  t0 = _mm256_permute2x128_si256(p0, p0, 0x08);
+  t0 = _mm256_shuffle_epi8(t0, fix);
+  return _mm256_add_epi8(p0, t0);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubAVX2_T(uint8_t* p, uint32_t bpl) {
+  uint32_t i = bpl - bpp;
+
+  if (i >= 64) {
+    // Align to 32-BYTE boundary.
+    uint32_t j = OptAlignDiff(p + bpp, 32);
+    for (i -= j; j != 0; j--, p++)
+      p[bpp] = Sum(p[bpp], p[0]);
+
+    __m256i fix = _mm256_setr_epi8(
+      PNG_AVX2_SUB_INDEX( 0), PNG_AVX2_SUB_INDEX( 1), PNG_AVX2_SUB_INDEX( 2), PNG_AVX2_SUB_INDEX( 3),
+      PNG_AVX2_SUB_INDEX( 4), PNG_AVX2_SUB_INDEX( 5), PNG_AVX2_SUB_INDEX( 6), PNG_AVX2_SUB_INDEX( 7),
+      PNG_AVX2_SUB_INDEX( 8), PNG_AVX2_SUB_INDEX( 9), PNG_AVX2_SUB_INDEX(10), PNG_AVX2_SUB_INDEX(11),
+      PNG_AVX2_SUB_INDEX(12), PNG_AVX2_SUB_INDEX(13), PNG_AVX2_SUB_INDEX(14), PNG_AVX2_SUB_INDEX(15),
+      PNG_AVX2_SUB_INDEX( 0), PNG_AVX2_SUB_INDEX( 1), PNG_AVX2_SUB_INDEX( 2), PNG_AVX2_SUB_INDEX( 3),
+      PNG_AVX2_SUB_INDEX( 4), PNG_AVX2_SUB_INDEX( 5), PNG_AVX2_SUB_INDEX( 6), PNG_AVX2_SUB_INDEX( 7),
+      PNG_AVX2_SUB_INDEX( 8), PNG_AVX2_SUB_INDEX( 9), PNG_AVX2_SUB_INDEX(10), PNG_AVX2_SUB_INDEX(11),
+      PNG_AVX2_SUB_INDEX(12), PNG_AVX2_SUB_INDEX(13), PNG_AVX2_SUB_INDEX(14), PNG_AVX2_SUB_INDEX(15));
+
+    __m256i ext = _mm256_setr_epi8(
+      PNG_AVX2_SUB_INDEX( 0), PNG_AVX2_SUB_INDEX( 1), PNG_AVX2_SUB_INDEX( 2), PNG_AVX2_SUB_INDEX( 3),
+      PNG_AVX2_SUB_INDEX( 4), PNG_AVX2_SUB_INDEX( 5), PNG_AVX2_SUB_INDEX( 6), PNG_AVX2_SUB_INDEX( 7),
+      PNG_AVX2_SUB_INDEX( 8), PNG_AVX2_SUB_INDEX( 9), PNG_AVX2_SUB_INDEX(10), PNG_AVX2_SUB_INDEX(11),
+      PNG_AVX2_SUB_INDEX(12), PNG_AVX2_SUB_INDEX(13), PNG_AVX2_SUB_INDEX(14), PNG_AVX2_SUB_INDEX(15),
+      PNG_AVX2_SUB_INDEX(16), PNG_AVX2_SUB_INDEX(17), PNG_AVX2_SUB_INDEX(18), PNG_AVX2_SUB_INDEX(19),
+      PNG_AVX2_SUB_INDEX(20), PNG_AVX2_SUB_INDEX(21), PNG_AVX2_SUB_INDEX(22), PNG_AVX2_SUB_INDEX(23),
+      PNG_AVX2_SUB_INDEX(24), PNG_AVX2_SUB_INDEX(25), PNG_AVX2_SUB_INDEX(26), PNG_AVX2_SUB_INDEX(27),
+      PNG_AVX2_SUB_INDEX(28), PNG_AVX2_SUB_INDEX(29), PNG_AVX2_SUB_INDEX(30), PNG_AVX2_SUB_INDEX(31));
+
+    // `z0` contains the last pixel in the highest BYTEs of its high lane.
+    __m128i z = _mm_slli_si128(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), 16 - bpp);
+    __m256i z0 = _mm256_inserti128_si256(_mm256_castsi128_si256(z), z, 1);
+
+    // Process 64 BYTEs at a time.
+    while (i >= 64) {
+      __m256i p0 = _mm256_load_si256(reinterpret_cast<__m256i*>(p + bpp));
+      __m256i p1 = _mm256_load_si256(reinterpret_cast<__m256i*>(p + bpp + 32));
+
+      p0 = OptDePngSubSumAVX2_T<bpp>(p0, fix);
+      p1 = OptDePngSubSumAVX2_T<bpp>(p1, fix);
+
+      z0 = _mm256_permute2x128_si256(z0, z0, 0x11);
+      p0 = _mm256_add_epi8(p0, _mm256_shuffle_epi8(z0, ext));
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + bpp), p0);
+
+      z0 = _mm256_permute2x128_si256(p0, p0, 0x11);
+      p1 = _mm256_add_epi8(p1, _mm256_shuffle_epi8(z0, ext));
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + bpp + 32), p1);
+
+      z0 = p1;
+      p += 64;
+      i -= 64;
+    }
+
+    // Process 32 BYTEs at a time.
+    while (i >= 32) {
+      __m256i p0 = _mm256_load_si256(reinterpret_cast<__m256i*>(p + bpp));
+      p0 = OptDePngSubSumAVX2_T<bpp>(p0, fix);
+
+      z0 = _mm256_permute2x128_si256(z0, z0, 0x11);
+      p0 = _mm256_add_epi8(p0, _mm256_shuffle_epi8(z0, ext));
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + bpp), p0);
+
+      z0 = p0;
+      p += 32;
+      i -= 32;
+    }
+  }
+
+  for (; i != 0; i--, p++)
+    p[bpp] = Sum(p[bpp], p[0]);
+}
+
+// ----------------------------------------------------------------------------
+// [Up]
+// ----------------------------------------------------------------------------
+
+static OPT_INLINE void OptDePngUpAVX2(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl;
+
+  if (i >= 64) {
+    // Align to 32-BYTE boundary.
+    uint32_t j = OptAlignDiff(p, 32);
+    for (i -= j; j != 0; j--, p++, u++)
+      p[0] = Sum(p[0], u[0]);
+
+    // Process 128 BYTEs at a time.
+    while (i >= 128) {
+      __m256i u0 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(u));
+      __m256i u1 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(u + 32));
+      __m256i u2 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(u + 64));
+      __m256i u3 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(u + 96));
+
+      __m256i p0 = _mm256_add_epi8(u0, *reinterpret_cast<__m256i*>(p));
+      __m256i p1 = _mm256_add_epi8(u1, *reinterpret_cast<__m256i*>(p + 32));
+      __m256i p2 = _mm256_add_epi8(u2, *reinterpret_cast<__m256i*>(p + 64));
+      __m256i p3 = _mm256_add_epi8(u3, *reinterpret_cast<__m256i*>(p + 96));
+
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p     ), p0);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + 32), p1);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + 64), p2);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p + 96), p3);
+
+      p += 128;
+      u += 128;
+      i -= 128;
+    }
+
+    // Process 32 BYTEs at a time.
+    while (i >= 32) {
+      __m256i u0 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(u));
+      __m256i p0 = _mm256_add_epi8(u0, *reinterpret_cast<__m256i*>(p));
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p), p0);
+
+      p += 32;
+      u += 32;
+      i -= 32;
+    }
+
+    // Process 8 BYTEs at a time.
+    while (i >= 8) {
+      __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
+      __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+
+      p0 = _mm_add_epi8(p0, u0);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), p0);
+
+      p += 8;
+      u += 8;
+      i -= 8;
+    }
+  }
+
+  for (; i != 0; i--, p++, u++)
+    p[0] = Sum(p[0], u[0]);
+}
+
+// Out-of-place `Up`, `dst = src + u`.
+static OPT_INLINE void OptDePngUpToAVX2(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n) {
+  uint32_t i = n;
+
+  if (i >= 64) {
+    // Align to 32-BYTE boundary.
+    uint32_t j = OptAlignDiff(dst, 32);
+    for (i -= j; j != 0; j--, dst++, src++, u++)
+      dst[0] = Sum(src[0], u[0]);
+
+    // Process 64 BYTEs at a time.
+    while (i >= 64) {
+      __m256i p0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      __m256i p1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+      __m256i u0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u));
+      __m256i u1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + 32));
+
+      _mm256_store_si256(reinterpret_cast<__m256i*>(dst     ), _mm256_add_epi8(p0, u0));
+      _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_add_epi8(p1, u1));
+
+      dst += 64;
+      src += 64;
+      u += 64;
+      i -= 64;
+    }
+  }
+
+  OptDePngUpToSSE2(dst, src, u, i);
+}
+
+// ----------------------------------------------------------------------------
+// [Span]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSpanAVX2_T(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t x0, uint32_t x1) {
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst_T<bpp>(p, x0, x1);
+      return;
+    }
+  }
+
+  if (x0 == 0) {
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubAVX2_T<bpp>(p, x1); break;
+      case kPngFilterUp   : OptDePngUpAVX2(p, u, x1); break;
+      case kPngFilterAvg  : OptDePngAvgSSE2_T<bpp>(p, u, x1); break;
+      case kPngFilterPaeth: OptDePngPaethSSE2_T<bpp>(p, u, x1); break;
+    }
+  }
+  else {
+    // Start at the last pixel of the previous span, which is unfiltered.
+    uint32_t n = x1 - x0 + bpp;
+    p += x0 - bpp;
+    u += x0 - bpp;
+
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubAVX2_T<bpp>(p, n); break;
+      case kPngFilterUp   : OptDePngUpAVX2(p + bpp, u + bpp, n - bpp); break;
+      case kPngFilterAvg  : OptDePngAvgNextSSE2_T<bpp>(p, u, n); break;
+      case kPngFilterPaeth: OptDePngPaethNextSSE2_T<bpp>(p, u, n); break;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Image]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterAVX2_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  uint32_t y = h;
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  do {
+    uint32_t filter = *p++;
+
+    // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+    if (u == NULL) {
+      filter = OptDePngFirstRowFilter(filter);
+      if (filter == kPngFilterAvg) {
+        OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        filter = kPngFilterNone;
+      }
+    }
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubAVX2_T<bpp>(p, bpl); break;
+      case kPngFilterUp   : OptDePngUpAVX2(p, u, bpl); break;
+      case kPngFilterAvg  : OptDePngAvgSSE2_T<bpp>(p, u, bpl); break;
+      case kPngFilterPaeth: OptDePngPaethSSE2_T<bpp>(p, u, bpl); break;
+    }
+
+    u = p;
+    p += bpl;
+  } while (--y != 0);
+}
+
+uint32_t OptDePngFilterAVX2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterAVX2_T<1>(p, h, bpl); break;
+    case 2: OptDePngFilterAVX2_T<2>(p, h, bpl); break;
+    case 3: OptDePngFilterAVX2_T<3>(p, h, bpl); break;
+    case 4: OptDePngFilterAVX2_T<4>(p, h, bpl); break;
+    case 6: OptDePngFilterAVX2_T<6>(p, h, bpl); break;
+    case 8: OptDePngFilterAVX2_T<8>(p, h, bpl); break;
+    default: OptDePngFilterSSE2_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanAVX2(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanAVX2_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanAVX2_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanAVX2_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanAVX2_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanAVX2_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanAVX2_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanSSE2_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+uint32_t OptDePngFilterAVX2To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanAVX2, OptDePngUpToAVX2);
+}
+
+OptDePngConvertFunc OptDePngConvertGetAVX2(uint32_t bpp, uint32_t format) {
+  return OptDePngConvertSelectSSE2(bpp, format);
+}
@@ -0,0 +1,536 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_SSE2
+#define USE_SSSE3
+#define USE_AVX2
+#define USE_AVX512
+
+#include "./optdepng_p.h"
+#include "./optdepng_sse2_p.h"
+
+// ============================================================================
+// [Implementation - AVX-512 Optimized]
+//
+// AVX-512 implementation requires AVX512F, AVX512BW, AVX512VL, and VBMI (Ice
+// Lake and newer). Masked loads and stores handle the beginning and the end of
+// each row, so there are no scalar prologues and tails. VBMI's VPERMB shifts
+// BYTEs across the whole 512-bit register, which replaces both the per-lane
+// shifts and the lane fix-ups of the AVX2 Sub filter. Avg kernels and 1 BPP
+// Paeth are the SSE2/SSSE3 kernels compiled as EVEX encoded code.
+// ============================================================================
+
+// Shift BYTEs of `P0` left by `Shift` (across lanes) and add them to `P0`.
+#define PNG_AVX512_SLL_ADDB_1X(P0, Iota, Shift) \
+  do { \
+    __m512i T0 = _mm512_maskz_permutexvar_epi8( \
+      ~OptDePngMaskAVX512(Shift), _mm512_sub_epi8(Iota, _mm512_set1_epi8(Shift)), P0); \
+    P0 = _mm512_add_epi8(P0, T0); \
+  } while (0)
+
+// Index of the BYTE of the previous 64 BYTEs that carries into BYTE `k`.
+#define PNG_AVX512_SUB_INDEX(k) static_cast<char>(64 - bpp + ((k) % bpp))
+
+// Get a mask of the lowest `n` BYTEs of a 512-bit register.
+static OPT_INLINE __mmask64 OptDePngMaskAVX512(uint32_t n) {
+  return n >= 64 ? ~static_cast<__mmask64>(0) : (static_cast<__mmask64>(1) << n) - 1u;
+}
+
+// VPERMB of all BYTEs. The unmasked intrinsic passes an undefined register as
+// a source, which GCC warns about as possibly uninitialized.
+static OPT_INLINE __m512i OptDePngPermuteAVX512(__m512i idx, __m512i x) {
+  return _mm512_maskz_permutexvar_epi8(~static_cast<__mmask64>(0), idx, x);
+}
+
+// Get `[0, 1, 2, ..., 63]`, used to build VPERMB predicates.
+static OPT_INLINE __m512i OptDePngIotaAVX512() {
+  return _mm512_set_epi64(
+    0x3F3E3D3C3B3A3938, 0x3736353433323130, 0x2F2E2D2C2B2A2928, 0x2726252423222120,
+    0x1F1E1D1C1B1A1918, 0x1716151413121110, 0x0F0E0D0C0B0A0908, 0x0706050403020100);
+}
+
+// ----------------------------------------------------------------------------
+// [Sub]
+// ----------------------------------------------------------------------------
+
+// Same as AVX2, the only sequential work per 64 BYTEs is VPERMB and VPADDB,
+// which broadcast the last pixel of the previous 64 BYTEs and add it.
+template<uint32_t bpp>
+static OPT_INLINE __m512i OptDePngSubSumAVX512_T(__m512i p0, __m512i iota) {
+  PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp);
+  if (bpp *  2 < 64) PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp *  2);
+  if (bpp *  4 < 64) PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp *  4);
+  if (bpp *  8 < 64) PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp *  8);
+  if (bpp * 16 < 64) PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp * 16);
+  if (bpp * 32 < 64) PNG_AVX512_SLL_ADDB_1X(p0, iota, bpp * 32);
+  return p0;
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubAVX512_T(uint8_t* p, uint32_t bpl) {
+  if (bpl <= bpp)
+    return;
+
+  __m512i iota = OptDePngIotaAVX512();
+  __m512i ext = _mm512_set_epi8(
+    PNG_AVX512_SUB_INDEX(63), PNG_AVX512_SUB_INDEX(62), PNG_AVX512_SUB_INDEX(61), PNG_AVX512_SUB_INDEX(60),
+    PNG_AVX512_SUB_INDEX(59), PNG_AVX512_SUB_INDEX(58), PNG_AVX512_SUB_INDEX(57), PNG_AVX512_SUB_INDEX(56),
+    PNG_AVX512_SUB_INDEX(55), PNG_AVX512_SUB_INDEX(54), PNG_AVX512_SUB_INDEX(53), PNG_AVX512_SUB_INDEX(52),
+    PNG_AVX512_SUB_INDEX(51), PNG_AVX512_SUB_INDEX(50), PNG_AVX512_SUB_INDEX(49), PNG_AVX512_SUB_INDEX(48),
+    PNG_AVX512_SUB_INDEX(47), PNG_AVX512_SUB_INDEX(46), PNG_AVX512_SUB_INDEX(45), PNG_AVX512_SUB_INDEX(44),
+    PNG_AVX512_SUB_INDEX(43), PNG_AVX512_SUB_INDEX(42), PNG_AVX512_SUB_INDEX(41), PNG_AVX512_SUB_INDEX(40),
+    PNG_AVX512_SUB_INDEX(39), PNG_AVX512_SUB_INDEX(38), PNG_AVX512_SUB_INDEX(37), PNG_AVX512_SUB_INDEX(36),
+    PNG_AVX512_SUB_INDEX(35), PNG_AVX512_SUB_INDEX(34), PNG_AVX512_SUB_INDEX(33), PNG_AVX512_SUB_INDEX(32),
+    PNG_AVX512_SUB_INDEX(31), PNG_AVX512_SUB_INDEX(30), PNG_AVX512_SUB_INDEX(29), PNG_AVX512_SUB_INDEX(28),
+    PNG_AVX512_SUB_INDEX(27), PNG_AVX512_SUB_INDEX(26), PNG_AVX512_SUB_INDEX(25), PNG_AVX512_SUB_INDEX(24),
+    PNG_AVX512_SUB_INDEX(23), PNG_AVX512_SUB_INDEX(22), PNG_AVX512_SUB_INDEX(21), PNG_AVX512_SUB_INDEX(20),
+    PNG_AVX512_SUB_INDEX(19), PNG_AVX512_SUB_INDEX(18), PNG_AVX512_SUB_INDEX(17), PNG_AVX512_SUB_INDEX(16),
+    PNG_AVX512_SUB_INDEX(15), PNG_AVX512_SUB_INDEX(14), PNG_AVX512_SUB_INDEX(13), PNG_AVX512_SUB_INDEX(12),
+    PNG_AVX512_SUB_INDEX(11), PNG_AVX512_SUB_INDEX(10), PNG_AVX512_SUB_INDEX( 9), PNG_AVX512_SUB_INDEX( 8),
+    PNG_AVX512_SUB_INDEX( 7), PNG_AVX512_SUB_INDEX( 6), PNG_AVX512_SUB_INDEX( 5), PNG_AVX512_SUB_INDEX( 4),
+    PNG_AVX512_SUB_INDEX( 3), PNG_AVX512_SUB_INDEX( 2), PNG_AVX512_SUB_INDEX( 1), PNG_AVX512_SUB_INDEX( 0));
+
+  // The first 64 BYTEs start at the 64-BYTE boundary that precedes `p`, BYTEs
+  // before `p` are masked out, so they are zero. The first pixel is already
+  // unfiltered and it's a part of the prefix-sum, so it needs no carry.
+  uint32_t j = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) & 63);
+  uint32_t n = j + bpl;
+  p -= j;
+
+  __mmask64 m = OptDePngMaskAVX512(n) & ~OptDePngMaskAVX512(j);
+  __m512i p0 = _mm512_maskz_loadu_epi8(m, p);
+
+  p0 = OptDePngSubSumAVX512_T<bpp>(p0, iota);
+  _mm512_mask_storeu_epi8(p, m, p0);
+
+  // Process 64 BYTEs at a time.
+  while (n > 128) {
+    p += 64;
+    n -= 64;
+
+    __m512i p1 = _mm512_load_si512(reinterpret_cast<__m512i*>(p));
+    p1 = OptDePngSubSumAVX512_T<bpp>(p1, iota);
+
+    p0 = _mm512_add_epi8(p1, OptDePngPermuteAVX512(ext, p0));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p), p0);
+  }
+
+  // Process the remaining [1, 64] BYTEs.
+  if (n > 64) {
+    p += 64;
+    n -= 64;
+    m = OptDePngMaskAVX512(n);
+
+    __m512i p1 = _mm512_maskz_loadu_epi8(m, p);
+    p1 = OptDePngSubSumAVX512_T<bpp>(p1, iota);
+
+    p0 = _mm512_add_epi8(p1, OptDePngPermuteAVX512(ext, p0));
+    _mm512_mask_storeu_epi8(p, m, p0);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Up]
+// ----------------------------------------------------------------------------
+
+static OPT_INLINE void OptDePngUpAVX512(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl;
+
+  // Align to 64-BYTE boundary.
+  uint32_t j = OptAlignDiff(p, 64);
+  if (j != 0 && i != 0) {
+    if (j > i) j = i;
+
+    __mmask64 m = OptDePngMaskAVX512(j);
+    __m512i p0 = _mm512_maskz_loadu_epi8(m, p);
+    __m512i u0 = _mm512_maskz_loadu_epi8(m, u);
+    _mm512_mask_storeu_epi8(p, m, _mm512_add_epi8(p0, u0));
+
+    p += j;
+    u += j;
+    i -= j;
+  }
+
+  // Process 256 BYTEs at a time.
+  while (i >= 256) {
+    __m512i u0 = _mm512_loadu_si512(reinterpret_cast<__m512i*>(u));
+    __m512i u1 = _mm512_loadu_si512(reinterpret_cast<__m512i*>(u + 64));
+    __m512i u2 = _mm512_loadu_si512(reinterpret_cast<__m512i*>(u + 128));
+    __m512i u3 = _mm512_loadu_si512(reinterpret_cast<__m512i*>(u + 192));
+
+    __m512i p0 = _mm512_add_epi8(u0, _mm512_load_si512(reinterpret_cast<__m512i*>(p)));
+    __m512i p1 = _mm512_add_epi8(u1, _mm512_load_si512(reinterpret_cast<__m512i*>(p + 64)));
+    __m512i p2 = _mm512_add_epi8(u2, _mm512_load_si512(reinterpret_cast<__m512i*>(p + 128)));
+    __m512i p3 = _mm512_add_epi8(u3, _mm512_load_si512(reinterpret_cast<__m512i*>(p + 192)));
+
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p      ), p0);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p +  64), p1);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p + 128), p2);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p + 192), p3);
+
+    p += 256;
+    u += 256;
+    i -= 256;
+  }
+
+  // Process 64 BYTEs at a time.
+  while (i >= 64) {
+    __m512i u0 = _mm512_loadu_si512(reinterpret_cast<__m512i*>(u));
+    __m512i p0 = _mm512_add_epi8(u0, _mm512_load_si512(reinterpret_cast<__m512i*>(p)));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p), p0);
+
+    p += 64;
+    u += 64;
+    i -= 64;
+  }
+
+  if (i != 0) {
+    __mmask64 m = OptDePngMaskAVX512(i);
+    __m512i p0 = _mm512_maskz_loadu_epi8(m, p);
+    __m512i u0 = _mm512_maskz_loadu_epi8(m, u);
+    _mm512_mask_storeu_epi8(p, m, _mm512_add_epi8(p0, u0));
+  }
+}
+
+// Out-of-place `Up`, `dst = src + u`.
+static OPT_INLINE void OptDePngUpToAVX512(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n) {
+  uint32_t i = n;
+
+  // Align to 64-BYTE boundary.
+  uint32_t j = OptAlignDiff(dst, 64);
+  if (j != 0 && i != 0) {
+    if (j > i) j = i;
+
+    __mmask64 m = OptDePngMaskAVX512(j);
+    __m512i p0 = _mm512_maskz_loadu_epi8(m, src);
+    __m512i u0 = _mm512_maskz_loadu_epi8(m, u);
+    _mm512_mask_storeu_epi8(dst, m, _mm512_add_epi8(p0, u0));
+
+    dst += j;
+    src += j;
+    u += j;
+    i -= j;
+  }
+
+  // Process 128 BYTEs at a time.
+  while (i >= 128) {
+    __m512i p0 = _mm512_loadu_si512(reinterpret_cast<const __m512i*>(src));
+    __m512i p1 = _mm512_loadu_si512(reinterpret_cast<const __m512i*>(src + 64));
+    __m512i u0 = _mm512_loadu_si512(reinterpret_cast<const __m512i*>(u));
+    __m512i u1 = _mm512_loadu_si512(reinterpret_cast<const __m512i*>(u + 64));
+
+    _mm512_store_si512(reinterpret_cast<__m512i*>(dst     ), _mm512_add_epi8(p0, u0));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(dst + 64), _mm512_add_epi8(p1, u1));
+
+    dst += 128;
+    src += 128;
+    u += 128;
+    i -= 128;
+  }
+
+  // Process the remaining [0, 128) BYTEs.
+  while (i != 0) {
+    uint32_t k = i < 64 ? i : 64;
+
+    __mmask64 m = OptDePngMaskAVX512(k);
+    __m512i p0 = _mm512_maskz_loadu_epi8(m, src);
+    __m512i u0 = _mm512_maskz_loadu_epi8(m, u);
+    _mm512_mask_storeu_epi8(dst, m, _mm512_add_epi8(p0, u0));
+
+    dst += k;
+    src += k;
+    u += k;
+    i -= k;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Paeth]
+// ----------------------------------------------------------------------------
+
+// Paeth filter of BYTEs [bpp, bpl), the first `bpp` BYTEs must be unfiltered.
+//
+// Uses the same ranges as the 1 BPP SSE2 kernel, see `OptDePngPaethNextSSE2_T`,
+// but clamped to [0, 255], so all calculations are done in BYTEs. The bounds of
+// a block of whole pixels (up to 64 BYTEs) are calculated in advance, which
+// leaves two range checks and two selects (VPTERNLOG) on the sequential path
+// of each pixel. Comparing into mask registers is slower here, as the latency
+// of a mask that feeds a masked move is higher than that of a vector.
+//
+// An empty range of `b` becomes [b, b] and an empty range of `c` becomes
+// [c, c], which predict the same value as `a` does. `b` is selected after `c`,
+// as such `c` range can overlap the `b` range.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethNextAVX512_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  const uint32_t kBlockSize = (64 / bpp) * bpp;
+  const __mmask16 kPixelMask = static_cast<__mmask16>((1u << bpp) - 1u);
+
+  // Pixels are loaded 8 BYTEs at a time, so each row is followed by padding.
+  enum { kRowX, kRowB, kRowC, kRowBLo, kRowBLen, kRowCLo, kRowCLen, kRowCount };
+  OPT_ALIGN(64) uint8_t blockData[kRowCount][128];
+
+  __m512i one = _mm512_set1_epi8(1);
+  __m512i ones = _mm512_set1_epi8(-1);
+  __m512i mask7F = _mm512_set1_epi8(0x7F);
+
+  __m128i a0 = _mm_maskz_loadu_epi8(kPixelMask, p);
+  p += bpp;
+
+  for (uint32_t i = bpl - bpp; i != 0; ) {
+    uint32_t n = i < kBlockSize ? i : kBlockSize;
+    __mmask64 m = OptDePngMaskAVX512(n);
+
+    __m512i x = _mm512_maskz_loadu_epi8(m, p);
+    __m512i b = _mm512_maskz_loadu_epi8(m, u + bpp);
+    __m512i c = _mm512_maskz_loadu_epi8(m, u);
+
+    __mmask64 gt = _mm512_cmpgt_epu8_mask(b, c);
+    __mmask64 lt = _mm512_cmplt_epu8_mask(b, c);
+
+    // `m0 = |b - c|`, `h0 = m0 >> 1`.
+    __m512i m0 = _mm512_sub_epi8(_mm512_max_epu8(b, c), _mm512_min_epu8(b, c));
+    __m512i h0 = _mm512_and_si512(_mm512_srli_epi16(m0, 1), mask7F);
+    __m512i cSubH = _mm512_subs_epu8(c, h0);
+    __m512i cAddH = _mm512_adds_epu8(c, h0);
+
+    //   b > c: `b` if a in [c - h, b - 1], `c` if a in [c - 2m + 1, c - h - 1]
+    //   b < c: `b` if a in [b + 1, c + h], `c` if a in [c + h + 1, c + 2m - 1]
+    __m512i bLo = _mm512_mask_blend_epi8(gt, _mm512_add_epi8(b, one), cSubH);
+    __m512i bHi = _mm512_mask_blend_epi8(gt, cAddH, _mm512_sub_epi8(b, one));
+    __m512i cLo = _mm512_mask_blend_epi8(gt, _mm512_add_epi8(cAddH, one),
+                                             _mm512_subs_epu8(_mm512_subs_epu8(_mm512_add_epi8(c, one), m0), m0));
+    __m512i cHi = _mm512_mask_blend_epi8(gt, _mm512_adds_epu8(_mm512_adds_epu8(c, _mm512_sub_epi8(m0, one)), m0),
+                                             _mm512_sub_epi8(cSubH, one));
+
+    // `b` range is empty if `b == c`, `c` range is empty if its upper (b > c)
+    // or lower (b < c) bound is out of [0, 255].
+    __mmask64 bMask = gt | lt;
+    __mmask64 cMask = _mm512_mask_cmpgt_epu8_mask(gt, c, h0) |
+                      _mm512_mask_cmpneq_epu8_mask(lt, cAddH, ones);
+
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowX   ]), x);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowB   ]), b);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowC   ]), c);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowBLo ]), _mm512_mask_blend_epi8(bMask, b, bLo));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowBLen]), _mm512_maskz_sub_epi8(bMask, bHi, bLo));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowCLo ]), _mm512_mask_blend_epi8(cMask, c, cLo));
+    _mm512_store_si512(reinterpret_cast<__m512i*>(blockData[kRowCLen]), _mm512_maskz_sub_epi8(cMask, cHi, cLo));
+
+    for (uint32_t k = 0; k < n; k += bpp) {
+      __m128i x0    = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowX   ][k]));
+      __m128i b0    = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowB   ][k]));
+      __m128i c0    = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowC   ][k]));
+      __m128i bLo0  = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowBLo ][k]));
+      __m128i bLen0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowBLen][k]));
+      __m128i cLo0  = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowCLo ][k]));
+      __m128i cLen0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(&blockData[kRowCLen][k]));
+
+      // `a - lo <= len` (unsigned) as `min(a - lo, len) == a - lo`.
+      __m128i tb = _mm_sub_epi8(a0, bLo0);
+      __m128i tc = _mm_sub_epi8(a0, cLo0);
+
+      tb = _mm_cmpeq_epi8(_mm_min_epu8(tb, bLen0), tb);
+      tc = _mm_cmpeq_epi8(_mm_min_epu8(tc, cLen0), tc);
+
+      // 0xCA is `A ? B : C`.
+      a0 = _mm_ternarylogic_epi32(tc, c0, a0, 0xCA);
+      a0 = _mm_ternarylogic_epi32(tb, b0, a0, 0xCA);
+      a0 = _mm_add_epi8(a0, x0);
+      _mm_mask_storeu_epi8(p + k, kPixelMask, a0);
+    }
+
+    p += n;
+    u += n;
+    i -= n;
+  }
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethAVX512_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  // 1 BPP is faster with scalar range checks, see `OptDePngPaethNextSSE2_T`.
+  if (bpp == 1) {
+    OptDePngPaethSSE2_T<bpp>(p, u, bpl);
+    return;
+  }
+
+  // Paeth of the first pixel is `Up`, as both `Left` and `UpLeft` are zero.
+  for (uint32_t i = 0; i < bpp; i++)
+    p[i] = Sum(p[i], u[i]);
+
+  OptDePngPaethNextAVX512_T<bpp>(p, u, bpl);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethNextSelectAVX512_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  if (bpp == 1)
+    OptDePngPaethNextSSE2_T<bpp>(p, u, bpl);
+  else
+    OptDePngPaethNextAVX512_T<bpp>(p, u, bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Span]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSpanAVX512_T(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t x0, uint32_t x1) {
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst_T<bpp>(p, x0, x1);
+      return;
+    }
+  }
+
+  if (x0 == 0) {
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubAVX512_T<bpp>(p, x1); break;
+      case kPngFilterUp   : OptDePngUpAVX512(p, u, x1); break;
+      case kPngFilterAvg  : OptDePngAvgSSE2_T<bpp>(p, u, x1); break;
+      case kPngFilterPaeth: OptDePngPaethAVX512_T<bpp>(p, u, x1); break;
+    }
+  }
+  else {
+    // Start at the last pixel of the previous span, which is unfiltered.
+    uint32_t n = x1 - x0 + bpp;
+    p += x0 - bpp;
+    u += x0 - bpp;
+
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubAVX512_T<bpp>(p, n); break;
+      case kPngFilterUp   : OptDePngUpAVX512(p + bpp, u + bpp, n - bpp); break;
+      case kPngFilterAvg  : OptDePngAvgNextSSE2_T<bpp>(p, u, n); break;
+      case kPngFilterPaeth: OptDePngPaethNextSelectAVX512_T<bpp>(p, u, n); break;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Image]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterAVX512_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  uint32_t y = h;
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  do {
+    uint32_t filter = *p++;
+
+    // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+    if (u == NULL) {
+      filter = OptDePngFirstRowFilter(filter);
+      if (filter == kPngFilterAvg) {
+        OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        filter = kPngFilterNone;
+      }
+    }
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubAVX512_T<bpp>(p, bpl); break;
+      case kPngFilterUp   : OptDePngUpAVX512(p, u, bpl); break;
+      case kPngFilterAvg  : OptDePngAvgSSE2_T<bpp>(p, u, bpl); break;
+      case kPngFilterPaeth: OptDePngPaethAVX512_T<bpp>(p, u, bpl); break;
+    }
+
+    u = p;
+    p += bpl;
+  } while (--y != 0);
+}
+
+// ----------------------------------------------------------------------------
+// [Batch]
+// ----------------------------------------------------------------------------
+
+// Same as `OptDePngFilterShortSSE2_T()`, but uses AVX-512 `Paeth`.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterShortAVX512_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  const uint8_t* end = p + static_cast<size_t>(h) * bpl;
+  uint8_t* u = NULL;
+
+  bpl--;
+  do {
+    uint32_t filter = *p++;
+
+    if (u == NULL)
+      filter = OptDePngFirstRowFilter(filter);
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubShortSSE2_T<bpp>(p, bpl, end); break;
+      case kPngFilterUp   : OptDePngUpShortSSE2(p, u, bpl); break;
+      case kPngFilterAvg  :
+        if (u != NULL)
+          OptDePngAvgSSE2_T<bpp>(p, u, bpl);
+        else
+          OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        break;
+      case kPngFilterPaeth: OptDePngPaethAVX512_T<bpp>(p, u, bpl); break;
+    }
+
+    u = p;
+    p += bpl;
+  } while (--h != 0);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngBatchAVX512_T(OptDePngBatchItem* const* items, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    OptDePngFilterShortAVX512_T<bpp>(items[i]->p, items[i]->h, items[i]->bpl);
+}
+
+uint32_t OptDePngFilterAVX512(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterAVX512_T<1>(p, h, bpl); break;
+    case 2: OptDePngFilterAVX512_T<2>(p, h, bpl); break;
+    case 3: OptDePngFilterAVX512_T<3>(p, h, bpl); break;
+    case 4: OptDePngFilterAVX512_T<4>(p, h, bpl); break;
+    case 6: OptDePngFilterAVX512_T<6>(p, h, bpl); break;
+    case 8: OptDePngFilterAVX512_T<8>(p, h, bpl); break;
+    default: OptDePngFilterSSE2_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanAVX512(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanAVX512_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanAVX512_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanAVX512_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanAVX512_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanAVX512_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanAVX512_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanSSE2_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+void OptDePngBatchAVX512(OptDePngBatchItem* const* items, size_t count, uint32_t bpp) {
+  switch (bpp) {
+    case 1: OptDePngBatchAVX512_T<1>(items, count); break;
+    case 2: OptDePngBatchAVX512_T<2>(items, count); break;
+    case 3: OptDePngBatchAVX512_T<3>(items, count); break;
+    case 4: OptDePngBatchAVX512_T<4>(items, count); break;
+    case 6: OptDePngBatchAVX512_T<6>(items, count); break;
+    case 8: OptDePngBatchAVX512_T<8>(items, count); break;
+  }
+}
+
+uint32_t OptDePngFilterAVX512To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanAVX512, OptDePngUpToAVX512);
+}
+
+OptDePngConvertFunc OptDePngConvertGetAVX512(uint32_t bpp, uint32_t format) {
+  return OptDePngConvertSelectSSE2(bpp, format);
+}
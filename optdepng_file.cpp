@@ -0,0 +1,317 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+#include "./optdepng_p.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// ============================================================================
+// [Mapping]
+//
+// Whole file mapped to memory. A source is mapped read-only (or read-write if
+// it's unfiltered in place), a destination is created with the given size.
+// ============================================================================
+
+struct OptDePngMapping {
+  uint8_t* data;
+  uint64_t size;
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+};
+
+#if defined(_WIN32)
+static uint32_t OptDePngMapView(OptDePngMapping& m, bool writable) {
+  m.mapping = NULL;
+  m.data = NULL;
+
+  if (m.size > static_cast<uint64_t>(~static_cast<size_t>(0)))
+    return kOptDePngErrorOutOfMemory;
+
+  // An empty file can't be mapped, there is nothing to do anyway.
+  if (m.size == 0)
+    return kOptDePngErrorOk;
+
+  m.mapping = ::CreateFileMappingA(m.file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+    static_cast<DWORD>(m.size >> 32), static_cast<DWORD>(m.size), NULL);
+  if (m.mapping == NULL)
+    return kOptDePngErrorFile;
+
+  m.data = static_cast<uint8_t*>(::MapViewOfFile(m.mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+  if (m.data == NULL) {
+    ::CloseHandle(m.mapping);
+    m.mapping = NULL;
+    return kOptDePngErrorFile;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+static uint32_t OptDePngMapOpen(OptDePngMapping& m, const char* path, bool writable) {
+  m.file = ::CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+    FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (m.file == INVALID_HANDLE_VALUE)
+    return kOptDePngErrorFile;
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(m.file, &size)) {
+    ::CloseHandle(m.file);
+    return kOptDePngErrorFile;
+  }
+
+  m.size = static_cast<uint64_t>(size.QuadPart);
+  uint32_t err = OptDePngMapView(m, writable);
+
+  if (err != kOptDePngErrorOk)
+    ::CloseHandle(m.file);
+  return err;
+}
+
+static uint32_t OptDePngMapCreate(OptDePngMapping& m, const char* path, uint64_t size) {
+  m.file = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m.file == INVALID_HANDLE_VALUE)
+    return kOptDePngErrorFile;
+
+  // Creating the mapping extends the file to `size`.
+  m.size = size;
+  uint32_t err = OptDePngMapView(m, true);
+
+  if (err != kOptDePngErrorOk)
+    ::CloseHandle(m.file);
+  return err;
+}
+
+static void OptDePngMapClose(OptDePngMapping& m) {
+  if (m.data != NULL) {
+    ::UnmapViewOfFile(m.data);
+    ::CloseHandle(m.mapping);
+  }
+  ::CloseHandle(m.file);
+}
+#else
+static uint32_t OptDePngMapView(OptDePngMapping& m, bool writable) {
+  m.data = NULL;
+
+  if (m.size > static_cast<uint64_t>(~static_cast<size_t>(0)))
+    return kOptDePngErrorOutOfMemory;
+
+  // An empty file can't be mapped, there is nothing to do anyway.
+  if (m.size == 0)
+    return kOptDePngErrorOk;
+
+  void* data = ::mmap(NULL, static_cast<size_t>(m.size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+    writable ? MAP_SHARED : MAP_PRIVATE, m.fd, 0);
+  if (data == MAP_FAILED)
+    return kOptDePngErrorFile;
+
+  m.data = static_cast<uint8_t*>(data);
+  return kOptDePngErrorOk;
+}
+
+static uint32_t OptDePngMapOpen(OptDePngMapping& m, const char* path, bool writable) {
+  m.fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+  if (m.fd < 0)
+    return kOptDePngErrorFile;
+
+  struct stat st;
+  if (::fstat(m.fd, &st) != 0) {
+    ::close(m.fd);
+    return kOptDePngErrorFile;
+  }
+
+  m.size = static_cast<uint64_t>(st.st_size);
+  uint32_t err = OptDePngMapView(m, writable);
+
+  if (err != kOptDePngErrorOk)
+    ::close(m.fd);
+  return err;
+}
+
+static uint32_t OptDePngMapCreate(OptDePngMapping& m, const char* path, uint64_t size) {
+  m.fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (m.fd < 0)
+    return kOptDePngErrorFile;
+
+  m.size = size;
+  uint32_t err = kOptDePngErrorFile;
+
+  if (::ftruncate(m.fd, static_cast<off_t>(size)) == 0)
+    err = OptDePngMapView(m, true);
+
+  if (err != kOptDePngErrorOk)
+    ::close(m.fd);
+  return err;
+}
+
+static void OptDePngMapClose(OptDePngMapping& m) {
+  if (m.data != NULL)
+    ::munmap(m.data, static_cast<size_t>(m.size));
+  ::close(m.fd);
+}
+#endif
+
+// ============================================================================
+// [Hints]
+//
+// Used between chunks of `OptDePngFilterFile()`. Pages of the source that were
+// read are dropped from the address space, they are clean and can be read from
+// the file again. Pages that were written are scheduled for write-back and then
+// dropped only on Linux, which documents that dropped pages of a shared mapping
+// keep their data. Other systems reclaim them once they are written back.
+// ============================================================================
+
+static size_t OptDePngPageSize() {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  long size = ::sysconf(_SC_PAGESIZE);
+  return size > 0 ? static_cast<size_t>(size) : 4096;
+#endif
+}
+
+// Read `[p, p + n)` ahead, `p` doesn't have to be aligned.
+static void OptDePngHintWillNeed(uint8_t* p, size_t n, size_t pageSize) {
+#if defined(MADV_WILLNEED)
+  size_t offset = static_cast<size_t>(reinterpret_cast<uintptr_t>(p) & (pageSize - 1));
+  ::madvise(p - offset, n + offset, MADV_WILLNEED);
+#else
+  (void)p;
+  (void)n;
+  (void)pageSize;
+#endif
+}
+
+// Drop read pages `[p, p + n)`, `p` and `n` must be aligned to `pageSize`.
+static void OptDePngHintDone(uint8_t* p, size_t n) {
+#if defined(MADV_DONTNEED)
+  ::madvise(p, n, MADV_DONTNEED);
+#else
+  (void)p;
+  (void)n;
+#endif
+}
+
+// Start write-back of written pages `[p, p + n)`, `p` and `n` must be aligned
+// to `pageSize`.
+static void OptDePngHintWritten(uint8_t* p, size_t n) {
+#if defined(_WIN32)
+  ::FlushViewOfFile(p, n);
+#else
+  ::msync(p, n, MS_ASYNC);
+#if defined(__linux__)
+  ::madvise(p, n, MADV_DONTNEED);
+#endif
+#endif
+}
+
+// ============================================================================
+// [Implementation - File]
+// ============================================================================
+
+uint32_t OptDePngFilterFile(const char* dstPath, const char* srcPath, uint32_t bpp, uint32_t bpl, size_t chunkSize) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  bool inPlace = dstPath == NULL;
+
+  OptDePngMapping src;
+  err = OptDePngMapOpen(src, srcPath, inPlace);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  uint64_t h = src.size / bpl;
+  uint32_t rowSize = bpl - 1;
+
+  if (src.size % bpl != 0 || h > 0xFFFFFFFFu) {
+    OptDePngMapClose(src);
+    return kOptDePngErrorInvalidGeometry;
+  }
+
+  OptDePngMapping dst = {};
+  if (!inPlace) {
+    err = OptDePngMapCreate(dst, dstPath, h * rowSize);
+    if (err != kOptDePngErrorOk) {
+      OptDePngMapClose(src);
+      return err;
+    }
+  }
+
+  // Rows are unfiltered in chunks of whole rows, at least one.
+  uint64_t chunkRows = chunkSize != 0 ? Max<uint64_t>(chunkSize / bpl, 1) : h;
+  size_t pageSize = OptDePngPageSize();
+
+  // Parts of mappings that were already released by hints.
+  size_t srcDone = 0;
+  size_t dstDone = 0;
+
+  OptDePngSpanFunc span = OptDePngSpanGetBest();
+  uint8_t* u = NULL;
+
+  for (uint64_t y0 = 0; y0 < h; y0 += chunkRows) {
+    uint64_t y1 = Min<uint64_t>(y0 + chunkRows, h);
+    uint8_t* s = src.data + static_cast<size_t>(y0 * bpl);
+
+    if (chunkSize != 0)
+      OptDePngHintWillNeed(s, static_cast<size_t>((y1 - y0) * bpl), pageSize);
+
+    if (inPlace) {
+      for (uint64_t y = y0; y < y1; y++, s += bpl) {
+        if (s[0] != kPngFilterNone)
+          span(s + 1, u, s[0], bpp, 0, rowSize);
+        u = s + 1;
+      }
+    }
+    else {
+      uint8_t* d = dst.data + static_cast<size_t>(y0 * rowSize);
+      for (uint64_t y = y0; y < y1; y++, s += bpl, d += rowSize) {
+        ::memcpy(d, s + 1, rowSize);
+        if (s[0] != kPngFilterNone)
+          span(d, u, s[0], bpp, 0, rowSize);
+        u = d;
+      }
+    }
+
+    if (chunkSize == 0 || y1 == h)
+      continue;
+
+    // Release whole pages of finished rows, in place the last row is needed
+    // by the next chunk.
+    size_t end = static_cast<size_t>(y1 * bpl) - (inPlace ? bpl : 0);
+    end &= ~(pageSize - 1);
+
+    if (end > srcDone) {
+      if (inPlace)
+        OptDePngHintWritten(src.data + srcDone, end - srcDone);
+      else
+        OptDePngHintDone(src.data + srcDone, end - srcDone);
+      srcDone = end;
+    }
+
+    if (!inPlace) {
+      end = static_cast<size_t>((y1 - 1) * rowSize) & ~(pageSize - 1);
+      if (end > dstDone) {
+        OptDePngHintWritten(dst.data + dstDone, end - dstDone);
+        dstDone = end;
+      }
+    }
+  }
+
+  if (!inPlace)
+    OptDePngMapClose(dst);
+
+  OptDePngMapClose(src);
+  return kOptDePngErrorOk;
+}
@@ -0,0 +1,571 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_NEON
+
+#include "./optdepng_p.h"
+
+// ============================================================================
+// [Implementation - NEON Optimized]
+//
+// NEON kernels follow the structure of the SSE2 kernels, each one unfilters a
+// single row; `p` points to the first BYTE of the row (after the filter ID),
+// `u` to the first BYTE of the previous row, and `bpl` is the number of BYTEs
+// per row without the filter ID. NEON has no alignment penalty, so there are
+// no alignment prologues. Unlike PAVGB, VHADD truncates, so it matches `Avg`.
+// ============================================================================
+
+// Shift `x` by `n` BYTEs towards the higher lanes, shifting in zeros. `n` must
+// be in [1, 15], the mask only keeps VEXT's immediate valid in dead branches.
+template<uint32_t n>
+static OPT_INLINE uint8x16_t OptDePngSllNEON_T(uint8x16_t x) {
+  return vextq_u8(vdupq_n_u8(0), x, (16 - n) & 15);
+}
+
+// Store the first `bpp` BYTEs of `x`, which holds a single pixel.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngStorePixelNEON_T(uint8_t* p, uint8x8_t x) {
+  if (bpp == 3) {
+    vst1_lane_u16(reinterpret_cast<uint16_t*>(p), vreinterpret_u16_u8(x), 0);
+    vst1_lane_u8(p + 2, x, 2);
+  }
+  else if (bpp == 4) {
+    vst1_lane_u32(reinterpret_cast<uint32_t*>(p), vreinterpret_u32_u8(x), 0);
+  }
+  else if (bpp == 6) {
+    vst1_lane_u32(reinterpret_cast<uint32_t*>(p), vreinterpret_u32_u8(x), 0);
+    vst1_lane_u16(reinterpret_cast<uint16_t*>(p + 4), vreinterpret_u16_u8(x), 2);
+  }
+  else {
+    vst1_u8(p, x);
+  }
+}
+
+// Paeth predictor of 8 BYTEs, calculated in 8-bit cells. `pc` is `|pa + pb|`
+// if `a` and `b` are on the same side of `c`, otherwise it's `|pa - pb|`. The
+// saturated sum is never less than `pa` or `pb`, so the result is the same.
+static OPT_INLINE uint8x8_t OptDePngPaethNEON(uint8x8_t a, uint8x8_t b, uint8x8_t c) {
+  uint8x8_t pa = vabd_u8(b, c);
+  uint8x8_t pb = vabd_u8(a, c);
+
+  uint8x8_t same = vmvn_u8(veor_u8(vcge_u8(a, c), vcge_u8(b, c)));
+  uint8x8_t pc = vbsl_u8(same, vqadd_u8(pa, pb), vabd_u8(pa, pb));
+
+  uint8x8_t ma = vand_u8(vcle_u8(pa, pb), vcle_u8(pa, pc));
+  uint8x8_t mb = vcle_u8(pb, pc);
+
+  return vbsl_u8(ma, a, vbsl_u8(mb, b, c));
+}
+
+// ----------------------------------------------------------------------------
+// [Sub]
+// ----------------------------------------------------------------------------
+
+// Each 16 BYTEs are prefix-summed independently (shifts and adds that don't
+// depend on the previous result), then the last pixel of the previous 16
+// BYTEs is broadcasted by VTBL (in the right phase, as 16 is not divisible by
+// 3 and 6) and added, which is the only sequential work per 16 BYTEs.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubNEON_T(uint8_t* p, uint32_t bpl) {
+  uint32_t i = bpl - bpp;
+
+  if (i >= 32) {
+    OPT_ALIGN(16) uint8_t firstIndex[16];
+    OPT_ALIGN(16) uint8_t lastIndex[16];
+
+    for (uint32_t k = 0; k < 16; k++) {
+      firstIndex[k] = static_cast<uint8_t>(k % bpp);
+      lastIndex[k] = static_cast<uint8_t>(16 - bpp + k % bpp);
+    }
+
+    uint8x16_t last = vld1q_u8(lastIndex);
+    uint8x16_t carry = vqtbl1q_u8(vld1q_u8(p), vld1q_u8(firstIndex));
+
+    // Process 16 BYTEs at a time.
+    while (i >= 16) {
+      uint8x16_t p0 = vld1q_u8(p + bpp);
+
+      p0 = vaddq_u8(p0, OptDePngSllNEON_T<bpp>(p0));
+      if (bpp * 2 < 16) p0 = vaddq_u8(p0, OptDePngSllNEON_T<bpp * 2>(p0));
+      if (bpp * 4 < 16) p0 = vaddq_u8(p0, OptDePngSllNEON_T<bpp * 4>(p0));
+      if (bpp * 8 < 16) p0 = vaddq_u8(p0, OptDePngSllNEON_T<bpp * 8>(p0));
+
+      p0 = vaddq_u8(p0, carry);
+      vst1q_u8(p + bpp, p0);
+      carry = vqtbl1q_u8(p0, last);
+
+      p += 16;
+      i -= 16;
+    }
+  }
+
+  for (; i != 0; i--, p++)
+    p[bpp] = Sum(p[bpp], p[0]);
+}
+
+// ----------------------------------------------------------------------------
+// [Up]
+// ----------------------------------------------------------------------------
+
+static OPT_INLINE void OptDePngUpNEON(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl;
+
+  // Process 64 BYTEs at a time.
+  while (i >= 64) {
+    uint8x16_t p0 = vaddq_u8(vld1q_u8(p     ), vld1q_u8(u     ));
+    uint8x16_t p1 = vaddq_u8(vld1q_u8(p + 16), vld1q_u8(u + 16));
+    uint8x16_t p2 = vaddq_u8(vld1q_u8(p + 32), vld1q_u8(u + 32));
+    uint8x16_t p3 = vaddq_u8(vld1q_u8(p + 48), vld1q_u8(u + 48));
+
+    vst1q_u8(p     , p0);
+    vst1q_u8(p + 16, p1);
+    vst1q_u8(p + 32, p2);
+    vst1q_u8(p + 48, p3);
+
+    p += 64;
+    u += 64;
+    i -= 64;
+  }
+
+  // Process 16 BYTEs at a time.
+  while (i >= 16) {
+    vst1q_u8(p, vaddq_u8(vld1q_u8(p), vld1q_u8(u)));
+
+    p += 16;
+    u += 16;
+    i -= 16;
+  }
+
+  for (; i != 0; i--, p++, u++)
+    p[0] = Sum(p[0], u[0]);
+}
+
+// Out-of-place `Up`, `dst = src + u`.
+static OPT_INLINE void OptDePngUpToNEON(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n) {
+  uint32_t i = n;
+
+  // Process 32 BYTEs at a time.
+  while (i >= 32) {
+    vst1q_u8(dst     , vaddq_u8(vld1q_u8(src     ), vld1q_u8(u     )));
+    vst1q_u8(dst + 16, vaddq_u8(vld1q_u8(src + 16), vld1q_u8(u + 16)));
+
+    dst += 32;
+    src += 32;
+    u += 32;
+    i -= 32;
+  }
+
+  for (; i != 0; i--, dst++, src++, u++)
+    dst[0] = Sum(src[0], u[0]);
+}
+
+// ----------------------------------------------------------------------------
+// [Avg]
+// ----------------------------------------------------------------------------
+
+// Avg filter of BYTEs [bpp, bpl), the first `bpp` BYTEs must be unfiltered.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngAvgNextNEON_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl - bpp;
+  u += bpp;
+
+  if (bpp <= 2) {
+    // Same approach as SSE2, `2Y + U` of 16 BYTEs is calculated by SIMD and
+    // the sequential part is `X' = (X + 2Y + U) >> 1`, 2BPP calculates both
+    // BYTEs of a pixel at once in two 16-bit cells of a 32-bit register.
+    union {
+      OPT_ALIGN(16) uint16_t u16[16];
+      uint32_t u32[8];
+    } sumData;
+    uint32_t x0 = bpp == 1 ? p[0] : p[0] | (static_cast<uint32_t>(p[1]) << 16);
+
+    // Process 16 BYTEs at a time.
+    while (i >= 16) {
+      uint8x16_t p0 = vld1q_u8(p + bpp);
+      uint8x16_t u0 = vld1q_u8(u);
+
+      vst1q_u16(sumData.u16    , vaddw_u8(vshll_n_u8(vget_low_u8 (p0), 1), vget_low_u8 (u0)));
+      vst1q_u16(sumData.u16 + 8, vaddw_u8(vshll_n_u8(vget_high_u8(p0), 1), vget_high_u8(u0)));
+
+      if (bpp == 1) {
+        for (uint32_t k = 0; k < 16; k++) {
+          x0 = ((x0 + sumData.u16[k]) >> 1) & 0xFF;
+          p[1 + k] = static_cast<uint8_t>(x0);
+        }
+      }
+      else {
+        for (uint32_t k = 0; k < 8; k++) {
+          x0 = ((x0 + sumData.u32[k]) >> 1) & 0x00FF00FF;
+          reinterpret_cast<uint16_t*>(p + 2)[k] = static_cast<uint16_t>(x0 | (x0 >> 8));
+        }
+      }
+
+      p += 16;
+      u += 16;
+      i -= 16;
+    }
+  }
+  else {
+    // A pixel is kept in a 64-bit register, so the sequential part is only
+    // VHADD and VADD. Loads and stores are not on the critical path.
+    if (i >= 8) {
+      uint8x8_t p0 = vld1_u8(p);
+
+      // Process one pixel at a time, while 8 BYTEs can be loaded.
+      do {
+        p0 = vadd_u8(vld1_u8(p + bpp), vhadd_u8(p0, vld1_u8(u)));
+        OptDePngStorePixelNEON_T<bpp>(p + bpp, p0);
+
+        p += bpp;
+        u += bpp;
+        i -= bpp;
+      } while (i >= 8);
+    }
+  }
+
+  for (; i != 0; i--, p++, u++)
+    p[bpp] = Sum(p[bpp], Avg(p[0], u[0]));
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngAvgNEON_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  for (uint32_t i = 0; i < bpp; i++)
+    p[i] = Sum(p[i], u[i] >> 1);
+
+  OptDePngAvgNextNEON_T<bpp>(p, u, bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Paeth]
+// ----------------------------------------------------------------------------
+
+// Paeth filter of BYTEs [bpp, bpl), the first `bpp` BYTEs must be unfiltered.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethNextNEON_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpp;
+
+  if (bpp <= 2) {
+    // Same approach as SSE2 1BPP, see `OptDePngPaethNextSSE2_T()`. For fixed
+    // `b` and `c` Paeth predicts `a` except when `a` falls into one of two
+    // adjacent ranges where it predicts `b` or `c`. The bounds of these ranges
+    // are calculated by SIMD, 2BPP interleaves two independent sequences.
+    OPT_ALIGN(16) int16_t rangeData[4][16];
+
+    uint32_t x0 = p[0];
+    uint32_t x1 = p[bpp - 1];
+
+    int16x8_t none = vdupq_n_s16(0x7FFF);
+    int16x8_t one = vdupq_n_s16(1);
+
+    // Process 16 BYTEs at a time.
+    for (; i + 16 <= bpl; i += 16) {
+      for (uint32_t k = 0; k < 2; k++) {
+        int16x8_t b0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + i + k * 8      )));
+        int16x8_t c0 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + i + k * 8 - bpp)));
+
+        int16x8_t d0 = vsubq_s16(b0, c0);
+        int16x8_t m0 = vabsq_s16(d0);
+        int16x8_t h0 = vshrq_n_s16(m0, 1);
+        uint16x8_t gt = vcgtq_s16(d0, vdupq_n_s16(0));
+        uint16x8_t eq = vceqq_s16(d0, vdupq_n_s16(0));
+
+        // Lower bound of the `b` and `c` range, `none` makes them empty.
+        int16x8_t bLo = vbslq_s16(gt, vsubq_s16(c0, h0), vaddq_s16(b0, one));
+        int16x8_t cLo = vbslq_s16(gt, vsubq_s16(vaddq_s16(c0, one), vaddq_s16(m0, m0)),
+                                      vaddq_s16(vaddq_s16(c0, h0), one));
+
+        bLo = vbslq_s16(eq, none, bLo);
+        cLo = vbslq_s16(eq, none, cLo);
+
+        // Length of the `b` and `c` range minus one.
+        int16x8_t bLen = vsubq_s16(vaddq_s16(m0, h0), one);
+        int16x8_t cLen = vsubq_s16(vsubq_s16(vaddq_s16(m0, m0), h0), vaddq_s16(one, one));
+
+        vst1q_s16(&rangeData[0][k * 8], bLo);
+        vst1q_s16(&rangeData[1][k * 8], bLen);
+        vst1q_s16(&rangeData[2][k * 8], cLo);
+        vst1q_s16(&rangeData[3][k * 8], cLen);
+      }
+
+      for (uint32_t k = 0; k < 16; k += bpp) {
+        uint32_t b0 = u[i + k];
+        uint32_t c0 = u[i + k - bpp];
+
+        uint32_t y0 = static_cast<uint32_t>(static_cast<int32_t>(x0) - rangeData[0][k]) <= static_cast<uint16_t>(rangeData[1][k]) ? b0 : x0;
+        y0 = static_cast<uint32_t>(static_cast<int32_t>(x0) - rangeData[2][k]) <= static_cast<uint16_t>(rangeData[3][k]) ? c0 : y0;
+
+        x0 = (static_cast<uint32_t>(p[i + k]) + y0) & 0xFF;
+        p[i + k] = static_cast<uint8_t>(x0);
+
+        if (bpp == 2) {
+          uint32_t b1 = u[i + k + 1];
+          uint32_t c1 = u[i + k - 1];
+
+          uint32_t y1 = static_cast<uint32_t>(static_cast<int32_t>(x1) - rangeData[0][k + 1]) <= static_cast<uint16_t>(rangeData[1][k + 1]) ? b1 : x1;
+          y1 = static_cast<uint32_t>(static_cast<int32_t>(x1) - rangeData[2][k + 1]) <= static_cast<uint16_t>(rangeData[3][k + 1]) ? c1 : y1;
+
+          x1 = (static_cast<uint32_t>(p[i + k + 1]) + y1) & 0xFF;
+          p[i + k + 1] = static_cast<uint8_t>(x1);
+        }
+      }
+    }
+  }
+  else {
+    // A pixel is kept in a 64-bit register, `b` and `c` are loaded directly.
+    if (i + 8 <= bpl) {
+      uint8x8_t p0 = vld1_u8(p);
+
+      // Process one pixel at a time, while 8 BYTEs can be loaded.
+      do {
+        uint8x8_t b0 = vld1_u8(u + i);
+        uint8x8_t c0 = vld1_u8(u + i - bpp);
+
+        p0 = vadd_u8(vld1_u8(p + i), OptDePngPaethNEON(p0, b0, c0));
+        OptDePngStorePixelNEON_T<bpp>(p + i, p0);
+
+        i += bpp;
+      } while (i + 8 <= bpl);
+    }
+  }
+
+  for (; i < bpl; i++)
+    p[i] = Sum(p[i], PaethOpt(p[i - bpp], u[i], u[i - bpp]));
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethNEON_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  // Paeth of the first pixel is `Up`, as both `Left` and `UpLeft` are zero.
+  for (uint32_t i = 0; i < bpp; i++)
+    p[i] = Sum(p[i], u[i]);
+
+  OptDePngPaethNextNEON_T<bpp>(p, u, bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Generic]
+// ----------------------------------------------------------------------------
+
+// Generic kernels handle any `bpp` that has no specialized kernel, the same way
+// as the SSE2 generic kernels. If `bpp >= 8` each BYTE depends on a BYTE that
+// is at least 8 BYTEs back, so 8 (or 16 if `bpp >= 16`) BYTEs can be unfiltered
+// at a time. These kernels unfilter BYTEs [i, n), `i` must be at least `bpp`.
+static OPT_INLINE void OptDePngSubNEON_Generic(uint8_t* p, uint32_t bpp, uint32_t i, uint32_t n) {
+  if (bpp >= 16) {
+    for (; i + 16 <= n; i += 16)
+      vst1q_u8(p + i, vaddq_u8(vld1q_u8(p + i), vld1q_u8(p + i - bpp)));
+  }
+
+  if (bpp >= 8) {
+    for (; i + 8 <= n; i += 8)
+      vst1_u8(p + i, vadd_u8(vld1_u8(p + i), vld1_u8(p + i - bpp)));
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], p[i - bpp]);
+}
+
+static OPT_INLINE void OptDePngAvgNEON_Generic(uint8_t* p, uint8_t* u, uint32_t bpp, uint32_t i, uint32_t n) {
+  if (bpp >= 16) {
+    for (; i + 16 <= n; i += 16)
+      vst1q_u8(p + i, vaddq_u8(vld1q_u8(p + i), vhaddq_u8(vld1q_u8(p + i - bpp), vld1q_u8(u + i))));
+  }
+
+  if (bpp >= 8) {
+    for (; i + 8 <= n; i += 8)
+      vst1_u8(p + i, vadd_u8(vld1_u8(p + i), vhadd_u8(vld1_u8(p + i - bpp), vld1_u8(u + i))));
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], Avg(p[i - bpp], u[i]));
+}
+
+static OPT_INLINE void OptDePngPaethNEON_Generic(uint8_t* p, uint8_t* u, uint32_t bpp, uint32_t i, uint32_t n) {
+  if (bpp >= 8) {
+    for (; i + 8 <= n; i += 8) {
+      uint8x8_t a0 = vld1_u8(p + i - bpp);
+      uint8x8_t b0 = vld1_u8(u + i);
+      uint8x8_t c0 = vld1_u8(u + i - bpp);
+      vst1_u8(p + i, vadd_u8(vld1_u8(p + i), OptDePngPaethNEON(a0, b0, c0)));
+    }
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], PaethOpt(p[i - bpp], u[i], u[i - bpp]));
+}
+
+static OPT_INLINE void OptDePngSpanNEON_Generic(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  uint32_t i = x0;
+
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst(p, bpp, x0, x1);
+      return;
+    }
+  }
+
+  switch (filter) {
+    case kPngFilterSub: {
+      OptDePngSubNEON_Generic(p, bpp, Max(i, bpp), x1);
+      break;
+    }
+
+    case kPngFilterUp: {
+      OptDePngUpNEON(p + i, u + i, x1 - i);
+      break;
+    }
+
+    case kPngFilterAvg: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i] >> 1);
+
+      OptDePngAvgNEON_Generic(p, u, bpp, i, x1);
+      break;
+    }
+
+    case kPngFilterPaeth: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i]);
+
+      OptDePngPaethNEON_Generic(p, u, bpp, i, x1);
+      break;
+    }
+  }
+}
+
+static OPT_INLINE void OptDePngFilterNEON_Generic(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = *p++;
+    OptDePngSpanNEON_Generic(p, u, filter, bpp, 0, bpl);
+
+    u = p;
+    p += bpl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Span]
+// ----------------------------------------------------------------------------
+
+// Unfilter BYTEs [x0, x1) of a row, see `OptDePngSpanFunc`.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSpanNEON_T(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t x0, uint32_t x1) {
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst_T<bpp>(p, x0, x1);
+      return;
+    }
+  }
+
+  if (x0 == 0) {
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubNEON_T<bpp>(p, x1); break;
+      case kPngFilterUp   : OptDePngUpNEON(p, u, x1); break;
+      case kPngFilterAvg  : OptDePngAvgNEON_T<bpp>(p, u, x1); break;
+      case kPngFilterPaeth: OptDePngPaethNEON_T<bpp>(p, u, x1); break;
+    }
+  }
+  else {
+    // Start at the last pixel of the previous span, which is unfiltered.
+    uint32_t n = x1 - x0 + bpp;
+    p += x0 - bpp;
+    u += x0 - bpp;
+
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubNEON_T<bpp>(p, n); break;
+      case kPngFilterUp   : OptDePngUpNEON(p + bpp, u + bpp, n - bpp); break;
+      case kPngFilterAvg  : OptDePngAvgNextNEON_T<bpp>(p, u, n); break;
+      case kPngFilterPaeth: OptDePngPaethNextNEON_T<bpp>(p, u, n); break;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Image]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterNEON_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  uint32_t y = h;
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  do {
+    uint32_t filter = *p++;
+
+    // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+    if (u == NULL)
+      filter = OptDePngFirstRowFilter(filter);
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubNEON_T<bpp>(p, bpl); break;
+      case kPngFilterUp   : OptDePngUpNEON(p, u, bpl); break;
+      case kPngFilterAvg  :
+        if (u != NULL)
+          OptDePngAvgNEON_T<bpp>(p, u, bpl);
+        else
+          OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        break;
+      case kPngFilterPaeth: OptDePngPaethNEON_T<bpp>(p, u, bpl); break;
+    }
+
+    u = p;
+    p += bpl;
+  } while (--y != 0);
+}
+
+// ----------------------------------------------------------------------------
+// [Entry Points]
+// ----------------------------------------------------------------------------
+
+uint32_t OptDePngFilterNEON(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterNEON_T<1>(p, h, bpl); break;
+    case 2: OptDePngFilterNEON_T<2>(p, h, bpl); break;
+    case 3: OptDePngFilterNEON_T<3>(p, h, bpl); break;
+    case 4: OptDePngFilterNEON_T<4>(p, h, bpl); break;
+    case 6: OptDePngFilterNEON_T<6>(p, h, bpl); break;
+    case 8: OptDePngFilterNEON_T<8>(p, h, bpl); break;
+    default: OptDePngFilterNEON_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanNEON(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanNEON_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanNEON_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanNEON_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanNEON_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanNEON_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanNEON_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanNEON_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+uint32_t OptDePngFilterNEONTo(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanNEON, OptDePngUpToNEON);
+}
+
+// There are no NEON converters yet, the portable ones are used instead.
+OptDePngConvertFunc OptDePngConvertGetNEON(uint32_t bpp, uint32_t format) {
+  return OptDePngConvertGetOpt(bpp, format);
+}
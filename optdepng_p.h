@@ -0,0 +1,488 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// [Guard]
+#ifndef _OPTDEPNG_P_H
+#define _OPTDEPNG_P_H
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./optglobals.h"
+#include "./optdepng.h"
+
+// ============================================================================
+// [Helpers]
+//
+// These are some inlines that are used across the reference and the optimized
+// code. The goal is to move some logic here so the implementation is not
+// polluted by code that can be easily moved out.
+// ============================================================================
+
+template<typename T> static T OPT_INLINE Min(T a, T b) { return a < b ? a : b; }
+template<typename T> static T OPT_INLINE Max(T a, T b) { return a > b ? a : b; }
+
+// Sum and pack to BYTE. The compiler should omit the `0xFF` as when the result
+// is stored in memory it's done automatically.
+static OPT_INLINE uint8_t Sum(uint32_t a, uint32_t b) {
+  return static_cast<uint8_t>((a + b) & 0xFF);
+}
+
+// Unsigned division by 3 translated into a multiplication and shift. The range
+// of `x` is [0, 255], inclusive. This means that we need at most 16 bits to
+// have the result. In SIMD this is exploited by using PMULHUW instruction that
+// will multiply and shift by 16 bits right (the constant is adjusted for that).
+static OPT_INLINE int32_t UDiv3(int32_t x) {
+  return (x * 0xAB) >> 9;
+}
+
+// Return an absolute value of `x`. This is used exclusively by `PaethRef()`
+// implementation. You can experiment by trying to make `Abs()` condition-
+// less, but since the `PaethOpt()` is using much better approach than the
+// reference implementation it probably doesn't matter at all.
+static OPT_INLINE int32_t Abs(int32_t x) {
+  return x >= 0 ? x : -x;
+}
+
+// Reference implementation of PNG's AVG reverse filter. Please note that the
+// SIMD functions (PAVGB, PAVGW) are not equal to the AVG method required by
+// PNG; SSE2 instructions add `1` before the result is shifted, thus becomes
+// rounded instead of truncated.
+static OPT_INLINE uint32_t Avg(uint32_t a, uint32_t b) {
+  return (a + b) >> 1;
+}
+
+// Reference implementation of PNG's Paeth reverse filter. This implementation
+// follows the specification pretty closely with only minor optimizations done.
+// This implementation is found in many PNG decoders; good to test against.
+static OPT_INLINE uint32_t PaethRef(uint32_t b, uint32_t a, uint32_t c) {
+  int32_t pa = static_cast<int32_t>(b) - static_cast<int32_t>(c);
+  int32_t pb = static_cast<int32_t>(a) - static_cast<int32_t>(c);
+  int32_t pc = pa + pb;
+
+  pa = Abs(pa);
+  pb = Abs(pb);
+  pc = Abs(pc);
+
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// This is an optimized implementation of PNG's Paeth reference filter. This
+// optimization originally comes from my previous implementation where I tried
+// to simplify it to be more SIMD friendly. One interesting property of Paeth
+// filter is:
+//
+//   Paeth(a, b, c) == Paeth(b, a, c);
+//
+// Actually what the filter needs is a minimum and maximum of `a` and `b`, so
+// I based the implementation on getting those first. If you know `min(a, b)`
+// and `max(a, b)` you can divide the interval to be checked against `c`. This
+// requires division by 3, which is available above as `UDiv3()`.
+//
+// The previous implementation looked like:
+//
+//   static inline uint32_t Paeth(uint32_t a, uint32_t b, uint32_t c) {
+//     uint32_t minAB = Min(a, b);
+//     uint32_t maxAB = Max(a, b);
+//     uint32_t divAB = UDiv3(maxAB - minAB);
+//
+//     if (c <= minAB + divAB) return maxAB;
+//     if (c >= maxAB - divAB) return minAB;
+//
+//     return c;
+//   }
+//
+// Although it's not bad I tried to exploit more the idea of SIMD and masking.
+// The following code basically removes the need of any comparison, it relies
+// on bit shifting and performs an arithmetic (not logical) shift of signs
+// produced by `divAB + minAB` and `divAB - maxAB`, which are then used to mask
+// out `minAB` and `maxAB`. The `minAB` and `maxAB` can be negative after `c`
+// is subtracted, which will basically remove the original `c` if one of the
+// two additions is unmasked. The code can unmask either zero or one addition,
+// but it never unmasks both.
+//
+// Don't hesitate to contact the author <kobalicek.petr@gmail.com> if you need
+// a further explanation of the code below, it's probably hard to understand
+// without looking into the original Paeth implementation and without having a
+// visualization of the Paeth function.
+static OPT_INLINE uint32_t PaethOpt(uint32_t a, uint32_t b, uint32_t c) {
+  int32_t minAB = static_cast<int32_t>(Min(a, b));
+  int32_t maxAB = static_cast<int32_t>(Max(a, b));
+  int32_t divAB = UDiv3(maxAB - minAB);
+
+  minAB -= static_cast<int32_t>(c);
+  maxAB -= static_cast<int32_t>(c);
+
+  return static_cast<uint32_t>(c + (maxAB & ~((divAB + minAB) >> 31)) +
+                                   (minAB & ~((divAB - maxAB) >> 31)) );
+}
+
+// ============================================================================
+// [Validation]
+// ============================================================================
+
+// Check that `bpp` and `bpl` describe rows that contain at least one pixel.
+static OPT_INLINE uint32_t OptDePngValidate(uint32_t bpp, uint32_t bpl) {
+  if (bpp == 0 || bpl <= bpp || (bpl - 1) % bpp != 0)
+    return kOptDePngErrorInvalidGeometry;
+  return kOptDePngErrorOk;
+}
+
+// ============================================================================
+// [First Row]
+//
+// The first row of an image has no previous row, which the PNG specification
+// defines as a row of zeros. Instead of allocating a zero row the filters are
+// simplified: `Up` is a no-op, `Paeth` always predicts the left pixel so it's
+// the same as `Sub`, and `Avg` adds only a half of the left pixel (the first
+// pixel isn't changed at all). `Avg` is the only one that needs a new kernel.
+// ============================================================================
+
+// Get a filter that unfilters the first row the same way as `filter`, but
+// without reading the previous row. `Avg` is returned as is and must be passed
+// to `OptDePngAvgFirst_T()`.
+static OPT_INLINE uint32_t OptDePngFirstRowFilter(uint32_t filter) {
+  if (filter == kPngFilterUp   ) return kPngFilterNone;
+  if (filter == kPngFilterPaeth) return kPngFilterSub;
+  return filter;
+}
+
+// Unfilter BYTEs [x0, x1) of the first row that uses `Avg` filter. Each pixel
+// depends on the previous one, so there is not much to gain by using SIMD.
+static OPT_INLINE void OptDePngAvgFirst(uint8_t* p, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  for (uint32_t i = Max<uint32_t>(x0, bpp); i < x1; i++)
+    p[i] = Sum(p[i], p[i - bpp] >> 1);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngAvgFirst_T(uint8_t* p, uint32_t x0, uint32_t x1) {
+  OptDePngAvgFirst(p, bpp, x0, x1);
+}
+
+// ============================================================================
+// [Profiling]
+//
+// Kernels report BYTEs they handle by scalar code through these macros, they
+// are no-ops unless `OPT_DEPNG_PROFILE` is defined. Stats are only collected
+// while `OptDePngProfileStats` is set by `OptDePngFilterSSE2Profile()`.
+// ============================================================================
+
+#if defined(OPT_DEPNG_PROFILE)
+// Defined in `optdepng_sse2.cpp`, shared by all translation units.
+extern OptDePngStats* OptDePngProfileStats;
+
+# define OPT_DEPNG_PROFILE_SCALAR(filter, n) \
+  do { \
+    if (OptDePngProfileStats != NULL) \
+      OptDePngProfileStats->scalarBytes[filter] += (n); \
+  } while (0)
+
+# define OPT_DEPNG_PROFILE_ROW_BEGIN() \
+  uint64_t profileStart = OptClock::tsc()
+
+# define OPT_DEPNG_PROFILE_ROW_END(filter, n) \
+  do { \
+    if (OptDePngProfileStats != NULL) { \
+      OptDePngProfileStats->rows[filter]++; \
+      OptDePngProfileStats->bytes[filter] += (n); \
+      OptDePngProfileStats->cycles[filter] += OptClock::tsc() - profileStart; \
+    } \
+  } while (0)
+#else
+# define OPT_DEPNG_PROFILE_SCALAR(filter, n) do {} while (0)
+# define OPT_DEPNG_PROFILE_ROW_BEGIN() do {} while (0)
+# define OPT_DEPNG_PROFILE_ROW_END(filter, n) do {} while (0)
+#endif // OPT_DEPNG_PROFILE
+
+// ============================================================================
+// [Spans]
+//
+// Span functions unfilter BYTEs [x0, x1) of a single row, where `p` points to
+// the first BYTE of the row (after the filter ID) and `u` to the first BYTE of
+// the previous row, which is NULL if `p` is the first row. If `x0` is not zero
+// it must be a multiple of `bpp` and all BYTEs that precede `x0` in both rows
+// must be already unfiltered. They are used by drivers that split rows into
+// tiles processed out of the row order.
+// ============================================================================
+
+void OptDePngSpanOpt(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+void OptDePngSpanSSE2(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+void OptDePngSpanSSSE3(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+void OptDePngSpanAVX2(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+void OptDePngSpanAVX512(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+void OptDePngSpanNEON(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1);
+
+// Get the span function that matches `OptDePngFilterGetBest()`.
+OptDePngSpanFunc OptDePngSpanGetBest();
+
+// ============================================================================
+// [Out-of-Place]
+//
+// Out-of-place filters copy each row to `dst` and unfilter it there by using
+// the span function of the implementation, so the previous row is read from
+// `dst` as well and SIMD code works with aligned rows. `Up` is the only filter
+// that is fused with the copy as it doesn't depend on the left pixel.
+// ============================================================================
+
+typedef void (*OptDePngUpToFunc)(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n);
+
+static OPT_INLINE uint32_t OptDePngFilterTo_Driver(
+  uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl,
+  OptDePngSpanFunc span, OptDePngUpToFunc upTo) {
+
+  uint32_t err = OptDePngValidate(bpp, srcBpl);
+  uint32_t rowSize = srcBpl - 1;
+
+  if (err == kOptDePngErrorOk && h > 1 && static_cast<uintptr_t>(dstStride < 0 ? -dstStride : dstStride) < rowSize)
+    err = kOptDePngErrorInvalidGeometry;
+
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  uint8_t* u = NULL;
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = src[0];
+
+    if (filter == kPngFilterUp && u != NULL) {
+      upTo(dst, src + 1, u, rowSize);
+    }
+    else {
+      ::memcpy(dst, src + 1, rowSize);
+      if (filter != kPngFilterNone)
+        span(dst, u, filter, bpp, 0, rowSize);
+    }
+
+    u = dst;
+    dst += dstStride;
+    src += srcBpl;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+// ============================================================================
+// [Padded]
+//
+// Filters of the padded layout, see `OptDePngFilterPadded()`. The driver is
+// used by implementations that have no kernels for the layout, it unfilters
+// each row by the span function and ignores the slack.
+// ============================================================================
+
+// Check the requirements of the padded layout.
+static OPT_INLINE uint32_t OptDePngValidatePadded(const uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  if (OptAlignDiff(p + 1, 16) != 0 || (stride & 15) != 0 || (h > 1 && stride < OptDePngGetPaddedStride(bpl)))
+    return kOptDePngErrorInvalidGeometry;
+  return kOptDePngErrorOk;
+}
+
+static OPT_INLINE void OptDePngFilterPadded_Driver(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl, OptDePngSpanFunc span) {
+  uint8_t* u = NULL;
+  p++;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = p[-1];
+    if (filter != kPngFilterNone)
+      span(p, u, filter, bpp, 0, bpl - 1);
+
+    u = p;
+    p += stride;
+  }
+}
+
+// ============================================================================
+// [Batch]
+//
+// Batch functions unfilter `count` valid images of the same `bpp`, which is
+// one of 1, 2, 3, 4, 6 and 8. They are only used for images whose rows have
+// at most `OPT_DEPNG_BATCH_MAX_ROW` BYTEs (without the filter ID), larger ones
+// are unfiltered by the filter function of the implementation.
+// ============================================================================
+
+#define OPT_DEPNG_BATCH_MAX_ROW 64
+
+typedef void (*OptDePngBatchFunc)(OptDePngBatchItem* const* items, size_t count, uint32_t bpp);
+
+void OptDePngBatchSSE2(OptDePngBatchItem* const* items, size_t count, uint32_t bpp);
+void OptDePngBatchAVX512(OptDePngBatchItem* const* items, size_t count, uint32_t bpp);
+
+// ============================================================================
+// [Large]
+//
+// Row copy functions of `OptDePngFilterToLarge()`. The load function copies a
+// source row into a row buffer that stays in L1 and prefetches the source rows
+// that follow, the store function copies an unfiltered row to the output by
+// using non-temporal stores so the output doesn't evict the source from cache.
+// ============================================================================
+
+typedef void (*OptDePngCopyFunc)(uint8_t* dst, const uint8_t* src, uint32_t n);
+
+void OptDePngLoadRowSSE2(uint8_t* dst, const uint8_t* src, uint32_t n);
+void OptDePngStoreRowSSE2(uint8_t* dst, const uint8_t* src, uint32_t n);
+
+// ============================================================================
+// [Forward]
+//
+// Forward filters run on rows of the source image, so unlike reverse filters
+// they have no dependency between pixels. `u` is the previous source row, the
+// first row uses a row of zeros, so the first row needs no special case.
+// ============================================================================
+
+// Filter one row by `filter`.
+typedef void (*OptDePngForwardRowFunc)(uint8_t* dst, const uint8_t* x, const uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t n);
+
+// Filter one row by `Sub`, `Up`, `Avg`, and `Paeth` into `dst[0..3]` and store
+// sums of absolute differences of all five filters (including `None`) to `sums`.
+typedef void (*OptDePngForwardAllFunc)(uint8_t* const* dst, uint64_t* sums, const uint8_t* x, const uint8_t* u, uint32_t bpp, uint32_t n);
+
+// Absolute value of a filtered BYTE taken as signed, used by the heuristic.
+static OPT_INLINE uint32_t OptDePngForwardCost(uint32_t v) {
+  return v < 128 ? v : 256 - v;
+}
+
+static OPT_INLINE uint32_t OptDePngForward_Driver(
+  uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter,
+  OptDePngForwardRowFunc rowFunc, OptDePngForwardAllFunc allFunc) {
+
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  uint32_t rowSize = bpl - 1;
+
+  if (err == kOptDePngErrorOk && h > 1 && static_cast<uintptr_t>(srcStride < 0 ? -srcStride : srcStride) < rowSize)
+    err = kOptDePngErrorInvalidGeometry;
+
+  if (err == kOptDePngErrorOk && filter > kOptDePngForwardAdaptive)
+    err = kOptDePngErrorInvalidFilter;
+
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  // A row of zeros followed by four candidate rows used by the adaptive mode,
+  // all aligned to 16 BYTEs.
+  bool adaptive = filter == kOptDePngForwardAdaptive;
+  uint32_t rowStride = (rowSize + 15) & ~15u;
+
+  uint8_t* buffer = static_cast<uint8_t*>(::malloc(static_cast<size_t>(rowStride) * (adaptive ? 5 : 1) + 16));
+  if (buffer == NULL)
+    return kOptDePngErrorOutOfMemory;
+
+  uint8_t* zero = buffer + OptAlignDiff(buffer, 16);
+  ::memset(zero, 0, rowSize);
+
+  uint8_t* rows[4];
+  for (uint32_t i = 0; i < 4; i++)
+    rows[i] = zero + static_cast<size_t>(rowStride) * (i + 1);
+
+  const uint8_t* u = zero;
+  for (uint32_t y = 0; y < h; y++) {
+    if (adaptive) {
+      uint64_t sums[kPngFilterCount];
+      allFunc(rows, sums, src, u, bpp, rowSize);
+
+      // The first filter wins a tie, like in libpng.
+      uint32_t best = kPngFilterNone;
+      for (uint32_t i = 1; i < kPngFilterCount; i++)
+        if (sums[i] < sums[best])
+          best = i;
+
+      dst[0] = static_cast<uint8_t>(best);
+      ::memcpy(dst + 1, best == kPngFilterNone ? src : rows[best - 1], rowSize);
+    }
+    else {
+      dst[0] = static_cast<uint8_t>(filter);
+      rowFunc(dst + 1, src, u, filter, bpp, rowSize);
+    }
+
+    u = src;
+    src += srcStride;
+    dst += bpl;
+  }
+
+  ::free(buffer);
+  return kOptDePngErrorOk;
+}
+
+// ============================================================================
+// [Convert]
+//
+// Convert functions convert `w` unfiltered pixels from `src` to `dst`, see
+// `OptDePngFilterConvert()` for supported formats. Each implementation has a
+// getter that returns NULL if the combination of `bpp` and `format` is not
+// supported.
+// ============================================================================
+
+typedef void (*OptDePngConvertFunc)(uint8_t* dst, const uint8_t* src, uint32_t w);
+
+OptDePngConvertFunc OptDePngConvertGetOpt(uint32_t bpp, uint32_t format);
+OptDePngConvertFunc OptDePngConvertGetSSE2(uint32_t bpp, uint32_t format);
+OptDePngConvertFunc OptDePngConvertGetSSSE3(uint32_t bpp, uint32_t format);
+OptDePngConvertFunc OptDePngConvertGetAVX2(uint32_t bpp, uint32_t format);
+OptDePngConvertFunc OptDePngConvertGetAVX512(uint32_t bpp, uint32_t format);
+OptDePngConvertFunc OptDePngConvertGetNEON(uint32_t bpp, uint32_t format);
+
+// Calculate `x * a / 255` rounded to the nearest integer (exact).
+static OPT_INLINE uint32_t OptDePngMulDiv255(uint32_t x, uint32_t a) {
+  x = x * a + 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+// Convert pixels [i, w), SIMD implementations use it for their tails.
+template<uint32_t bpp, bool premultiply>
+static OPT_INLINE void OptDePngConvertOpt_T(uint8_t* dst, const uint8_t* src, uint32_t i, uint32_t w) {
+  dst += i * 4;
+  src += i * bpp;
+
+  for (; i < w; i++, dst += 4, src += bpp) {
+    uint32_t r = src[0];
+    uint32_t g = src[bpp >= 3 ? 1 : 0];
+    uint32_t b = src[bpp >= 3 ? 2 : 0];
+    uint32_t a = bpp == 2 ? src[1] : bpp == 4 ? src[3] : 0xFF;
+
+    if (premultiply && (bpp == 2 || bpp == 4)) {
+      r = OptDePngMulDiv255(r, a);
+      g = OptDePngMulDiv255(g, a);
+      b = OptDePngMulDiv255(b, a);
+    }
+
+    dst[0] = static_cast<uint8_t>(b);
+    dst[1] = static_cast<uint8_t>(g);
+    dst[2] = static_cast<uint8_t>(r);
+    dst[3] = static_cast<uint8_t>(a);
+  }
+}
+
+// ============================================================================
+// [CRC32C]
+//
+// Tables of CRC32C initialized in `optdepng.cpp`, also used by SIMD versions
+// as the tables can't be initialized by code compiled with ISA flags. `slice`
+// are the tables of slicing-by-8. `shift` appends `kOptDePngCrc32cBlock` zero
+// BYTEs to a CRC register, which is linear, so `shift(a) ^ b` is the register
+// of two consecutive blocks if `b` is the register of the second block that
+// started at zero. This combines CRCs of blocks calculated in parallel.
+// ============================================================================
+
+static const uint32_t kOptDePngCrc32cPoly = 0x82F63B78u;
+static const uint32_t kOptDePngCrc32cBlock = 256;
+
+struct OptDePngCrc32cTables {
+  uint32_t slice[8][256];
+  uint32_t shift[4][256];
+};
+
+extern const OptDePngCrc32cTables OptDePngCrc32cData;
+
+static OPT_INLINE uint32_t OptDePngCrc32cShift(uint32_t crc) {
+  const OptDePngCrc32cTables& t = OptDePngCrc32cData;
+  return t.shift[0][(crc      ) & 0xFF] ^ t.shift[1][(crc >>  8) & 0xFF] ^
+         t.shift[2][(crc >> 16) & 0xFF] ^ t.shift[3][(crc >> 24)       ];
+}
+
+// [Guard]
+#endif // _OPTDEPNG_P_H
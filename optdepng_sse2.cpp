@@ -0,0 +1,184 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_SSE2
+
+#include "./optdepng_p.h"
+#include "./optdepng_sse2_p.h"
+
+// ============================================================================
+// [Implementation - SSE2 Optimized]
+// ============================================================================
+
+uint32_t OptDePngFilterSSE2(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterSSE2_T<1>(p, h, bpl); break;
+    case 2: OptDePngFilterSSE2_T<2>(p, h, bpl); break;
+    case 3: OptDePngFilterSSE2_T<3>(p, h, bpl); break;
+    case 4: OptDePngFilterSSE2_T<4>(p, h, bpl); break;
+    case 6: OptDePngFilterSSE2_T<6>(p, h, bpl); break;
+    case 8: OptDePngFilterSSE2_T<8>(p, h, bpl); break;
+    default: OptDePngFilterSSE2_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanSSE2(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanSSE2_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanSSE2_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanSSE2_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanSSE2_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanSSE2_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanSSE2_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanSSE2_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+#if defined(OPT_DEPNG_PROFILE)
+OptDePngStats* OptDePngProfileStats;
+
+// Only the specialized kernels are instrumented, other `bpp` values use the
+// generic kernels and are not counted.
+uint32_t OptDePngFilterSSE2Profile(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl, OptDePngStats* stats) {
+  OptDePngProfileStats = stats;
+  uint32_t err = OptDePngFilterSSE2(p, h, bpp, bpl);
+  OptDePngProfileStats = NULL;
+
+  // Kernels only count scalar BYTEs, everything else was handled by SIMD.
+  for (uint32_t i = 0; i < kPngFilterCount; i++)
+    stats->simdBytes[i] = stats->bytes[i] - stats->scalarBytes[i];
+
+  return err;
+}
+#endif // OPT_DEPNG_PROFILE
+
+void OptDePngBatchSSE2(OptDePngBatchItem* const* items, size_t count, uint32_t bpp) {
+  switch (bpp) {
+    case 1: OptDePngBatchSSE2_T<1>(items, count); break;
+    case 2: OptDePngBatchSSE2_T<2>(items, count); break;
+    case 3: OptDePngBatchSSE2_T<3>(items, count); break;
+    case 4: OptDePngBatchSSE2_T<4>(items, count); break;
+    case 6: OptDePngBatchSSE2_T<6>(items, count); break;
+    case 8: OptDePngBatchSSE2_T<8>(items, count); break;
+  }
+}
+
+uint32_t OptDePngFilterSSE2To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanSSE2, OptDePngUpToSSE2);
+}
+
+uint32_t OptDePngFilterPaddedSSE2(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidatePadded(p, stride, h, bpp, bpl);
+  if (err != kOptDePngErrorOk)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterPaddedSSE2_T<1>(p, stride, h, bpl); break;
+    case 2: OptDePngFilterPaddedSSE2_T<2>(p, stride, h, bpl); break;
+    case 3: OptDePngFilterPaddedSSE2_T<3>(p, stride, h, bpl); break;
+    case 4: OptDePngFilterPaddedSSE2_T<4>(p, stride, h, bpl); break;
+    case 5: OptDePngFilterPaddedSSE2_T<5>(p, stride, h, bpl); break;
+    case 6: OptDePngFilterPaddedSSE2_T<6>(p, stride, h, bpl); break;
+    case 7: OptDePngFilterPaddedSSE2_T<7>(p, stride, h, bpl); break;
+    case 8: OptDePngFilterPaddedSSE2_T<8>(p, stride, h, bpl); break;
+    // A pixel doesn't fit in a half of a register.
+    default: OptDePngFilterPadded_Driver(p, stride, h, bpp, bpl, OptDePngSpanSSE2); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+OptDePngConvertFunc OptDePngConvertGetSSE2(uint32_t bpp, uint32_t format) {
+  return OptDePngConvertSelectSSE2(bpp, format);
+}
+
+static void OptDePngForwardRowSSE2(uint8_t* dst, const uint8_t* x, const uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t n) {
+  switch (filter) {
+    case kPngFilterNone : ::memcpy(dst, x, n); break;
+    case kPngFilterSub  : OptDePngForwardRowSSE2_T<kPngFilterSub  >(dst, x, u, bpp, n); break;
+    case kPngFilterUp   : OptDePngForwardRowSSE2_T<kPngFilterUp   >(dst, x, u, bpp, n); break;
+    case kPngFilterAvg  : OptDePngForwardRowSSE2_T<kPngFilterAvg  >(dst, x, u, bpp, n); break;
+    case kPngFilterPaeth: OptDePngForwardRowSSE2_T<kPngFilterPaeth>(dst, x, u, bpp, n); break;
+  }
+}
+
+uint32_t OptDePngForwardSSE2(uint8_t* dst, const uint8_t* src, intptr_t srcStride, uint32_t h, uint32_t bpp, uint32_t bpl, uint32_t filter) {
+  return OptDePngForward_Driver(dst, src, srcStride, h, bpp, bpl, filter, OptDePngForwardRowSSE2, OptDePngForwardAllSSE2);
+}
+
+// Distance of software prefetch in BYTEs (32 cache lines ahead). A shorter
+// distance or `_MM_HINT_NTA` measured slower, as the hardware prefetcher is
+// already ahead of them.
+#define OPT_DEPNG_PREFETCH_DISTANCE 2048
+
+// `dst` is the row buffer aligned to 64 BYTEs.
+void OptDePngLoadRowSSE2(uint8_t* dst, const uint8_t* src, uint32_t n) {
+  uint32_t i = n;
+
+  // Process 64 BYTEs (a cache line) at a time. Prefetch doesn't fault, so it
+  // can point past the end of the source.
+  while (i >= 64) {
+    _mm_prefetch(reinterpret_cast<const char*>(src) + OPT_DEPNG_PREFETCH_DISTANCE, _MM_HINT_T0);
+
+    __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src     ));
+    __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+    __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(dst     ), p0);
+    _mm_store_si128(reinterpret_cast<__m128i*>(dst + 16), p1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(dst + 32), p2);
+    _mm_store_si128(reinterpret_cast<__m128i*>(dst + 48), p3);
+
+    dst += 64;
+    src += 64;
+    i -= 64;
+  }
+
+  ::memcpy(dst, src, i);
+}
+
+// `src` is the row buffer, `dst` has any alignment. Only whole cache lines are
+// written by non-temporal stores, a partially written line would be flushed
+// from the write-combining buffer by several partial writes.
+void OptDePngStoreRowSSE2(uint8_t* dst, const uint8_t* src, uint32_t n) {
+  uint32_t i = n;
+
+  if (i >= 128) {
+    uint32_t j = OptAlignDiff(dst, 64);
+    ::memcpy(dst, src, j);
+
+    dst += j;
+    src += j;
+    i -= j;
+
+    while (i >= 64) {
+      __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src     ));
+      __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+      __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+      __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst     ), p0);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), p1);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), p2);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), p3);
+
+      dst += 64;
+      src += 64;
+      i -= 64;
+    }
+
+    // Make non-temporal stores globally visible before the row is returned.
+    _mm_sfence();
+  }
+
+  ::memcpy(dst, src, i);
+}
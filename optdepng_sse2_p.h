@@ -0,0 +1,2116 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// [Guard]
+#ifndef _OPTDEPNG_SSE2_P_H
+#define _OPTDEPNG_SSE2_P_H
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./optdepng_p.h"
+
+// ============================================================================
+// [Implementation - SSE2 Optimized]
+//
+// SSE2 kernels are shared by all x86 translation units. Each one includes
+// this file with its own `USE_...` macros and compiler flags, so the same
+// code is also compiled as SSSE3 and VEX encoded AVX2 code. Each kernel
+// unfilters a single row; `p` points to the first BYTE of the row (after
+// the filter ID), `u` to the first BYTE of the previous row, and `bpl` is
+// the number of BYTEs per row without the filter ID.
+// ============================================================================
+
+#define PNG_SSE_SLL_ADDB_1X(P0, T0, Shift) \
+  do { \
+    T0 = _mm_slli_si128(P0, Shift); \
+    P0 = _mm_add_epi8(P0, T0); \
+  } while (0)
+
+#define PNG_SSE_SLL_ADDB_2X(P0, T0, P1, T1, Shift) \
+  do { \
+    T0 = _mm_slli_si128(P0, Shift); \
+    T1 = _mm_slli_si128(P1, Shift); \
+    P0 = _mm_add_epi8(P0, T0); \
+    P1 = _mm_add_epi8(P1, T1); \
+  } while (0)
+
+// Calculate `Dst = BYTE(X + ((A + U) >> 1))` in 16-bit cells. PADDB wraps the
+// low BYTE of each cell and keeps its high BYTE zero as both inputs have it zero.
+#define PNG_SSE_AVG_1X(Dst, X, A, U) \
+  do { \
+    Dst = _mm_add_epi8(X, _mm_srli_epi16(_mm_add_epi16(A, U), 1)); \
+  } while (0)
+
+#define PNG_SSE_PAETH(Dst, A, B, C) \
+  do { \
+    __m128i MinAB = _mm_min_epi16(A, B); \
+    __m128i MaxAB = _mm_max_epi16(A, B); \
+    __m128i DivAB = _mm_mulhi_epu16(_mm_sub_epi16(MaxAB, MinAB), rcp3); \
+    \
+    MinAB = _mm_sub_epi16(MinAB, C); \
+    MaxAB = _mm_sub_epi16(MaxAB, C); \
+    \
+    Dst = _mm_add_epi16(C  , _mm_andnot_si128(_mm_srai_epi16(_mm_add_epi16(DivAB, MinAB), 15), MaxAB)); \
+    Dst = _mm_add_epi16(Dst, _mm_andnot_si128(_mm_srai_epi16(_mm_sub_epi16(DivAB, MaxAB), 15), MinAB)); \
+  } while (0)
+
+// ----------------------------------------------------------------------------
+// [Sub]
+// ----------------------------------------------------------------------------
+
+// This is one of the easiest filters to parallelize. Although it looks
+// like the data dependency is too high, it's simply additions, which are
+// really easy to parallelize. The following formula:
+//
+//     Y1' = BYTE(Y1 + Y0')
+//     Y2' = BYTE(Y2 + Y1')
+//     Y3' = BYTE(Y3 + Y2')
+//     Y4' = BYTE(Y4 + Y3')
+//
+// Expanded to (with byte casts removed, as they are implicit in our case):
+//
+//     Y1' = Y1 + Y0'
+//     Y2' = Y2 + Y1 + Y0'
+//     Y3' = Y3 + Y2 + Y1 + Y0'
+//     Y4' = Y4 + Y3 + Y2 + Y1 + Y0'
+//
+// Can be implemented like this by taking advantage of SIMD:
+//
+//     +-----------+-----------+-----------+-----------+----->
+//     |    Y1     |    Y2     |    Y3     |    Y4     | ...
+//     +-----------+-----------+-----------+-----------+----->
+//                   Shift by 1 and PADDB
+//     +-----------+-----------+-----------+-----------+
+//     |           |    Y1     |    Y2     |    Y3     | ----+
+//     +-----------+-----------+-----------+-----------+     |
+//                                                           |
+//     +-----------+-----------+-----------+-----------+     |
+//     |    Y1     |   Y1+Y2   |   Y2+Y3   |   Y3+Y4   | <---+
+//     +-----------+-----------+-----------+-----------+
+//                   Shift by 2 and PADDB
+//     +-----------+-----------+-----------+-----------+
+//     |           |           |    Y1     |   Y1+Y2   | ----+
+//     +-----------+-----------+-----------+-----------+     |
+//                                                           |
+//     +-----------+-----------+-----------+-----------+     |
+//     |    Y1     |   Y1+Y2   | Y1+Y2+Y3  |Y1+Y2+Y3+Y4| <---+
+//     +-----------+-----------+-----------+-----------+
+//
+// The size of the register doesn't matter here. The Y0' dependency has
+// been omitted to make the flow cleaner, however, it can be added to Y1
+// before processing or it can be shifter to the first cell so the first
+// addition would be performed against [Y0', Y1, Y2, Y3].
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubSSE2_T(uint8_t* p, uint32_t bpl) {
+  uint32_t i = bpl - bpp;
+
+  if (i >= 32) {
+    // Align to 16-BYTE boundary.
+    uint32_t j = OptAlignDiff(p + bpp, 16);
+    OPT_DEPNG_PROFILE_SCALAR(kPngFilterSub, j);
+    for (i -= j; j != 0; j--, p++)
+      p[bpp] = Sum(p[bpp], p[0]);
+
+    if (bpp == 1) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t2;
+
+      // Process 64 BYTEs at a time.
+      p0 = _mm_cvtsi32_si128(p[0]);
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 1));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 17));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 33));
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 49));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 1);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 2);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 4);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 1), p0);
+
+        p0 = _mm_srli_si128(p0, 15);
+        t2 = _mm_srli_si128(p2, 15);
+        p1 = _mm_add_epi8(p1, p0);
+        p3 = _mm_add_epi8(p3, t2);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 1);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 2);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 4);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 17), p1);
+
+        p1 = _mm_unpackhi_epi8(p1, p1);
+        p1 = _mm_unpackhi_epi16(p1, p1);
+        p1 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+
+        p2 = _mm_add_epi8(p2, p1);
+        p3 = _mm_add_epi8(p3, p1);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 33), p2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 49), p3);
+        p0 = _mm_srli_si128(p3, 15);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 1));
+
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 1);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 2);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 1), p0);
+        p0 = _mm_srli_si128(p0, 15);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 2) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t2;
+
+      // Process 64 BYTEs at a time.
+      p0 = _mm_cvtsi32_si128(reinterpret_cast<uint16_t*>(p)[0]);
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 2));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 18));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 34));
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 50));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 2);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 4);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 2), p0);
+
+        p0 = _mm_srli_si128(p0, 14);
+        t2 = _mm_srli_si128(p2, 14);
+        p1 = _mm_add_epi8(p1, p0);
+        p3 = _mm_add_epi8(p3, t2);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 2);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 4);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 18), p1);
+
+        p1 = _mm_unpackhi_epi16(p1, p1);
+        p1 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+
+        p2 = _mm_add_epi8(p2, p1);
+        p3 = _mm_add_epi8(p3, p1);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 34), p2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 50), p3);
+        p0 = _mm_srli_si128(p3, 14);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 2));
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 2);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 2), p0);
+        p0 = _mm_srli_si128(p0, 14);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 3) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t2;
+#if defined(USE_SSSE3)
+      __m128i ext3b = _mm_setr_epi8(13, 14, 15, 13, 14, 15, 13, 14, 15, 13, 14, 15, 13, 14, 15, 13);
+#else
+      __m128i ext3b = _mm_set1_epi32(0x01000001);
+#endif // USE_SSSE3
+
+      // Process 64 BYTEs at a time.
+      p0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0] & 0x00FFFFFFU);
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 3));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 19));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 35));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 3);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 6);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t2, 12);
+
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 51));
+        t0 = _mm_srli_si128(p0, 13);
+        t2 = _mm_srli_si128(p2, 13);
+
+        p1 = _mm_add_epi8(p1, t0);
+        p3 = _mm_add_epi8(p3, t2);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 3);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 6);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t2, 12);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p +  3), p0);
+
+#if defined(USE_SSSE3)
+        // Broadcast the last pixel of `p1` into all 16 BYTEs (PSHUFB).
+        p0 = _mm_shuffle_epi8(p1, ext3b);
+#else
+        p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+        p0 = _mm_srli_epi32(p0, 8);
+        p0 = _mm_mul_epu32(p0, ext3b);
+
+        p0 = _mm_shufflelo_epi16(p0, _MM_SHUFFLE(0, 2, 1, 0));
+        p0 = _mm_shufflehi_epi16(p0, _MM_SHUFFLE(1, 0, 2, 1));
+#endif // USE_SSSE3
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 19), p1);
+        p2 = _mm_add_epi8(p2, p0);
+        p0 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 3, 2, 1));
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 35), p2);
+        p0 = _mm_add_epi8(p0, p3);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 51), p0);
+        p0 = _mm_srli_si128(p0, 13);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 3));
+
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 3);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 6);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 12);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 3), p0);
+        p0 = _mm_srli_si128(p0, 13);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 4) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t1, t2;
+
+      // Process 64 BYTEs at a time.
+      p0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]);
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 4));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 20));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 36));
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 52));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 4);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+
+        p0 = _mm_srli_si128(p0, 12);
+        t2 = _mm_srli_si128(p2, 12);
+
+        p1 = _mm_add_epi8(p1, p0);
+        p3 = _mm_add_epi8(p3, t2);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 4);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 8);
+
+        p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 20), p1);
+
+        p2 = _mm_add_epi8(p2, p0);
+        p0 = _mm_add_epi8(p0, p3);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 36), p2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 52), p0);
+        p0 = _mm_srli_si128(p0, 12);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 4));
+
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 4);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+        p0 = _mm_srli_si128(p0, 12);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 6) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t1;
+
+#if defined(USE_SSSE3)
+      __m128i ext6b = _mm_setr_epi8(10, 11, 12, 13, 14, 15, 10, 11, 12, 13, 14, 15, 10, 11, 12, 13);
+#endif // USE_SSSE3
+
+      p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+      p0 = _mm_slli_epi64(p0, 16);
+      p0 = _mm_srli_epi64(p0, 16);
+
+      // Process 64 BYTEs at a time.
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 6));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 22));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 38));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 6);
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 12);
+
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 54));
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
+
+        p0 = _mm_srli_si128(p0, 10);
+        t1 = _mm_srli_si128(p2, 10);
+
+        p1 = _mm_add_epi8(p1, p0);
+        p3 = _mm_add_epi8(p3, t1);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 6);
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 12);
+
+#if defined(USE_SSSE3)
+        // Broadcast the last pixel of `p1` into all 16 BYTEs (PSHUFB).
+        p0 = _mm_shuffle_epi8(p1, ext6b);
+#else
+        p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 2, 3, 2));
+        p0 = _mm_shufflelo_epi16(p0, _MM_SHUFFLE(1, 3, 2, 1));
+        p0 = _mm_shufflehi_epi16(p0, _MM_SHUFFLE(2, 1, 3, 2));
+#endif // USE_SSSE3
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 22), p1);
+        p2 = _mm_add_epi8(p2, p0);
+        p0 = _mm_shuffle_epi32(p0, _MM_SHUFFLE(1, 3, 2, 1));
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 38), p2);
+        p0 = _mm_add_epi8(p0, p3);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 54), p0);
+        p0 = _mm_srli_si128(p0, 10);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 6));
+
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 6);
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 12);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
+        p0 = _mm_srli_si128(p0, 10);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 8) {
+      __m128i p0, p1, p2, p3;
+      __m128i t0, t1, t2;
+
+      // Process 64 BYTEs at a time.
+      p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+      while (i >= 64) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 8));
+        p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 24));
+        p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 40));
+        p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 56));
+
+        PNG_SSE_SLL_ADDB_2X(p0, t0, p2, t1, 8);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
+
+        p0 = _mm_srli_si128(p0, 8);
+        t2 = _mm_shuffle_epi32(p2, _MM_SHUFFLE(3, 2, 3, 2));
+        p1 = _mm_add_epi8(p1, p0);
+
+        PNG_SSE_SLL_ADDB_2X(p1, t0, p3, t1, 8);
+        p0 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 2, 3, 2));
+        p3 = _mm_add_epi8(p3, t2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 24), p1);
+
+        p2 = _mm_add_epi8(p2, p0);
+        p0 = _mm_add_epi8(p0, p3);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 40), p2);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 56), p0);
+        p0 = _mm_srli_si128(p0, 8);
+
+        p += 64;
+        i -= 64;
+      }
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        p0 = _mm_add_epi8(p0, *reinterpret_cast<__m128i*>(p + 8));
+        PNG_SSE_SLL_ADDB_1X(p0, t0, 8);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
+        p0 = _mm_srli_si128(p0, 8);
+
+        p += 16;
+        i -= 16;
+      }
+    }
+  }
+
+  OPT_DEPNG_PROFILE_SCALAR(kPngFilterSub, i);
+  for (; i != 0; i--, p++)
+    p[bpp] = Sum(p[bpp], p[0]);
+}
+
+// ----------------------------------------------------------------------------
+// [Up]
+// ----------------------------------------------------------------------------
+
+// This is actually the easiest filter that doesn't require any kind of
+// specialization for a particular BPP. Even C++ compiler like GCC is
+// able to parallelize a naive implementation. However, MSC compiler does
+// not parallelize the naive implementation so the SSE2 implementation
+// provided greatly boosted the performance on Windows.
+//
+//     +-----------+-----------+-----------+-----------+
+//     |    Y1     |    Y2     |    Y3     |    Y4     |
+//     +-----------+-----------+-----------+-----------+
+//                           PADDB
+//     +-----------+-----------+-----------+-----------+
+//     |    U1     |    U2     |    U3     |    U4     | ----+
+//     +-----------+-----------+-----------+-----------+     |
+//                                                           |
+//     +-----------+-----------+-----------+-----------+     |
+//     |   Y1+U1   |   Y2+U2   |   Y3+U3   |   Y4+U4   | <---+
+//     +-----------+-----------+-----------+-----------+
+static OPT_INLINE void OptDePngUpSSE2(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl;
+
+  if (i >= 24) {
+    // Align to 16-BYTE boundary.
+    uint32_t j = OptAlignDiff(p, 16);
+    OPT_DEPNG_PROFILE_SCALAR(kPngFilterUp, j);
+    for (i -= j; j != 0; j--, p++, u++)
+      p[0] = Sum(p[0], u[0]);
+
+    // Process 64 BYTEs at a time.
+    while (i >= 64) {
+      __m128i u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+      __m128i u1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 16));
+
+      __m128i p0 = _mm_load_si128 (reinterpret_cast<__m128i*>(p));
+      __m128i p1 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 16));
+
+      __m128i u2 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 32));
+      __m128i u3 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 48));
+
+      p0 = _mm_add_epi8(p0, u0);
+      p1 = _mm_add_epi8(p1, u1);
+
+      __m128i p2 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 32));
+      __m128i p3 = _mm_load_si128 (reinterpret_cast<__m128i*>(p + 48));
+
+      p2 = _mm_add_epi8(p2, u2);
+      p3 = _mm_add_epi8(p3, u3);
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(p     ), p0);
+      _mm_store_si128(reinterpret_cast<__m128i*>(p + 16), p1);
+      _mm_store_si128(reinterpret_cast<__m128i*>(p + 32), p2);
+      _mm_store_si128(reinterpret_cast<__m128i*>(p + 48), p3);
+
+      p += 64;
+      u += 64;
+      i -= 64;
+    }
+
+    // Process 8 BYTEs at a time.
+    while (i >= 8) {
+      __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
+      __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+
+      p0 = _mm_add_epi8(p0, u0);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), p0);
+
+      p += 8;
+      u += 8;
+      i -= 8;
+    }
+  }
+
+  OPT_DEPNG_PROFILE_SCALAR(kPngFilterUp, i);
+  for (; i != 0; i--, p++, u++)
+    p[0] = Sum(p[0], u[0]);
+}
+
+// Out-of-place `Up`, `dst = src + u`.
+static OPT_INLINE void OptDePngUpToSSE2(uint8_t* dst, const uint8_t* src, const uint8_t* u, uint32_t n) {
+  uint32_t i = n;
+
+  if (i >= 24) {
+    // Align to 16-BYTE boundary.
+    uint32_t j = OptAlignDiff(dst, 16);
+    for (i -= j; j != 0; j--, dst++, src++, u++)
+      dst[0] = Sum(src[0], u[0]);
+
+    // Process 32 BYTEs at a time.
+    while (i >= 32) {
+      __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+      __m128i u0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u));
+      __m128i u1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + 16));
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst     ), _mm_add_epi8(p0, u0));
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_add_epi8(p1, u1));
+
+      dst += 32;
+      src += 32;
+      u += 32;
+      i -= 32;
+    }
+
+    // Process 8 BYTEs at a time.
+    while (i >= 8) {
+      __m128i p0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+      __m128i u0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_add_epi8(p0, u0));
+
+      dst += 8;
+      src += 8;
+      u += 8;
+      i -= 8;
+    }
+  }
+
+  for (; i != 0; i--, dst++, src++, u++)
+    dst[0] = Sum(src[0], u[0]);
+}
+
+// ----------------------------------------------------------------------------
+// [Avg]
+// ----------------------------------------------------------------------------
+
+// Avg filter has a sequential dependency between a BYTE and the BYTE `bpp`
+// to its left, which is the hardest for low BPP values. Since `2*Y` is even
+// the truncating average can be written without the inner shift:
+//
+//     Y1' = byte((2*Y1 + U1 + Y0') >> 1)
+//     Y2' = byte((2*Y2 + U2 + Y1') >> 1)
+//     Y3' = byte((2*Y3 + U3 + Y2') >> 1)
+//     Y4' = byte((2*Y4 + U4 + Y3') >> 1)
+//     Y5' = ...
+//
+// 1 and 2 BPP calculate `2*Y + U` of 16 BYTEs by SIMD into `sumData` and the
+// remaining recurrence `X' = (X + Sum) >> 1` is a single add and shift per
+// pixel with the left pixel kept in a register. 3 BPP and more calculate
+// whole pixels in 16-bit cells, see the comments of each case.
+
+// Avg filter of BYTEs [bpp, bpl), the first `bpp` BYTEs must be unfiltered.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngAvgNextSSE2_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl - bpp;
+  u += bpp;
+
+  if (i >= 32) {
+    // Align to 16-BYTE boundary.
+    uint32_t j = OptAlignDiff(p + bpp, 16);
+    __m128i zero = _mm_setzero_si128();
+
+    OPT_DEPNG_PROFILE_SCALAR(kPngFilterAvg, j);
+    for (i -= j; j != 0; j--, p++, u++)
+      p[bpp] = Sum(p[bpp], Avg(p[0], u[0]));
+
+    if (bpp <= 2) {
+      // 1BPP and 2BPP have a sequential dependency that can't be parallelized
+      // as `Avg` truncates (PAVGB rounds up). The dependency chain is reduced
+      // to `X' = (X + 2Y + U) >> 1` by calculating `2Y + U` of 16 BYTEs with
+      // SIMD first, and the sequential part keeps the left pixel in register.
+      // 2BPP calculates both BYTEs of a pixel at once in two 16-bit cells of
+      // a 32-bit register, which matches the layout of `sumData`.
+      union {
+        OPT_ALIGN(16) uint16_t u16[16];
+        uint32_t u32[8];
+      } sumData;
+      uint32_t x0 = bpp == 1 ? p[0] : p[0] | (static_cast<uint32_t>(p[1]) << 16);
+
+      // The recurrence is computed by scalar code, so it's counted as scalar.
+      OPT_DEPNG_PROFILE_SCALAR(kPngFilterAvg, i & ~15u);
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + bpp));
+        __m128i u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+
+        __m128i s0 = _mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(p0, zero), 1), _mm_unpacklo_epi8(u0, zero));
+        __m128i s1 = _mm_add_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(p0, zero), 1), _mm_unpackhi_epi8(u0, zero));
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(sumData.u16    ), s0);
+        _mm_store_si128(reinterpret_cast<__m128i*>(sumData.u16 + 8), s1);
+
+        if (bpp == 1) {
+          for (uint32_t k = 0; k < 16; k++) {
+            x0 = ((x0 + sumData.u16[k]) >> 1) & 0xFF;
+            p[1 + k] = static_cast<uint8_t>(x0);
+          }
+        }
+        else {
+          for (uint32_t k = 0; k < 8; k++) {
+            x0 = ((x0 + sumData.u32[k]) >> 1) & 0x00FF00FF;
+            reinterpret_cast<uint16_t*>(p + 2)[k] = static_cast<uint16_t>(x0 | (x0 >> 8));
+          }
+        }
+
+        p += 16;
+        u += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 3) {
+      // 3 BPP has a sequential dependency as well, but the distance between
+      // two dependent BYTEs is 3, so it's possible to calculate 3 BYTEs at a
+      // time in 16-bit cells. The code always recalculates all 8 cells of a
+      // register from the previous result shifted by 3 cells; 3 iterations
+      // make all 8 cells valid:
+      //
+      //     +----+----+----+----+----+----+----+----+
+      //     | Z5 | Z6 | Z7 | Y0'| Y1'| Y2'| Y3'| Y4'|  <- Shifted by 3 cells
+      //     +----+----+----+----+----+----+----+----+
+      //                  BYTE(Y + ((Last + Up) >> 1))
+      //     +----+----+----+----+----+----+----+----+
+      //     | Y0'| Y1'| Y2'| Y3'| Y4'| Y5'| Y6'| Y7'|
+      //     +----+----+----+----+----+----+----+----+
+      //
+      // The carry `Z5..Z7` (last 3 BYTEs of the previous 8) would be shifted
+      // into the vacated cells, but as these cells are zero after the shift it
+      // can be added to `Up` instead, outside of the critical path. PALIGNR
+      // (SSSE3) was tried to shift the carry in, but it's not faster as it's
+      // still on the critical path, so all implementations share this code.
+      __m128i t1 = _mm_unpacklo_epi8(
+        _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0] & 0x00FFFFFFU), zero);
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        __m128i p0, p1;
+        __m128i u0, u1;
+        __m128i t0;
+
+        p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 3));
+        u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+
+        p1 = _mm_unpackhi_epi8(p0, zero);
+        p0 = _mm_unpacklo_epi8(p0, zero);
+        u1 = _mm_unpackhi_epi8(u0, zero);
+        u0 = _mm_unpacklo_epi8(u0, zero);
+
+        u0 = _mm_add_epi16(u0, t1);
+        t0 = _mm_add_epi8(p0, _mm_srli_epi16(u0, 1));
+        PNG_SSE_AVG_1X(t0, p0, _mm_slli_si128(t0, 6), u0);
+        PNG_SSE_AVG_1X(p0, p0, _mm_slli_si128(t0, 6), u0);
+
+        t1 = _mm_srli_si128(p0, 10);
+        u1 = _mm_add_epi16(u1, t1);
+        t0 = _mm_add_epi8(p1, _mm_srli_epi16(u1, 1));
+        PNG_SSE_AVG_1X(t0, p1, _mm_slli_si128(t0, 6), u1);
+        PNG_SSE_AVG_1X(p1, p1, _mm_slli_si128(t0, 6), u1);
+        t1 = _mm_srli_si128(p1, 10);
+
+        p0 = _mm_packus_epi16(p0, p1);
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 3), p0);
+
+        p += 16;
+        u += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 4) {
+      __m128i m00FF = _mm_set1_epi16(0x00FF);
+      __m128i m01FF = _mm_set1_epi16(0x01FF);
+
+      __m128i t1 = _mm_unpacklo_epi8(
+        _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]), zero);
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        __m128i p0, p1;
+        __m128i u0, u1;
+
+        p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 4));
+        u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+
+        p1 = p0;                          // HI | Move Ln
+        p0 = _mm_unpacklo_epi8(p0, zero); // LO | Unpack Ln
+
+        u1 = u0;                          // HI | Move Up
+        p0 = _mm_slli_epi16(p0, 1);       // LO | << 1
+
+        u0 = _mm_unpacklo_epi8(u0, zero); // LO | Unpack Up
+        p0 = _mm_add_epi16(p0, t1);       // LO | Add Last
+
+        p1 = _mm_unpackhi_epi8(p1, zero); // HI | Unpack Ln
+        p0 = _mm_add_epi16(p0, u0);       // LO | Add Up
+        p0 = _mm_and_si128(p0, m01FF);    // LO | & 0x01FE
+
+        u1 = _mm_unpackhi_epi8(u1, zero); // HI | Unpack Up
+        t1 = _mm_slli_si128(p0, 8);       // LO | Get Last
+        p0 = _mm_slli_epi16(p0, 1);       // LO | << 1
+
+        p1 = _mm_slli_epi16(p1, 1);       // HI | << 1
+        p0 = _mm_add_epi16(p0, t1);       // LO | Add Last
+        p0 = _mm_srli_epi16(p0, 2);       // LO | >> 2
+
+        p1 = _mm_add_epi16(p1, u1);       // HI | Add Up
+        p0 = _mm_and_si128(p0, m00FF);    // LO | & 0x00FF
+        t1 = _mm_srli_si128(p0, 8);       // LO | Get Last
+
+        p1 = _mm_add_epi16(p1, t1);       // HI | Add Last
+        p1 = _mm_and_si128(p1, m01FF);    // HI | & 0x01FE
+
+        t1 = _mm_slli_si128(p1, 8);       // HI | Get Last
+        p1 = _mm_slli_epi16(p1, 1);       // HI | << 1
+
+        t1 = _mm_add_epi16(t1, p1);       // HI | Add Last
+        t1 = _mm_srli_epi16(t1, 2);       // HI | >> 2
+        t1 = _mm_and_si128(t1, m00FF);    // HI | & 0x00FF
+
+        p0 = _mm_packus_epi16(p0, t1);
+        t1 = _mm_srli_si128(t1, 8);       // HI | Get Last
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+
+        p += 16;
+        u += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 6) {
+      __m128i t1 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+
+      // Process 16 BYTEs at a time.
+      while (i >= 16) {
+        __m128i p0, p1, p2;
+        __m128i u0, u1, u2;
+
+        u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+        t1 = _mm_unpacklo_epi8(t1, zero);
+        p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 6));
+
+        p1 = _mm_srli_si128(p0, 6);       // P1 | Extract
+        u1 = _mm_srli_si128(u0, 6);       // P1 | Extract
+
+        p2 = _mm_srli_si128(p0, 12);      // P2 | Extract
+        u2 = _mm_srli_si128(u0, 12);      // P2 | Extract
+
+        p0 = _mm_unpacklo_epi8(p0, zero); // P0 | Unpack
+        u0 = _mm_unpacklo_epi8(u0, zero); // P0 | Unpack
+
+        p1 = _mm_unpacklo_epi8(p1, zero); // P1 | Unpack
+        u1 = _mm_unpacklo_epi8(u1, zero); // P1 | Unpack
+
+        p2 = _mm_unpacklo_epi8(p2, zero); // P2 | Unpack
+        u2 = _mm_unpacklo_epi8(u2, zero); // P2 | Unpack
+
+        u0 = _mm_add_epi16(u0, t1);       // P0 | Add Last
+        u0 = _mm_srli_epi16(u0, 1);       // P0 | >> 1
+        p0 = _mm_add_epi8(p0, u0);        // P0 | Add (Up+Last)/2
+
+        u1 = _mm_add_epi16(u1, p0);       // P1 | Add P0
+        u1 = _mm_srli_epi16(u1, 1);       // P1 | >> 1
+        p1 = _mm_add_epi8(p1, u1);        // P1 | Add (Up+Last)/2
+
+        u2 = _mm_add_epi16(u2, p1);       // P2 | Add P1
+        u2 = _mm_srli_epi16(u2, 1);       // P2 | >> 1
+        p2 = _mm_add_epi8(p2, u2);        // P2 | Add (Up+Last)/2
+
+        p0 = _mm_slli_si128(p0, 4);
+        p0 = _mm_packus_epi16(p0, p1);
+        p0 = _mm_slli_si128(p0, 2);
+        p0 = _mm_srli_si128(p0, 4);
+
+        p2 = _mm_packus_epi16(p2, p2);
+        p2 = _mm_slli_si128(p2, 12);
+        p0 = _mm_or_si128(p0, p2);
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
+        t1 = _mm_srli_si128(p0, 10);
+
+        p += 16;
+        u += 16;
+        i -= 16;
+      }
+    }
+    else if (bpp == 8) {
+      // Process 16 BYTEs at a time.
+      __m128i t1 = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
+
+      while (i >= 16) {
+        __m128i p0, p1;
+        __m128i u0, u1;
+
+        u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+        p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 8));
+
+        u1 = u0;                          // HI | Move Up
+        p1 = p0;                          // HI | Move Ln
+        u0 = _mm_unpacklo_epi8(u0, zero); // LO | Unpack Up
+        p0 = _mm_unpacklo_epi8(p0, zero); // LO | Unpack Ln
+
+        u0 = _mm_add_epi16(u0, t1);       // LO | Add Last
+        p1 = _mm_unpackhi_epi8(p1, zero); // HI | Unpack Ln
+        u0 = _mm_srli_epi16(u0, 1);       // LO | >> 1
+        u1 = _mm_unpackhi_epi8(u1, zero); // HI | Unpack Up
+
+        p0 = _mm_add_epi8(p0, u0);        // LO | Add (Up+Last)/2
+        u1 = _mm_add_epi16(u1, p0);       // HI | Add LO
+        u1 = _mm_srli_epi16(u1, 1);       // HI | >> 1
+        p1 = _mm_add_epi8(p1, u1);        // HI | Add (Up+LO)/2
+
+        p0 = _mm_packus_epi16(p0, p1);
+        t1 = p1;                          // HI | Get Last
+        _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
+
+        p += 16;
+        u += 16;
+        i -= 16;
+      }
+    }
+  }
+
+  OPT_DEPNG_PROFILE_SCALAR(kPngFilterAvg, i);
+  for (; i != 0; i--, p++, u++)
+    p[bpp] = Sum(p[bpp], Avg(p[0], u[0]));
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngAvgSSE2_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  OPT_DEPNG_PROFILE_SCALAR(kPngFilterAvg, bpp);
+  for (uint32_t i = 0; i < bpp; i++)
+    p[i] = Sum(p[i], u[i] >> 1);
+
+  OptDePngAvgNextSSE2_T<bpp>(p, u, bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Paeth]
+// ----------------------------------------------------------------------------
+
+// Paeth filter of BYTEs [bpp, bpl), the first `bpp` BYTEs must be unfiltered.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethNextSSE2_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i;
+
+  if (bpp == 1) {
+    // 1BPP has a sequential dependency on the left pixel `a`, but `b` and `c`
+    // are known in advance. For fixed `b` and `c` Paeth predicts `a` except
+    // when `a` falls into one of two adjacent ranges where it predicts `b` or
+    // `c`, respectively. With `m = |b - c|` and `h = m >> 1` these ranges are:
+    //
+    //   b > c: `c` if a in [c - 2m + 1, c - h - 1], `b` if a in [c - h, b - 1]
+    //   b < c: `b` if a in [b + 1, c + h], `c` if a in [c + h + 1, c + 2m - 1]
+    //
+    // Both ranges are empty if `m` is zero. SIMD code calculates the bounds of
+    // 16 pixels at a time, which leaves only two range checks (an unsigned
+    // comparison each) in the sequential part.
+    OPT_ALIGN(16) int16_t rangeData[4][16];
+
+    uint32_t pz = p[0];
+    uint32_t uz = u[0];
+    uint32_t u0;
+
+    // The recurrence is computed by scalar code, so it's counted as scalar.
+    OPT_DEPNG_PROFILE_SCALAR(kPngFilterPaeth, bpl - 1);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i none = _mm_set1_epi16(0x7FFF);
+    __m128i one = _mm_set1_epi16(1);
+
+    // Process 16 BYTEs at a time.
+    for (i = 1; i + 16 <= bpl; i += 16) {
+      for (uint32_t k = 0; k < 2; k++) {
+        __m128i b0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u + i + k * 8    )), zero);
+        __m128i c0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u + i + k * 8 - 1)), zero);
+
+        __m128i d0 = _mm_sub_epi16(b0, c0);
+        __m128i m0 = _mm_max_epi16(d0, _mm_sub_epi16(zero, d0));
+        __m128i h0 = _mm_srli_epi16(m0, 1);
+        __m128i gt = _mm_cmpgt_epi16(d0, zero);
+        __m128i eq = _mm_cmpeq_epi16(m0, zero);
+
+        // Lower bound of the `b` and `c` range, `none` makes them empty.
+        __m128i bLo = _mm_or_si128(_mm_and_si128(gt, _mm_sub_epi16(c0, h0)),
+                                   _mm_andnot_si128(gt, _mm_add_epi16(b0, one)));
+        __m128i cLo = _mm_or_si128(_mm_and_si128(gt, _mm_sub_epi16(_mm_add_epi16(c0, one), _mm_add_epi16(m0, m0))),
+                                   _mm_andnot_si128(gt, _mm_add_epi16(_mm_add_epi16(c0, h0), one)));
+
+        bLo = _mm_or_si128(_mm_and_si128(eq, none), _mm_andnot_si128(eq, bLo));
+        cLo = _mm_or_si128(_mm_and_si128(eq, none), _mm_andnot_si128(eq, cLo));
+
+        // Length of the `b` and `c` range minus one.
+        __m128i bLen = _mm_sub_epi16(_mm_add_epi16(m0, h0), one);
+        __m128i cLen = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(m0, m0), h0), _mm_add_epi16(one, one));
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(&rangeData[0][k * 8]), bLo);
+        _mm_store_si128(reinterpret_cast<__m128i*>(&rangeData[1][k * 8]), bLen);
+        _mm_store_si128(reinterpret_cast<__m128i*>(&rangeData[2][k * 8]), cLo);
+        _mm_store_si128(reinterpret_cast<__m128i*>(&rangeData[3][k * 8]), cLen);
+      }
+
+      // `b` and `c` are loaded first, so the compiler can use CMOVs instead of
+      // branches that would be mispredicted most of the time.
+      for (uint32_t k = 0; k < 16; k++) {
+        uint32_t b0 = u[i + k];
+        uint32_t c0 = u[i + k - 1];
+
+        uint32_t x = static_cast<uint32_t>(static_cast<int32_t>(pz) - rangeData[0][k]) <= static_cast<uint16_t>(rangeData[1][k]) ? b0 : pz;
+        x = static_cast<uint32_t>(static_cast<int32_t>(pz) - rangeData[2][k]) <= static_cast<uint16_t>(rangeData[3][k]) ? c0 : x;
+
+        pz = (static_cast<uint32_t>(p[i + k]) + x) & 0xFF;
+        p[i + k] = static_cast<uint8_t>(pz);
+      }
+    }
+
+    uz = u[i - 1];
+    for (; i < bpl; i++) {
+      u0 = u[i];
+      pz = (static_cast<uint32_t>(p[i]) + PaethOpt(pz, u0, uz)) & 0xFF;
+
+      p[i] = static_cast<uint8_t>(pz);
+      uz = u0;
+    }
+  }
+  else {
+    i = bpl - bpp;
+
+    if (i >= 32) {
+      // Align to 16-BYTE boundary.
+      uint32_t j = OptAlignDiff(p + bpp, 16);
+
+      __m128i zero = _mm_setzero_si128();
+      __m128i rcp3 = _mm_set1_epi16(0xAB << 7);
+
+      OPT_DEPNG_PROFILE_SCALAR(kPngFilterPaeth, j);
+      for (i -= j; j != 0; j--, p++, u++)
+        p[bpp] = Sum(p[bpp], PaethOpt(p[0], u[bpp], u[0]));
+
+      if (bpp == 2) {
+        // 2 BPP uses the same approach as 3 BPP Avg. All 8 cells (4 pixels)
+        // are always recalculated from the previous result shifted by one
+        // pixel, and each iteration makes one more pixel valid. `Up` and
+        // `UpLeft` don't depend on the result, so they are loaded directly.
+        __m128i pz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint16_t*>(p)[0]), zero);
+
+        // Process 16 BYTEs at a time.
+        while (i >= 16) {
+          __m128i p0, p1;
+          __m128i u0, u1;
+          __m128i v0, v1;
+          __m128i t0;
+
+          p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 2));
+          u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 2));
+          v0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+
+          p1 = _mm_unpackhi_epi8(p0, zero);
+          p0 = _mm_unpacklo_epi8(p0, zero);
+          u1 = _mm_unpackhi_epi8(u0, zero);
+          u0 = _mm_unpacklo_epi8(u0, zero);
+          v1 = _mm_unpackhi_epi8(v0, zero);
+          v0 = _mm_unpacklo_epi8(v0, zero);
+
+          PNG_SSE_PAETH(t0, pz, u0, v0);
+          t0 = _mm_add_epi8(t0, p0);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u0, v0);
+          t0 = _mm_add_epi8(t0, p0);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u0, v0);
+          t0 = _mm_add_epi8(t0, p0);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u0, v0);
+          p0 = _mm_add_epi8(t0, p0);
+          pz = _mm_srli_si128(p0, 12);
+
+          PNG_SSE_PAETH(t0, pz, u1, v1);
+          t0 = _mm_add_epi8(t0, p1);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u1, v1);
+          t0 = _mm_add_epi8(t0, p1);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u1, v1);
+          t0 = _mm_add_epi8(t0, p1);
+
+          t0 = _mm_or_si128(_mm_slli_si128(t0, 4), pz);
+          PNG_SSE_PAETH(t0, t0, u1, v1);
+          p1 = _mm_add_epi8(t0, p1);
+          pz = _mm_srli_si128(p1, 12);
+
+          p0 = _mm_packus_epi16(p0, p1);
+          _mm_store_si128(reinterpret_cast<__m128i*>(p + 2), p0);
+
+          p += 16;
+          u += 16;
+          i -= 16;
+        }
+      }
+      else if (bpp == 3) {
+        __m128i pz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0] & 0x00FFFFFFU), zero);
+        __m128i uz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(u)[0] & 0x00FFFFFFU), zero);
+        __m128i mask = _mm_setr_epi32(0xFFFFFFFF, 0x0000FFFF, 0x00000000, 0x00000000);
+
+        // Process 8 BYTEs at a time.
+        while (i >= 8) {
+          __m128i p0, p1;
+          __m128i u0, u1;
+
+          u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u + 3));
+          p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + 3));
+
+          u0 = _mm_unpacklo_epi8(u0, zero);
+          p0 = _mm_unpacklo_epi8(p0, zero);
+          u1 = _mm_srli_si128(u0, 6);
+
+          PNG_SSE_PAETH(uz, pz, u0, uz);
+          uz = _mm_and_si128(uz, mask);
+          p0 = _mm_add_epi8(p0, uz);
+
+          PNG_SSE_PAETH(uz, p0, u1, u0);
+          uz = _mm_and_si128(uz, mask);
+          uz = _mm_slli_si128(uz, 6);
+          p0 = _mm_add_epi8(p0, uz);
+
+          p1 = _mm_srli_si128(p0, 6);
+          u0 = _mm_srli_si128(u1, 6);
+
+          PNG_SSE_PAETH(u0, p1, u0, u1);
+          u0 = _mm_slli_si128(u0, 12);
+
+          p0 = _mm_add_epi8(p0, u0);
+          pz = _mm_srli_si128(p0, 10);
+          uz = _mm_srli_si128(u1, 4);
+
+          p0 = _mm_packus_epi16(p0, p0);
+          _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 3), p0);
+
+          p += 8;
+          u += 8;
+          i -= 8;
+        }
+      }
+      else if (bpp == 4) {
+        __m128i pz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]), zero);
+        __m128i uz = _mm_unpacklo_epi8(_mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(u)[0]), zero);
+        __m128i mask = _mm_setr_epi32(0xFFFFFFFF, 0xFFFFFFFF, 0, 0);
+
+        // Process 16 BYTEs at a time.
+        while (i >= 16) {
+          __m128i p0, p1;
+          __m128i u0, u1;
+
+          p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 4));
+          u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 4));
+
+          p1 = _mm_unpackhi_epi8(p0, zero);
+          p0 = _mm_unpacklo_epi8(p0, zero);
+          u1 = _mm_unpackhi_epi8(u0, zero);
+          u0 = _mm_unpacklo_epi8(u0, zero);
+
+          PNG_SSE_PAETH(uz, pz, u0, uz);
+          uz = _mm_and_si128(uz, mask);
+          p0 = _mm_add_epi8(p0, uz);
+          uz = _mm_shuffle_epi32(u0, _MM_SHUFFLE(1, 0, 3, 2));
+
+          PNG_SSE_PAETH(u0, p0, uz, u0);
+          u0 = _mm_slli_si128(u0, 8);
+          p0 = _mm_add_epi8(p0, u0);
+          pz = _mm_srli_si128(p0, 8);
+
+          PNG_SSE_PAETH(uz, pz, u1, uz);
+          uz = _mm_and_si128(uz, mask);
+          p1 = _mm_add_epi8(p1, uz);
+          uz = _mm_shuffle_epi32(u1, _MM_SHUFFLE(1, 0, 3, 2));
+
+          PNG_SSE_PAETH(u1, p1, uz, u1);
+          u1 = _mm_slli_si128(u1, 8);
+          p1 = _mm_add_epi8(p1, u1);
+          pz = _mm_srli_si128(p1, 8);
+
+          p0 = _mm_packus_epi16(p0, p1);
+          _mm_store_si128(reinterpret_cast<__m128i*>(p + 4), p0);
+
+          p += 16;
+          u += 16;
+          i -= 16;
+        }
+      }
+      else if (bpp == 6) {
+        __m128i pz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
+        __m128i uz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u)), zero);
+
+        // Process 16 BYTEs at a time.
+        while (i >= 16) {
+          __m128i p0, p1, p2;
+          __m128i u0, u1, u2;
+
+          p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 6));
+          u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 6));
+
+          p1 = _mm_srli_si128(p0, 6);
+          p0 = _mm_unpacklo_epi8(p0, zero);
+          u1 = _mm_srli_si128(u0, 6);
+          u0 = _mm_unpacklo_epi8(u0, zero);
+
+          PNG_SSE_PAETH(uz, pz, u0, uz);
+          p0 = _mm_add_epi8(p0, uz);
+          p2 = _mm_srli_si128(p1, 6);
+          u2 = _mm_srli_si128(u1, 6);
+          p1 = _mm_unpacklo_epi8(p1, zero);
+          u1 = _mm_unpacklo_epi8(u1, zero);
+
+          PNG_SSE_PAETH(u0, p0, u1, u0);
+          p1 = _mm_add_epi8(p1, u0);
+          p2 = _mm_unpacklo_epi8(p2, zero);
+          u2 = _mm_unpacklo_epi8(u2, zero);
+
+          PNG_SSE_PAETH(u0, p1, u2, u1);
+          p2 = _mm_add_epi8(p2, u0);
+
+          p0 = _mm_slli_si128(p0, 4);
+          p0 = _mm_packus_epi16(p0, p1);
+          p0 = _mm_slli_si128(p0, 2);
+          p0 = _mm_srli_si128(p0, 4);
+
+          p2 = _mm_shuffle_epi32(p2, _MM_SHUFFLE(1, 0, 1, 0));
+          u2 = _mm_shuffle_epi32(u2, _MM_SHUFFLE(1, 0, 1, 0));
+
+          pz = _mm_shuffle_epi32(_mm_unpackhi_epi32(p1, p2), _MM_SHUFFLE(3, 3, 1, 0));
+          uz = _mm_shuffle_epi32(_mm_unpackhi_epi32(u1, u2), _MM_SHUFFLE(3, 3, 1, 0));
+
+          p2 = _mm_packus_epi16(p2, p2);
+          p2 = _mm_slli_si128(p2, 12);
+
+          p0 = _mm_or_si128(p0, p2);
+          _mm_store_si128(reinterpret_cast<__m128i*>(p + 6), p0);
+
+          p += 16;
+          u += 16;
+          i -= 16;
+        }
+      }
+      else if (bpp == 8) {
+        __m128i pz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p)), zero);
+        __m128i uz = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u)), zero);
+
+        // Process 16 BYTEs at a time.
+        while (i >= 16) {
+          __m128i p0, p1;
+          __m128i u0, u1;
+
+          p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + 8));
+          u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + 8));
+
+          p1 = _mm_unpackhi_epi8(p0, zero);
+          p0 = _mm_unpacklo_epi8(p0, zero);
+          u1 = _mm_unpackhi_epi8(u0, zero);
+          u0 = _mm_unpacklo_epi8(u0, zero);
+
+          PNG_SSE_PAETH(uz, pz, u0, uz);
+          p0 = _mm_add_epi8(p0, uz);
+
+          PNG_SSE_PAETH(pz, p0, u1, u0);
+          pz = _mm_add_epi8(pz, p1);
+          uz = u1;
+
+          p0 = _mm_packus_epi16(p0, pz);
+          _mm_store_si128(reinterpret_cast<__m128i*>(p + 8), p0);
+
+          p += 16;
+          u += 16;
+          i -= 16;
+        }
+      }
+    }
+
+    OPT_DEPNG_PROFILE_SCALAR(kPngFilterPaeth, i);
+    for (; i != 0; i--, p++, u++)
+      p[bpp] = Sum(p[bpp], PaethOpt(p[0], u[bpp], u[0]));
+  }
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethSSE2_T(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  // Paeth of the first pixel is `Up`, as both `Left` and `UpLeft` are zero.
+  OPT_DEPNG_PROFILE_SCALAR(kPngFilterPaeth, bpp);
+  for (uint32_t i = 0; i < bpp; i++)
+    p[i] = Sum(p[i], u[i]);
+
+  OptDePngPaethNextSSE2_T<bpp>(p, u, bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Generic]
+// ----------------------------------------------------------------------------
+
+// Generic kernels handle any `bpp` that has no specialized kernel. PNG itself
+// never uses more than 8 BYTEs per pixel (16-bit RGBA), but extension formats
+// may. If `bpp >= 8` each BYTE depends on a BYTE that is at least 8 BYTEs back,
+// so 8 (or 16 if `bpp >= 16`) BYTEs can be unfiltered at a time without any
+// shifting. The remaining `bpp` values (5 and 7) use scalar code.
+//
+// These kernels unfilter BYTEs [i, n), the first pixel is never included, so
+// `i` must be at least `bpp`.
+
+static OPT_INLINE void OptDePngSubSSE2_Generic(uint8_t* p, uint32_t bpp, uint32_t i, uint32_t n) {
+  if (bpp >= 16) {
+    for (; i + 16 <= n; i += 16) {
+      __m128i p0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i));
+      __m128i a0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i - bpp));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_add_epi8(p0, a0));
+    }
+  }
+
+  if (bpp >= 8) {
+    for (; i + 8 <= n; i += 8) {
+      __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i));
+      __m128i a0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i - bpp));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p + i), _mm_add_epi8(p0, a0));
+    }
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], p[i - bpp]);
+}
+
+// PAVGB rounds up, so the rounding is corrected by subtracting `(A ^ U) & 1`.
+static OPT_INLINE void OptDePngAvgSSE2_Generic(uint8_t* p, uint8_t* u, uint32_t bpp, uint32_t i, uint32_t n) {
+  __m128i one = _mm_set1_epi8(1);
+
+  if (bpp >= 16) {
+    for (; i + 16 <= n; i += 16) {
+      __m128i p0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i));
+      __m128i a0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i - bpp));
+      __m128i u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u + i));
+
+      __m128i t0 = _mm_sub_epi8(_mm_avg_epu8(a0, u0), _mm_and_si128(_mm_xor_si128(a0, u0), one));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_add_epi8(p0, t0));
+    }
+  }
+
+  if (bpp >= 8) {
+    for (; i + 8 <= n; i += 8) {
+      __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i));
+      __m128i a0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i - bpp));
+      __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u + i));
+
+      __m128i t0 = _mm_sub_epi8(_mm_avg_epu8(a0, u0), _mm_and_si128(_mm_xor_si128(a0, u0), one));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p + i), _mm_add_epi8(p0, t0));
+    }
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], Avg(p[i - bpp], u[i]));
+}
+
+static OPT_INLINE void OptDePngPaethSSE2_Generic(uint8_t* p, uint8_t* u, uint32_t bpp, uint32_t i, uint32_t n) {
+  if (bpp >= 8) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i rcp3 = _mm_set1_epi16(0xAB << 7);
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i p0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i      )), zero);
+      __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(p + i - bpp)), zero);
+      __m128i b0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u + i      )), zero);
+      __m128i c0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<__m128i*>(u + i - bpp)), zero);
+
+      PNG_SSE_PAETH(c0, a0, b0, c0);
+      p0 = _mm_add_epi8(p0, c0);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p + i), _mm_packus_epi16(p0, p0));
+    }
+  }
+
+  for (; i < n; i++)
+    p[i] = Sum(p[i], PaethOpt(p[i - bpp], u[i], u[i - bpp]));
+}
+
+static OPT_INLINE void OptDePngSpanSSE2_Generic(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  uint32_t i = x0;
+
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst(p, bpp, x0, x1);
+      return;
+    }
+  }
+
+  switch (filter) {
+    case kPngFilterSub: {
+      OptDePngSubSSE2_Generic(p, bpp, Max(i, bpp), x1);
+      break;
+    }
+
+    case kPngFilterUp: {
+      OptDePngUpSSE2(p + i, u + i, x1 - i);
+      break;
+    }
+
+    case kPngFilterAvg: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i] >> 1);
+
+      OptDePngAvgSSE2_Generic(p, u, bpp, i, x1);
+      break;
+    }
+
+    case kPngFilterPaeth: {
+      for (; i < bpp; i++)
+        p[i] = Sum(p[i], u[i]);
+
+      OptDePngPaethSSE2_Generic(p, u, bpp, i, x1);
+      break;
+    }
+  }
+}
+
+static OPT_INLINE void OptDePngFilterSSE2_Generic(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = *p++;
+    OptDePngSpanSSE2_Generic(p, u, filter, bpp, 0, bpl);
+
+    u = p;
+    p += bpl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Span]
+// ----------------------------------------------------------------------------
+
+// Unfilter BYTEs [x0, x1) of a row, see `OptDePngSpanFunc`.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSpanSSE2_T(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t x0, uint32_t x1) {
+  // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+  if (u == NULL) {
+    filter = OptDePngFirstRowFilter(filter);
+    if (filter == kPngFilterAvg) {
+      OptDePngAvgFirst_T<bpp>(p, x0, x1);
+      return;
+    }
+  }
+
+  if (x0 == 0) {
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubSSE2_T<bpp>(p, x1); break;
+      case kPngFilterUp   : OptDePngUpSSE2(p, u, x1); break;
+      case kPngFilterAvg  : OptDePngAvgSSE2_T<bpp>(p, u, x1); break;
+      case kPngFilterPaeth: OptDePngPaethSSE2_T<bpp>(p, u, x1); break;
+    }
+  }
+  else {
+    // Start at the last pixel of the previous span, which is unfiltered.
+    uint32_t n = x1 - x0 + bpp;
+    p += x0 - bpp;
+    u += x0 - bpp;
+
+    switch (filter) {
+      case kPngFilterSub  : OptDePngSubSSE2_T<bpp>(p, n); break;
+      case kPngFilterUp   : OptDePngUpSSE2(p + bpp, u + bpp, n - bpp); break;
+      case kPngFilterAvg  : OptDePngAvgNextSSE2_T<bpp>(p, u, n); break;
+      case kPngFilterPaeth: OptDePngPaethNextSSE2_T<bpp>(p, u, n); break;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Image]
+// ----------------------------------------------------------------------------
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterSSE2_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  uint32_t y = h;
+  uint8_t* u = NULL;
+
+  // Subtract one BYTE that is used to store the `filter` ID.
+  bpl--;
+
+  do {
+    uint32_t filter = *p++;
+    OPT_DEPNG_PROFILE_ROW_BEGIN();
+
+    // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+    if (u == NULL)
+      filter = OptDePngFirstRowFilter(filter);
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubSSE2_T<bpp>(p, bpl); break;
+      case kPngFilterUp   : OptDePngUpSSE2(p, u, bpl); break;
+      case kPngFilterAvg  :
+        if (u != NULL) {
+          OptDePngAvgSSE2_T<bpp>(p, u, bpl);
+        }
+        else {
+          OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+          OPT_DEPNG_PROFILE_SCALAR(kPngFilterAvg, bpl);
+        }
+        break;
+      case kPngFilterPaeth: OptDePngPaethSSE2_T<bpp>(p, u, bpl); break;
+    }
+
+    // `Sub` doesn't touch the first pixel, `None` doesn't touch anything.
+    OPT_DEPNG_PROFILE_ROW_END(filter, filter == kPngFilterNone ? 0 : filter == kPngFilterSub ? bpl - bpp : bpl);
+
+    u = p;
+    p += bpl;
+  } while (--y != 0);
+}
+
+// ----------------------------------------------------------------------------
+// [Padded]
+// ----------------------------------------------------------------------------
+
+// Kernels of the padded layout, see `OptDePngFilterPadded()`. `p` and `u` are
+// aligned to 16 BYTEs and the row is unfiltered as whole registers from its
+// first BYTE up to `n` rounded up to 16, which ends in the slack after the
+// row, so there is neither an alignment prologue nor a tail. BYTEs past `n`
+// are garbage, but no BYTE of the row depends on BYTEs to its right. The left
+// (and upper-left) pixel of the first register is zero and then it's carried
+// in a register. `Avg` and `Paeth` work in 16-bit cells, a half of a register
+// at a time, and recalculate all 8 cells of the half from the previous result
+// shifted by one pixel until every pixel of the half is valid (the approach of
+// 3 BPP `Avg` above).
+
+static OPT_INLINE void OptDePngUpPaddedSSE2(uint8_t* p, const uint8_t* u, uint32_t n) {
+  uint32_t i = 0;
+
+  // Process 64 BYTEs at a time.
+  for (; i + 64 <= n; i += 64) {
+    __m128i p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i));
+    __m128i p1 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i + 16));
+    __m128i p2 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i + 32));
+    __m128i p3 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i + 48));
+
+    p0 = _mm_add_epi8(p0, _mm_load_si128(reinterpret_cast<const __m128i*>(u + i)));
+    p1 = _mm_add_epi8(p1, _mm_load_si128(reinterpret_cast<const __m128i*>(u + i + 16)));
+    p2 = _mm_add_epi8(p2, _mm_load_si128(reinterpret_cast<const __m128i*>(u + i + 32)));
+    p3 = _mm_add_epi8(p3, _mm_load_si128(reinterpret_cast<const __m128i*>(u + i + 48)));
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i     ), p0);
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i + 16), p1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i + 32), p2);
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i + 48), p3);
+  }
+
+  // Process 16 BYTEs at a time, the last register ends in the slack.
+  for (; i < n; i += 16) {
+    __m128i p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i));
+    __m128i u0 = _mm_load_si128(reinterpret_cast<const __m128i*>(u + i));
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i), _mm_add_epi8(p0, u0));
+  }
+}
+
+// Broadcast the last `bpp` BYTEs of `x` into a register, which is the carry
+// added to each pixel of the next register of `Sub`. The pattern continues
+// the pixels of `x`, so if `bpp` doesn't divide 16 it's not pixel aligned.
+template<uint32_t bpp>
+static OPT_INLINE __m128i OptDePngSubCarrySSE2_T(__m128i x) {
+  if (bpp == 1) {
+    x = _mm_unpackhi_epi8(x, x);
+    x = _mm_unpackhi_epi16(x, x);
+    return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  else if (bpp == 2) {
+    x = _mm_unpackhi_epi16(x, x);
+    return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  else if (bpp == 4) {
+    return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  else if (bpp == 8) {
+    return _mm_unpackhi_epi64(x, x);
+  }
+  else {
+    x = _mm_srli_si128(x, 16 - bpp);
+    x = _mm_or_si128(x, _mm_slli_si128(x, bpp));
+    if (bpp * 2 < 16) x = _mm_or_si128(x, _mm_slli_si128(x, (bpp * 2) & 15));
+    if (bpp * 4 < 16) x = _mm_or_si128(x, _mm_slli_si128(x, (bpp * 4) & 15));
+    return x;
+  }
+}
+
+// The sum of each register is calculated without the carry, which is added
+// as a broadcast afterwards, so the dependency between registers is only the
+// addition and the broadcast and the sums of the next registers run ahead of
+// it, see `OptDePngSubSSE2_T()`.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubPaddedSSE2_T(uint8_t* p, uint32_t n) {
+  __m128i carry = _mm_setzero_si128();
+
+  for (uint32_t i = 0; i < n; i += 16) {
+    __m128i p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i));
+    __m128i t0;
+
+    PNG_SSE_SLL_ADDB_1X(p0, t0, bpp);
+    if (bpp * 2 < 16) PNG_SSE_SLL_ADDB_1X(p0, t0, (bpp * 2) & 15);
+    if (bpp * 4 < 16) PNG_SSE_SLL_ADDB_1X(p0, t0, (bpp * 4) & 15);
+    if (bpp * 8 < 16) PNG_SSE_SLL_ADDB_1X(p0, t0, (bpp * 8) & 15);
+
+    p0 = _mm_add_epi8(p0, carry);
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i), p0);
+    carry = OptDePngSubCarrySSE2_T<bpp>(p0);
+  }
+}
+
+// Unfilter 8 cells of `Avg`, `carry` is the left pixel in the first cells.
+template<uint32_t bpp>
+static OPT_INLINE __m128i OptDePngAvgHalfSSE2_T(__m128i x, __m128i u, __m128i& carry) {
+  // Cells of the first pixel are zero after a shift, so the carry is added to
+  // `Up` instead of being shifted in.
+  u = _mm_add_epi16(u, carry);
+
+  __m128i t = _mm_add_epi8(x, _mm_srli_epi16(u, 1));
+  for (uint32_t k = bpp; k < 8; k += bpp)
+    PNG_SSE_AVG_1X(t, x, _mm_slli_si128(t, (bpp * 2) & 15), u);
+
+  carry = _mm_srli_si128(t, 16 - bpp * 2);
+  return t;
+}
+
+// `hasUp` is false for the first row, which has no previous row.
+template<uint32_t bpp, bool hasUp>
+static OPT_INLINE void OptDePngAvgPaddedSSE2_T(uint8_t* p, const uint8_t* u, uint32_t n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i carry = zero;
+
+  for (uint32_t i = 0; i < n; i += 16) {
+    __m128i p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i));
+    __m128i u0 = hasUp ? _mm_load_si128(reinterpret_cast<const __m128i*>(u + i)) : zero;
+
+    __m128i t0 = OptDePngAvgHalfSSE2_T<bpp>(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(u0, zero), carry);
+    __m128i t1 = OptDePngAvgHalfSSE2_T<bpp>(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(u0, zero), carry);
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i), _mm_packus_epi16(t0, t1));
+  }
+}
+
+// Unfilter 8 cells of `Paeth`, `a` and `c` are the left and the upper-left
+// pixel in the first cells.
+template<uint32_t bpp>
+static OPT_INLINE __m128i OptDePngPaethHalfSSE2_T(__m128i x, __m128i b, __m128i& a, __m128i& c, __m128i rcp3) {
+  // `UpLeft` doesn't depend on the result, so it's calculated only once.
+  __m128i c0 = bpp < 8 ? _mm_or_si128(_mm_slli_si128(b, (bpp * 2) & 15), c) : c;
+  __m128i t;
+
+  PNG_SSE_PAETH(t, a, b, c0);
+  t = _mm_add_epi8(t, x);
+
+  for (uint32_t k = bpp; k < 8; k += bpp) {
+    __m128i a0 = _mm_or_si128(_mm_slli_si128(t, (bpp * 2) & 15), a);
+    PNG_SSE_PAETH(t, a0, b, c0);
+    t = _mm_add_epi8(t, x);
+  }
+
+  a = _mm_srli_si128(t, 16 - bpp * 2);
+  c = _mm_srli_si128(b, 16 - bpp * 2);
+  return t;
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngPaethPaddedSSE2_T(uint8_t* p, const uint8_t* u, uint32_t n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i rcp3 = _mm_set1_epi16(0xAB << 7);
+
+  __m128i a = zero;
+  __m128i c = zero;
+
+  for (uint32_t i = 0; i < n; i += 16) {
+    __m128i p0 = _mm_load_si128(reinterpret_cast<__m128i*>(p + i));
+    __m128i u0 = _mm_load_si128(reinterpret_cast<const __m128i*>(u + i));
+
+    __m128i t0 = OptDePngPaethHalfSSE2_T<bpp>(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(u0, zero), a, c, rcp3);
+    __m128i t1 = OptDePngPaethHalfSSE2_T<bpp>(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(u0, zero), a, c, rcp3);
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(p + i), _mm_packus_epi16(t0, t1));
+  }
+}
+
+// Row size from which the kernels above are slower than the kernels of the
+// compact layout, which run aligned in the padded layout as well except for a
+// short prologue and the tail. The kernels above have a longer dependency
+// between registers if `bpp` is not a power of 2 (`Sub`) or calculate all 8
+// cells of a half per pixel (`Avg` and `Paeth`).
+static const uint32_t kOptDePngPaddedSpanMin = 512;
+
+// Get whether a row of `n` BYTEs is unfiltered by `OptDePngSpanSSE2()`. It's
+// always used by `Avg` and `Paeth` of 1 and 2 BPP and by `Paeth` of 6 BPP, as
+// their kernels are faster at any size. There are only generic kernels for 5
+// and 7 BPP, which are never used.
+template<uint32_t bpp>
+static OPT_INLINE bool OptDePngPaddedUseSpanSSE2_T(uint32_t filter, uint32_t n) {
+  if (filter == kPngFilterNone || filter == kPngFilterUp || bpp == 5 || bpp == 7)
+    return false;
+
+  if (filter == kPngFilterSub)
+    return (bpp & (bpp - 1)) != 0 && n >= kOptDePngPaddedSpanMin;
+
+  if (bpp <= 2 || (bpp == 6 && filter == kPngFilterPaeth))
+    return true;
+
+  return n >= kOptDePngPaddedSpanMin;
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterPaddedSSE2_T(uint8_t* p, intptr_t stride, uint32_t h, uint32_t bpl) {
+  uint32_t n = bpl - 1;
+  uint8_t* u = NULL;
+
+  // Skip the filter ID, `p` is aligned from now on.
+  p++;
+
+  for (uint32_t y = 0; y < h; y++) {
+    uint32_t filter = p[-1];
+
+    if (OptDePngPaddedUseSpanSSE2_T<bpp>(filter, n)) {
+      OptDePngSpanSSE2(p, u, filter, bpp, 0, n);
+    }
+    else {
+      // The first row has no previous row, see `OptDePngFirstRowFilter()`.
+      if (u == NULL) {
+        filter = OptDePngFirstRowFilter(filter);
+        if (filter == kPngFilterAvg) {
+          OptDePngAvgPaddedSSE2_T<bpp, false>(p, NULL, n);
+          filter = kPngFilterNone;
+        }
+      }
+
+      switch (filter) {
+        case kPngFilterSub  : OptDePngSubPaddedSSE2_T<bpp>(p, n); break;
+        case kPngFilterUp   : OptDePngUpPaddedSSE2(p, u, n); break;
+        case kPngFilterAvg  : OptDePngAvgPaddedSSE2_T<bpp, true>(p, u, n); break;
+        case kPngFilterPaeth: OptDePngPaethPaddedSSE2_T<bpp>(p, u, n); break;
+      }
+    }
+
+    u = p;
+    p += stride;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// [Batch]
+// ----------------------------------------------------------------------------
+
+// Short rows don't reach the SIMD loops of the kernels above, which need at
+// least 24-32 BYTEs and an aligned pointer. Batch kernels unfilter `Sub` and
+// `Up` rows as a sequence of unaligned 16-BYTE registers instead and the rest
+// of the row is stored as 8, 4, 2, and 1 BYTE pieces. Stores never go past the
+// end of the row, otherwise loads of the next row would overlap them and stall
+// on store forwarding. `Sub` loads the last register of a row as a whole, so it
+// reads past the end of the row, which is only done if these BYTEs belong to
+// the same image (checked by `end`).
+
+// Store the first `n` BYTEs of `x` to `p`, `n` must be less than 16.
+static OPT_INLINE void OptDePngStorePartialSSE2(uint8_t* p, __m128i x, uint32_t n) {
+  if (n & 8) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), x);
+    x = _mm_srli_si128(x, 8);
+    p += 8;
+  }
+
+  uint32_t v = static_cast<uint32_t>(_mm_cvtsi128_si32(x));
+  if (n & 4) {
+    reinterpret_cast<uint32_t*>(p)[0] = v;
+    v = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x, 4)));
+    p += 4;
+  }
+
+  if (n & 2) {
+    reinterpret_cast<uint16_t*>(p)[0] = static_cast<uint16_t>(v);
+    v >>= 16;
+    p += 2;
+  }
+
+  if (n & 1)
+    p[0] = static_cast<uint8_t>(v);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngSubShortSSE2_T(uint8_t* p, uint32_t bpl, const uint8_t* end) {
+  __m128i carry = _mm_setzero_si128();
+  __m128i t0;
+  uint32_t i = 0;
+
+  while (i < bpl && static_cast<size_t>(end - p) >= 16) {
+    __m128i x0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p));
+    x0 = _mm_add_epi8(x0, _mm_srli_si128(carry, 16 - bpp));
+
+    PNG_SSE_SLL_ADDB_1X(x0, t0, bpp);
+    if (bpp < 8) PNG_SSE_SLL_ADDB_1X(x0, t0, bpp * 2);
+    if (bpp < 4) PNG_SSE_SLL_ADDB_1X(x0, t0, bpp * 4);
+    if (bpp < 2) PNG_SSE_SLL_ADDB_1X(x0, t0, bpp * 8);
+
+    if (bpl - i < 16) {
+      OptDePngStorePartialSSE2(p, x0, bpl - i);
+      return;
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x0);
+    carry = x0;
+
+    p += 16;
+    i += 16;
+  }
+
+  // The first `bpp` BYTEs are never changed.
+  if (i < bpp) {
+    p += bpp - i;
+    i = bpp;
+  }
+
+  for (; i < bpl; i++, p++)
+    p[0] = Sum(p[0], p[-static_cast<intptr_t>(bpp)]);
+}
+
+static OPT_INLINE void OptDePngUpShortSSE2(uint8_t* p, uint8_t* u, uint32_t bpl) {
+  uint32_t i = bpl;
+
+  while (i >= 16) {
+    __m128i p0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(p));
+    __m128i u0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(u));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_add_epi8(p0, u0));
+
+    p += 16;
+    u += 16;
+    i -= 16;
+  }
+
+  // Loads use the same pieces as stores of the previous row.
+  if (i & 8) {
+    __m128i p0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(p));
+    __m128i u0 = _mm_loadl_epi64(reinterpret_cast<__m128i*>(u));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_add_epi8(p0, u0));
+
+    p += 8;
+    u += 8;
+  }
+
+  if (i & 4) {
+    __m128i p0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(p)[0]);
+    __m128i u0 = _mm_cvtsi32_si128(reinterpret_cast<uint32_t*>(u)[0]);
+    reinterpret_cast<uint32_t*>(p)[0] = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_add_epi8(p0, u0)));
+
+    p += 4;
+    u += 4;
+  }
+
+  for (i &= 3; i != 0; i--, p++, u++)
+    p[0] = Sum(p[0], u[0]);
+}
+
+// Same as `OptDePngFilterSSE2_T()`, but uses batch kernels for `Sub` and `Up`.
+// Geometry of the image must be valid and `h` must not be zero.
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngFilterShortSSE2_T(uint8_t* p, uint32_t h, uint32_t bpl) {
+  const uint8_t* end = p + static_cast<size_t>(h) * bpl;
+  uint8_t* u = NULL;
+
+  bpl--;
+  do {
+    uint32_t filter = *p++;
+
+    if (u == NULL)
+      filter = OptDePngFirstRowFilter(filter);
+
+    switch (filter) {
+      case kPngFilterNone : break;
+      case kPngFilterSub  : OptDePngSubShortSSE2_T<bpp>(p, bpl, end); break;
+      case kPngFilterUp   : OptDePngUpShortSSE2(p, u, bpl); break;
+      case kPngFilterAvg  :
+        if (u != NULL)
+          OptDePngAvgSSE2_T<bpp>(p, u, bpl);
+        else
+          OptDePngAvgFirst_T<bpp>(p, 0, bpl);
+        break;
+      case kPngFilterPaeth: OptDePngPaethSSE2_T<bpp>(p, u, bpl); break;
+    }
+
+    u = p;
+    p += bpl;
+  } while (--h != 0);
+}
+
+template<uint32_t bpp>
+static OPT_INLINE void OptDePngBatchSSE2_T(OptDePngBatchItem* const* items, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    OptDePngFilterShortSSE2_T<bpp>(items[i]->p, items[i]->h, items[i]->bpl);
+}
+
+// ----------------------------------------------------------------------------
+// [Forward]
+// ----------------------------------------------------------------------------
+
+// Forward filters have no dependency between pixels. Each register loads `a`
+// and `c` at `-bpp` offset, so the same code handles any `bpp`. The first bpp
+// BYTEs (where `a` and `c` are zero) and the tail of a row are scalar.
+
+// Scalar prediction of a BYTE, `PaethOpt()` is exact, like `PNG_SSE_PAETH`.
+static OPT_INLINE uint32_t OptDePngForwardPredict(uint32_t filter, uint32_t a, uint32_t b, uint32_t c) {
+  switch (filter) {
+    case kPngFilterSub  : return a;
+    case kPngFilterUp   : return b;
+    case kPngFilterAvg  : return Avg(a, b);
+    case kPngFilterPaeth: return PaethOpt(a, b, c);
+    default             : return 0;
+  }
+}
+
+// PAVGB rounds up, subtracting the lost bit of `a ^ b` makes it truncate.
+static OPT_INLINE __m128i OptDePngForwardAvgSSE2(__m128i a, __m128i b) {
+  __m128i one = _mm_set1_epi8(1);
+  return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+}
+
+static OPT_INLINE __m128i OptDePngForwardPaethSSE2(__m128i a, __m128i b, __m128i c) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i rcp3 = _mm_set1_epi16(0xAB << 7);
+
+  __m128i a0 = _mm_unpacklo_epi8(a, zero);
+  __m128i a1 = _mm_unpackhi_epi8(a, zero);
+  __m128i b0 = _mm_unpacklo_epi8(b, zero);
+  __m128i b1 = _mm_unpackhi_epi8(b, zero);
+  __m128i c0 = _mm_unpacklo_epi8(c, zero);
+  __m128i c1 = _mm_unpackhi_epi8(c, zero);
+
+  PNG_SSE_PAETH(a0, a0, b0, c0);
+  PNG_SSE_PAETH(a1, a1, b1, c1);
+  return _mm_packus_epi16(a0, a1);
+}
+
+// Sums of absolute values of BYTEs in `v` taken as signed (in two QWORDs).
+static OPT_INLINE __m128i OptDePngForwardCostSSE2(__m128i v) {
+  __m128i zero = _mm_setzero_si128();
+  return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+template<uint32_t filter>
+static OPT_INLINE void OptDePngForwardRowSSE2_T(uint8_t* dst, const uint8_t* x, const uint8_t* u, uint32_t bpp, uint32_t n) {
+  uint32_t i = 0;
+  uint32_t head = Min(bpp, n);
+
+  for (; i < head; i++)
+    dst[i] = static_cast<uint8_t>(x[i] - OptDePngForwardPredict(filter, 0, u[i], 0));
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    __m128i av = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - bpp));
+    __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i));
+    __m128i pv;
+
+    if (filter == kPngFilterSub)
+      pv = av;
+    else if (filter == kPngFilterUp)
+      pv = bv;
+    else if (filter == kPngFilterAvg)
+      pv = OptDePngForwardAvgSSE2(av, bv);
+    else
+      pv = OptDePngForwardPaethSSE2(av, bv, _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i - bpp)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi8(xv, pv));
+  }
+
+  for (; i < n; i++)
+    dst[i] = static_cast<uint8_t>(x[i] - OptDePngForwardPredict(filter, x[i - bpp], u[i], u[i - bpp]));
+}
+
+// Scalar part of `OptDePngForwardAllSSE2()`, BYTEs `[i, n)`.
+static OPT_INLINE void OptDePngForwardAllScalar(uint8_t* const* dst, uint64_t* sums, const uint8_t* x, const uint8_t* u, uint32_t bpp, uint32_t i, uint32_t n) {
+  for (; i < n; i++) {
+    uint32_t a = i >= bpp ? x[i - bpp] : 0;
+    uint32_t c = i >= bpp ? u[i - bpp] : 0;
+
+    sums[kPngFilterNone] += OptDePngForwardCost(x[i]);
+    for (uint32_t filter = kPngFilterSub; filter < kPngFilterCount; filter++) {
+      uint32_t v = (x[i] - OptDePngForwardPredict(filter, a, u[i], c)) & 0xFF;
+      dst[filter - 1][i] = static_cast<uint8_t>(v);
+      sums[filter] += OptDePngForwardCost(v);
+    }
+  }
+}
+
+// All candidates are computed in one pass over `x` and `u`.
+static OPT_INLINE void OptDePngForwardAllSSE2(uint8_t* const* dst, uint64_t* sums, const uint8_t* x, const uint8_t* u, uint32_t bpp, uint32_t n) {
+  uint8_t* dSub = dst[0];
+  uint8_t* dUp = dst[1];
+  uint8_t* dAvg = dst[2];
+  uint8_t* dPaeth = dst[3];
+
+  for (uint32_t filter = 0; filter < kPngFilterCount; filter++)
+    sums[filter] = 0;
+
+  uint32_t i = Min(bpp, n);
+  OptDePngForwardAllScalar(dst, sums, x, u, bpp, 0, i);
+
+  __m128i sNone = _mm_setzero_si128();
+  __m128i sSub = _mm_setzero_si128();
+  __m128i sUp = _mm_setzero_si128();
+  __m128i sAvg = _mm_setzero_si128();
+  __m128i sPaeth = _mm_setzero_si128();
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    __m128i av = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - bpp));
+    __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i));
+    __m128i cv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i - bpp));
+
+    __m128i vSub = _mm_sub_epi8(xv, av);
+    __m128i vUp = _mm_sub_epi8(xv, bv);
+    __m128i vAvg = _mm_sub_epi8(xv, OptDePngForwardAvgSSE2(av, bv));
+    __m128i vPaeth = _mm_sub_epi8(xv, OptDePngForwardPaethSSE2(av, bv, cv));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dSub + i), vSub);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dUp + i), vUp);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dAvg + i), vAvg);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dPaeth + i), vPaeth);
+
+    sNone = _mm_add_epi64(sNone, OptDePngForwardCostSSE2(xv));
+    sSub = _mm_add_epi64(sSub, OptDePngForwardCostSSE2(vSub));
+    sUp = _mm_add_epi64(sUp, OptDePngForwardCostSSE2(vUp));
+    sAvg = _mm_add_epi64(sAvg, OptDePngForwardCostSSE2(vAvg));
+    sPaeth = _mm_add_epi64(sPaeth, OptDePngForwardCostSSE2(vPaeth));
+  }
+
+  __m128i acc[kPngFilterCount] = { sNone, sSub, sUp, sAvg, sPaeth };
+  for (uint32_t filter = 0; filter < kPngFilterCount; filter++) {
+    uint64_t q[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(q), acc[filter]);
+    sums[filter] += q[0] + q[1];
+  }
+
+  OptDePngForwardAllScalar(dst, sums, x, u, bpp, i, n);
+}
+
+// ----------------------------------------------------------------------------
+// [Convert]
+// ----------------------------------------------------------------------------
+
+// Premultiply 4 BGRA pixels in `px`, alpha is multiplied by 255 to keep it.
+static OPT_INLINE __m128i OptDePngPremultiplySSE2(__m128i px) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i c128 = _mm_set1_epi16(128);
+  __m128i a255 = _mm_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0);
+
+  __m128i p0 = _mm_unpacklo_epi8(px, zero);
+  __m128i p1 = _mm_unpackhi_epi8(px, zero);
+
+  __m128i a0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p0, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i a1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p1, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+  p0 = _mm_add_epi16(_mm_mullo_epi16(p0, _mm_or_si128(a0, a255)), c128);
+  p1 = _mm_add_epi16(_mm_mullo_epi16(p1, _mm_or_si128(a1, a255)), c128);
+
+  p0 = _mm_srli_epi16(_mm_add_epi16(p0, _mm_srli_epi16(p0, 8)), 8);
+  p1 = _mm_srli_epi16(_mm_add_epi16(p1, _mm_srli_epi16(p1, 8)), 8);
+
+  return _mm_packus_epi16(p0, p1);
+}
+
+// Convert 4 source pixels at `src` into 4 BGRA pixels.
+template<uint32_t bpp>
+static OPT_INLINE __m128i OptDePngFetch4SSE2_T(const uint8_t* src) {
+  if (bpp == 1) {
+    __m128i g0 = _mm_cvtsi32_si128(*reinterpret_cast<const int32_t*>(src));
+    g0 = _mm_unpacklo_epi8(g0, g0);
+    g0 = _mm_unpacklo_epi16(g0, g0);
+    return _mm_or_si128(g0, _mm_set1_epi32(static_cast<int>(0xFF000000)));
+  }
+  else if (bpp == 2) {
+    // [A:G] -> [A:G:G:G].
+    __m128i ga = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    __m128i gg = _mm_and_si128(ga, _mm_set1_epi16(0x00FF));
+    gg = _mm_or_si128(gg, _mm_slli_epi16(gg, 8));
+    return _mm_unpacklo_epi16(gg, ga);
+  }
+#if defined(USE_SSSE3)
+  else if (bpp == 3) {
+    // Reads 16 BYTEs, the caller guarantees they are readable.
+    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    px = _mm_shuffle_epi8(px, _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1));
+    return _mm_or_si128(px, _mm_set1_epi32(static_cast<int>(0xFF000000)));
+  }
+#endif // USE_SSSE3
+  else {
+    // RGBA -> BGRA, swap R and B.
+    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i rb = _mm_and_si128(px, _mm_set1_epi32(0x00FF00FF));
+    __m128i ga = _mm_and_si128(px, _mm_set1_epi32(static_cast<int>(0xFF00FF00)));
+    return _mm_or_si128(ga, _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+  }
+}
+
+template<uint32_t bpp, bool premultiply>
+static void OptDePngConvertSSE2_T(uint8_t* dst, const uint8_t* src, uint32_t w) {
+  uint32_t i = 0;
+
+#if !defined(USE_SSSE3)
+  // There is no fast way to shuffle RGB pixels without PSHUFB.
+  if (bpp != 3)
+#endif // !USE_SSSE3
+  {
+    // RGB fetches 16 BYTEs for 12 BYTEs of pixels, which needs 2 more pixels.
+    uint32_t extra = bpp == 3 ? 2 : 0;
+
+    for (; i + 4 + extra <= w; i += 4) {
+      __m128i px = OptDePngFetch4SSE2_T<bpp>(src + i * bpp);
+      if (premultiply && (bpp == 2 || bpp == 4))
+        px = OptDePngPremultiplySSE2(px);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), px);
+    }
+  }
+
+  OptDePngConvertOpt_T<bpp, premultiply>(dst, src, i, w);
+}
+
+static OPT_INLINE OptDePngConvertFunc OptDePngConvertSelectSSE2(uint32_t bpp, uint32_t format) {
+  bool premultiply = format == kOptDePngFormatPRGB32;
+
+  if (format >= kOptDePngFormatCount)
+    return NULL;
+
+  switch (bpp) {
+    case 1: return OptDePngConvertSSE2_T<1, false>;
+    case 2: return premultiply ? OptDePngConvertSSE2_T<2, true> : OptDePngConvertSSE2_T<2, false>;
+    case 3: return OptDePngConvertSSE2_T<3, false>;
+    case 4: return premultiply ? OptDePngConvertSSE2_T<4, true> : OptDePngConvertSSE2_T<4, false>;
+  }
+
+  return NULL;
+}
+
+// [Guard]
+#endif // _OPTDEPNG_SSE2_P_H
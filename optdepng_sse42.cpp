@@ -0,0 +1,59 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_SSE2
+#define USE_SSE42
+
+#include "./optdepng_p.h"
+
+// ============================================================================
+// [Implementation - SSE4.2 Optimized]
+//
+// CRC32 instruction calculates CRC32C of 8 BYTEs (4 BYTEs on 32-bit x86), it
+// has a latency of 3 cycles, but a throughput of one per cycle. Data of three
+// consecutive blocks are checksummed in parallel and their CRCs are combined
+// by `OptDePngCrc32cShift()`, shorter data use a single stream.
+// ============================================================================
+
+static OPT_INLINE uint32_t OptDePngCrc32cU64SSE42(uint32_t c, const uint8_t* p) {
+#if defined(_M_X64) || defined(__x86_64__)
+  uint64_t x;
+  ::memcpy(&x, p, 8);
+  return static_cast<uint32_t>(_mm_crc32_u64(c, x));
+#else
+  uint32_t x0, x1;
+  ::memcpy(&x0, p, 4);
+  ::memcpy(&x1, p + 4, 4);
+  return _mm_crc32_u32(_mm_crc32_u32(c, x0), x1);
+#endif
+}
+
+uint32_t OptDePngCrc32cSSE42(uint32_t crc, const uint8_t* data, size_t size) {
+  const uint32_t kBlock = kOptDePngCrc32cBlock;
+  uint32_t c = ~crc;
+
+  while (size >= kBlock * 3) {
+    uint32_t c1 = 0;
+    uint32_t c2 = 0;
+
+    for (uint32_t i = 0; i < kBlock; i += 8) {
+      c  = OptDePngCrc32cU64SSE42(c , data + i);
+      c1 = OptDePngCrc32cU64SSE42(c1, data + i + kBlock);
+      c2 = OptDePngCrc32cU64SSE42(c2, data + i + kBlock * 2);
+    }
+
+    c = OptDePngCrc32cShift(OptDePngCrc32cShift(c) ^ c1) ^ c2;
+    data += kBlock * 3;
+    size -= kBlock * 3;
+  }
+
+  for (; size >= 8; size -= 8, data += 8)
+    c = OptDePngCrc32cU64SSE42(c, data);
+
+  for (; size != 0; size--, data++)
+    c = _mm_crc32_u8(c, data[0]);
+
+  return ~c;
+}
@@ -0,0 +1,55 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+#define USE_SSE2
+#define USE_SSSE3
+
+#include "./optdepng_p.h"
+#include "./optdepng_sse2_p.h"
+
+// ============================================================================
+// [Implementation - SSSE3 Optimized]
+//
+// This is the SSE2 implementation compiled with `USE_SSSE3`. The kernels use
+// PSHUFB where the SSE2 version needs a chain of shuffles to move a pixel.
+// ============================================================================
+
+uint32_t OptDePngFilterSSSE3(uint8_t* p, uint32_t h, uint32_t bpp, uint32_t bpl) {
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err != kOptDePngErrorOk || h == 0)
+    return err;
+
+  switch (bpp) {
+    case 1: OptDePngFilterSSE2_T<1>(p, h, bpl); break;
+    case 2: OptDePngFilterSSE2_T<2>(p, h, bpl); break;
+    case 3: OptDePngFilterSSE2_T<3>(p, h, bpl); break;
+    case 4: OptDePngFilterSSE2_T<4>(p, h, bpl); break;
+    case 6: OptDePngFilterSSE2_T<6>(p, h, bpl); break;
+    case 8: OptDePngFilterSSE2_T<8>(p, h, bpl); break;
+    default: OptDePngFilterSSE2_Generic(p, h, bpp, bpl); break;
+  }
+
+  return kOptDePngErrorOk;
+}
+
+void OptDePngSpanSSSE3(uint8_t* p, uint8_t* u, uint32_t filter, uint32_t bpp, uint32_t x0, uint32_t x1) {
+  switch (bpp) {
+    case 1: OptDePngSpanSSE2_T<1>(p, u, filter, x0, x1); break;
+    case 2: OptDePngSpanSSE2_T<2>(p, u, filter, x0, x1); break;
+    case 3: OptDePngSpanSSE2_T<3>(p, u, filter, x0, x1); break;
+    case 4: OptDePngSpanSSE2_T<4>(p, u, filter, x0, x1); break;
+    case 6: OptDePngSpanSSE2_T<6>(p, u, filter, x0, x1); break;
+    case 8: OptDePngSpanSSE2_T<8>(p, u, filter, x0, x1); break;
+    default: OptDePngSpanSSE2_Generic(p, u, filter, bpp, x0, x1); break;
+  }
+}
+
+uint32_t OptDePngFilterSSSE3To(uint8_t* dst, intptr_t dstStride, const uint8_t* src, uint32_t h, uint32_t bpp, uint32_t srcBpl) {
+  return OptDePngFilterTo_Driver(dst, dstStride, src, h, bpp, srcBpl, OptDePngSpanSSSE3, OptDePngUpToSSE2);
+}
+
+OptDePngConvertFunc OptDePngConvertGetSSSE3(uint32_t bpp, uint32_t format) {
+  return OptDePngConvertSelectSSE2(bpp, format);
+}
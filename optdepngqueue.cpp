@@ -0,0 +1,613 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+#include "./optdepng_p.h"
+#include "./optdepngqueue.h"
+#include "./optthreadpool.h"
+
+// ============================================================================
+// [Constants]
+// ============================================================================
+
+// Condition variables used by `_wait()` and `_wake()`.
+enum {
+  kOptDePngQueueCondWork = 0,
+  kOptDePngQueueCondDone = 1
+};
+
+// Size of a band a large image is split into, in BYTEs. Images smaller than
+// twice that are never split.
+static const uint32_t kOptDePngQueueChunkSize = 256 * 1024;
+// Initial capacity of a task queue, it grows by doubling.
+static const uint32_t kOptDePngQueueInitialCapacity = 64;
+// Maximum number of CPUs and NUMA nodes considered by thread pinning.
+static const uint32_t kOptDePngQueueMaxCpus = 1024;
+static const uint32_t kOptDePngQueueMaxNodes = 64;
+
+// ============================================================================
+// [Worker]
+//
+// Task queue of one thread (a ring buffer), the owner takes the newest task
+// the thieves the oldest one. Each queue has its own lock, which is held only
+// to move a task in or out.
+// ============================================================================
+
+struct OptDePngQueueWorker {
+  OptDePngQueue* queue;
+  uint32_t index;
+  // CPU the thread is pinned to or -1, and its NUMA node.
+  int32_t cpu;
+  uint32_t node;
+  bool started;
+
+#if defined(_WIN32)
+  HANDLE thread;
+  CRITICAL_SECTION mutex;
+#else
+  pthread_t thread;
+  pthread_mutex_t mutex;
+#endif
+
+  OptDePngQueueTask* tasks;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t count;
+};
+
+static OPT_INLINE void OptDePngQueueWorkerLock(OptDePngQueueWorker& w) {
+#if defined(_WIN32)
+  ::EnterCriticalSection(&w.mutex);
+#else
+  pthread_mutex_lock(&w.mutex);
+#endif
+}
+
+static OPT_INLINE void OptDePngQueueWorkerUnlock(OptDePngQueueWorker& w) {
+#if defined(_WIN32)
+  ::LeaveCriticalSection(&w.mutex);
+#else
+  pthread_mutex_unlock(&w.mutex);
+#endif
+}
+
+// ============================================================================
+// [Topology]
+//
+// CPUs the process may run on and their NUMA nodes, ordered so that adjacent
+// CPUs are on different nodes. Pinned workers take CPUs in this order, so any
+// number of workers is spread evenly across nodes, and never more CPUs than
+// the affinity mask of the process allows are used.
+// ============================================================================
+
+#if defined(__linux__)
+// Parse a CPU list like "0-3,8-11" of `/sys/devices/system/node/nodeN/cpulist`.
+static void OptDePngQueueReadNode(uint32_t* nodeOf, uint32_t node) {
+  char path[64];
+  ::snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+
+  FILE* f = ::fopen(path, "r");
+  if (f == NULL)
+    return;
+
+  char buf[4096];
+  size_t len = ::fread(buf, 1, sizeof(buf) - 1, f);
+  ::fclose(f);
+  buf[len] = '\0';
+
+  const char* s = buf;
+  for (;;) {
+    char* end;
+    unsigned long first = ::strtoul(s, &end, 10);
+    if (end == s)
+      break;
+
+    unsigned long last = first;
+    s = end;
+
+    if (*s == '-') {
+      last = ::strtoul(s + 1, &end, 10);
+      s = end;
+    }
+
+    for (unsigned long cpu = first; cpu <= last && cpu < kOptDePngQueueMaxCpus; cpu++)
+      nodeOf[cpu] = node;
+
+    if (*s != ',')
+      break;
+    s++;
+  }
+}
+#endif
+
+// Get CPUs (in increasing order) and their nodes, returns zero if unknown.
+static uint32_t OptDePngQueueGetCpus(uint32_t* cpus, uint32_t* nodes) {
+  uint32_t count = 0;
+
+#if defined(_WIN32)
+  DWORD_PTR processMask;
+  DWORD_PTR systemMask;
+
+  if (!::GetProcessAffinityMask(::GetCurrentProcess(), &processMask, &systemMask))
+    return 0;
+
+  for (uint32_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; cpu++) {
+    if (((processMask >> cpu) & 1) == 0)
+      continue;
+
+    UCHAR node;
+    if (!::GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node))
+      node = 0;
+
+    cpus[count] = cpu;
+    nodes[count] = Min<uint32_t>(node, kOptDePngQueueMaxNodes - 1);
+    count++;
+  }
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  if (::sched_getaffinity(0, sizeof(set), &set) != 0)
+    return 0;
+
+  uint32_t nodeOf[kOptDePngQueueMaxCpus];
+  ::memset(nodeOf, 0, sizeof(nodeOf));
+
+  for (uint32_t node = 0; node < kOptDePngQueueMaxNodes; node++)
+    OptDePngQueueReadNode(nodeOf, node);
+
+  for (uint32_t cpu = 0; cpu < kOptDePngQueueMaxCpus && cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+
+    cpus[count] = cpu;
+    nodes[count] = nodeOf[cpu];
+    count++;
+  }
+#else
+  (void)cpus;
+  (void)nodes;
+#endif
+
+  return count;
+}
+
+// Reorder CPUs so that each round takes the next CPU of each node.
+static void OptDePngQueueSpreadCpus(uint32_t* cpus, uint32_t* nodes, uint32_t count) {
+  uint32_t orderedCpus[kOptDePngQueueMaxCpus];
+  uint32_t orderedNodes[kOptDePngQueueMaxCpus];
+  uint32_t next[kOptDePngQueueMaxNodes] = { 0 };
+
+  uint32_t nodeCount = 0;
+  for (uint32_t i = 0; i < count; i++)
+    nodeCount = Max(nodeCount, nodes[i] + 1);
+
+  uint32_t n = 0;
+  while (n < count) {
+    for (uint32_t node = 0; node < nodeCount; node++) {
+      uint32_t& i = next[node];
+      while (i < count && nodes[i] != node)
+        i++;
+
+      if (i < count) {
+        orderedCpus[n] = cpus[i];
+        orderedNodes[n] = node;
+        n++;
+        i++;
+      }
+    }
+  }
+
+  ::memcpy(cpus, orderedCpus, count * sizeof(uint32_t));
+  ::memcpy(nodes, orderedNodes, count * sizeof(uint32_t));
+}
+
+static void OptDePngQueuePinThread(uint32_t cpu) {
+#if defined(_WIN32)
+  ::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+
+// ============================================================================
+// [OptDePngQueue - Construction / Destruction]
+// ============================================================================
+
+OptDePngQueue::OptDePngQueue()
+  : _workers(NULL),
+    _queueCount(0),
+    _workerCount(0),
+    _nextQueue(0),
+    _quit(false),
+    _filter(OptDePngFilterGetBest()),
+    _queued(0),
+    _pending(0),
+    _error(kOptDePngErrorOk) {
+
+#if defined(_WIN32)
+  ::InitializeCriticalSection(&_mutex);
+  ::InitializeConditionVariable(&_cond[0]);
+  ::InitializeConditionVariable(&_cond[1]);
+#else
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond[0], NULL);
+  pthread_cond_init(&_cond[1], NULL);
+#endif
+}
+
+OptDePngQueue::~OptDePngQueue() {
+  reset();
+
+#if defined(_WIN32)
+  ::DeleteCriticalSection(&_mutex);
+#else
+  pthread_cond_destroy(&_cond[1]);
+  pthread_cond_destroy(&_cond[0]);
+  pthread_mutex_destroy(&_mutex);
+#endif
+}
+
+// ============================================================================
+// [OptDePngQueue - Init / Reset]
+// ============================================================================
+
+#if defined(_WIN32)
+static DWORD WINAPI OptDePngQueueEntry(LPVOID arg) {
+  OptDePngQueueWorker* w = static_cast<OptDePngQueueWorker*>(arg);
+  w->queue->_workerMain(w->index);
+  return 0;
+}
+#else
+static void* OptDePngQueueEntry(void* arg) {
+  OptDePngQueueWorker* w = static_cast<OptDePngQueueWorker*>(arg);
+  w->queue->_workerMain(w->index);
+  return NULL;
+}
+#endif
+
+bool OptDePngQueue::init(uint32_t threadCount, bool pinThreads) {
+  reset();
+
+  uint32_t cpus[kOptDePngQueueMaxCpus];
+  uint32_t nodes[kOptDePngQueueMaxCpus];
+  uint32_t cpuCount = OptDePngQueueGetCpus(cpus, nodes);
+
+  if (threadCount == 0)
+    threadCount = cpuCount != 0 ? cpuCount : OptThreadPool::getCpuCount();
+
+  if (!pinThreads)
+    cpuCount = 0;
+  OptDePngQueueSpreadCpus(cpus, nodes, cpuCount);
+
+  _workers = static_cast<OptDePngQueueWorker*>(::malloc(threadCount * sizeof(OptDePngQueueWorker)));
+  if (_workers == NULL)
+    return false;
+
+  // Worker `i` takes the i-th CPU, the first one is left to the calling thread,
+  // which is not pinned, but it still gets a node to steal from first.
+  for (uint32_t i = 0; i < threadCount; i++) {
+    OptDePngQueueWorker& w = _workers[i];
+
+    w.queue = this;
+    w.index = i;
+    w.cpu = (i != 0 && cpuCount != 0) ? static_cast<int32_t>(cpus[i % cpuCount]) : -1;
+    w.node = cpuCount != 0 ? nodes[i % cpuCount] : 0;
+    w.started = false;
+    w.tasks = NULL;
+    w.capacity = 0;
+    w.head = 0;
+    w.count = 0;
+
+#if defined(_WIN32)
+    ::InitializeCriticalSection(&w.mutex);
+#else
+    pthread_mutex_init(&w.mutex, NULL);
+#endif
+  }
+
+  // Queues of threads that failed to start are drained by the others.
+  _queueCount = threadCount;
+
+  for (uint32_t i = 1; i < threadCount; i++) {
+    OptDePngQueueWorker& w = _workers[i];
+
+#if defined(_WIN32)
+    w.thread = ::CreateThread(NULL, 0, OptDePngQueueEntry, &w, 0, NULL);
+    w.started = w.thread != NULL;
+#else
+    w.started = pthread_create(&w.thread, NULL, OptDePngQueueEntry, &w) == 0;
+#endif
+
+    if (!w.started) {
+      if (i == 1) {
+        reset();
+        return false;
+      }
+      break;
+    }
+
+    _workerCount++;
+  }
+
+  return true;
+}
+
+void OptDePngQueue::reset() {
+  if (_workers == NULL)
+    return;
+
+  _lock();
+  _quit = true;
+  _wake(kOptDePngQueueCondWork);
+  _unlock();
+
+  for (uint32_t i = 0; i < _queueCount; i++) {
+    OptDePngQueueWorker& w = _workers[i];
+
+    if (w.started) {
+#if defined(_WIN32)
+      ::WaitForSingleObject(w.thread, INFINITE);
+      ::CloseHandle(w.thread);
+#else
+      pthread_join(w.thread, NULL);
+#endif
+    }
+
+#if defined(_WIN32)
+    ::DeleteCriticalSection(&w.mutex);
+#else
+    pthread_mutex_destroy(&w.mutex);
+#endif
+    ::free(w.tasks);
+  }
+
+  ::free(_workers);
+  _workers = NULL;
+
+  _queueCount = 0;
+  _workerCount = 0;
+  _nextQueue = 0;
+  _quit = false;
+}
+
+// ============================================================================
+// [OptDePngQueue - Submit / Wait]
+// ============================================================================
+
+void OptDePngQueue::submit(OptDePngBatchItem* item) {
+  uint32_t h = item->h;
+  uint32_t bpp = item->bpp;
+  uint32_t bpl = item->bpl;
+
+  uint32_t err = OptDePngValidate(bpp, bpl);
+  if (err == kOptDePngErrorOk && (_workers == NULL || h == 0))
+    err = _filter(item->p, h, bpp, bpl);
+
+  item->error = err;
+  if (err != kOptDePngErrorOk && _error == kOptDePngErrorOk)
+    _error = err;
+
+  if (err != kOptDePngErrorOk || _workers == NULL || h == 0)
+    return;
+
+  // Split the image into bands of at least `kOptDePngQueueChunkSize` BYTEs,
+  // which start at rows that don't depend on the previous row. An image that
+  // has no such rows stays whole.
+  uint32_t bandRows = static_cast<uint64_t>(h) * bpl >= 2 * kOptDePngQueueChunkSize
+    ? Max<uint32_t>(kOptDePngQueueChunkSize / bpl, 1) : h;
+
+  OptDePngQueueTask task;
+  task.bpp = bpp;
+  task.bpl = bpl;
+
+  uint32_t y0 = 0;
+  while (y0 < h) {
+    uint32_t y1 = y0 + Min(bandRows, h - y0);
+    while (y1 < h) {
+      uint32_t filter = item->p[static_cast<size_t>(y1) * bpl];
+      if (filter == kPngFilterNone || filter == kPngFilterSub)
+        break;
+      y1++;
+    }
+
+    task.p = item->p + static_cast<size_t>(y0) * bpl;
+    task.h = y1 - y0;
+
+    OptAtomicAdd(&_pending, 1);
+    OptAtomicAdd(&_queued, 1);
+
+    // Run the task right away if the queue can't grow.
+    if (!_push(_nextQueue, task)) {
+      OptAtomicAdd(&_queued, ~0u);
+      _filter(task.p, task.h, task.bpp, task.bpl);
+      OptAtomicAdd(&_pending, ~0u);
+    }
+
+    if (++_nextQueue == _queueCount)
+      _nextQueue = 0;
+    y0 = y1;
+  }
+
+  if (_workerCount != 0) {
+    _lock();
+    _wake(kOptDePngQueueCondWork);
+    _unlock();
+  }
+}
+
+uint32_t OptDePngQueue::wait() {
+  if (_workers != NULL) {
+    while (_work(0))
+      continue;
+
+    _lock();
+    while (OptAtomicLoad(&_pending) != 0)
+      _wait(kOptDePngQueueCondDone);
+    _unlock();
+  }
+
+  uint32_t err = _error;
+  _error = kOptDePngErrorOk;
+  return err;
+}
+
+// ============================================================================
+// [OptDePngQueue - Work]
+// ============================================================================
+
+bool OptDePngQueue::_push(uint32_t index, const OptDePngQueueTask& task) {
+  OptDePngQueueWorker& w = _workers[index];
+  OptDePngQueueWorkerLock(w);
+
+  if (w.count == w.capacity) {
+    uint32_t capacity = w.capacity != 0 ? w.capacity * 2 : kOptDePngQueueInitialCapacity;
+    OptDePngQueueTask* tasks = static_cast<OptDePngQueueTask*>(::malloc(capacity * sizeof(OptDePngQueueTask)));
+
+    if (tasks == NULL) {
+      OptDePngQueueWorkerUnlock(w);
+      return false;
+    }
+
+    // Unwrap the ring, so the oldest task is at index zero.
+    for (uint32_t i = 0; i < w.count; i++)
+      tasks[i] = w.tasks[(w.head + i) & (w.capacity - 1)];
+
+    ::free(w.tasks);
+    w.tasks = tasks;
+    w.capacity = capacity;
+    w.head = 0;
+  }
+
+  w.tasks[(w.head + w.count) & (w.capacity - 1)] = task;
+  w.count++;
+
+  OptDePngQueueWorkerUnlock(w);
+  return true;
+}
+
+bool OptDePngQueue::_pop(uint32_t index, OptDePngQueueTask& task) {
+  OptDePngQueueWorker& w = _workers[index];
+  OptDePngQueueWorkerLock(w);
+
+  bool ok = w.count != 0;
+  if (ok) {
+    w.count--;
+    task = w.tasks[(w.head + w.count) & (w.capacity - 1)];
+  }
+
+  OptDePngQueueWorkerUnlock(w);
+  return ok;
+}
+
+bool OptDePngQueue::_steal(uint32_t index, OptDePngQueueTask& task) {
+  uint32_t node = _workers[index].node;
+
+  // Try victims on the same node first, then all others.
+  for (uint32_t pass = 0; pass < 2; pass++) {
+    for (uint32_t i = 1; i < _queueCount; i++) {
+      OptDePngQueueWorker& w = _workers[(index + i) % _queueCount];
+      if ((w.node == node) != (pass == 0) || OptAtomicLoad(&_queued) == 0)
+        continue;
+
+      OptDePngQueueWorkerLock(w);
+
+      bool ok = w.count != 0;
+      if (ok) {
+        task = w.tasks[w.head];
+        w.head = (w.head + 1) & (w.capacity - 1);
+        w.count--;
+      }
+
+      OptDePngQueueWorkerUnlock(w);
+      if (ok)
+        return true;
+    }
+  }
+
+  return false;
+}
+
+// Run one task of the own queue or a stolen one, returns false if there is
+// no task at all.
+bool OptDePngQueue::_work(uint32_t index) {
+  OptDePngQueueTask task;
+  if (!_pop(index, task) && !_steal(index, task))
+    return false;
+
+  OptAtomicAdd(&_queued, ~0u);
+  _filter(task.p, task.h, task.bpp, task.bpl);
+
+  if (OptAtomicAdd(&_pending, ~0u) == 1) {
+    _lock();
+    _wake(kOptDePngQueueCondDone);
+    _unlock();
+  }
+
+  return true;
+}
+
+void OptDePngQueue::_workerMain(uint32_t index) {
+  if (_workers[index].cpu >= 0)
+    OptDePngQueuePinThread(static_cast<uint32_t>(_workers[index].cpu));
+
+  for (;;) {
+    if (_work(index))
+      continue;
+
+    // A task counted by `_queued` may not be in its queue yet, in that case
+    // the loop spins until it's there.
+    _lock();
+    while (OptAtomicLoad(&_queued) == 0 && !_quit)
+      _wait(kOptDePngQueueCondWork);
+
+    bool quit = _quit && OptAtomicLoad(&_queued) == 0;
+    _unlock();
+
+    if (quit)
+      break;
+  }
+}
+
+// ============================================================================
+// [OptDePngQueue - Synchronization]
+// ============================================================================
+
+void OptDePngQueue::_lock() {
+#if defined(_WIN32)
+  ::EnterCriticalSection(&_mutex);
+#else
+  pthread_mutex_lock(&_mutex);
+#endif
+}
+
+void OptDePngQueue::_unlock() {
+#if defined(_WIN32)
+  ::LeaveCriticalSection(&_mutex);
+#else
+  pthread_mutex_unlock(&_mutex);
+#endif
+}
+
+void OptDePngQueue::_wait(uint32_t which) {
+#if defined(_WIN32)
+  ::SleepConditionVariableCS(&_cond[which], &_mutex, INFINITE);
+#else
+  pthread_cond_wait(&_cond[which], &_mutex);
+#endif
+}
+
+void OptDePngQueue::_wake(uint32_t which) {
+#if defined(_WIN32)
+  ::WakeAllConditionVariable(&_cond[which]);
+#else
+  pthread_cond_broadcast(&_cond[which]);
+#endif
+}
@@ -0,0 +1,107 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// [Guard]
+#ifndef _OPTDEPNGQUEUE_H
+#define _OPTDEPNGQUEUE_H
+
+#include "./optdepng.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// ============================================================================
+// [OptDePngQueue]
+//
+// Unfilters many independent images of any size by a pool of worker threads,
+// meant for aggregate throughput of decode jobs. Each submitted image becomes
+// one or more tasks: small images stay whole, large images are split into
+// bands of rows that start at a row that doesn't depend on the previous one
+// (`None` or `Sub`), other rows never start a band. Each thread has its own
+// queue of tasks, an idle thread steals tasks from other threads, the threads
+// on the same NUMA node first. The calling thread works too while it waits.
+// ============================================================================
+
+struct OptDePngQueueTask {
+  uint8_t* p;
+  uint32_t h;
+  uint32_t bpp;
+  uint32_t bpl;
+};
+
+struct OptDePngQueueWorker;
+
+class OptDePngQueue {
+public:
+  OptDePngQueue();
+  ~OptDePngQueue();
+
+  //! Create worker threads. The `threadCount` includes the calling thread, if
+  //! zero the number of CPUs available to the process is used. If `pinThreads`
+  //! is true, each worker is pinned to one CPU and workers are spread across
+  //! NUMA nodes (Linux and Windows only).
+  bool init(uint32_t threadCount = 0, bool pinThreads = false);
+  //! Stop and join all worker threads, must not be called while images are
+  //! pending.
+  void reset();
+
+  //! Get the number of threads (including the calling thread).
+  uint32_t getThreadCount() const { return _workerCount + 1; }
+
+  //! Queue `item` to be unfiltered, it must stay valid until `wait()` returns.
+  //! An item that has an invalid geometry gets its `error` set immediately and
+  //! is not queued. Before `init()` the item is unfiltered by the call.
+  void submit(OptDePngBatchItem* item);
+  //! Wait for all submitted images, returns the first error of `submit()`.
+  uint32_t wait();
+
+  // --------------------------------------------------------------------------
+  // [Internal]
+  // --------------------------------------------------------------------------
+
+  bool _push(uint32_t index, const OptDePngQueueTask& task);
+  bool _pop(uint32_t index, OptDePngQueueTask& task);
+  bool _steal(uint32_t index, OptDePngQueueTask& task);
+  bool _work(uint32_t index);
+  void _workerMain(uint32_t index);
+
+  void _lock();
+  void _unlock();
+  void _wait(uint32_t which);
+  void _wake(uint32_t which);
+
+#if defined(_WIN32)
+  CRITICAL_SECTION _mutex;
+  CONDITION_VARIABLE _cond[2];
+#else
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond[2];
+#endif
+
+  //! Task queues, the first one belongs to the calling thread.
+  OptDePngQueueWorker* _workers;
+  uint32_t _queueCount;
+  uint32_t _workerCount;
+  //! Queue that gets the next submitted task.
+  uint32_t _nextQueue;
+  bool _quit;
+
+  OptDePngFilterFunc _filter;
+  //! Tasks in queues and tasks not finished yet.
+  volatile uint32_t _queued;
+  volatile uint32_t _pending;
+  uint32_t _error;
+
+private:
+  OptDePngQueue(const OptDePngQueue&);
+  OptDePngQueue& operator=(const OptDePngQueue&);
+};
+
+// [Guard]
+#endif // _OPTDEPNGQUEUE_H
@@ -21,13 +21,26 @@
 #if defined(_WIN32)
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// ============================================================================
+// [Architecture]
+// ============================================================================
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+# define OPT_ARCH_X86
+#elif defined(_M_ARM64) || defined(__aarch64__)
+# define OPT_ARCH_ARM64
 #endif
 
 // ============================================================================
 // [Instructions]
 // ============================================================================
 
+#if defined(OPT_ARCH_X86)
 // SSE.
 #include <xmmintrin.h>
 
@@ -41,6 +54,33 @@
 #include <tmmintrin.h>
 #endif // USE_SSE3
 
+// SSE4.2 (CRC32 instruction).
+#if defined(USE_SSE42)
+#include <nmmintrin.h>
+#endif // USE_SSE42
+
+// AVX2 and AVX-512.
+#if defined(USE_AVX2) || defined(USE_AVX512)
+#include <immintrin.h>
+#endif // USE_AVX2 || USE_AVX512
+
+// CPUID.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__)
+#include <cpuid.h>
+#endif
+#endif // OPT_ARCH_X86
+
+// NEON (always available on ARM64).
+#if defined(USE_NEON)
+#include <arm_neon.h>
+#endif // USE_NEON
+
+#if defined(OPT_ARCH_ARM64) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 // ============================================================================
 // [Portability]
 // ============================================================================
@@ -51,6 +91,12 @@
 # define OPT_INLINE inline
 #endif
 
+#if defined(_MSC_VER)
+# define OPT_ALIGN(N) __declspec(align(N))
+#else
+# define OPT_ALIGN(N) __attribute__((aligned(N)))
+#endif
+
 // ============================================================================
 // [Helpers]
 // ============================================================================
@@ -68,27 +114,239 @@ static uint32_t OPT_INLINE OptAlignDiff(T p, uint32_t alignment) {
 }
 
 // ============================================================================
-// [OptTimer]
+// [Atomics]
+//
+// Minimal set of atomic operations used to synchronize threads. Loads have
+// acquire and stores release semantics, which is all the drivers need. MSVC
+// on x86 only needs a compiler barrier as the hardware doesn't reorder these,
+// ARM64 needs LDAR/STLR.
 // ============================================================================
 
-struct OptTimer {
-  OPT_INLINE OptTimer() : _cnt(0) {}
+static OPT_INLINE uint32_t OptAtomicLoad(const volatile uint32_t* p) {
+#if defined(_MSC_VER) && defined(OPT_ARCH_ARM64)
+  return __ldar32(const_cast<volatile uint32_t*>(p));
+#elif defined(_MSC_VER)
+  uint32_t v = *p;
+  _ReadWriteBarrier();
+  return v;
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
 
-  OPT_INLINE uint32_t get() const { return _cnt; }
-  OPT_INLINE void start() { _cnt = _getTime(); }
-  OPT_INLINE void stop() { _cnt = _getTime() - _cnt; }
+static OPT_INLINE void OptAtomicStore(volatile uint32_t* p, uint32_t v) {
+#if defined(_MSC_VER) && defined(OPT_ARCH_ARM64)
+  __stlr32(p, v);
+#elif defined(_MSC_VER)
+  _ReadWriteBarrier();
+  *p = v;
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+// Returns the value before the addition.
+static OPT_INLINE uint32_t OptAtomicAdd(volatile uint32_t* p, uint32_t v) {
+#if defined(_MSC_VER)
+  return static_cast<uint32_t>(_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(p), static_cast<long>(v)));
+#else
+  return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Spin-wait hint.
+static OPT_INLINE void OptPause() {
+#if defined(OPT_ARCH_X86)
+  _mm_pause();
+#elif defined(OPT_ARCH_ARM64) && defined(_MSC_VER)
+  __yield();
+#elif defined(OPT_ARCH_ARM64)
+  __asm__ __volatile__("yield");
+#endif
+}
 
-  static OPT_INLINE uint32_t _getTime() {
+// Give up the rest of the time slice to other threads.
+static OPT_INLINE void OptYield() {
 #if defined(_WIN32)
-    return GetTickCount();
+  ::SwitchToThread();
 #else
-    timeval ts;
-    gettimeofday(&ts,0);
-    return (uint32_t)(ts.tv_sec * 1000 + (ts.tv_usec / 1000));
+  ::sched_yield();
+#endif
+}
+
+// ============================================================================
+// [OptCpu]
+// ============================================================================
+
+enum OptCpuFeatures {
+  kOptCpuSSE2  = 0x00000001,
+  kOptCpuSSSE3 = 0x00000002,
+  kOptCpuAVX2  = 0x00000004,
+  kOptCpuNEON  = 0x00000008,
+  // AVX512F, AVX512BW, AVX512VL, and AVX512VBMI (all of them are required).
+  kOptCpuAVX512 = 0x00000010,
+  kOptCpuSSE42 = 0x00000020
+};
+
+struct OptCpu {
+#if defined(OPT_ARCH_X86)
+  static OPT_INLINE void _cpuid(uint32_t level, uint32_t sub, uint32_t out[4]) {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuidex(regs, static_cast<int>(level), static_cast<int>(sub));
+    for (uint32_t i = 0; i < 4; i++)
+      out[i] = static_cast<uint32_t>(regs[i]);
+#else
+    __cpuid_count(level, sub, out[0], out[1], out[2], out[3]);
+#endif
+  }
+
+  // Returns XCR0, which tells which register states are saved by the OS. AVX
+  // instructions can only be used if both XMM and YMM states are enabled.
+  static OPT_INLINE uint64_t _xgetbv() {
+#if defined(_MSC_VER)
+    return static_cast<uint64_t>(::_xgetbv(0));
+#else
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+  }
+#endif // OPT_ARCH_X86
+
+  static uint32_t detect() {
+    uint32_t features = 0;
+
+#if defined(OPT_ARCH_X86)
+    uint32_t regs[4];
+
+    _cpuid(0, 0, regs);
+    uint32_t maxLevel = regs[0];
+
+    if (maxLevel >= 1) {
+      _cpuid(1, 0, regs);
+      if (regs[3] & (1u << 26)) features |= kOptCpuSSE2;
+      if (regs[2] & (1u <<  9)) features |= kOptCpuSSSE3;
+      if (regs[2] & (1u << 20)) features |= kOptCpuSSE42;
+
+      // AVX2 requires OSXSAVE and the OS to preserve XMM|YMM registers.
+      bool avxOS = (regs[2] & (1u << 27)) != 0 && (_xgetbv() & 0x6) == 0x6;
+      if (avxOS && maxLevel >= 7) {
+        _cpuid(7, 0, regs);
+        if (regs[1] & (1u << 5)) features |= kOptCpuAVX2;
+
+        // AVX-512 also requires the OS to preserve K0-7 and ZMM0-31.
+        const uint32_t kAVX512Mask = (1u << 16) | (1u << 30) | (1u << 31);
+        if ((regs[1] & kAVX512Mask) == kAVX512Mask && (regs[2] & (1u << 1)) && (_xgetbv() & 0xE6) == 0xE6)
+          features |= kOptCpuAVX512;
+      }
+    }
+#elif defined(OPT_ARCH_ARM64)
+    // NEON is a mandatory part of ARMv8-A.
+    features |= kOptCpuNEON;
+#endif
+
+    return features;
+  }
+
+  // Get the size of the data cache of the given `level` (1, 2, or 3) in BYTEs,
+  // or zero if it's not known.
+  static uint32_t getCacheSize(uint32_t level) {
+#if defined(OPT_ARCH_X86)
+    uint32_t regs[4];
+
+    _cpuid(0, 0, regs);
+    uint32_t maxLevel = regs[0];
+
+    // Intel - deterministic cache parameters ("GenuineIntel" starts with "Genu").
+    if (regs[1] == 0x756E6547u && maxLevel >= 4) {
+      for (uint32_t i = 0; i < 16; i++) {
+        _cpuid(4, i, regs);
+
+        uint32_t type = regs[0] & 0x1F;
+        if (type == 0)
+          break;
+
+        // Data (1) or unified (3) cache.
+        if ((type == 1 || type == 3) && ((regs[0] >> 5) & 0x7) == level) {
+          uint32_t ways = ((regs[1] >> 22) & 0x3FF) + 1;
+          uint32_t partitions = ((regs[1] >> 12) & 0x3FF) + 1;
+          uint32_t lineSize = (regs[1] & 0xFFF) + 1;
+          return ways * partitions * lineSize * (regs[2] + 1);
+        }
+      }
+      return 0;
+    }
+
+    // AMD and others - L1 and L2 sizes in KiB, L3 size in 512 KiB units, all
+    // reported by extended leaves.
+    _cpuid(0x80000000u, 0, regs);
+    uint32_t maxExtLevel = regs[0];
+
+    if (level == 1 && maxExtLevel >= 0x80000005u) {
+      _cpuid(0x80000005u, 0, regs);
+      return (regs[2] >> 24) * 1024;
+    }
+
+    if (level == 2 && maxExtLevel >= 0x80000006u) {
+      _cpuid(0x80000006u, 0, regs);
+      return (regs[2] >> 16) * 1024;
+    }
+
+    if (level == 3 && maxExtLevel >= 0x80000006u) {
+      _cpuid(0x80000006u, 0, regs);
+      return (regs[3] >> 18) * 512 * 1024;
+    }
+#elif defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    long size = ::sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE :
+                          level == 2 ? _SC_LEVEL2_CACHE_SIZE  : _SC_LEVEL3_CACHE_SIZE);
+    if (size > 0)
+      return static_cast<uint32_t>(size);
+#endif
+
+    (void)level;
+    return 0;
+  }
+};
+
+// ============================================================================
+// [OptClock]
+//
+// Monotonic clock with nanosecond resolution and a time-stamp counter, both
+// used by benchmarks. TSC counts reference cycles, which match CPU cycles only
+// if the CPU runs at its nominal frequency (no turbo or power saving). ARM64
+// uses the generic timer, which usually runs much slower than the CPU.
+// ============================================================================
+
+struct OptClock {
+  static OPT_INLINE uint64_t ns() {
+#if defined(_WIN32)
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return static_cast<uint64_t>(static_cast<double>(cnt.QuadPart) * 1e9 / static_cast<double>(freq.QuadPart));
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
 #endif
   }
 
-  uint32_t _cnt;
+  static OPT_INLINE uint64_t tsc() {
+#if defined(_MSC_VER) && defined(OPT_ARCH_X86)
+    return __rdtsc();
+#elif defined(__GNUC__) && defined(OPT_ARCH_X86)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#elif defined(__GNUC__) && defined(OPT_ARCH_ARM64)
+    uint64_t cnt;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cnt));
+    return cnt;
+#else
+    return 0;
+#endif
+  }
 };
 
 // [Guard]
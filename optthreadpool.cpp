@@ -0,0 +1,262 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+#include "./optglobals.h"
+#include "./optthreadpool.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+// ============================================================================
+// [Constants]
+// ============================================================================
+
+// Condition variables used by `_wait()` and `_wake()`.
+enum {
+  kOptThreadPoolCondWork = 0,
+  kOptThreadPoolCondDone = 1
+};
+
+// ============================================================================
+// [OptThreadPool - Construction / Destruction]
+// ============================================================================
+
+OptThreadPool::OptThreadPool()
+  : _threads(NULL),
+    _workerCount(0),
+    _busyCount(0),
+    _generation(0),
+    _quit(false),
+    _func(NULL),
+    _data(NULL),
+    _count(0),
+    _next(0) {
+
+#if defined(_WIN32)
+  ::InitializeCriticalSection(&_mutex);
+  ::InitializeConditionVariable(&_cond[0]);
+  ::InitializeConditionVariable(&_cond[1]);
+#else
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond[0], NULL);
+  pthread_cond_init(&_cond[1], NULL);
+#endif
+}
+
+OptThreadPool::~OptThreadPool() {
+  reset();
+
+#if defined(_WIN32)
+  ::DeleteCriticalSection(&_mutex);
+#else
+  pthread_cond_destroy(&_cond[1]);
+  pthread_cond_destroy(&_cond[0]);
+  pthread_mutex_destroy(&_mutex);
+#endif
+}
+
+// ============================================================================
+// [OptThreadPool - Init / Reset]
+// ============================================================================
+
+#if defined(_WIN32)
+static DWORD WINAPI OptThreadPoolEntry(LPVOID arg) {
+  static_cast<OptThreadPool*>(arg)->_workerMain();
+  return 0;
+}
+#else
+static void* OptThreadPoolEntry(void* arg) {
+  static_cast<OptThreadPool*>(arg)->_workerMain();
+  return NULL;
+}
+#endif
+
+bool OptThreadPool::init(uint32_t threadCount) {
+  reset();
+
+  if (threadCount == 0)
+    threadCount = getCpuCount();
+
+  uint32_t workerCount = threadCount - 1;
+  if (workerCount == 0)
+    return true;
+
+  // Workers start by waiting for a generation other than zero.
+  _generation = 0;
+
+#if defined(_WIN32)
+  _threads = static_cast<HANDLE*>(::malloc(workerCount * sizeof(HANDLE)));
+#else
+  _threads = static_cast<pthread_t*>(::malloc(workerCount * sizeof(pthread_t)));
+#endif
+
+  if (_threads == NULL)
+    return false;
+
+  for (uint32_t i = 0; i < workerCount; i++) {
+#if defined(_WIN32)
+    _threads[i] = ::CreateThread(NULL, 0, OptThreadPoolEntry, this, 0, NULL);
+    bool ok = _threads[i] != NULL;
+#else
+    bool ok = pthread_create(&_threads[i], NULL, OptThreadPoolEntry, this) == 0;
+#endif
+
+    if (!ok) {
+      // Keep the threads that have been created, the pool is still usable.
+      if (i == 0) {
+        ::free(_threads);
+        _threads = NULL;
+        return false;
+      }
+      break;
+    }
+
+    _workerCount++;
+  }
+
+  return true;
+}
+
+void OptThreadPool::reset() {
+  if (_threads == NULL)
+    return;
+
+  _lock();
+  _quit = true;
+  _wake(kOptThreadPoolCondWork);
+  _unlock();
+
+  for (uint32_t i = 0; i < _workerCount; i++) {
+#if defined(_WIN32)
+    ::WaitForSingleObject(_threads[i], INFINITE);
+    ::CloseHandle(_threads[i]);
+#else
+    pthread_join(_threads[i], NULL);
+#endif
+  }
+
+  ::free(_threads);
+  _threads = NULL;
+
+  _workerCount = 0;
+  _quit = false;
+}
+
+uint32_t OptThreadPool::getCpuCount() {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  uint32_t n = static_cast<uint32_t>(info.dwNumberOfProcessors);
+#else
+  long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n > 0 ? static_cast<uint32_t>(n) : 1;
+}
+
+// ============================================================================
+// [OptThreadPool - Run]
+// ============================================================================
+
+void OptThreadPool::run(OptThreadFunc func, void* data, uint32_t count) {
+  if (_workerCount == 0 || count <= 1) {
+    for (uint32_t i = 0; i < count; i++)
+      func(data, i);
+    return;
+  }
+
+  _lock();
+  _func = func;
+  _data = data;
+  _count = count;
+  _next = 0;
+  _busyCount = _workerCount;
+  _generation++;
+  _wake(kOptThreadPoolCondWork);
+  _unlock();
+
+  _work();
+
+  // Wait for all workers, even those that didn't get any task, so none of
+  // them can see the data of the next `run()` call.
+  _lock();
+  while (_busyCount != 0)
+    _wait(kOptThreadPoolCondDone);
+  _unlock();
+}
+
+void OptThreadPool::_work() {
+  OptThreadFunc func = _func;
+  void* data = _data;
+  uint32_t count = _count;
+
+  for (;;) {
+    uint32_t index = OptAtomicAdd(&_next, 1);
+    if (index >= count)
+      break;
+    func(data, index);
+  }
+}
+
+void OptThreadPool::_workerMain() {
+  uint32_t generation = 0;
+  _lock();
+
+  for (;;) {
+    while (_generation == generation && !_quit)
+      _wait(kOptThreadPoolCondWork);
+
+    if (_quit)
+      break;
+
+    generation = _generation;
+    _unlock();
+
+    _work();
+
+    _lock();
+    if (--_busyCount == 0)
+      _wake(kOptThreadPoolCondDone);
+  }
+
+  _unlock();
+}
+
+// ============================================================================
+// [OptThreadPool - Synchronization]
+// ============================================================================
+
+void OptThreadPool::_lock() {
+#if defined(_WIN32)
+  ::EnterCriticalSection(&_mutex);
+#else
+  pthread_mutex_lock(&_mutex);
+#endif
+}
+
+void OptThreadPool::_unlock() {
+#if defined(_WIN32)
+  ::LeaveCriticalSection(&_mutex);
+#else
+  pthread_mutex_unlock(&_mutex);
+#endif
+}
+
+void OptThreadPool::_wait(uint32_t which) {
+#if defined(_WIN32)
+  ::SleepConditionVariableCS(&_cond[which], &_mutex, INFINITE);
+#else
+  pthread_cond_wait(&_cond[which], &_mutex);
+#endif
+}
+
+void OptThreadPool::_wake(uint32_t which) {
+#if defined(_WIN32)
+  ::WakeAllConditionVariable(&_cond[which]);
+#else
+  pthread_cond_broadcast(&_cond[which]);
+#endif
+}
@@ -0,0 +1,88 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// [Guard]
+#ifndef _OPTTHREADPOOL_H
+#define _OPTTHREADPOOL_H
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// ============================================================================
+// [OptThreadPool]
+//
+// A simple pool of worker threads that can run `count` tasks concurrently.
+// Tasks are handed out in increasing order of their index, so a task can wait
+// for a task that has a lower index without causing a deadlock. The calling
+// thread participates in the work, so the pool never has less than 1 thread.
+// ============================================================================
+
+typedef void (*OptThreadFunc)(void* data, uint32_t index);
+
+class OptThreadPool {
+public:
+  OptThreadPool();
+  ~OptThreadPool();
+
+  //! Create worker threads used by `run()`. The `threadCount` includes the
+  //! calling thread, if zero the number of the CPUs available is used.
+  bool init(uint32_t threadCount = 0);
+  //! Stop and join all worker threads.
+  void reset();
+
+  //! Get the number of threads (including the calling thread).
+  uint32_t getThreadCount() const { return _workerCount + 1; }
+
+  //! Run `func(data, index)` for each `index` in [0, count) and wait.
+  void run(OptThreadFunc func, void* data, uint32_t count);
+
+  //! Get the number of CPUs available to the process.
+  static uint32_t getCpuCount();
+
+  // --------------------------------------------------------------------------
+  // [Internal]
+  // --------------------------------------------------------------------------
+
+  void _work();
+  void _workerMain();
+
+  void _lock();
+  void _unlock();
+  void _wait(uint32_t which);
+  void _wake(uint32_t which);
+
+#if defined(_WIN32)
+  CRITICAL_SECTION _mutex;
+  CONDITION_VARIABLE _cond[2];
+  HANDLE* _threads;
+#else
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond[2];
+  pthread_t* _threads;
+#endif
+
+  uint32_t _workerCount;
+  uint32_t _busyCount;
+  uint32_t _generation;
+  bool _quit;
+
+  OptThreadFunc _func;
+  void* _data;
+  uint32_t _count;
+  volatile uint32_t _next;
+
+private:
+  OptThreadPool(const OptThreadPool&);
+  OptThreadPool& operator=(const OptThreadPool&);
+};
+
+// [Guard]
+#endif // _OPTTHREADPOOL_H
@@ -8,101 +8,7 @@
 // [Dependencies]
 // ============================================================================
 
-#include "./optglobals.h"
-#include "./optdepng.h"
-
-// ============================================================================
-// [Constants]
-// ============================================================================
-
-static const char* OptDePngFilterNames[] = {
-  "None", "Sub", "Up", "Avg", "Paeth", "Mixed"
-};
-
-static const uint32_t OptDePngBppData[] = {
-  1, 2, 3, 4, 6, 8
-};
-
-static const uint8_t OptDePngRandomData[] = {
-  0xD9, 0xFA, 0xA7, 0x20, 0x6B, 0xD3, 0x41, 0xC9, 0x1A, 0x27, 0x2F, 0x64, 0x59,
-  0x85, 0x47, 0x1C, 0xFC, 0x3E, 0xA3, 0x5B, 0x3C, 0xD2, 0xB5, 0xB6, 0x80, 0xBB,
-  0x84, 0x3C, 0xD4, 0x94, 0x3A, 0x6D, 0xC2, 0x1B, 0x3D, 0x5F, 0x82, 0xD9, 0x1A,
-  0x7F, 0xC6, 0x8D, 0x39, 0xDD, 0x07, 0xAD, 0x7A, 0x40, 0x8D, 0x37, 0x56, 0x12,
-  0x8B, 0x51, 0xAF, 0x9D, 0x17, 0xBD, 0xD0, 0x61, 0x58, 0xC8, 0x05, 0x44, 0x9B,
-  0xCA, 0xD4, 0xD0, 0xD0, 0xB9, 0x83, 0x75, 0x31, 0x4B, 0x09, 0xEC, 0x52, 0xEB,
-  0xE5, 0xE8, 0xAA, 0xF6, 0xDD, 0x79, 0x36, 0x61, 0x17, 0xB1, 0x8A, 0x48, 0x00,
-  0x1A, 0x9D, 0xDC, 0x51, 0x9F, 0x34, 0x7A, 0x48, 0x56, 0xC9, 0xF3, 0x6A, 0x81,
-  0x9B, 0x47, 0x56, 0x64, 0x00, 0x30, 0x60, 0x04, 0x90, 0x4B, 0xC2, 0x48, 0xE3,
-  0xED, 0x62, 0xDF, 0x46, 0xEF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-  0xFE, 0x94, 0xEE, 0x00, 0xA9, 0x3B, 0x86, 0x9B, 0xD8, 0xEE, 0x3D, 0x9E, 0x32,
-  0x00, 0x00, 0x00, 0x00, 0x92, 0x61, 0x9F, 0x3B, 0x22, 0xB0, 0xB9, 0xB3, 0xB0,
-  0x01, 0x01, 0x01, 0x01, 0xF4, 0x83, 0xFC, 0x49, 0xA9, 0xD2, 0x89, 0xE0, 0x17,
-  0x74, 0x3E, 0xBD, 0x28, 0x74, 0x5E, 0xF8, 0x6D, 0xD2, 0x43, 0xB7, 0x5A, 0xB5,
-  0xE6, 0xA4, 0xC7, 0xA4, 0x46, 0xD3, 0x00, 0x1A, 0x26, 0x0C, 0x65, 0x24, 0xAD,
-  0xA7, 0xEA, 0xF4, 0xBD, 0xF6, 0x63, 0x2B, 0xEC, 0x1E, 0xDF, 0x0C, 0xBD, 0x50,
-  0xEB, 0x71, 0xD9, 0x86, 0x31, 0x62, 0x5E, 0xE7, 0x4D, 0x8B, 0xD1, 0x11, 0x5B,
-  0x26, 0x48, 0x9F, 0x8E, 0xE6, 0x7B, 0xE1, 0x0C, 0xF8, 0xCD, 0xF8, 0x90, 0x1E,
-  0x4E, 0x24, 0xFE, 0x90, 0xD3, 0xA2, 0x2D, 0xFC, 0x4F, 0x3A, 0x2F, 0x1B, 0xE2,
-  0xB8, 0xBF, 0x11, 0x68, 0x80, 0xCB, 0x26, 0xAD, 0x1C, 0x58, 0x4E, 0x57, 0x30,
-  0x00, 0x00, 0x00, 0x86, 0x4A, 0x50, 0x36, 0x90, 0x5C, 0x40, 0xA7, 0x38, 0x92,
-  0x03, 0xF0, 0x39, 0x82, 0x40, 0xED, 0x39, 0x22, 0x82, 0x90, 0x67, 0xDF, 0x95,
-  0x34, 0x15, 0x8A, 0x0F, 0x25, 0x94, 0x56, 0xFD, 0x38, 0x85, 0x9B, 0x06, 0x22
-};
-
-// ============================================================================
-// [Helpers]
-// ============================================================================
-
-static uint32_t OptDePngRandomWrap(uint32_t x, uint32_t advance, uint32_t count) {
-  x += advance;
-  return x < count ? x : x - count;
-}
-
-static uint8_t* OptDePngRandomImage(uint32_t w, uint32_t h, uint32_t bpp, uint32_t filter, uint32_t seed) {
-  uint32_t rCount = sizeof(OptDePngRandomData);
-
-  uint32_t rIndex0 = (seed     ) % rCount;
-  uint32_t rIndex1 = (seed * 33) % rCount;
-
-  w *= bpp;
-  uint32_t size = (w + 1) * h;
-
-  uint8_t* pImage = static_cast<uint8_t*>(::malloc(size));
-  if (pImage == NULL)
-    return NULL;
-
-  uint8_t* p = pImage;
-  uint32_t f = filter;
-
-  for (uint32_t y = 0; y < h; y++) {
-    // NOTE: We always use no filter for the very first for so we don't have to
-    // handle special cases in the code. However, when decoding real PNG image,
-    // the first row has to be handled as well.
-    if (y == 0) {
-      *p++ = kPngFilterNone;
-    }
-    else if (filter < kPngFilterCount) {
-      *p++ = static_cast<uint8_t>(filter);
-    }
-    else {
-      if (++f >= kPngFilterCount) f = 0;
-      *p++ = static_cast<uint8_t>(f);
-    }
-
-    uint32_t x = w;
-    for (;;) {
-      *p++ = OptDePngRandomData[rIndex0];
-      rIndex0 = OptDePngRandomWrap(rIndex0, 1, rCount);
-      if (--x == 0) break;
-
-      *p++ = OptDePngRandomData[rIndex1];
-      rIndex1 = OptDePngRandomWrap(rIndex1, 2, rCount);
-      if (--x == 0) break;
-    }
-  }
-
-  return pImage;
-}
+#include "./test_p.h"
 
 // ============================================================================
 // [Compare]
@@ -119,13 +25,13 @@ static bool OptDePngCompare(const char* name, const uint8_t* pA, const uint8_t*
     uint32_t bFilter = pB[0];
 
     if (aFilter != bFilter) {
-      printf("[ERROR] IMPL=%-4s  [%ux%u|bpp:%u|bpl=%u at Y=%u X=Filter] Filter %u != %u\n",
+      printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u|bpl=%u at Y=%u X=Filter] Filter %u != %u\n",
         name, w, h, bpp, bpl, y, aFilter, bFilter);
       return false;
     }
 
     if (aFilter >= kPngFilterCount) {
-      printf("[ERROR] IMPL=%-4s  [%ux%u|bpp:%u|bpl=%u at Y=%u X=Filter] Filter %u\n",
+      printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u|bpl=%u at Y=%u X=Filter] Filter %u\n",
         name, w, h, bpp, bpl, y, aFilter);
       return false;
     }
@@ -139,7 +45,7 @@ static bool OptDePngCompare(const char* name, const uint8_t* pA, const uint8_t*
         uint32_t bVal = pB[i];
 
         if (aVal != bVal) {
-          printf("[ERROR] IMPL=%-4s  [%ux%u|bpp:%u|bpl=%u at Y=%u|X=%u|Byte=%u] Pixel %u != %u (%s)\n",
+          printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u|bpl=%u at Y=%u|X=%u|Byte=%u] Pixel %u != %u (%s)\n",
             name, w, h, bpp, bpl, y, x, i, aVal, bVal, OptDePngFilterNames[aFilter]);
           return false;
         }
@@ -158,14 +64,25 @@ static bool OptDePngCompare(const char* name, const uint8_t* pA, const uint8_t*
 // ============================================================================
 
 static bool OptDePngCheck(const char* name, OptDePngFilterFunc ref, OptDePngFilterFunc opt) {
-  printf("[CHECK] IMPL=%-4s\n", name);
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  // Invalid geometry (no pixel, a row that is not a multiple of BPP, or zero
+  // BPP) must be rejected without touching the image.
+  uint8_t row[9] = { kPngFilterSub, 1, 2, 3, 4, 5, 6, 7, 8 };
+  if (opt(row, 1, 8, 8) != kOptDePngErrorInvalidGeometry ||
+      opt(row, 1, 3, 9) != kOptDePngErrorInvalidGeometry ||
+      opt(row, 1, 0, 9) != kOptDePngErrorInvalidGeometry ||
+      row[2] != 2) {
+    printf("[ERROR] IMPL=%-5s  Invalid geometry not rejected\n", name);
+    return false;
+  }
 
   uint32_t seed = 0;
   for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
     for (uint32_t h = 1; h < 20; h++) {
       for (uint32_t w = 1; w < 100; w++) {
-        for (uint32_t bppIndex = 0; bppIndex < 6; bppIndex++) {
-          uint32_t bpp = OptDePngBppData[bppIndex];
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
           uint32_t bpl = w * bpp + 1;
 
           uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
@@ -191,48 +108,1012 @@ static bool OptDePngCheck(const char* name, OptDePngFilterFunc ref, OptDePngFilt
   return true;
 }
 
+static bool OptDePngCheckTo(const char* name, OptDePngFilterToFunc func) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 20; h++) {
+      for (uint32_t w = 1; w < 100; w++) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+          intptr_t stride = OptDePngGetAlignedStride(w, bpp);
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pSrc = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pBuf = static_cast<uint8_t*>(::malloc(stride * h + 32));
+          uint8_t* pDst = pBuf + OptAlignDiff(pBuf, 32);
+
+          func(pDst, stride, pSrc, h, bpp, bpl);
+
+          // The source must stay filtered.
+          bool ok = ::memcmp(pRef, pSrc, bpl * h) == 0;
+          if (!ok)
+            printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u] Source modified\n", name, w, h, bpp);
+
+          // Copy the result back to the source layout so it can be compared.
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+          for (uint32_t y = 0; y < h; y++)
+            ::memcpy(pSrc + y * bpl + 1, pDst + y * stride, bpl - 1);
+
+          ok = ok && OptDePngCompare(name, pRef, pSrc, w, h, bpp, bpl);
+
+          ::free(pRef);
+          ::free(pSrc);
+          ::free(pBuf);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool OptDePngCheckStream(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  OptDePngStream stream;
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 20; h++) {
+      for (uint32_t w = 1; w < 100; w++) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pRows = static_cast<uint8_t*>(::malloc(bpl * 2));
+
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+
+          // Simulate an inflate loop that only has two row buffers.
+          stream.init(bpp, bpl);
+          for (uint32_t y = 0; y < h; y++) {
+            uint8_t* row = pRows + (y & 1) * bpl;
+
+            ::memcpy(row, pOpt + y * bpl, bpl);
+            stream.feedRow(row);
+            ::memcpy(pOpt + y * bpl, stream.prevRow(), bpl);
+          }
+
+          bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+          ::free(pRef);
+          ::free(pOpt);
+          ::free(pRows);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool OptDePngCheckChecked(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t badRow = 1;
+  if (OptDePngFilterChecked(NULL, 1, 3, 3, &badRow) != kOptDePngErrorInvalidGeometry || badRow != 0) {
+    printf("[ERROR] IMPL=%-5s  Invalid geometry not reported\n", name);
+    return false;
+  }
+
+  uint32_t seed = 0;
+  for (uint32_t h = 1; h < 20; h++) {
+    for (uint32_t w = 1; w < 40; w += 3) {
+      for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+        uint32_t bpp = OptDePngBppCheck[bppIndex];
+        uint32_t bpl = w * bpp + 1;
+
+        // Row `h` means that all rows are valid.
+        for (uint32_t invalidRow = 0; invalidRow <= h; invalidRow++) {
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, kPngFilterCount, seed);
+          uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, kPngFilterCount, seed);
+
+          if (invalidRow < h) {
+            uint8_t invalidId = static_cast<uint8_t>(kPngFilterCount + seed % (256 - kPngFilterCount));
+            pRef[invalidRow * bpl] = invalidId;
+            pOpt[invalidRow * bpl] = invalidId;
+          }
+
+          // Only rows above the invalid one are unfiltered.
+          if (invalidRow != 0)
+            OptDePngFilterRef(pRef, invalidRow, bpp, bpl);
+
+          uint32_t err = OptDePngFilterChecked(pOpt, h, bpp, bpl, &badRow);
+          uint32_t expected = invalidRow < h ? kOptDePngErrorInvalidFilter : kOptDePngErrorOk;
+
+          bool ok = true;
+          if (err != expected || badRow != invalidRow) {
+            printf("[ERROR] IMPL=%-5s  W=%u H=%u BPP=%u ROW=%u: Returned %u (row %u)\n",
+              name, w, h, bpp, invalidRow, err, badRow);
+            ok = false;
+          }
+          else if (::memcmp(pRef, pOpt, h * bpl) != 0) {
+            printf("[ERROR] IMPL=%-5s  W=%u H=%u BPP=%u ROW=%u: Output doesn't match the reference\n",
+              name, w, h, bpp, invalidRow);
+            ok = false;
+          }
+
+          ::free(pRef);
+          ::free(pOpt);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// CRC32C of a known vector, then of random data at any alignment and length,
+// whole and in two parts, which must match `OptDePngCrc32cOpt()`.
+static bool OptDePngCheckCrc32c(const char* name, OptDePngCrc32cFunc func) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  const uint8_t vector[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  if (func(0, vector, sizeof(vector)) != 0xE3069283u || func(0, vector, 0) != 0) {
+    printf("[ERROR] IMPL=%-5s  CRC32C of a known vector doesn't match\n", name);
+    return false;
+  }
+
+  const uint32_t kMaxSize = 3000;
+  uint8_t* data = static_cast<uint8_t*>(::malloc(kMaxSize + 8));
+
+  for (uint32_t i = 0; i < kMaxSize + 8; i++)
+    data[i] = OptDePngRandomData[(i * 7) % sizeof(OptDePngRandomData)] ^ static_cast<uint8_t>(i >> 8);
+
+  for (uint32_t size = 0; size < kMaxSize; size += 1 + size / 16) {
+    for (uint32_t offset = 0; offset < 8; offset++) {
+      const uint8_t* p = data + offset;
+      uint32_t split = size / 3;
+
+      uint32_t ref = OptDePngCrc32cOpt(0, p, size);
+      uint32_t crc = func(0, p, size);
+      uint32_t crcParts = func(func(0, p, split), p + split, size - split);
+
+      if (crc != ref || crcParts != ref) {
+        printf("[ERROR] IMPL=%-5s  [Size=%u|Offset=%u] CRC32C %08X (%08X in parts) != %08X\n",
+          name, size, offset, crc, crcParts, ref);
+        ::free(data);
+        return false;
+      }
+    }
+  }
+
+  ::free(data);
+  return true;
+}
+
+// The image must be the same as unfiltered by `OptDePngFilterRef()` and the
+// checksum the same as CRC32C of its rows without filter IDs.
+static bool OptDePngCheckChecksum(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint8_t row[9] = { kPngFilterSub, 1, 2, 3, 4, 5, 6, 7, 8 };
+  uint32_t crc = 1;
+
+  if (OptDePngFilterChecksum(row, 1, 3, 9, &crc) != kOptDePngErrorInvalidGeometry || crc != 0 || row[2] != 2) {
+    printf("[ERROR] IMPL=%-5s  Invalid geometry not rejected\n", name);
+    return false;
+  }
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 12; h++) {
+      for (uint32_t w = 1; w < 200; w += 9) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, filter, seed);
+
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+          bool ok = OptDePngFilterChecksum(pOpt, h, bpp, bpl, &crc) == kOptDePngErrorOk &&
+                    OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+          uint32_t ref = 0;
+          for (uint32_t y = 0; y < h; y++)
+            ref = OptDePngCrc32cOpt(ref, pRef + y * bpl + 1, bpl - 1);
+
+          if (ok && crc != ref) {
+            printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u] CRC32C %08X != %08X\n", name, w, h, bpp, crc, ref);
+            ok = false;
+          }
+
+          ::free(pRef);
+          ::free(pOpt);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool OptDePngCheckBatch(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  // Mostly small images of all BPPs (including ones that are not grouped)
+  // and a few large ones, each allocated separately with its exact size.
+  static const uint32_t kBppList[] = { 1, 2, 3, 4, 5, 6, 8, 16 };
+  static const uint32_t kItemCount = 400;
+
+  OptDePngBatchItem items[kItemCount];
+  uint8_t* pRef[kItemCount];
+  uint32_t width[kItemCount];
+
+  for (uint32_t seed = 0; seed < 4; seed++) {
+    for (uint32_t i = 0; i < kItemCount; i++) {
+      uint32_t bpp = kBppList[(i + seed) % (sizeof(kBppList) / sizeof(kBppList[0]))];
+      uint32_t w = (i % 7 == 0) ? 100 + i : 1 + (i * 7 + seed) % 40;
+      uint32_t h = 1 + (i * 3 + seed) % 20;
+      uint32_t filter = (i + seed) % (kPngFilterCount + 1);
+
+      items[i].p = OptDePngRandomImage(w, h, bpp, filter, i * 4 + seed);
+      items[i].h = h;
+      items[i].bpp = bpp;
+      items[i].bpl = w * bpp + 1;
+
+      pRef[i] = OptDePngRandomImage(w, h, bpp, filter, i * 4 + seed);
+      OptDePngFilterRef(pRef[i], h, bpp, items[i].bpl);
+      width[i] = w;
+    }
+
+    // An invalid item must be reported and must not affect other items.
+    items[5].bpp = 0;
+
+    uint32_t err = OptDePngFilterBatch(items, kItemCount);
+    bool ok = err == kOptDePngErrorInvalidGeometry && items[5].error == kOptDePngErrorInvalidGeometry;
+
+    if (!ok)
+      printf("[ERROR] IMPL=%-5s  Invalid item not reported\n", name);
+
+    for (uint32_t i = 0; i < kItemCount; i++) {
+      if (ok && i != 5) {
+        ok = items[i].error == kOptDePngErrorOk &&
+             OptDePngCompare(name, pRef[i], items[i].p, width[i], items[i].h, items[i].bpp, items[i].bpl);
+      }
+
+      ::free(items[i].p);
+      ::free(pRef[i]);
+    }
+
+    if (!ok)
+      return false;
+  }
+
+  return true;
+}
+
+static bool OptDePngCheckConvert(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t format = 0; format < kOptDePngFormatCount; format++) {
+    for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+      for (uint32_t h = 1; h < 10; h++) {
+        for (uint32_t w = 1; w < 100; w++) {
+          for (uint32_t bpp = 1; bpp <= 4; bpp++) {
+            uint32_t bpl = w * bpp + 1;
+
+            uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+            uint8_t* pSrc = OptDePngRandomImage(w, h, bpp, filter, seed);
+            uint8_t* pOpt = static_cast<uint8_t*>(::malloc(w * h * 4));
+
+            OptDePngFilterConvert(pOpt, w * 4, format, pSrc, h, bpp, bpl);
+
+            // The source must stay filtered.
+            bool ok = ::memcmp(pRef, pSrc, bpl * h) == 0;
+            OptDePngFilterRef(pRef, h, bpp, bpl);
+
+            for (uint32_t y = 0; ok && y < h; y++) {
+              for (uint32_t x = 0; ok && x < w; x++) {
+                const uint8_t* s = pRef + y * bpl + 1 + x * bpp;
+                const uint8_t* d = pOpt + (y * w + x) * 4;
+
+                uint32_t r = s[0];
+                uint32_t g = s[bpp >= 3 ? 1 : 0];
+                uint32_t b = s[bpp >= 3 ? 2 : 0];
+                uint32_t a = bpp == 2 ? s[1] : bpp == 4 ? s[3] : 255;
+
+                if (format == kOptDePngFormatPRGB32) {
+                  r = (r * a * 2 + 255) / 510;
+                  g = (g * a * 2 + 255) / 510;
+                  b = (b * a * 2 + 255) / 510;
+                }
+
+                if (d[0] != b || d[1] != g || d[2] != r || d[3] != a) {
+                  printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u|format:%u at Y=%u|X=%u] Pixel %02X%02X%02X%02X != %02X%02X%02X%02X\n",
+                    name, w, h, bpp, format, y, x, a, r, g, b, d[3], d[2], d[1], d[0]);
+                  ok = false;
+                }
+              }
+            }
+
+            ::free(pRef);
+            ::free(pSrc);
+            ::free(pOpt);
+
+            if (!ok)
+              return false;
+
+            seed++;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Adam7 passes as {x0, y0, dx, dy}, used to de-interlace the reference image.
+static const uint32_t OptDePngAdam7Table[7][4] = {
+  { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+};
+
+static bool OptDePngCheckAdam7(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 20; h++) {
+      for (uint32_t w = 1; w < 40; w++) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t stride = w * bpp;
+
+          size_t srcSize = OptDePngAdam7GetSize(w, h, bpp);
+          uint8_t* pSrc = static_cast<uint8_t*>(::malloc(srcSize));
+          uint8_t* pRef = static_cast<uint8_t*>(::calloc(stride * h, 1));
+          uint8_t* pOpt = static_cast<uint8_t*>(::calloc(stride * h, 1));
+
+          // Unfilter each pass by the reference implementation and scatter it.
+          uint8_t* pPass = pSrc;
+          for (uint32_t i = 0; i < 7; i++) {
+            const uint32_t* pass = OptDePngAdam7Table[i];
+
+            uint32_t pw = w > pass[0] ? (w - pass[0] + pass[2] - 1) / pass[2] : 0;
+            uint32_t ph = h > pass[1] ? (h - pass[1] + pass[3] - 1) / pass[3] : 0;
+
+            if (pw == 0 || ph == 0)
+              continue;
+
+            uint32_t bpl = pw * bpp + 1;
+            uint8_t* pImage = OptDePngRandomImage(pw, ph, bpp, filter, seed + i);
+
+            ::memcpy(pPass, pImage, bpl * ph);
+            OptDePngFilterRef(pImage, ph, bpp, bpl);
+
+            for (uint32_t y = 0; y < ph; y++) {
+              for (uint32_t x = 0; x < pw; x++) {
+                ::memcpy(pRef + (pass[1] + y * pass[3]) * stride + (pass[0] + x * pass[2]) * bpp,
+                         pImage + y * bpl + 1 + x * bpp, bpp);
+              }
+            }
+
+            ::free(pImage);
+            pPass += bpl * ph;
+          }
+
+          OptDePngFilterAdam7(pOpt, stride, pSrc, w, h, bpp);
+          bool ok = ::memcmp(pRef, pOpt, stride * h) == 0;
+
+          if (!ok) {
+            printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u] De-interlaced image doesn't match (%s)\n",
+              name, w, h, bpp, OptDePngFilterNames[filter]);
+          }
+
+          ::free(pSrc);
+          ::free(pRef);
+          ::free(pOpt);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static const uint32_t OptDePngParallelWidth[] = { 1031, 4099 };
+static const uint32_t OptDePngParallelHeight[] = { 131, 256 };
+
+static bool OptDePngCheckParallel(const char* name, uint32_t threadCount) {
+  printf("[CHECK] IMPL=%-5s THREADS=%u\n", name, threadCount);
+
+  OptThreadPool threadPool;
+  threadPool.init(threadCount);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t hIndex = 0; hIndex < 2; hIndex++) {
+      for (uint32_t wIndex = 0; wIndex < 2; wIndex++) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t w = OptDePngParallelWidth[wIndex];
+          uint32_t h = OptDePngParallelHeight[hIndex];
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, filter, seed);
+
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+          OptDePngFilterParallel(pOpt, h, bpp, bpl, &threadPool);
+
+          bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+          ::free(pRef);
+          ::free(pOpt);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Images of all sizes submitted to `OptDePngQueue`, large ones are split into
+// bands if their rows use `None` or `Sub` filters. Each queue is used twice to
+// check that it can be reused after `wait()`.
+static bool OptDePngCheckQueue(const char* name, uint32_t threadCount, bool pinThreads) {
+  printf("[CHECK] IMPL=%-5s THREADS=%u PIN=%u\n", name, threadCount, pinThreads);
+
+  static const uint32_t kBppList[] = { 1, 2, 3, 4, 6, 8 };
+  static const uint32_t kItemCount = 60;
+
+  OptDePngBatchItem items[kItemCount];
+  uint8_t* pRef[kItemCount];
+  uint32_t width[kItemCount];
+
+  OptDePngQueue queue;
+  if (!queue.init(threadCount, pinThreads)) {
+    printf("[ERROR] IMPL=%-5s  Failed to start threads\n", name);
+    return false;
+  }
+
+  for (uint32_t seed = 0; seed < 2; seed++) {
+    for (uint32_t i = 0; i < kItemCount; i++) {
+      uint32_t bpp = kBppList[(i + seed) % (sizeof(kBppList) / sizeof(kBppList[0]))];
+      bool large = i % 10 == 0;
+      uint32_t w = large ? 1031 : 1 + (i * 13 + seed) % 300;
+      uint32_t h = large ? 150 + i : 1 + (i * 7 + seed) % 50;
+      uint32_t filter = (i / 10 + i + seed) % (kPngFilterCount + 1);
+
+      items[i].p = OptDePngRandomImage(w, h, bpp, filter, i * 2 + seed);
+      items[i].h = h;
+      items[i].bpp = bpp;
+      items[i].bpl = w * bpp + 1;
+
+      pRef[i] = OptDePngRandomImage(w, h, bpp, filter, i * 2 + seed);
+      OptDePngFilterRef(pRef[i], h, bpp, items[i].bpl);
+      width[i] = w;
+    }
+
+    // An invalid item must be reported and must not affect other items.
+    items[7].bpp = 0;
+
+    for (uint32_t i = 0; i < kItemCount; i++)
+      queue.submit(&items[i]);
+
+    uint32_t err = queue.wait();
+    bool ok = err == kOptDePngErrorInvalidGeometry && items[7].error == kOptDePngErrorInvalidGeometry;
+
+    if (!ok)
+      printf("[ERROR] IMPL=%-5s  Invalid item not reported\n", name);
+
+    for (uint32_t i = 0; i < kItemCount; i++) {
+      if (ok && i != 7) {
+        ok = items[i].error == kOptDePngErrorOk &&
+             OptDePngCompare(name, pRef[i], items[i].p, width[i], items[i].h, items[i].bpp, items[i].bpl);
+      }
+
+      ::free(items[i].p);
+      ::free(pRef[i]);
+    }
+
+    if (!ok)
+      return false;
+  }
+
+  return true;
+}
+
+// Band sizes in BYTEs, zero selects the default, others are rounded down to
+// a multiple of BPP (and the smallest one becomes a single pixel).
+static const uint32_t OptDePngBlockedBand[] = { 0, 1, 17, 64, 100 };
+
+static bool OptDePngCheckBlocked(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t bandIndex = 0; bandIndex < sizeof(OptDePngBlockedBand) / sizeof(OptDePngBlockedBand[0]); bandIndex++) {
+      for (uint32_t h = 1; h < 12; h++) {
+        for (uint32_t w = 1; w < 200; w += 13) {
+          for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+            uint32_t bpp = OptDePngBppCheck[bppIndex];
+            uint32_t bpl = w * bpp + 1;
+
+            uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+            uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, filter, seed);
+
+            OptDePngFilter(pRef, h, bpp, bpl);
+            OptDePngFilterBlocked(pOpt, h, bpp, bpl, OptDePngBlockedBand[bandIndex]);
+
+            bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+            ::free(pRef);
+            ::free(pOpt);
+
+            if (!ok)
+              return false;
+
+            seed++;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Like `OptDePngCheckTo()`, but rows are wider and `dst` and `dstStride` are
+// not aligned, so the non-temporal part of a row starts anywhere.
+static bool OptDePngCheckLarge(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 8; h++) {
+      for (uint32_t w = 1; w < 700; w += 23) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+          intptr_t stride = static_cast<intptr_t>(w * bpp + (seed % 5));
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pSrc = OptDePngRandomImage(w, h, bpp, filter, seed);
+          uint8_t* pBuf = static_cast<uint8_t*>(::malloc(stride * h + 64));
+          uint8_t* pDst = pBuf + (seed % 64);
+
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+          OptDePngFilterToLarge(pDst, stride, pSrc, h, bpp, bpl);
+
+          for (uint32_t y = 0; y < h; y++)
+            ::memcpy(pSrc + y * bpl + 1, pDst + y * stride, bpl - 1);
+
+          bool ok = OptDePngCompare(name, pRef, pSrc, w, h, bpp, bpl);
+
+          ::free(pRef);
+          ::free(pSrc);
+          ::free(pBuf);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Rows are copied to the padded layout of a random stride and slack filled by
+// random BYTEs, which must not change the result. A misaligned `p` and stride
+// are rejected.
+static bool OptDePngCheckPadded(const char* name, OptDePngFilterPaddedFunc func) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kPngFilterCount; filter++) {
+    for (uint32_t h = 1; h < 8; h++) {
+      for (uint32_t w = 1; w < 200; w += 7) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+          intptr_t stride = OptDePngGetPaddedStride(bpl) + static_cast<intptr_t>(seed % 3) * 16;
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+          size_t size = static_cast<size_t>(stride) * h;
+
+          uint8_t* pBuf = static_cast<uint8_t*>(::malloc(size + 32));
+          uint8_t* pDst = pBuf + OptAlignDiff(pBuf + 1, 16);
+
+          for (size_t i = 0; i < size; i++)
+            pDst[i] = OptDePngRandomData[(seed + i) % sizeof(OptDePngRandomData)];
+
+          for (uint32_t y = 0; y < h; y++)
+            ::memcpy(pDst + y * stride, pRef + y * bpl, bpl);
+
+          bool ok = func(pDst, stride + 1, h, bpp, bpl) == kOptDePngErrorInvalidGeometry &&
+                    func(pDst + 1, stride, h, bpp, bpl) == kOptDePngErrorInvalidGeometry;
+          if (!ok)
+            printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u] Misaligned layout not rejected\n", name, w, h, bpp);
+
+          OptDePngFilterRef(pRef, h, bpp, bpl);
+          ok = ok && func(pDst, stride, h, bpp, bpl) == kOptDePngErrorOk;
+
+          for (uint32_t y = 0; y < h; y++)
+            ::memmove(pDst + y * bpl, pDst + y * stride, bpl);
+          ok = ok && OptDePngCompare(name, pRef, pDst, w, h, bpp, bpl);
+
+          ::free(pRef);
+          ::free(pBuf);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Images that use one filter for all rows except the first one, which uses any
+// filter, with or without a different filter in the last row.
+static bool OptDePngCheckUniform(const char* name, OptDePngFilterFunc func) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t first = 0; first < kPngFilterCount; first++) {
+    for (uint32_t filter = 0; filter < kPngFilterCount; filter++) {
+      for (uint32_t h = 2; h < 6; h++) {
+        for (uint32_t w = 1; w < 80; w += 7) {
+          for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+            for (uint32_t lastDiffers = 0; lastDiffers < 2; lastDiffers++) {
+              uint32_t bpp = OptDePngBppCheck[bppIndex];
+              uint32_t bpl = w * bpp + 1;
+
+              uint8_t* pRef = OptDePngRandomImage(w, h, bpp, filter, seed);
+              uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, filter, seed);
+
+              pRef[0] = pOpt[0] = static_cast<uint8_t>(first);
+              if (lastDiffers)
+                pRef[(h - 1) * bpl] = pOpt[(h - 1) * bpl] = static_cast<uint8_t>((filter + 1) % kPngFilterCount);
+
+              OptDePngFilterRef(pRef, h, bpp, bpl);
+              func(pOpt, h, bpp, bpl);
+
+              bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+              ::free(pRef);
+              ::free(pOpt);
+
+              if (!ok)
+                return false;
+
+              seed++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Forward filter must produce the same rows (and filter IDs) as the reference
+// and the reverse filter must restore the source. Every other source is made
+// smooth, so the adaptive mode selects other filters than `None` as well.
+static bool OptDePngCheckForward(const char* name, OptDePngForwardFunc func) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t seed = 0;
+  for (uint32_t filter = 0; filter <= kOptDePngForwardAdaptive; filter++) {
+    for (uint32_t h = 1; h < 9; h++) {
+      for (uint32_t w = 1; w < 90; w += 3) {
+        for (uint32_t bppIndex = 0; bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+          uint32_t rowSize = bpl - 1;
+          intptr_t stride = static_cast<intptr_t>(rowSize + (seed % 3));
+
+          // Use the rows of a random image (without filter IDs) as the source.
+          uint8_t* pRnd = OptDePngRandomImage(w, h, bpp, kPngFilterCount, seed);
+          uint8_t* pSrc = static_cast<uint8_t*>(::malloc(stride * h));
+
+          for (uint32_t y = 0; y < h; y++) {
+            uint8_t* row = pSrc + y * stride;
+            ::memcpy(row, pRnd + y * bpl + 1, rowSize);
+
+            if (seed & 1) {
+              for (uint32_t i = 0; i < rowSize; i++)
+                row[i] = static_cast<uint8_t>(i / bpp * 7 + y * 5 + (row[i] & 7));
+            }
+          }
+
+          uint8_t* pRef = static_cast<uint8_t*>(::malloc(bpl * h));
+          uint8_t* pOpt = static_cast<uint8_t*>(::malloc(bpl * h));
+
+          OptDePngForwardRef(pRef, pSrc, stride, h, bpp, bpl, filter);
+          func(pOpt, pSrc, stride, h, bpp, bpl, filter);
+
+          bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+          // Unfilter the result and compare it with the source.
+          OptDePngFilter(pOpt, h, bpp, bpl);
+          for (uint32_t y = 0; ok && y < h; y++) {
+            if (::memcmp(pOpt + y * bpl + 1, pSrc + y * stride, rowSize) != 0) {
+              printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u|filter:%u at Y=%u] Source not restored\n", name, w, h, bpp, filter, y);
+              ok = false;
+            }
+          }
+
+          ::free(pRnd);
+          ::free(pSrc);
+          ::free(pRef);
+          ::free(pOpt);
+
+          if (!ok)
+            return false;
+
+          seed++;
+        }
+      }
+    }
+  }
+
+  uint8_t row[4] = { 0 };
+  if (func(row, row, 0, 1, 1, 4, kOptDePngForwardAdaptive + 1) != kOptDePngErrorInvalidFilter) {
+    printf("[ERROR] IMPL=%-5s  Invalid filter not reported\n", name);
+    return false;
+  }
+
+  return true;
+}
+
+// Chunk sizes of `OptDePngFilterFile()`, zero maps the whole file at once.
+static const size_t OptDePngFileChunk[] = { 0, 1, 5000, 65536 };
+
+static bool OptDePngWriteFile(const char* path, const uint8_t* data, size_t size) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL)
+    return false;
+
+  bool ok = fwrite(data, 1, size, f) == size;
+  return fclose(f) == 0 && ok;
+}
+
+// Unfiltered file must match `OptDePngFilter()`, the source file is read back
+// after an in-place run and the destination file after an out-of-place one.
+static bool OptDePngCheckFile(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  const char* srcPath = "optdepng_check_src.tmp";
+  const char* dstPath = "optdepng_check_dst.tmp";
+
+  static const uint32_t sizes[][2] = { { 1, 1 }, { 97, 61 }, { 1031, 40 } };
+  bool ok = true;
+
+  uint32_t seed = 0;
+  for (uint32_t sizeIndex = 0; ok && sizeIndex < sizeof(sizes) / sizeof(sizes[0]); sizeIndex++) {
+    for (uint32_t bppIndex = 0; ok && bppIndex < OPT_DEPNG_BPP_CHECK_COUNT; bppIndex++) {
+      for (uint32_t chunkIndex = 0; ok && chunkIndex < sizeof(OptDePngFileChunk) / sizeof(OptDePngFileChunk[0]); chunkIndex++) {
+        for (uint32_t inPlace = 0; ok && inPlace < 2; inPlace++) {
+          uint32_t w = sizes[sizeIndex][0];
+          uint32_t h = sizes[sizeIndex][1];
+          uint32_t bpp = OptDePngBppCheck[bppIndex];
+          uint32_t bpl = w * bpp + 1;
+          size_t size = static_cast<size_t>(bpl) * h;
+
+          uint8_t* pRef = OptDePngRandomImage(w, h, bpp, kPngFilterCount, seed);
+          uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, kPngFilterCount, seed);
+
+          ok = OptDePngWriteFile(srcPath, pRef, size);
+          if (!ok)
+            printf("[ERROR] IMPL=%-5s  Can't write '%s'\n", name, srcPath);
+
+          uint32_t err = kOptDePngErrorOk;
+          if (ok)
+            err = OptDePngFilterFile(inPlace ? NULL : dstPath, srcPath, bpp, bpl, OptDePngFileChunk[chunkIndex]);
+
+          if (ok && err != kOptDePngErrorOk) {
+            printf("[ERROR] IMPL=%-5s  [%ux%u|bpp:%u] Failed with error %u\n", name, w, h, bpp, err);
+            ok = false;
+          }
+
+          // Read the result back into the source layout so it can be compared.
+          OptDePngFilter(pRef, h, bpp, bpl);
+          if (ok) {
+            FILE* f = fopen(inPlace ? srcPath : dstPath, "rb");
+            for (uint32_t y = 0; f != NULL && y < h; y++) {
+              uint8_t* row = pOpt + static_cast<size_t>(y) * bpl;
+              if (!inPlace || fread(row, 1, 1, f) == 1)
+                fread(row + 1, 1, bpl - 1, f);
+            }
+
+            if (f != NULL)
+              fclose(f);
+            ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+          }
+
+          ::free(pRef);
+          ::free(pOpt);
+          seed++;
+        }
+      }
+    }
+  }
+
+  // The size of the file must be a multiple of `bpl`, a missing file must be
+  // reported.
+  if (ok && (OptDePngFilterFile(dstPath, srcPath, 1, 1000000, 0) != kOptDePngErrorInvalidGeometry ||
+             OptDePngFilterFile(NULL, "optdepng_check_missing.tmp", 1, 2, 0) != kOptDePngErrorFile)) {
+    printf("[ERROR] IMPL=%-5s  Invalid file not reported\n", name);
+    ok = false;
+  }
+
+  ::remove(srcPath);
+  ::remove(dstPath);
+  return ok;
+}
+
+#if defined(OPT_DEPNG_PROFILE) && defined(OPT_BUILD_SSE2)
+// Unfilter mixed images by the profiling build and print its counters. Every
+// row must be counted once and scalar BYTEs can't exceed all BYTEs handled.
+static bool OptDePngCheckProfile(const char* name) {
+  printf("[CHECK] IMPL=%-5s\n", name);
+
+  uint32_t w = 1031;
+  uint32_t h = 64;
+
+  for (uint32_t bppIndex = 0; bppIndex < sizeof(OptDePngBppData) / sizeof(OptDePngBppData[0]); bppIndex++) {
+    uint32_t bpp = OptDePngBppData[bppIndex];
+    uint32_t bpl = w * bpp + 1;
+
+    uint8_t* pRef = OptDePngRandomImage(w, h, bpp, kPngFilterCount, bppIndex);
+    uint8_t* pOpt = OptDePngRandomImage(w, h, bpp, kPngFilterCount, bppIndex);
+
+    OptDePngStats stats;
+    OptDePngStatsReset(&stats);
+
+    OptDePngFilterRef(pRef, h, bpp, bpl);
+    OptDePngFilterSSE2Profile(pOpt, h, bpp, bpl, &stats);
+
+    bool ok = OptDePngCompare(name, pRef, pOpt, w, h, bpp, bpl);
+
+    ::free(pRef);
+    ::free(pOpt);
+
+    if (!ok)
+      return false;
+
+    uint64_t rows = 0;
+    for (uint32_t filter = 0; filter < kPngFilterCount; filter++) {
+      rows += stats.rows[filter];
+      if (stats.scalarBytes[filter] > stats.bytes[filter]) {
+        printf("[ERROR] IMPL=%-5s FILTER=%-5s BPP=%u Scalar BYTEs exceed all BYTEs\n", name, OptDePngFilterNames[filter], bpp);
+        return false;
+      }
+
+      printf("[PROF ] BPP=%u FILTER=%-5s ROWS=%-4u SIMD=%-7u SCALAR=%-7u CYCLES=%u\n", bpp,
+        OptDePngFilterNames[filter],
+        static_cast<unsigned int>(stats.rows[filter]),
+        static_cast<unsigned int>(stats.simdBytes[filter]),
+        static_cast<unsigned int>(stats.scalarBytes[filter]),
+        static_cast<unsigned int>(stats.cycles[filter]));
+    }
+
+    if (rows != h) {
+      printf("[ERROR] IMPL=%-5s BPP=%u Counted %u rows of %u\n", name, bpp, static_cast<unsigned int>(rows), h);
+      return false;
+    }
+  }
+
+  return true;
+}
+#endif // OPT_DEPNG_PROFILE
+
 // ============================================================================
-// [Bench]
+// [Corpus]
 // ============================================================================
 
-static void OptDePngBench(const char* name, OptDePngFilterFunc func) {
-  OptTimer timer;
+static bool OptDePngCheckCorpus(const char* dir, const OptDePngImplInfo* impls, uint32_t implCount) {
+  static const uint32_t kMaxFiles = 4096;
+  char** names = static_cast<char**>(::malloc(sizeof(char*) * kMaxFiles));
+  if (names == NULL)
+    return false;
 
-  uint32_t w = 256;
-  uint32_t h = 256;
-  uint32_t quantity = 1000;
-  uint32_t totalTime = 0;
+  uint32_t fileCount = OptDePngListCorpus(dir, names, kMaxFiles);
+  bool ok = true;
 
-  for (uint32_t filter = 1; filter <= kPngFilterCount; filter++) {
-    uint32_t filterTime = 0;
+  if (fileCount == 0)
+    printf("[CORPUS] No *.png or *.idat files found in '%s'\n", dir);
 
-    for (uint32_t bppIndex = 0; bppIndex < 6; bppIndex++) {
-      uint32_t bpp = OptDePngBppData[bppIndex];
-      uint32_t bpl = w * bpp + 1;
+  for (uint32_t fileIndex = 0; fileIndex < fileCount; fileIndex++) {
+    const char* name = names[fileIndex];
+    OptDePngCorpusImage image;
 
-      uint8_t* pImage = OptDePngRandomImage(w, h, bpp, filter, 0);
+    const char* msg = OptDePngLoadCorpus(dir, name, image);
+    if (msg != NULL) {
+      printf("[CORPUS] %s: Skipped (%s)\n", name, msg);
+      continue;
+    }
 
-      timer.start();
-      for (uint32_t i = 0; i < quantity; i++) {
-        func(pImage, h, bpp, bpl);
-      }
-      timer.stop();
+    size_t dataSize = static_cast<size_t>(image.bpl) * image.h;
+    uint32_t histogram[kPngFilterCount + 1];
 
-      filterTime += timer.get();
-      totalTime += timer.get();
+    OptDePngCorpusHistogram(image, histogram);
+    OptDePngCorpusPrint(name, image, histogram);
 
-      printf("[BENCH] IMPL=%-4s  [%.2u.%.3u s] [%s:%u]\n",
-        name, timer.get() / 1000, timer.get() % 1000, OptDePngFilterNames[filter], bpp);
+    uint8_t* pRef = static_cast<uint8_t*>(::malloc(dataSize));
+    uint8_t* pOpt = static_cast<uint8_t*>(::malloc(dataSize));
 
-      ::free(pImage);
+    if (pRef == NULL || pOpt == NULL) {
+      ::free(pRef);
+      ::free(pOpt);
+      ::free(image.data);
+      ok = false;
+      break;
     }
 
-    printf("[BENCH] IMPL=%-4s  [%.2u.%.3u s] [%s:ALL]\n",
-      name, filterTime / 1000, filterTime % 1000, OptDePngFilterNames[filter]);
+    ::memcpy(pRef, image.data, dataSize);
+    OptDePngFilterRef(pRef, image.h, image.bpp, image.bpl);
+
+    for (uint32_t implIndex = 1; implIndex < implCount; implIndex++) {
+      const OptDePngImplInfo& impl = impls[implIndex];
+
+      ::memcpy(pOpt, image.data, dataSize);
+      impl.func(pOpt, image.h, image.bpp, image.bpl);
+
+      if (::memcmp(pRef, pOpt, dataSize) != 0) {
+        printf("[ERROR] IMPL=%-5s  %s: Output doesn't match the reference\n", impl.name, name);
+        ok = false;
+      }
+    }
+
+    ::free(pRef);
+    ::free(pOpt);
+    ::free(image.data);
   }
 
-  printf("[BENCH] IMPL=%-4s  [%.2u.%.3u s] [Total]\n\n",
-    name, totalTime / 1000, totalTime % 1000);
+  for (uint32_t i = 0; i < fileCount; i++)
+    ::free(names[i]);
+  ::free(names);
+
+  return ok;
 }
 
 // ============================================================================
@@ -240,12 +1121,83 @@ static void OptDePngBench(const char* name, OptDePngFilterFunc func) {
 // ============================================================================
 
 int main(int argc, char* argv[]) {
-  if (!OptDePngCheck("Opt" , OptDePngFilterRef, OptDePngFilterOpt )) return 1;
-  if (!OptDePngCheck("SSE2", OptDePngFilterRef, OptDePngFilterSSE2)) return 1;
+  OptDePngImplInfo impls[OPT_DEPNG_MAX_IMPLS];
+  uint32_t implCount = OptDePngGetImpls(impls);
+  const char* corpusDir = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (::strncmp(arg, "--corpus=", 9) == 0) {
+      corpusDir = arg + 9;
+    }
+    else {
+      printf("Usage: %s [--corpus=DIR]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Corpus mode replaces synthetic images by real ones.
+  if (corpusDir != NULL)
+    return OptDePngCheckCorpus(corpusDir, impls, implCount) ? 0 : 1;
+
+  for (uint32_t implIndex = 1; implIndex < implCount; implIndex++) {
+    if (!OptDePngCheck(impls[implIndex].name, OptDePngFilterRef, impls[implIndex].func))
+      return 1;
+  }
+
+  if (!OptDePngCheck("Best", OptDePngFilterRef, OptDePngFilter))
+    return 1;
+
+  for (uint32_t implIndex = 1; implIndex < implCount; implIndex++) {
+    char name[32];
+    ::sprintf(name, "%sTo", impls[implIndex].name);
 
-  OptDePngBench("Ref" , OptDePngFilterRef);
-  OptDePngBench("Opt" , OptDePngFilterOpt);
-  OptDePngBench("SSE2", OptDePngFilterSSE2);
+    if (impls[implIndex].funcTo != NULL && !OptDePngCheckTo(name, impls[implIndex].funcTo))
+      return 1;
+  }
+
+  for (uint32_t implIndex = 1; implIndex < implCount; implIndex++) {
+    char name[32];
+    ::sprintf(name, "%sUnif", impls[implIndex].name);
+
+    if (!OptDePngCheckUniform(name, impls[implIndex].func))
+      return 1;
+  }
+
+  if (!OptDePngCheckUniform("Unif", OptDePngFilter)) return 1;
+  if (!OptDePngCheckStream("Strm")) return 1;
+  if (!OptDePngCheckChecked("Chkd")) return 1;
+  if (!OptDePngCheckCrc32c("CrcOpt", OptDePngCrc32cOpt)) return 1;
+  if (!OptDePngCheckCrc32c("Crc", OptDePngCrc32c)) return 1;
+#if defined(OPT_BUILD_SSE42)
+  if (OptCpu::detect() & kOptCpuSSE42) {
+    if (!OptDePngCheckCrc32c("CrcSSE42", OptDePngCrc32cSSE42)) return 1;
+  }
+#endif // OPT_BUILD_SSE42
+  if (!OptDePngCheckChecksum("Csum")) return 1;
+  if (!OptDePngCheckBatch("Batch")) return 1;
+  if (!OptDePngCheckAdam7("Adam7")) return 1;
+  if (!OptDePngCheckConvert("Conv")) return 1;
+  if (!OptDePngCheckParallel("Par", 4)) return 1;
+  if (!OptDePngCheckQueue("Queue", 1, false)) return 1;
+  if (!OptDePngCheckQueue("Queue", 4, false)) return 1;
+  if (!OptDePngCheckQueue("Queue", 4, true)) return 1;
+  if (!OptDePngCheckBlocked("Block")) return 1;
+  if (!OptDePngCheckLarge("Large")) return 1;
+  if (!OptDePngCheckFile("File")) return 1;
+#if defined(OPT_BUILD_SSE2)
+  if (OptCpu::detect() & kOptCpuSSE2) {
+    if (!OptDePngCheckForward("FwdSSE2", OptDePngForwardSSE2)) return 1;
+    if (!OptDePngCheckPadded("PadSSE2", OptDePngFilterPaddedSSE2)) return 1;
+  }
+#endif // OPT_BUILD_SSE2
+  if (!OptDePngCheckPadded("PadOpt", OptDePngFilterPaddedOpt)) return 1;
+  if (!OptDePngCheckPadded("Pad", OptDePngFilterPadded)) return 1;
+  if (!OptDePngCheckForward("Fwd", OptDePngForward)) return 1;
+#if defined(OPT_DEPNG_PROFILE) && defined(OPT_BUILD_SSE2)
+  if (!OptDePngCheckProfile("Prof")) return 1;
+#endif // OPT_DEPNG_PROFILE
 
   return 0;
 }
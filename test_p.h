@@ -0,0 +1,505 @@
+// [OptDePng]
+// SIMD optimized "PNG Reverse Filter" implementation.
+//
+// [License]
+// Zlib - See LICENSE.md file in the package.
+
+// [Guard]
+#ifndef _OPTDEPNG_TEST_P_H
+#define _OPTDEPNG_TEST_P_H
+
+// Shared by `optdepng_test` (test.cpp) and `optdepng_bench` (bench.cpp).
+
+// ============================================================================
+// [Dependencies]
+// ============================================================================
+
+#include "./optglobals.h"
+#include "./optdepng.h"
+#include "./optdepngqueue.h"
+#include "./optthreadpool.h"
+
+#if defined(OPT_HAVE_ZLIB)
+#include <zlib.h>
+#endif // OPT_HAVE_ZLIB
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#endif
+
+// ============================================================================
+// [Constants]
+// ============================================================================
+
+static const char* const OptDePngFilterNames[] = {
+  "None", "Sub", "Up", "Avg", "Paeth", "Mixed"
+};
+
+static const uint32_t OptDePngBppData[] = {
+  1, 2, 3, 4, 6, 8
+};
+
+// BPPs used by checks, the last ones are handled by generic kernels.
+static const uint32_t OptDePngBppCheck[] = {
+  1, 2, 3, 4, 6, 8, 5, 7, 9, 12, 16, 17
+};
+
+#define OPT_DEPNG_BPP_CHECK_COUNT (sizeof(OptDePngBppCheck) / sizeof(OptDePngBppCheck[0]))
+
+static const uint8_t OptDePngRandomData[] = {
+  0xD9, 0xFA, 0xA7, 0x20, 0x6B, 0xD3, 0x41, 0xC9, 0x1A, 0x27, 0x2F, 0x64, 0x59,
+  0x85, 0x47, 0x1C, 0xFC, 0x3E, 0xA3, 0x5B, 0x3C, 0xD2, 0xB5, 0xB6, 0x80, 0xBB,
+  0x84, 0x3C, 0xD4, 0x94, 0x3A, 0x6D, 0xC2, 0x1B, 0x3D, 0x5F, 0x82, 0xD9, 0x1A,
+  0x7F, 0xC6, 0x8D, 0x39, 0xDD, 0x07, 0xAD, 0x7A, 0x40, 0x8D, 0x37, 0x56, 0x12,
+  0x8B, 0x51, 0xAF, 0x9D, 0x17, 0xBD, 0xD0, 0x61, 0x58, 0xC8, 0x05, 0x44, 0x9B,
+  0xCA, 0xD4, 0xD0, 0xD0, 0xB9, 0x83, 0x75, 0x31, 0x4B, 0x09, 0xEC, 0x52, 0xEB,
+  0xE5, 0xE8, 0xAA, 0xF6, 0xDD, 0x79, 0x36, 0x61, 0x17, 0xB1, 0x8A, 0x48, 0x00,
+  0x1A, 0x9D, 0xDC, 0x51, 0x9F, 0x34, 0x7A, 0x48, 0x56, 0xC9, 0xF3, 0x6A, 0x81,
+  0x9B, 0x47, 0x56, 0x64, 0x00, 0x30, 0x60, 0x04, 0x90, 0x4B, 0xC2, 0x48, 0xE3,
+  0xED, 0x62, 0xDF, 0x46, 0xEF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFE, 0x94, 0xEE, 0x00, 0xA9, 0x3B, 0x86, 0x9B, 0xD8, 0xEE, 0x3D, 0x9E, 0x32,
+  0x00, 0x00, 0x00, 0x00, 0x92, 0x61, 0x9F, 0x3B, 0x22, 0xB0, 0xB9, 0xB3, 0xB0,
+  0x01, 0x01, 0x01, 0x01, 0xF4, 0x83, 0xFC, 0x49, 0xA9, 0xD2, 0x89, 0xE0, 0x17,
+  0x74, 0x3E, 0xBD, 0x28, 0x74, 0x5E, 0xF8, 0x6D, 0xD2, 0x43, 0xB7, 0x5A, 0xB5,
+  0xE6, 0xA4, 0xC7, 0xA4, 0x46, 0xD3, 0x00, 0x1A, 0x26, 0x0C, 0x65, 0x24, 0xAD,
+  0xA7, 0xEA, 0xF4, 0xBD, 0xF6, 0x63, 0x2B, 0xEC, 0x1E, 0xDF, 0x0C, 0xBD, 0x50,
+  0xEB, 0x71, 0xD9, 0x86, 0x31, 0x62, 0x5E, 0xE7, 0x4D, 0x8B, 0xD1, 0x11, 0x5B,
+  0x26, 0x48, 0x9F, 0x8E, 0xE6, 0x7B, 0xE1, 0x0C, 0xF8, 0xCD, 0xF8, 0x90, 0x1E,
+  0x4E, 0x24, 0xFE, 0x90, 0xD3, 0xA2, 0x2D, 0xFC, 0x4F, 0x3A, 0x2F, 0x1B, 0xE2,
+  0xB8, 0xBF, 0x11, 0x68, 0x80, 0xCB, 0x26, 0xAD, 0x1C, 0x58, 0x4E, 0x57, 0x30,
+  0x00, 0x00, 0x00, 0x86, 0x4A, 0x50, 0x36, 0x90, 0x5C, 0x40, 0xA7, 0x38, 0x92,
+  0x03, 0xF0, 0x39, 0x82, 0x40, 0xED, 0x39, 0x22, 0x82, 0x90, 0x67, 0xDF, 0x95,
+  0x34, 0x15, 0x8A, 0x0F, 0x25, 0x94, 0x56, 0xFD, 0x38, 0x85, 0x9B, 0x06, 0x22
+};
+
+// ============================================================================
+// [Helpers]
+// ============================================================================
+
+static inline uint32_t OptDePngRandomWrap(uint32_t x, uint32_t advance, uint32_t count) {
+  x += advance;
+  return x < count ? x : x - count;
+}
+
+static inline uint8_t* OptDePngRandomImage(uint32_t w, uint32_t h, uint32_t bpp, uint32_t filter, uint32_t seed) {
+  uint32_t rCount = sizeof(OptDePngRandomData);
+
+  uint32_t rIndex0 = (seed     ) % rCount;
+  uint32_t rIndex1 = (seed * 33) % rCount;
+
+  w *= bpp;
+  uint32_t size = (w + 1) * h;
+
+  uint8_t* pImage = static_cast<uint8_t*>(::malloc(size));
+  if (pImage == NULL)
+    return NULL;
+
+  uint8_t* p = pImage;
+  uint32_t f = seed % kPngFilterCount;
+
+  for (uint32_t y = 0; y < h; y++) {
+    // NOTE: The first row uses the same filter as other rows (mixed filters
+    // start at a filter based on `seed`), so the first row handling, which
+    // doesn't have a previous row, is tested as well.
+    if (filter < kPngFilterCount) {
+      *p++ = static_cast<uint8_t>(filter);
+    }
+    else {
+      if (++f >= kPngFilterCount) f = 0;
+      *p++ = static_cast<uint8_t>(f);
+    }
+
+    uint32_t x = w;
+    for (;;) {
+      *p++ = OptDePngRandomData[rIndex0];
+      rIndex0 = OptDePngRandomWrap(rIndex0, 1, rCount);
+      if (--x == 0) break;
+
+      *p++ = OptDePngRandomData[rIndex1];
+      rIndex1 = OptDePngRandomWrap(rIndex1, 2, rCount);
+      if (--x == 0) break;
+    }
+  }
+
+  return pImage;
+}
+
+// ============================================================================
+// [Impls]
+//
+// Implementations compiled into the library that the host CPU can run, `Ref`
+// is always first. `funcTo` is NULL if there is no out-of-place version.
+// ============================================================================
+
+struct OptDePngImplInfo {
+  const char* name;
+  OptDePngFilterFunc func;
+  OptDePngFilterToFunc funcTo;
+};
+
+#define OPT_DEPNG_MAX_IMPLS 7
+
+static inline void OptDePngAddImpl(OptDePngImplInfo* impls, uint32_t& count,
+  const char* name, OptDePngFilterFunc func, OptDePngFilterToFunc funcTo) {
+
+  impls[count].name = name;
+  impls[count].func = func;
+  impls[count].funcTo = funcTo;
+  count++;
+}
+
+static inline uint32_t OptDePngGetImpls(OptDePngImplInfo* impls) {
+  uint32_t features = OptCpu::detect();
+  uint32_t count = 0;
+
+  OptDePngAddImpl(impls, count, "Ref", OptDePngFilterRef, NULL);
+  OptDePngAddImpl(impls, count, "Opt", OptDePngFilterOpt, OptDePngFilterOptTo);
+
+#if defined(OPT_BUILD_SSE2)
+  if (features & kOptCpuSSE2)
+    OptDePngAddImpl(impls, count, "SSE2", OptDePngFilterSSE2, OptDePngFilterSSE2To);
+#endif // OPT_BUILD_SSE2
+
+#if defined(OPT_BUILD_SSSE3)
+  if (features & kOptCpuSSSE3)
+    OptDePngAddImpl(impls, count, "SSSE3", OptDePngFilterSSSE3, OptDePngFilterSSSE3To);
+#endif // OPT_BUILD_SSSE3
+
+#if defined(OPT_BUILD_AVX2)
+  if (features & kOptCpuAVX2)
+    OptDePngAddImpl(impls, count, "AVX2", OptDePngFilterAVX2, OptDePngFilterAVX2To);
+#endif // OPT_BUILD_AVX2
+
+#if defined(OPT_BUILD_AVX512)
+  if (features & kOptCpuAVX512)
+    OptDePngAddImpl(impls, count, "AVX512", OptDePngFilterAVX512, OptDePngFilterAVX512To);
+#endif // OPT_BUILD_AVX512
+
+#if defined(OPT_BUILD_NEON)
+  if (features & kOptCpuNEON)
+    OptDePngAddImpl(impls, count, "NEON", OptDePngFilterNEON, OptDePngFilterNEONTo);
+#endif // OPT_BUILD_NEON
+
+  (void)features;
+  return count;
+}
+
+// ============================================================================
+// [Measure]
+//
+// Benchmarks of `optdepng_bench` and `optdepng_compare` measure the same way.
+// The first run is a warmup that also calibrates the number of runs per trial
+// to `minTrialNs`, each trial then records the average time of one run.
+// ============================================================================
+
+#define OPT_DEPNG_MAX_TRIALS 101
+
+static inline int OptDePngCompareU64(const void* a, const void* b) {
+  uint64_t x = *static_cast<const uint64_t*>(a);
+  uint64_t y = *static_cast<const uint64_t*>(b);
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Measure `run()` of `trials` trials and sort times of one run in nanoseconds
+// into `ns` and TSC ticks into `tsc` (optional), so `ns[trials / 2]` is the
+// median.
+template<typename Run>
+static inline void OptDePngMeasure(Run& run, uint32_t trials, uint64_t minTrialNs, uint64_t* ns, uint64_t* tsc) {
+  uint64_t t0 = OptClock::ns();
+  run();
+  uint64_t t1 = OptClock::ns();
+
+  uint64_t runNs = t1 > t0 ? t1 - t0 : 1;
+  uint32_t runs = static_cast<uint32_t>(minTrialNs / runNs);
+  if (runs == 0) runs = 1;
+
+  for (uint32_t trial = 0; trial < trials; trial++) {
+    uint64_t c0 = OptClock::tsc();
+    t0 = OptClock::ns();
+
+    for (uint32_t i = 0; i < runs; i++)
+      run();
+
+    t1 = OptClock::ns();
+    uint64_t c1 = OptClock::tsc();
+
+    ns[trial] = (t1 - t0) / runs;
+    if (tsc != NULL)
+      tsc[trial] = (c1 - c0) / runs;
+  }
+
+  ::qsort(ns, trials, sizeof(uint64_t), OptDePngCompareU64);
+  if (tsc != NULL)
+    ::qsort(tsc, trials, sizeof(uint64_t), OptDePngCompareU64);
+}
+
+// Runs `func` in place, see `OptDePngMeasure()`.
+struct OptDePngMeasureFilter {
+  OptDePngFilterFunc func;
+  uint8_t* p;
+  uint32_t h;
+  uint32_t bpp;
+  uint32_t bpl;
+
+  OPT_INLINE void operator()() { func(p, h, bpp, bpl); }
+};
+
+// ============================================================================
+// [Corpus]
+//
+// Corpus mode (`--corpus=DIR`) of `optdepng_test` and `optdepng_bench` runs
+// checks and benchmarks over real images, so the per-row filter distribution
+// matches what real encoders produce. The following files are loaded from
+// `DIR`:
+//
+//   - `*.png`  - Non-interlaced PNG images, requires zlib (`OPT_HAVE_ZLIB`).
+//   - `*.idat` - Dump of inflated IDAT data preceded by a 12-BYTE header that
+//                contains 3 little-endian 32-bit integers - `bpl` (including
+//                the filter ID), `h`, and `bpp`.
+// ============================================================================
+
+struct OptDePngCorpusImage {
+  uint8_t* data;
+  uint32_t h;
+  uint32_t bpp;
+  uint32_t bpl;
+};
+
+static inline uint32_t OptDePngReadU32BE(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) <<  8) | (static_cast<uint32_t>(p[3])      );
+}
+
+static inline uint32_t OptDePngReadU32LE(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[3]) << 24) | (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[1]) <<  8) | (static_cast<uint32_t>(p[0])      );
+}
+
+static inline uint8_t* OptDePngReadFile(const char* path, size_t* size) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL)
+    return NULL;
+
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t* data = length > 0 ? static_cast<uint8_t*>(::malloc(static_cast<size_t>(length))) : NULL;
+  if (data != NULL && fread(data, 1, static_cast<size_t>(length), f) != static_cast<size_t>(length)) {
+    ::free(data);
+    data = NULL;
+  }
+
+  fclose(f);
+  *size = static_cast<size_t>(length);
+  return data;
+}
+
+static inline const char* OptDePngLoadIdat(const uint8_t* file, size_t size, OptDePngCorpusImage& image) {
+  if (size < 12)
+    return "Truncated header";
+
+  image.bpl = OptDePngReadU32LE(file + 0);
+  image.h = OptDePngReadU32LE(file + 4);
+  image.bpp = OptDePngReadU32LE(file + 8);
+
+  if (image.bpl < 2 || image.h == 0 || image.bpp == 0 || (size - 12) / image.bpl < image.h)
+    return "Invalid header";
+
+  size_t dataSize = static_cast<size_t>(image.bpl) * image.h;
+  image.data = static_cast<uint8_t*>(::malloc(dataSize));
+  if (image.data == NULL)
+    return "Out of memory";
+
+  ::memcpy(image.data, file + 12, dataSize);
+  return NULL;
+}
+
+static inline const char* OptDePngLoadPng(const uint8_t* file, size_t size, OptDePngCorpusImage& image) {
+#if defined(OPT_HAVE_ZLIB)
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+  if (size < 8 || ::memcmp(file, signature, 8) != 0)
+    return "Not a PNG file";
+
+  uint32_t w = 0, h = 0, depth = 0, colorType = 0, interlace = 0;
+  uint8_t* idat = NULL;
+  size_t idatSize = 0;
+
+  size_t i = 8;
+  while (size - i >= 12) {
+    uint32_t length = OptDePngReadU32BE(file + i);
+    const uint8_t* type = file + i + 4;
+    const uint8_t* data = file + i + 8;
+
+    if (length > size - i - 12)
+      break;
+
+    if (::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+      w = OptDePngReadU32BE(data);
+      h = OptDePngReadU32BE(data + 4);
+      depth = data[8];
+      colorType = data[9];
+      interlace = data[12];
+    }
+    else if (::memcmp(type, "IDAT", 4) == 0) {
+      uint8_t* p = static_cast<uint8_t*>(::realloc(idat, idatSize + length));
+      if (p == NULL)
+        break;
+
+      ::memcpy(p + idatSize, data, length);
+      idat = p;
+      idatSize += length;
+    }
+    else if (::memcmp(type, "IEND", 4) == 0) {
+      break;
+    }
+
+    i += static_cast<size_t>(length) + 12;
+  }
+
+  uint32_t channels = colorType == 0 ? 1 : colorType == 2 ? 3 : colorType == 3 ? 1 :
+                      colorType == 4 ? 2 : colorType == 6 ? 4 : 0;
+  const char* msg = NULL;
+
+  if (w == 0 || h == 0 || channels == 0 || depth == 0)
+    msg = "Invalid IHDR";
+  else if (interlace != 0)
+    msg = "Interlaced images are not supported";
+  else if (idat == NULL)
+    msg = "No IDAT";
+
+  if (msg == NULL) {
+    uint64_t rowBits = static_cast<uint64_t>(w) * depth * channels;
+    uint64_t dataSize = ((rowBits + 7) / 8 + 1) * h;
+
+    if (dataSize > 0x7FFFFFFFu) {
+      msg = "Image too large";
+    }
+    else {
+      image.bpl = static_cast<uint32_t>((rowBits + 7) / 8 + 1);
+      image.h = h;
+      image.bpp = OptDePngBppFromFormat(depth, channels);
+      image.data = static_cast<uint8_t*>(::malloc(static_cast<size_t>(dataSize)));
+
+      uLongf dstSize = static_cast<uLongf>(dataSize);
+      if (image.data == NULL) {
+        msg = "Out of memory";
+      }
+      else if (uncompress(image.data, &dstSize, idat, static_cast<uLong>(idatSize)) != Z_OK || dstSize != dataSize) {
+        ::free(image.data);
+        image.data = NULL;
+        msg = "Invalid IDAT stream";
+      }
+    }
+  }
+
+  ::free(idat);
+  return msg;
+#else
+  (void)file;
+  (void)size;
+  (void)image;
+  return "Built without zlib, only *.idat files are supported";
+#endif // OPT_HAVE_ZLIB
+}
+
+static inline int OptDePngCompareNames(const void* a, const void* b) {
+  return ::strcmp(*static_cast<char* const*>(a), *static_cast<char* const*>(b));
+}
+
+// List `*.png` and `*.idat` files in `dir`, sorted by name.
+static inline uint32_t OptDePngListCorpus(const char* dir, char** names, uint32_t maxNames) {
+  uint32_t count = 0;
+
+#if defined(_WIN32)
+  char pattern[1024];
+  if (::strlen(dir) + 3 > sizeof(pattern))
+    return 0;
+  ::strcpy(pattern, dir);
+  ::strcat(pattern, "\\*");
+
+  WIN32_FIND_DATAA fd;
+  HANDLE handle = FindFirstFileA(pattern, &fd);
+  if (handle == INVALID_HANDLE_VALUE)
+    return 0;
+
+  do {
+    const char* name = fd.cFileName;
+#else
+  DIR* d = opendir(dir);
+  if (d == NULL)
+    return 0;
+
+  while (dirent* entry = readdir(d)) {
+    const char* name = entry->d_name;
+#endif
+    size_t length = ::strlen(name);
+    bool ok = (length > 4 && ::strcmp(name + length - 4, ".png") == 0) ||
+              (length > 5 && ::strcmp(name + length - 5, ".idat") == 0);
+
+    if (ok && count < maxNames) {
+      names[count] = static_cast<char*>(::malloc(length + 1));
+      if (names[count] != NULL)
+        ::memcpy(names[count++], name, length + 1);
+    }
+#if defined(_WIN32)
+  } while (FindNextFileA(handle, &fd));
+  FindClose(handle);
+#else
+  }
+  closedir(d);
+#endif
+
+  ::qsort(names, count, sizeof(char*), OptDePngCompareNames);
+  return count;
+}
+
+// Load `name` from `dir`, returns NULL on success or a reason why the file was
+// skipped. `image.data` has to be freed by the caller on success.
+static inline const char* OptDePngLoadCorpus(const char* dir, const char* name, OptDePngCorpusImage& image) {
+  char path[2048];
+  image.data = NULL;
+
+  if (::strlen(dir) + ::strlen(name) + 2 > sizeof(path))
+    return "Path too long";
+
+  ::strcpy(path, dir);
+  ::strcat(path, "/");
+  ::strcat(path, name);
+
+  size_t fileSize = 0;
+  uint8_t* file = OptDePngReadFile(path, &fileSize);
+
+  size_t nameLength = ::strlen(name);
+  const char* msg = file == NULL ? "Cannot read file" :
+    ::strcmp(name + nameLength - 5, ".idat") == 0 ? OptDePngLoadIdat(file, fileSize, image)
+                                                  : OptDePngLoadPng(file, fileSize, image);
+  ::free(file);
+  return msg;
+}
+
+// Get the number of rows that use each filter, invalid filters are counted
+// at `histogram[kPngFilterCount]`.
+static inline void OptDePngCorpusHistogram(const OptDePngCorpusImage& image, uint32_t* histogram) {
+  for (uint32_t i = 0; i <= kPngFilterCount; i++)
+    histogram[i] = 0;
+
+  for (uint32_t y = 0; y < image.h; y++) {
+    uint32_t filter = image.data[static_cast<size_t>(y) * image.bpl];
+    histogram[filter < kPngFilterCount ? filter : static_cast<uint32_t>(kPngFilterCount)]++;
+  }
+}
+
+static inline void OptDePngCorpusPrint(const char* name, const OptDePngCorpusImage& image, const uint32_t* histogram) {
+  printf("[CORPUS] %s: BPL=%u H=%u BPP=%u  None %5.1f%%  Sub %5.1f%%  Up %5.1f%%  Avg %5.1f%%  Paeth %5.1f%%",
+    name, image.bpl, image.h, image.bpp,
+    histogram[0] * 100.0 / image.h, histogram[1] * 100.0 / image.h, histogram[2] * 100.0 / image.h,
+    histogram[3] * 100.0 / image.h, histogram[4] * 100.0 / image.h);
+  if (histogram[kPngFilterCount])
+    printf("  Invalid %u", histogram[kPngFilterCount]);
+  printf("\n");
+}
+
+// [Guard]
+#endif // _OPTDEPNG_TEST_P_H